@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "stego.h"
+#include "types.h"
+
+/* Valid name
+ * Input: Entry name
+ * Output: None
+ * Description: Names come from the image when decoding, so they must not
+ * reach out of the output directory
+ * Return value: 1 for a plain file name, 0 otherwise
+ */
+int archive_valid_name(const char *name)
+{
+    return name[0] != '\0' && strlen(name) <= ARCHIVE_MAX_NAME && strchr(name, '/') == NULL && strcmp(name, ".") && strcmp(name, "..");
+}
+
+/* Put entry
+ * Input: Field buffer of ARCHIVE_ENTRY_FIELD_BYTES + ARCHIVE_MAX_NAME bytes and the entry
+ * Output: Index fields of the entry
+ * Return value: Bytes of the fields
+ */
+size_t archive_put_entry(unsigned char *field, const ArchiveEntry *entry)
+{
+    size_t size_name = strlen(entry->name);
+    size_t size_field = 0;
+
+    size_field += stego_put_size(field + size_field, entry->offset, 8);
+    size_field += stego_put_size(field + size_field, entry->size, 8);
+    size_field += stego_put_size(field + size_field, size_name, 1);
+    memcpy(field + size_field, entry->name, size_name);
+
+    return size_field + size_name;
+}
+
+/* Get entry
+ * Input: The fixed fields of an entry and the entry to fill
+ * Output: Offset and size of the entry
+ * Return value: Bytes of the name following the fixed fields
+ */
+size_t archive_get_entry(const unsigned char *field, ArchiveEntry *entry)
+{
+    entry->offset = stego_get_size(field, 8);
+    entry->size = stego_get_size(field + 8, 8);
+
+    return stego_get_size(field + 16, 1);
+}
+
+/* Read list
+ * Input: List of files, one path per line, and addresses to store the paths, entries and their count
+ * Output: Path and entry of every file, offsets counted up from 0
+ * Description: Blank lines and lines starting with '#' are skipped like in
+ * batch manifests. Every file is opened here, so a missing one fails before
+ * anything is written, and two files can't go in under the same name
+ * Return value: e_success, e_failure
+ */
+static Status archive_read_list(FILE *fptr_list, char ***paths, ArchiveEntry **entries, size_t *count)
+{
+    char line[MAX_ARCHIVE_LINE];
+    size_t capacity = 0, offset = 0, length, line_no = 0;
+    const char *name;
+    struct stat st;
+    void *grown;
+
+    while (fgets(line, MAX_ARCHIVE_LINE, fptr_list) != NULL)
+    {
+        line_no++;
+        length = strcspn(line, "\r\n");
+        if (line[length] == '\0' && !feof(fptr_list))
+        {
+            printf("ERROR: Line %zu of the file list is too long\n", line_no);
+            return e_failure;
+        }
+        line[length] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        name = strrchr(line, '/') != NULL ? strrchr(line, '/') + 1 : line;
+        if (!archive_valid_name(name))
+        {
+            printf("ERROR: %s has no file name of 1 to %d bytes\n", line, ARCHIVE_MAX_NAME);
+            return e_failure;
+        }
+        if (stat(line, &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            perror("stat");
+            printf("ERROR: %s is not a regular file\n", line);
+            return e_failure;
+        }
+        for (size_t i = 0; i < *count; i++)
+        {
+            if (!strcmp((*entries)[i].name, name))
+            {
+                printf("ERROR: %s and %s go in under the same name\n", (*paths)[i], line);
+                return e_failure;
+            }
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            if ((grown = realloc(*paths, capacity * sizeof(char *))) == NULL)
+            {
+                return e_failure;
+            }
+            *paths = grown;
+            if ((grown = realloc(*entries, capacity * sizeof(ArchiveEntry))) == NULL)
+            {
+                return e_failure;
+            }
+            *entries = grown;
+        }
+        if (((*paths)[*count] = strdup(line)) == NULL)
+        {
+            return e_failure;
+        }
+        strcpy((*entries)[*count].name, name);
+        (*entries)[*count].offset = offset;
+        (*entries)[*count].size = st.st_size;
+        offset += st.st_size;
+        (*count)++;
+    }
+
+    if (*count == 0)
+    {
+        puts("ERROR: The file list names no files");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Copy entry
+ * Input: Path of the file, its entry, archive and a buffer of ARCHIVE_COPY_SIZE bytes
+ * Output: Contents of the file appended to the archive
+ * Return value: e_success, e_failure when the file changed size or a write fails
+ */
+static Status archive_copy_entry(const char *path, const ArchiveEntry *entry, FILE *fptr_archive, char *buffer)
+{
+    FILE *fptr = fopen(path, "r");
+    size_t done = 0, chunk;
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        printf("ERROR: Unable to open file %s\n", path);
+        return e_failure;
+    }
+    while ((chunk = fread(buffer, sizeof(char), ARCHIVE_COPY_SIZE, fptr)) > 0 && done + chunk <= entry->size)
+    {
+        if (fwrite(buffer, sizeof(char), chunk, fptr_archive) != chunk)
+        {
+            fclose(fptr);
+            return e_failure;
+        }
+        done += chunk;
+    }
+    fclose(fptr);
+
+    if (done != entry->size || chunk > 0)
+    {
+        printf("ERROR: %s changed while it was bundled\n", path);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Build archive
+ * Input: List of files, one path per line, archive to write and address to store the entry count
+ * Output: Index followed by the contents of all files
+ * Description: The sizes are taken from the files before the index is written,
+ * then the files are copied one after the other in list order
+ * Return value: e_success, e_failure
+ */
+Status archive_build(FILE *fptr_list, FILE *fptr_archive, size_t *count)
+{
+    unsigned char field[ARCHIVE_ENTRY_FIELD_BYTES + ARCHIVE_MAX_NAME];
+    ArchiveEntry *entries = NULL;
+    char **paths = NULL;
+    char *buffer = NULL;
+    Status status = e_failure;
+    size_t size_field;
+
+    *count = 0;
+    if (archive_read_list(fptr_list, &paths, &entries, count) == e_success && *count <= 0xFFFFFFFFu &&
+        (buffer = malloc(ARCHIVE_COPY_SIZE)) != NULL)
+    {
+        size_field = stego_put_size(field, *count, ARCHIVE_COUNT_FIELD_BYTES);
+        status = fwrite(field, sizeof(char), size_field, fptr_archive) == size_field ? e_success : e_failure;
+        for (size_t i = 0; i < *count && status == e_success; i++)
+        {
+            size_field = archive_put_entry(field, &entries[i]);
+            status = fwrite(field, sizeof(char), size_field, fptr_archive) == size_field ? e_success : e_failure;
+        }
+        for (size_t i = 0; i < *count && status == e_success; i++)
+        {
+            status = archive_copy_entry(paths[i], &entries[i], fptr_archive, buffer);
+        }
+        if (status == e_success && fflush(fptr_archive) != 0)
+        {
+            status = e_failure;
+        }
+    }
+
+    for (size_t i = 0; i < *count; i++)
+    {
+        free(paths[i]);
+    }
+    free(paths);
+    free(entries);
+    free(buffer);
+
+    return status;
+}
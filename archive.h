@@ -0,0 +1,48 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * Archive: many files embedded as one payload, stored with the extension
+ * ARCHIVE_EXTN. The data starts with an index,
+ *     32 bit entry count, then per entry 64 bit offset, 64 bit size, 8 bit name size, name
+ * followed by the contents of the entries one after the other. Offsets count
+ * data bytes from the end of the index, so an entry can be extracted by going
+ * straight to its bits, the entries in front of it are never decoded. Fields
+ * are MSB first like the header. Names are plain file names, the directories
+ * of the listed paths are left out
+ */
+
+#define ARCHIVE_EXTN ".arc"
+#define ARCHIVE_COUNT_FIELD_BYTES 4u
+#define ARCHIVE_ENTRY_FIELD_BYTES (8u + 8u + 1u)
+#define ARCHIVE_MAX_NAME 255
+
+/* Longest line of the list of files to bundle */
+#define MAX_ARCHIVE_LINE 4096
+
+/* Bytes copied per read while bundling */
+#define ARCHIVE_COPY_SIZE (64 * 1024)
+
+typedef struct _ArchiveEntry
+{
+    char name[ARCHIVE_MAX_NAME + 1];
+    size_t offset;      /* data bytes in front of the entry, from the end of the index on */
+    size_t size;
+} ArchiveEntry;
+
+/* Bundle the files listed in fptr_list, one path per line, into fptr_archive and count them */
+Status archive_build(FILE *fptr_list, FILE *fptr_archive, size_t *count);
+
+/* Index fields of an entry, name included, returns their bytes */
+size_t archive_put_entry(unsigned char *field, const ArchiveEntry *entry);
+
+/* Offset and size from the ARCHIVE_ENTRY_FIELD_BYTES fixed fields of an entry, returns the size of the name behind them */
+size_t archive_get_entry(const unsigned char *field, ArchiveEntry *entry);
+
+/* Whether name is a plain file name that can be created in the output directory */
+int archive_valid_name(const char *name);
+
+#endif
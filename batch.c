@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "lsb.h"
+#include "uring.h"
+#include "types.h"
+#include "common.h"
+
+/* Read and validate batch arguments
+ * Input: command line arguments and address of structure variable which holds batch data
+ * Output: Manifest and results file names
+ * Description: Validates the arguments of -b, the in place modes are turned down
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_batch_args(char *argv[], BatchInfo *batchInfo)
+{
+    if (argv[2] == NULL || argv[3] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for batch mode.");
+        puts("Usage: ./a.out -b <manifest> <results file> [-j workers] [-k bits] [-z] [-c] [-P | -K keyfile] [-r] [-a] [-U]");
+        return e_failure;
+    }
+    // Jobs side by side may share a carrier, patching it in place would race
+    if (batchInfo->inplace_mode != e_inplace_off)
+    {
+        puts("ERROR: Batch jobs can't be encoded in place");
+        return e_failure;
+    }
+
+    batchInfo->manifest_fname = argv[2];
+    batchInfo->results_fname = argv[3];
+    if (batchInfo->num_workers < 1)
+    {
+        batchInfo->num_workers = 1;
+    }
+
+    return e_success;
+}
+
+/* Open batch files
+ * Input: Address of structure variable which holds batch data
+ * Output: File pointers for the manifest and results file
+ * Return value: e_success, e_failure on file errors
+ */
+Status open_batch_files(BatchInfo *batchInfo)
+{
+    batchInfo->fptr_manifest = fopen(batchInfo->manifest_fname, "r");
+    if (batchInfo->fptr_manifest == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", batchInfo->manifest_fname);
+        return e_failure;
+    }
+
+    batchInfo->fptr_results = fopen(batchInfo->results_fname, "w");
+    if (batchInfo->fptr_results == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", batchInfo->results_fname);
+        fclose(batchInfo->fptr_manifest);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Next job
+ * Input: Batch data, buffer for the job line
+ * Output: Next non blank, non comment line of the manifest and its line number
+ * Description: Workers pull jobs one at a time, so the manifest is never held in memory
+ * Return value: 1 when a job was read, 0 at the end of the manifest
+ */
+static int next_batch_job(BatchInfo *batchInfo, char *line, uint *line_no)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&batchInfo->lock);
+    while (!found && fgets(line, MAX_MANIFEST_LINE, batchInfo->fptr_manifest) != NULL)
+    {
+        batchInfo->manifest_line++;
+        line += strspn(line, " \t");
+        found = *line != '\0' && *line != '\n' && *line != '#';
+    }
+    *line_no = batchInfo->manifest_line;
+    pthread_mutex_unlock(&batchInfo->lock);
+
+    return found;
+}
+
+/* Split job
+ * Input: Job line, storage for the arguments and the argv array to fill
+ * Output: argv as main would see it for the same job
+ * Description: Every argument gets its own buffer
+ * Return value: e_success, e_failure on too many arguments
+ */
+static Status split_batch_job(char *line, char args[][MAX_MANIFEST_LINE], char *argv[])
+{
+    char *save, *token;
+    int argc = 1;
+
+    strcpy(args[0], "batch");
+    argv[0] = args[0];
+    for (token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (argc == MAX_JOB_ARGS - 1)
+        {
+            return e_failure;
+        }
+        strcpy(args[argc], token);
+        argv[argc] = args[argc];
+        argc++;
+    }
+    argv[argc] = NULL;
+
+    return argc > 1 ? e_success : e_failure;
+}
+
+/* Run batch job
+ * Input: Batch data, argv of the job, encoding and decoding data to use for it
+ * and the worker's ring or NULL
+ * Output: Encoded or decoded file and its name
+ * Description: Goes through the same validation as the command line, with the
+ * options given along with -b, the INFO messages suppressed and the engine
+ * running serially
+ * Return value: e_success, e_failure
+ */
+Status run_batch_job(const BatchInfo *batchInfo, char *argv[], EncodeInfo *encInfo, DecodeInfo *decInfo, Uring *uring,
+                     const char **output_fname)
+{
+    Status status = e_failure;
+
+    *output_fname = "-";
+    switch (check_operation_type(argv))
+    {
+        case e_encode:
+            memset(encInfo, 0, sizeof(*encInfo));
+            encInfo->quiet = 1;
+            encInfo->uring = uring;
+            encInfo->lsb_bits = batchInfo->lsb_bits;
+            encInfo->compress = batchInfo->compress;
+            encInfo->checksum = batchInfo->checksum;
+            encInfo->passphrase = batchInfo->passphrase;
+            encInfo->passphrase_size = batchInfo->passphrase_size;
+            encInfo->scatter = batchInfo->scatter;
+        encInfo->archive = batchInfo->archive;
+            if (read_and_validate_encode_args(argv, encInfo) == e_success && open_files(encInfo) == e_success)
+            {
+                status = do_encoding(encInfo);
+            }
+            if (encInfo->stego_image_fname != NULL)
+            {
+                *output_fname = encInfo->stego_image_fname;
+            }
+            close_files_for_encoding(encInfo);
+            break;
+
+        case e_decode:
+            memset(decInfo, 0, sizeof(*decInfo));
+            decInfo->quiet = 1;
+            decInfo->uring = uring;
+            decInfo->passphrase = batchInfo->passphrase;
+            decInfo->passphrase_size = batchInfo->passphrase_size;
+            if (read_and_validate_decode_args(argv, decInfo) == d_success)
+            {
+                status = do_decoding(decInfo);
+            }
+            if (decInfo->output_fname != NULL)
+            {
+                *output_fname = decInfo->output_fname;
+            }
+            close_files_for_decoding(decInfo);
+            break;
+
+        default:
+            break;
+    }
+
+    return status;
+}
+
+/* Batch worker
+ * Input: Batch data
+ * Output: Jobs run until the manifest is exhausted
+ * Description: Every worker owns one EncodeInfo and DecodeInfo, reused for all its jobs,
+ * and with -U a ring, so the requests of all workers are in flight side by side.
+ * A worker whose ring can't be set up runs its jobs on the other engines
+ */
+static void *batch_worker(void *arg)
+{
+    BatchInfo *batchInfo = arg;
+    EncodeInfo *encInfo = malloc(sizeof(EncodeInfo));
+    DecodeInfo *decInfo = malloc(sizeof(DecodeInfo));
+    char line[MAX_MANIFEST_LINE];
+    char args[MAX_JOB_ARGS][MAX_MANIFEST_LINE];
+    char *argv[MAX_JOB_ARGS];
+    const char *output_fname;
+    Status status;
+    uint line_no;
+    Uring ring;
+    Uring *uring = NULL;
+
+    if (encInfo == NULL || decInfo == NULL)
+    {
+        free(encInfo);
+        free(decInfo);
+        return NULL;
+    }
+    if (batchInfo->uring && uring_setup(&ring) == e_success)
+    {
+        uring = &ring;
+    }
+
+    while (next_batch_job(batchInfo, line, &line_no))
+    {
+        status = split_batch_job(line, args, argv);
+        if (status == e_success)
+        {
+            status = run_batch_job(batchInfo, argv, encInfo, decInfo, uring, &output_fname);
+        }
+        else
+        {
+            argv[1] = "?";
+            output_fname = "-";
+        }
+
+        pthread_mutex_lock(&batchInfo->lock);
+        fprintf(batchInfo->fptr_results, "%u\t%s\t%s\t%s\n", line_no, status == e_success ? "ok" : "failed", argv[1], output_fname);
+        if (status == e_success)
+        {
+            batchInfo->jobs_ok++;
+        }
+        else
+        {
+            batchInfo->jobs_failed++;
+        }
+        pthread_mutex_unlock(&batchInfo->lock);
+    }
+
+    if (uring != NULL)
+    {
+        uring_close(uring);
+    }
+    free(encInfo);
+    free(decInfo);
+    return NULL;
+}
+
+/* Do batch
+ * Input: Address of structure variable which holds batch data
+ * Output: Every job of the manifest run, one line per job in the results file
+ * Description: Starts num_workers workers, each pulling the next job from the
+ * manifest when it is done with the previous one. At most num_workers jobs are
+ * in flight at any time
+ * Return value: e_success when all jobs succeeded, e_failure otherwise
+ */
+Status do_batch(BatchInfo *batchInfo)
+{
+    pthread_t tids[LSB_MAX_THREADS];
+    int started = 0;
+
+    batchInfo->manifest_line = 0;
+    batchInfo->jobs_ok = 0;
+    batchInfo->jobs_failed = 0;
+    pthread_mutex_init(&batchInfo->lock, NULL);
+
+    for (int w = 0; w < batchInfo->num_workers && w < LSB_MAX_THREADS; w++)
+    {
+        if (pthread_create(&tids[started], NULL, batch_worker, batchInfo) == 0)
+        {
+            started++;
+        }
+    }
+
+    // No thread could be started, work through the manifest here
+    if (started == 0)
+    {
+        batch_worker(batchInfo);
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+
+    pthread_mutex_destroy(&batchInfo->lock);
+    fclose(batchInfo->fptr_manifest);
+    if (fclose(batchInfo->fptr_results) == EOF)
+    {
+        perror("fclose");
+        return e_failure;
+    }
+
+    printf("INFO: %u jobs done, %u failed\n", batchInfo->jobs_ok, batchInfo->jobs_failed);
+    return batchInfo->jobs_failed == 0 ? e_success : e_failure;
+}
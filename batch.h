@@ -0,0 +1,72 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "encode.h"
+#include "decode.h"
+#include "types.h"
+
+/*
+ * Batch mode: a manifest holds one encode or decode job per line, written
+ * like the command line arguments, e.g.
+ *     -e beautiful.bmp secret.txt stego_1
+ *     -d stego_1.bmp decoded_1
+ * Blank lines and lines starting with '#' are skipped. The options given
+ * along with -b apply to every job of the manifest.
+ */
+
+#define MAX_MANIFEST_LINE 4096
+#define MAX_JOB_ARGS 6          /* program name, operation and up to 3 file names */
+
+typedef struct _BatchInfo
+{
+    /* Manifest info */
+    char *manifest_fname;
+    FILE *fptr_manifest;
+    uint manifest_line;
+
+    /* Results info, one status line per job */
+    char *results_fname;
+    FILE *fptr_results;
+
+    /* Worker pool, also the bound on jobs in flight */
+    int num_workers;
+
+    /* Every worker runs its jobs on an io_uring of its own (-U), set up once */
+    int uring;
+
+    /* Options of the command line, applied to every job */
+    uint lsb_bits;              /* -k, encoding */
+    int compress;               /* -z, encoding */
+    int checksum;               /* -c, encoding */
+
+    /* Passphrase or key file content (-P or -K), NULL for none, for encoding and decoding */
+    const char *passphrase;
+    size_t passphrase_size;
+    int scatter;                /* -r, encoding */
+    int archive;                /* -a, encoding */
+    InplaceMode inplace_mode;   /* -i and -I are turned down */
+
+    /* Job counters */
+    uint jobs_ok;
+    uint jobs_failed;
+
+    /* Guards the manifest, the results file and the counters */
+    pthread_mutex_t lock;
+} BatchInfo;
+
+/* Read and validate batch args from argv */
+Status read_and_validate_batch_args(char *argv[], BatchInfo *batchInfo);
+
+/* Open manifest and results files */
+Status open_batch_files(BatchInfo *batchInfo);
+
+/* Run all jobs of the manifest on the worker pool */
+Status do_batch(BatchInfo *batchInfo);
+
+/* Run a single job given as argv with the options of the batch, on the io_uring engine when a ring is given */
+Status run_batch_job(const BatchInfo *batchInfo, char *argv[], EncodeInfo *encInfo, DecodeInfo *decInfo, Uring *uring,
+                     const char **output_fname);
+
+#endif
@@ -0,0 +1,940 @@
+/*
+Description: Throughput benchmark for the LSB kernels, the stego header and the
+whole encode/decode path, on synthetic bmp carriers.
+Build (from the top directory):
+        gcc -O2 -pthread -I. -o stego_bench bench/bench.c $(ls *.c | grep -v test_encode.c)
+Sample Execution:
+        ./stego_bench -c 64 -p 4 -j 4
+        {"bench":"embed","variant":"avx2","bytes":4194304,"seconds":0.000712,"mb_per_s":5891.0,"ns_per_byte":0.170,"peak_rss_kb":45120}
+        ...
+Every result is one JSON object per line, sizes are payload bytes, or read bytes for
+the stego_read runs.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "encode.h"
+#include "decode.h"
+#include "stego.h"
+#include "uring.h"
+#include "bmp.h"
+#include "chacha.h"
+#include "crc.h"
+#include "lsb.h"
+#include "types.h"
+#include "common.h"
+
+/* Files the end to end runs work on, created in the work directory */
+#define BENCH_CARRIER_FNAME "bench_carrier.bmp"
+#define BENCH_SECRET_FNAME "bench_secret.txt"
+#define BENCH_STEGO_FNAME "bench_stego"
+#define BENCH_DECODED_FNAME "bench_decoded"
+
+/* Carrier rows are 4096 pixels wide, 12288 bytes, so rows need no padding */
+#define BENCH_WIDTH 4096
+
+/* Largest carrier, 64 GiB. Above 4 GiB only the height still fits the bmp header */
+#define BENCH_MAX_CARRIER_MB (64 * 1024)
+
+/* Largest carrier the in memory run reads whole, bigger ones skip it */
+#define BENCH_MAX_LIBRARY_MB 4096
+
+/* Payload bytes the kernel runs work on at most, keeps their working set in check */
+#define BENCH_MAX_KERNEL_BYTES (16 * 1024 * 1024)
+
+/* Random access runs: reads of BENCH_READ_SIZE bytes at random offsets in a window of BENCH_READ_WINDOW at the head,
+ * middle and tail of the payload */
+#define BENCH_READ_SIZE 4096
+#define BENCH_READ_WINDOW (1024 * 1024)
+#define BENCH_READS 64
+
+/* Times the in memory run sends back: encode, decode and a read at each of the three windows */
+#define BENCH_LIBRARY_TIMES 5
+
+/* Every timed run repeats until it took at least this long, the best repetition counts */
+#define BENCH_MIN_SECONDS 0.25
+
+/* Passphrase of the encrypted and scattered file runs */
+#define BENCH_PASSPHRASE "bench passphrase"
+
+/* The encrypted and scattered file runs, which the scattering ratio is taken from, count the best of this many */
+#define BENCH_RATIO_RUNS 3
+
+/* What the file runs embed: the plain payload, the encrypted one, or the encrypted one scattered (-r) */
+typedef enum
+{
+    e_bench_plain,
+    e_bench_encrypted,
+    e_bench_scattered
+} BenchMode;
+
+typedef struct _BenchInfo
+{
+    size_t carrier_size;        /* bytes of the synthetic carrier file */
+    size_t payload_size;        /* bytes of secret data */
+    uint lsb_bits;
+    int num_threads;
+    const char *work_dir;
+    int keep_files;
+    long max_rss_kb;            /* bound on the peak RSS of the file runs, 0 for none (-m) */
+} BenchInfo;
+
+/* Result of one timed run */
+typedef struct _BenchResult
+{
+    double seconds;
+    long peak_rss_kb;
+    int ok;
+} BenchResult;
+
+/* Seconds on the monotonic clock */
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Peak RSS of this process so far, in KiB */
+static long bench_peak_rss(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/* Fill random
+ * Input: Buffer, its size and the generator state
+ * Output: Buffer filled with xorshift64 output
+ * Description: Pixel data and payload should not compress or repeat
+ * Return value: None
+ */
+static void bench_fill_random(unsigned char *buffer, size_t size, uint64_t *state)
+{
+    uint64_t x = *state;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(buffer + i, &x, 8);
+    }
+    for (; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buffer[i] = x;
+    }
+    *state = x;
+}
+
+/* Put a little endian 16 or 32 bit field into a bmp header */
+static void bench_put_le(unsigned char *header, int offset, uint value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        header[offset + i] = value >> (8 * i);
+    }
+}
+
+/* Make bmp header
+ * Input: Buffer of 54 bytes and the carrier size
+ * Output: 24 bit bmp header for a BENCH_WIDTH wide image of about carrier_size bytes
+ * Return value: Size of the whole image file
+ */
+static size_t bench_make_bmp_header(unsigned char *header, size_t carrier_size)
+{
+    size_t row = BENCH_WIDTH * 3;
+    size_t height = (carrier_size - 54 + row - 1) / row;
+    size_t image_size = row * (height > 0 ? height : 1);
+
+    memset(header, 0, 54);
+    header[0] = 'B';
+    header[1] = 'M';
+    bench_put_le(header, 2, 54 + image_size > UINT32_MAX ? 0 : 54 + image_size, 4);
+    bench_put_le(header, 10, 54, 4);
+    bench_put_le(header, 14, 40, 4);
+    bench_put_le(header, 18, BENCH_WIDTH, 4);
+    bench_put_le(header, 22, image_size / row, 4);
+    bench_put_le(header, 26, 1, 2);
+    bench_put_le(header, 28, 24, 2);
+    bench_put_le(header, 34, image_size > UINT32_MAX ? 0 : image_size, 4);
+    bench_put_le(header, 38, 2835, 4);
+    bench_put_le(header, 42, 2835, 4);
+
+    return 54 + image_size;
+}
+
+/* Write synthetic file
+ * Input: File name, optional 54 byte header, bytes of random data behind it and generator state
+ * Output: File on disk
+ * Description: Written in MAX_COPY_BUF_SIZE blocks, a carrier of many GiB never sits in memory
+ * Return value: e_success, e_failure
+ */
+static Status bench_write_file(const char *fname, const unsigned char *header, size_t size, uint64_t *state)
+{
+    unsigned char *buffer = malloc(MAX_COPY_BUF_SIZE);
+    FILE *fptr = fopen(fname, "w");
+    size_t chunk;
+    Status status = e_success;
+
+    if (buffer == NULL || fptr == NULL)
+    {
+        perror(fname);
+        free(buffer);
+        if (fptr != NULL)
+        {
+            fclose(fptr);
+        }
+        return e_failure;
+    }
+    if (header != NULL && fwrite(header, 1, 54, fptr) != 54)
+    {
+        status = e_failure;
+    }
+    while (status == e_success && size > 0)
+    {
+        chunk = size < MAX_COPY_BUF_SIZE ? size : MAX_COPY_BUF_SIZE;
+        bench_fill_random(buffer, chunk, state);
+        if (fwrite(buffer, 1, chunk, fptr) != chunk)
+        {
+            status = e_failure;
+        }
+        size -= chunk;
+    }
+    if (fclose(fptr) == EOF)
+    {
+        status = e_failure;
+    }
+    free(buffer);
+
+    return status;
+}
+
+/* Report
+ * Input: Benchmark and variant name, payload bytes and the result
+ * Output: One JSON line on stdout
+ */
+static void bench_report(const char *bench, const char *variant, size_t bytes, const BenchResult *result)
+{
+    if (!result->ok)
+    {
+        printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"bytes\":%zu,\"error\":true}\n", bench, variant, bytes);
+        return;
+    }
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"bytes\":%zu,\"seconds\":%.6f,\"mb_per_s\":%.1f,\"ns_per_byte\":%.3f,\"peak_rss_kb\":%ld}\n",
+           bench, variant, bytes, result->seconds, bytes / result->seconds / 1e6, result->seconds * 1e9 / bytes, result->peak_rss_kb);
+    fflush(stdout);
+}
+
+/* Time embed kernel
+ * Input: Kernel, image and payload buffers, payload bytes and bits per image byte
+ * Output: Best time of the repetitions
+ */
+static BenchResult bench_time_embed(LsbEmbedFn embed, unsigned char *image, const unsigned char *data, size_t size)
+{
+    BenchResult result = { 1e9, 0, 1 };
+    double start, total = 0, t;
+
+    do
+    {
+        start = bench_now();
+        embed(image, image, data, size);
+        t = bench_now() - start;
+        total += t;
+        result.seconds = t < result.seconds ? t : result.seconds;
+    } while (total < BENCH_MIN_SECONDS);
+    result.peak_rss_kb = bench_peak_rss();
+
+    return result;
+}
+
+/* Time extract kernel, as bench_time_embed */
+static BenchResult bench_time_extract(LsbExtractFn extract, const unsigned char *image, unsigned char *data, size_t size)
+{
+    BenchResult result = { 1e9, 0, 1 };
+    double start, total = 0, t;
+
+    do
+    {
+        start = bench_now();
+        extract(data, image, size);
+        t = bench_now() - start;
+        total += t;
+        result.seconds = t < result.seconds ? t : result.seconds;
+    } while (total < BENCH_MIN_SECONDS);
+    result.peak_rss_kb = bench_peak_rss();
+
+    return result;
+}
+
+/* Time checksum kernel, as bench_time_embed */
+static BenchResult bench_time_crc(Crc32cFn crc, const unsigned char *data, size_t size)
+{
+    BenchResult result = { 1e9, 0, 1 };
+    double start, total = 0, t;
+    volatile uint32_t sink;
+
+    do
+    {
+        start = bench_now();
+        sink = crc(0, data, size);
+        t = bench_now() - start;
+        total += t;
+        result.seconds = t < result.seconds ? t : result.seconds;
+    } while (total < BENCH_MIN_SECONDS);
+    (void) sink;
+    result.peak_rss_kb = bench_peak_rss();
+
+    return result;
+}
+
+/* Time keystream kernel, as bench_time_embed, size is a multiple of CHACHA_BLOCK_SIZE */
+static BenchResult bench_time_chacha(ChaChaFn fn, const ChaCha *cipher, unsigned char *data, size_t size)
+{
+    BenchResult result = { 1e9, 0, 1 };
+    double start, total = 0, t;
+
+    do
+    {
+        start = bench_now();
+        fn(cipher, 0, data, data, size / CHACHA_BLOCK_SIZE);
+        t = bench_now() - start;
+        total += t;
+        result.seconds = t < result.seconds ? t : result.seconds;
+    } while (total < BENCH_MIN_SECONDS);
+    result.peak_rss_kb = bench_peak_rss();
+
+    return result;
+}
+
+/* Kernel benchmarks
+ * Input: Benchmark settings
+ * Output: One line per kernel the CPU supports, for embed and extract, the
+ * CRC32C and ChaCha20 kernels and the multi-threaded variants for the chosen
+ * bits per image byte
+ */
+static void bench_kernels(const BenchInfo *benchInfo)
+{
+    size_t size = benchInfo->payload_size < BENCH_MAX_KERNEL_BYTES ? benchInfo->payload_size : BENCH_MAX_KERNEL_BYTES;
+    unsigned char *image = malloc(size * 8);
+    unsigned char *data = malloc(size);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    BenchResult result;
+    char variant[32];
+
+    struct
+    {
+        const char *name;
+        uint bits;
+        LsbEmbedFn embed;
+        LsbExtractFn extract;
+        int supported;
+    } kernels[] =
+    {
+        { "scalar", 1, lsb_embed_scalar, lsb_extract_scalar, 1 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "sse2", 1, lsb_embed_sse2, lsb_extract_sse2, __builtin_cpu_supports("sse2") },
+        { "avx2", 1, lsb_embed_avx2, lsb_extract_avx2, __builtin_cpu_supports("avx2") },
+        { "bmi2", 1, lsb_embed_bmi2, lsb_extract_bmi2, __builtin_cpu_supports("bmi2") },
+        { "k2_sse2", 2, lsb_embed2_sse2, lsb_extract2_sse2, __builtin_cpu_supports("sse2") },
+        { "k4_sse2", 4, lsb_embed4_sse2, lsb_extract4_sse2, __builtin_cpu_supports("sse2") },
+#endif
+        { "k2_scalar", 2, lsb_embed2_scalar, lsb_extract2_scalar, 1 },
+        { "k4_scalar", 4, lsb_embed4_scalar, lsb_extract4_scalar, 1 },
+    };
+
+    if (image == NULL || data == NULL)
+    {
+        fprintf(stderr, "ERROR: No memory for the kernel benchmarks\n");
+        free(image);
+        free(data);
+        return;
+    }
+    bench_fill_random(image, size * 8, &state);
+    bench_fill_random(data, size, &state);
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        if (!kernels[k].supported)
+        {
+            continue;
+        }
+        result = bench_time_embed(kernels[k].embed, image, data, size);
+        bench_report("embed", kernels[k].name, size, &result);
+        result = bench_time_extract(kernels[k].extract, image, data, size);
+        bench_report("extract", kernels[k].name, size, &result);
+    }
+
+    // Chunk checksums of -c
+    result = bench_time_crc(crc32c_scalar, data, size);
+    bench_report("crc32c", crc32c_name(crc32c_scalar), size, &result);
+    if (crc32c_select() != crc32c_scalar)
+    {
+        result = bench_time_crc(crc32c_select(), data, size);
+        bench_report("crc32c", crc32c_name(crc32c_select()), size, &result);
+    }
+
+    // Keystream of -P and -K, every kernel the CPU supports
+    {
+        static const unsigned char key[CHACHA_KEY_SIZE], nonce[CHACHA_NONCE_SIZE];
+        ChaCha cipher;
+        ChaChaFn ciphers[3] = { chacha_xor_scalar, NULL, NULL };
+
+#if defined(__x86_64__) || defined(__i386__)
+        ciphers[1] = __builtin_cpu_supports("sse2") ? chacha_xor_sse2 : NULL;
+        ciphers[2] = __builtin_cpu_supports("avx2") ? chacha_xor_avx2 : NULL;
+#endif
+        chacha_init(&cipher, key, nonce);
+        for (int c = 0; c < 3; c++)
+        {
+            if (ciphers[c] != NULL)
+            {
+                result = bench_time_chacha(ciphers[c], &cipher, data, size);
+                bench_report("chacha20", chacha_name(ciphers[c]), size / CHACHA_BLOCK_SIZE * CHACHA_BLOCK_SIZE, &result);
+            }
+        }
+    }
+
+    // Threaded kernels, timed like the engine calls them
+    if (benchInfo->num_threads > 1)
+    {
+        BenchResult best = { 1e9, 0, 1 };
+        double start, total = 0, t;
+
+        snprintf(variant, sizeof(variant), "mt%d_k%u", benchInfo->num_threads, benchInfo->lsb_bits);
+        do
+        {
+            start = bench_now();
+            lsb_embed_mt(image, image, data, size, benchInfo->lsb_bits, benchInfo->num_threads);
+            t = bench_now() - start;
+            total += t;
+            best.seconds = t < best.seconds ? t : best.seconds;
+        } while (total < BENCH_MIN_SECONDS);
+        best.peak_rss_kb = bench_peak_rss();
+        bench_report("embed", variant, size, &best);
+
+        best.seconds = 1e9;
+        total = 0;
+        do
+        {
+            start = bench_now();
+            lsb_extract_mt(data, image, size, benchInfo->lsb_bits, benchInfo->num_threads);
+            t = bench_now() - start;
+            total += t;
+            best.seconds = t < best.seconds ? t : best.seconds;
+        } while (total < BENCH_MIN_SECONDS);
+        best.peak_rss_kb = bench_peak_rss();
+        bench_report("extract", variant, size, &best);
+    }
+
+    free(image);
+    free(data);
+}
+
+/* Header benchmarks
+ * Output: Time to build and embed a stego header, and to read one back, per header byte
+ */
+static void bench_header(void)
+{
+    unsigned char image[54 + STEGO_MAX_HEADER_IMAGE_SIZE];
+    unsigned char header[STEGO_MAX_HEADER_SIZE];
+    uint64_t state = 1;
+    StegoHeader parsed;
+    BmpInfo bmp;
+    BenchResult result = { 0, 0, 1 };
+    size_t size_header = 0, rounds = 0;
+    double start;
+
+    bench_make_bmp_header(image, 1 << 20);
+    bench_fill_random(image + 54, sizeof(image) - 54, &state);
+    bmp_parse_header(image, sizeof(image), &bmp);
+
+    start = bench_now();
+    do
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            size_header = stego_build_header(header, ".txt", 1000 + i, 0, 0, NULL, 0, NULL, 1, &bmp);
+            lsb_embed(image + 54, image + 54, header, size_header);
+        }
+        rounds += 1000;
+    } while ((result.seconds = bench_now() - start) < BENCH_MIN_SECONDS);
+    result.peak_rss_kb = bench_peak_rss();
+    bench_report("header_encode", "stego_build_header", size_header * rounds, &result);
+
+    rounds = 0;
+    start = bench_now();
+    do
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            result.ok = stego_read_header(image, sizeof(image), 1 << 20, &parsed) == e_success;
+        }
+        rounds += 1000;
+    } while ((result.seconds = bench_now() - start) < BENCH_MIN_SECONDS);
+    result.peak_rss_kb = bench_peak_rss();
+    bench_report("header_decode", "stego_read_header", size_header * rounds, &result);
+}
+
+/* Seconds of the payload and tail phases of a run measured with -t: the embed or
+ * extract work and the copy of the image, without the setup and header phases
+ * the key derivation happens in */
+static double bench_engine_seconds(const StatsInfo *stats)
+{
+    return stats->phase[e_phase_payload].seconds + stats->phase[e_phase_tail].seconds;
+}
+
+/* Encode files, the way the command line runs it, on the io_uring engine when a ring is given.
+ * With seconds the run is measured with -t and its engine seconds are stored there */
+static int bench_run_encode(const BenchInfo *benchInfo, Uring *uring, BenchMode mode, double *seconds)
+{
+    EncodeInfo *encInfo = calloc(1, sizeof(EncodeInfo));
+    char stego_fname[] = BENCH_STEGO_FNAME;
+    char *argv[] = { "bench", "-e", BENCH_CARRIER_FNAME, BENCH_SECRET_FNAME, stego_fname, NULL };
+    int ok;
+
+    if (encInfo == NULL)
+    {
+        return 0;
+    }
+    encInfo->quiet = 1;
+    encInfo->lsb_bits = benchInfo->lsb_bits;
+    encInfo->num_threads = benchInfo->num_threads;
+    encInfo->uring = uring;
+    if (mode != e_bench_plain)
+    {
+        encInfo->passphrase = BENCH_PASSPHRASE;
+        encInfo->passphrase_size = strlen(BENCH_PASSPHRASE);
+        encInfo->scatter = mode == e_bench_scattered;
+    }
+    encInfo->stats.format = seconds != NULL ? e_stats_kv : e_stats_off;
+    ok = read_and_validate_encode_args(argv, encInfo) == e_success && open_files(encInfo) == e_success && do_encoding(encInfo) == e_success;
+    if (seconds != NULL)
+    {
+        *seconds = bench_engine_seconds(&encInfo->stats);
+    }
+    close_files_for_encoding(encInfo);
+    free(encInfo);
+
+    return ok;
+}
+
+/* Decode files, the way the command line runs it, on the io_uring engine when a ring is given.
+ * With seconds the run is measured with -t and its engine seconds are stored there */
+static int bench_run_decode(const BenchInfo *benchInfo, Uring *uring, BenchMode mode, double *seconds)
+{
+    DecodeInfo *decInfo = calloc(1, sizeof(DecodeInfo));
+    char output_fname[] = BENCH_DECODED_FNAME;
+    char *argv[] = { "bench", "-d", BENCH_STEGO_FNAME ".bmp", output_fname, NULL };
+    int ok;
+
+    if (decInfo == NULL)
+    {
+        return 0;
+    }
+    decInfo->quiet = 1;
+    decInfo->num_threads = benchInfo->num_threads;
+    decInfo->uring = uring;
+    if (mode != e_bench_plain)
+    {
+        decInfo->passphrase = BENCH_PASSPHRASE;
+        decInfo->passphrase_size = strlen(BENCH_PASSPHRASE);
+    }
+    decInfo->stats.format = seconds != NULL ? e_stats_kv : e_stats_off;
+    ok = read_and_validate_decode_args(argv, decInfo) == d_success && do_decoding(decInfo) == d_success;
+    if (seconds != NULL)
+    {
+        *seconds = bench_engine_seconds(&decInfo->stats);
+    }
+    close_files_for_decoding(decInfo);
+    free(decInfo);
+
+    return ok;
+}
+
+/* Time reads
+ * Input: Handle on the payload, window start and size, generator state
+ * Output: Mean seconds of a BENCH_READ_SIZE read at a random offset in the window, negative when a read failed
+ */
+static double bench_time_reads(StegoFile *file, size_t start, size_t window, uint64_t *state)
+{
+    unsigned char buffer[BENCH_READ_SIZE];
+    size_t offsets[BENCH_READS], count;
+    double begin;
+    int ok = 1;
+
+    for (int i = 0; i < BENCH_READS; i++)
+    {
+        bench_fill_random((unsigned char *) &offsets[i], sizeof(size_t), state);
+        offsets[i] = start + offsets[i] % (window - BENCH_READ_SIZE + 1);
+    }
+    begin = bench_now();
+    for (int i = 0; i < BENCH_READS && ok; i++)
+    {
+        ok = stego_seek(file, offsets[i], SEEK_SET) == e_success && stego_read(file, buffer, BENCH_READ_SIZE, &count) == e_success &&
+             count == BENCH_READ_SIZE;
+    }
+
+    return ok ? (bench_now() - begin) / BENCH_READS : -1;
+}
+
+/*
+ * Encode and decode in memory through libstego, the carrier is read into memory first. Then reads through a stego_open
+ * handle at the head, middle and tail of the payload, which should take the same time wherever they are
+ */
+static int bench_run_library(const BenchInfo *benchInfo, double *seconds)
+{
+    FILE *fptr = fopen(BENCH_CARRIER_FNAME, "r");
+    unsigned char *image = malloc(benchInfo->carrier_size);
+    unsigned char *data = malloc(benchInfo->payload_size);
+    size_t window = benchInfo->payload_size < BENCH_READ_WINDOW ? benchInfo->payload_size : BENCH_READ_WINDOW;
+    uint64_t state = 7;
+    StegoHeader header;
+    StegoFile file;
+    double start;
+    int ok = 0;
+
+    if (fptr != NULL && image != NULL && data != NULL && fread(image, 1, benchInfo->carrier_size, fptr) == benchInfo->carrier_size)
+    {
+        bench_fill_random(data, benchInfo->payload_size, &state);
+        start = bench_now();
+        ok = stego_encode(image, image, benchInfo->carrier_size, data, benchInfo->payload_size, ".txt", benchInfo->lsb_bits, benchInfo->num_threads) == e_success;
+        seconds[0] = bench_now() - start;
+        start = bench_now();
+        ok = ok && stego_decode(data, benchInfo->payload_size, image, benchInfo->carrier_size, &header, benchInfo->num_threads) == e_success;
+        seconds[1] = bench_now() - start;
+        if (ok && window >= BENCH_READ_SIZE && stego_open(&file, image, benchInfo->carrier_size, NULL, 0, 1) == e_success)
+        {
+            seconds[2] = bench_time_reads(&file, 0, window, &state);
+            seconds[3] = bench_time_reads(&file, (benchInfo->payload_size - window) / 2, window, &state);
+            seconds[4] = bench_time_reads(&file, benchInfo->payload_size - window, window, &state);
+            stego_close(&file);
+        }
+    }
+    if (fptr != NULL)
+    {
+        fclose(fptr);
+    }
+    free(image);
+    free(data);
+
+    return ok;
+}
+
+/* Run isolated
+ * Input: Which end to end run (encode, decode, library, encode and decode on io_uring, encode and decode encrypted,
+ * encode and decode scattered), benchmark settings
+ * Output: Time and peak RSS of the run
+ * Description: Every end to end run happens in a child process, so its peak RSS
+ * is its own and not what earlier runs left behind. The child sends its times
+ * back through a pipe, the parent takes the peak RSS from wait4. The encrypted
+ * and scattered runs count only the payload and tail phases of their -t
+ * counters (reported to /dev/null): the fixed cost of the key derivation would
+ * otherwise decide the scattering ratio on small carriers
+ * Return value: Result, ok is 0 when the run failed
+ */
+static BenchResult bench_run_isolated(int which, const BenchInfo *benchInfo, double *seconds)
+{
+    BenchResult result = { 0, 0, 0 };
+    struct rusage ru;
+    int fds[2], status;
+    pid_t pid;
+
+    if (pipe(fds) == -1 || (pid = fork()) == -1)
+    {
+        perror("fork");
+        return result;
+    }
+    if (pid == 0)
+    {
+        double times[BENCH_LIBRARY_TIMES] = { 0 };
+        double start = bench_now();
+        int ok;
+
+        close(fds[0]);
+        if (which == 2)
+        {
+            ok = bench_run_library(benchInfo, times);
+        }
+        else if (which == 3 || which == 4)
+        {
+            Uring ring;
+
+            ok = uring_setup(&ring) == e_success &&
+                 (which == 3 ? bench_run_encode(benchInfo, &ring, e_bench_plain, NULL) : bench_run_decode(benchInfo, &ring, e_bench_plain, NULL));
+        }
+        else if (which < 2)
+        {
+            ok = which == 0 ? bench_run_encode(benchInfo, NULL, e_bench_plain, NULL) : bench_run_decode(benchInfo, NULL, e_bench_plain, NULL);
+        }
+        else
+        {
+            BenchMode mode = which < 7 ? e_bench_encrypted : e_bench_scattered;
+
+            ok = freopen("/dev/null", "w", stderr) != NULL &&
+                 (which == 5 || which == 7 ? bench_run_encode(benchInfo, NULL, mode, &times[0]) : bench_run_decode(benchInfo, NULL, mode, &times[0]));
+        }
+        if (which < 5 && which != 2)
+        {
+            times[0] = bench_now() - start;
+        }
+        ok = ok && write(fds[1], times, sizeof(times)) == sizeof(times);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    result.ok = read(fds[0], seconds, BENCH_LIBRARY_TIMES * sizeof(double)) == BENCH_LIBRARY_TIMES * sizeof(double);
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &ru) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        result.ok = 0;
+    }
+    result.seconds = seconds[0];
+    result.peak_rss_kb = ru.ru_maxrss;
+
+    return result;
+}
+
+/* Run best of
+ * Input: Which end to end run and benchmark settings, as for bench_run_isolated
+ * Output: Fastest of BENCH_RATIO_RUNS runs, with the highest peak RSS of them
+ * Description: For the runs a ratio is printed from, so a single slow run
+ * doesn't decide it
+ * Return value: Result, ok is 0 when any run failed
+ */
+static BenchResult bench_run_best(int which, const BenchInfo *benchInfo, double *seconds)
+{
+    BenchResult best = bench_run_isolated(which, benchInfo, seconds), result;
+
+    for (int run = 1; run < BENCH_RATIO_RUNS && best.ok; run++)
+    {
+        result = bench_run_isolated(which, benchInfo, seconds);
+        best.ok = result.ok;
+        best.seconds = result.seconds < best.seconds ? result.seconds : best.seconds;
+        best.peak_rss_kb = result.peak_rss_kb > best.peak_rss_kb ? result.peak_rss_kb : best.peak_rss_kb;
+    }
+
+    return best;
+}
+
+/* Check RSS
+ * Input: Benchmark settings, name of the run and its result
+ * Output: Error on stderr when the run failed or went above the bound
+ * Return value: 1 when it did, 0 otherwise
+ */
+static int bench_check_rss(const BenchInfo *benchInfo, const char *variant, const BenchResult *result)
+{
+    if (benchInfo->max_rss_kb == 0 || (result->ok && result->peak_rss_kb <= benchInfo->max_rss_kb))
+    {
+        return 0;
+    }
+    fprintf(stderr, "ERROR: %s peak RSS %ld KiB, bound %ld KiB\n", variant, result->peak_rss_kb, benchInfo->max_rss_kb);
+    return 1;
+}
+
+/* End to end benchmarks
+ * Input: Benchmark settings
+ * Output: do_encoding and do_decoding on the files, on the io_uring engine as
+ * well, encrypted and encrypted and scattered, then stego_encode and
+ * stego_decode on the carrier in memory unless it is too big for that
+ * Description: The file runs keep a fixed working set whatever the sizes, so
+ * with -m their peak RSS is checked against the bound. The in memory runs hold
+ * the carrier and payload by design and are not checked
+ * Return value: Number of file runs that failed or went above the RSS bound
+ */
+static int bench_end_to_end(const BenchInfo *benchInfo)
+{
+    const char *reads[] = { "stego_read_head", "stego_read_mid", "stego_read_tail" };
+    double seconds[BENCH_LIBRARY_TIMES];
+    BenchResult result, sequential[2];
+    Uring ring;
+    int failed = 0;
+
+    sync();
+    result = bench_run_isolated(0, benchInfo, seconds);
+    bench_report("encode", "do_encoding", benchInfo->payload_size, &result);
+    failed += bench_check_rss(benchInfo, "do_encoding", &result);
+    result = bench_run_isolated(1, benchInfo, seconds);
+    bench_report("decode", "do_decoding", benchInfo->payload_size, &result);
+    failed += bench_check_rss(benchInfo, "do_decoding", &result);
+
+    // The same files on the io_uring engine, where the kernel has it
+    if (uring_setup(&ring) == e_success)
+    {
+        uring_close(&ring);
+        result = bench_run_isolated(3, benchInfo, seconds);
+        bench_report("encode", "do_encoding_uring", benchInfo->payload_size, &result);
+        failed += bench_check_rss(benchInfo, "do_encoding_uring", &result);
+        result = bench_run_isolated(4, benchInfo, seconds);
+        bench_report("decode", "do_decoding_uring", benchInfo->payload_size, &result);
+        failed += bench_check_rss(benchInfo, "do_decoding_uring", &result);
+    }
+    else
+    {
+        fprintf(stderr, "INFO: No io_uring, skipping do_encoding_uring and do_decoding_uring\n");
+    }
+
+    // Scattering needs a key, the encrypted runs are the sequential ones to hold it against. Both count
+    // their payload and tail phases only, so the ratio is the one of the tile shuffle, not of PBKDF2
+    sequential[0] = bench_run_best(5, benchInfo, seconds);
+    bench_report("encode", "do_encoding_encrypted", benchInfo->payload_size, &sequential[0]);
+    failed += bench_check_rss(benchInfo, "do_encoding_encrypted", &sequential[0]);
+    sequential[1] = bench_run_best(6, benchInfo, seconds);
+    bench_report("decode", "do_decoding_encrypted", benchInfo->payload_size, &sequential[1]);
+    failed += bench_check_rss(benchInfo, "do_decoding_encrypted", &sequential[1]);
+    result = bench_run_best(7, benchInfo, seconds);
+    bench_report("encode", "do_encoding_scattered", benchInfo->payload_size, &result);
+    failed += bench_check_rss(benchInfo, "do_encoding_scattered", &result);
+    if (result.ok && sequential[0].ok)
+    {
+        fprintf(stderr, "INFO: Scattered encoding takes %.2f times as long as sequential\n", result.seconds / sequential[0].seconds);
+    }
+    result = bench_run_best(8, benchInfo, seconds);
+    bench_report("decode", "do_decoding_scattered", benchInfo->payload_size, &result);
+    failed += bench_check_rss(benchInfo, "do_decoding_scattered", &result);
+    if (result.ok && sequential[1].ok)
+    {
+        fprintf(stderr, "INFO: Scattered decoding takes %.2f times as long as sequential\n", result.seconds / sequential[1].seconds);
+    }
+
+    if (benchInfo->carrier_size > (size_t) BENCH_MAX_LIBRARY_MB << 20)
+    {
+        fprintf(stderr, "INFO: Carrier above %d MiB, skipping stego_encode and stego_decode\n", BENCH_MAX_LIBRARY_MB);
+        return failed;
+    }
+    result = bench_run_isolated(2, benchInfo, seconds);
+    bench_report("encode", "stego_encode", benchInfo->payload_size, &result);
+    result.seconds = seconds[1];
+    bench_report("decode", "stego_decode", benchInfo->payload_size, &result);
+    for (int i = 0; i < 3; i++)
+    {
+        /* 0 when the payload is below one read and the reads did not run */
+        if (seconds[2 + i] != 0)
+        {
+            result.seconds = seconds[2 + i];
+            result.ok = result.ok && seconds[2 + i] > 0;
+            bench_report("read", reads[i], BENCH_READ_SIZE, &result);
+        }
+    }
+
+    return failed;
+}
+
+/* Usage */
+static void bench_usage(void)
+{
+    puts("Usage: ./stego_bench [-c carrier MiB] [-p payload MiB] [-j threads] [-k bits] [-d work dir] [-m RSS MiB] [-K]");
+    printf("       carrier 1 to %d MiB (default 64), payload defaults to half the capacity, -K keeps the files\n", BENCH_MAX_CARRIER_MB);
+    puts("       -m fails the run when encoding or decoding the files takes more than the given peak RSS");
+}
+
+int main(int argc, char *argv[])
+{
+    BenchInfo benchInfo = { 64u << 20, 0, 1, 1, ".", 0, 0 };
+    unsigned char bmp_header[54];
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    size_t capacity;
+    int failed;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && !strcmp(argv[i], "-c"))
+        {
+            long mb = atol(argv[++i]);
+            if (mb < 1 || mb > BENCH_MAX_CARRIER_MB)
+            {
+                bench_usage();
+                return 1;
+            }
+            benchInfo.carrier_size = (size_t) mb << 20;
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-p"))
+        {
+            benchInfo.payload_size = atof(argv[++i]) * (1 << 20);
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-j"))
+        {
+            benchInfo.num_threads = lsb_resolve_threads(atoi(argv[++i]));
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-k"))
+        {
+            benchInfo.lsb_bits = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-d"))
+        {
+            benchInfo.work_dir = argv[++i];
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "-m"))
+        {
+            benchInfo.max_rss_kb = atol(argv[++i]) * 1024;
+        }
+        else if (!strcmp(argv[i], "-K"))
+        {
+            benchInfo.keep_files = 1;
+        }
+        else
+        {
+            bench_usage();
+            return 1;
+        }
+    }
+    if (lsb_select_embed_bits(benchInfo.lsb_bits) == NULL)
+    {
+        puts("ERROR: Bits per image byte must be 1, 2 or 4");
+        return 1;
+    }
+
+    // Carrier and payload are generated in the work directory
+    if (chdir(benchInfo.work_dir) == -1)
+    {
+        perror(benchInfo.work_dir);
+        return 1;
+    }
+    benchInfo.carrier_size = bench_make_bmp_header(bmp_header, benchInfo.carrier_size);
+    capacity = stego_capacity(bmp_header, benchInfo.carrier_size, ".txt", benchInfo.lsb_bits);
+    if (benchInfo.payload_size == 0)
+    {
+        benchInfo.payload_size = capacity / 2;
+    }
+    if (benchInfo.payload_size == 0 || benchInfo.payload_size > capacity * 15 / 16)
+    {
+        printf("ERROR: Payload must be between 1 byte and %zu bytes for this carrier\n", capacity * 15 / 16);
+        return 1;
+    }
+
+    fprintf(stderr, "INFO: Generating %zu byte carrier and %zu byte payload in %s\n", benchInfo.carrier_size, benchInfo.payload_size, benchInfo.work_dir);
+    if (bench_write_file(BENCH_CARRIER_FNAME, bmp_header, benchInfo.carrier_size - 54, &state) == e_failure ||
+        bench_write_file(BENCH_SECRET_FNAME, NULL, benchInfo.payload_size, &state) == e_failure)
+    {
+        return 1;
+    }
+
+    fprintf(stderr, "INFO: embed %s, extract %s, %d threads, %u bits per image byte\n",
+            lsb_embed_name(lsb_select_embed()), lsb_extract_name(lsb_select_extract()), benchInfo.num_threads, benchInfo.lsb_bits);
+    bench_kernels(&benchInfo);
+    bench_header();
+    failed = bench_end_to_end(&benchInfo);
+
+    if (!benchInfo.keep_files)
+    {
+        unlink(BENCH_CARRIER_FNAME);
+        unlink(BENCH_SECRET_FNAME);
+        unlink(BENCH_STEGO_FNAME ".bmp");
+        unlink(BENCH_DECODED_FNAME ".txt");
+    }
+
+    return failed > 0;
+}
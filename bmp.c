@@ -0,0 +1,471 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "bmp.h"
+#include "lsb.h"
+#include "types.h"
+
+/* One part of a row walk, run on its own thread */
+typedef struct _BmpRange
+{
+    unsigned char *dest;
+    const unsigned char *src;
+    unsigned char *out;
+    const unsigned char *data;
+    const BmpInfo *bmp;
+    size_t pos;
+    size_t size;
+    uint bits;
+    const ChaCha *cipher;           /* keystream XORed into the data, NULL for none */
+    unsigned long long stream;      /* stream offset of the first data byte */
+} BmpRange;
+
+/* Little endian field of the bmp header */
+static uint bmp_get_le(const unsigned char *header, int offset, int size)
+{
+    uint value = 0;
+
+    for (int i = size - 1; i >= 0; i--)
+    {
+        value = value << 8 | header[offset + i];
+    }
+    return value;
+}
+
+/* Parse bmp header
+ * Input: First len bytes of an image and the info to fill
+ * Output: Pixel offset, size and row layout of the image
+ * Description: Takes the file header and a BITMAPINFOHEADER or any of its
+ * successors (V4, V5). Only uncompressed 24 and 32 bit images carry data, 32 bit
+ * ones may come with bit fields. Negative heights are top down images, which only
+ * changes what the rows show, not where they are. Rows need at least 8 pixel bytes
+ * Return value: e_success, e_failure for anything else
+ */
+Status bmp_parse_header(const unsigned char *header, size_t len, BmpInfo *bmp)
+{
+    int width, height;
+    uint compression;
+
+    if (len < BMP_HEADER_SIZE || header[0] != 'B' || header[1] != 'M')
+    {
+        return e_failure;
+    }
+    bmp->pixel_offset = bmp_get_le(header, 10, 4);
+    bmp->dib_size = bmp_get_le(header, 14, 4);
+    width = (int) bmp_get_le(header, 18, 4);
+    height = (int) bmp_get_le(header, 22, 4);
+    bmp->bit_count = bmp_get_le(header, 28, 2);
+    compression = bmp_get_le(header, 30, 4);
+
+    if (bmp->dib_size < BMP_MIN_DIB_SIZE || bmp->dib_size > BMP_MAX_DIB_SIZE || bmp->pixel_offset < 14 + bmp->dib_size ||
+        bmp_get_le(header, 26, 2) != 1 || width <= 0 || height == 0 || height == INT32_MIN)
+    {
+        return e_failure;
+    }
+    if (!(bmp->bit_count == 24 && compression == BMP_BI_RGB) &&
+        !(bmp->bit_count == 32 && (compression == BMP_BI_RGB || compression == BMP_BI_BITFIELDS)))
+    {
+        return e_failure;
+    }
+
+    bmp->width = width;
+    bmp->top_down = height < 0;
+    bmp->height = height < 0 ? -height : height;
+    bmp->row_size = (size_t) bmp->width * (bmp->bit_count / 8);
+    bmp->row_stride = (bmp->row_size + 3) & ~(size_t) 3;
+
+    // A data byte may span two rows but no more
+    if (bmp->row_size < 8 || bmp->height > SIZE_MAX / bmp->row_stride)
+    {
+        return e_failure;
+    }
+    bmp->capacity = bmp->row_size * bmp->height;
+
+    return e_success;
+}
+
+/* Clip capacity
+ * Input: Parsed image and the size of its file
+ * Output: Capacity bounded by the pixel bytes the file really holds
+ * Description: A truncated last row still counts with the bytes it has
+ * Return value: None
+ */
+void bmp_clip_capacity(BmpInfo *bmp, size_t file_size)
+{
+    size_t rows_size, present;
+
+    if (file_size <= bmp->pixel_offset)
+    {
+        bmp->capacity = 0;
+        return;
+    }
+    rows_size = file_size - bmp->pixel_offset;
+    present = rows_size / bmp->row_stride * bmp->row_size;
+    present += rows_size % bmp->row_stride < bmp->row_size ? rows_size % bmp->row_stride : bmp->row_size;
+    if (present < bmp->capacity)
+    {
+        bmp->capacity = present;
+    }
+}
+
+/* Is linear
+ * Input: Parsed image
+ * Return value: 1 when the rows start at byte 54 and have no padding, so the
+ * layout is the same as the one of older versions
+ */
+int bmp_is_linear(const BmpInfo *bmp)
+{
+    return bmp->pixel_offset == BMP_HEADER_SIZE && bmp->row_size == bmp->row_stride;
+}
+
+/* Linear layout
+ * Input: Parsed image and the info to fill
+ * Output: One row of width * height * 3 bytes from byte 54 on
+ * Description: Images made before rows were honoured use all bytes behind the
+ * 54 byte header, padding included. Decoding them needs this layout
+ * Return value: None
+ */
+void bmp_linear_layout(const BmpInfo *bmp, BmpInfo *linear)
+{
+    *linear = *bmp;
+    linear->pixel_offset = BMP_HEADER_SIZE;
+    linear->row_size = (size_t) bmp->width * bmp->height * 3;
+    linear->row_stride = linear->row_size;
+    linear->capacity = linear->row_size;
+}
+
+/* File end
+ * Input: Parsed image and a pixel byte position
+ * Return value: File offset behind pixel byte pos - 1, so that the padding in
+ * front of a row belongs to the span that runs into the row
+ */
+size_t bmp_file_end(const BmpInfo *bmp, size_t pos)
+{
+    if (pos == 0)
+    {
+        return bmp->pixel_offset;
+    }
+    pos--;
+    return bmp->pixel_offset + pos / bmp->row_size * bmp->row_stride + pos % bmp->row_size + 1;
+}
+
+/* Copy pixels
+ * Input: File bytes at bmp_file_end(bmp, pos), pixel bytes, parsed image, first
+ * pixel byte, their count and the direction
+ * Output: Pixel bytes gathered from the file bytes, or put back into them
+ * Description: One memcpy per row, the padding in front of a row is skipped
+ * Return value: None
+ */
+static void bmp_copy_pixels(unsigned char *file, unsigned char *pixels, const BmpInfo *bmp, size_t pos, size_t count, int put)
+{
+    size_t padding = bmp->row_stride - bmp->row_size;
+    size_t offset = 0, done = 0;
+    size_t column, run;
+
+    while (done < count)
+    {
+        column = pos % bmp->row_size;
+        if (column == 0 && pos > 0)
+        {
+            offset += padding;
+        }
+        run = bmp->row_size - column < count - done ? bmp->row_size - column : count - done;
+        if (put)
+        {
+            memcpy(file + offset, pixels + done, run);
+        }
+        else
+        {
+            memcpy(pixels + done, file + offset, run);
+        }
+        offset += run;
+        pos += run;
+        done += run;
+    }
+}
+
+/* Get pixels
+ * Input: Array for count pixel bytes, file bytes at bmp_file_end(bmp, pos),
+ * parsed image, first pixel byte and count
+ * Output: The pixel bytes one after the other, without the row padding
+ * Return value: None
+ */
+void bmp_get_pixels(unsigned char *pixels, const unsigned char *src, const BmpInfo *bmp, size_t pos, size_t count)
+{
+    bmp_copy_pixels((unsigned char *) src, pixels, bmp, pos, count, 0);
+}
+
+/* Put pixels
+ * Input: File bytes at bmp_file_end(bmp, pos), count pixel bytes, parsed
+ * image, first pixel byte and count
+ * Output: The pixel bytes back in their rows, padding untouched
+ * Return value: None
+ */
+void bmp_put_pixels(unsigned char *dest, const unsigned char *pixels, const BmpInfo *bmp, size_t pos, size_t count)
+{
+    bmp_copy_pixels(dest, (unsigned char *) pixels, bmp, pos, count, 1);
+}
+
+/* Walk rows
+ * Input: Range to embed into or extract from, out set for extraction
+ * Output: Range processed row by row, one kernel call per row
+ * Description: A data byte takes 8 / bits pixel bytes, which may start at the
+ * end of one row and end in the next. Such a byte goes through a small buffer
+ * gathered from both rows and scattered back around the padding
+ * Return value: None
+ */
+static void bmp_walk_rows(const BmpRange *range)
+{
+    const BmpInfo *bmp = range->bmp;
+    LsbEmbedFn embed = range->out == NULL ? lsb_select_embed_bits(range->bits) : NULL;
+    LsbExtractFn extract = range->out == NULL ? NULL : lsb_select_extract_bits(range->bits);
+    size_t per_byte = 8 / range->bits;
+    size_t padding = bmp->row_stride - bmp->row_size;
+    size_t pos = range->pos, offset = 0, done = 0;
+    size_t column, count, head;
+    unsigned char split[8];
+
+    while (done < range->size)
+    {
+        column = pos % bmp->row_size;
+
+        // Padding in front of the row starting here
+        if (column == 0 && pos > 0)
+        {
+            if (embed != NULL && range->dest != range->src)
+            {
+                memcpy(range->dest + offset, range->src + offset, padding);
+            }
+            offset += padding;
+        }
+
+        // Every data byte that fits in the rest of the row
+        count = (bmp->row_size - column) / per_byte;
+        count = count < range->size - done ? count : range->size - done;
+        if (embed != NULL)
+        {
+            embed(range->dest + offset, range->src + offset, range->data + done, count);
+        }
+        else
+        {
+            extract(range->out + done, range->src + offset, count);
+        }
+        offset += count * per_byte;
+        pos += count * per_byte;
+        done += count;
+
+        // A data byte across the row end
+        head = bmp->row_size - (column + count * per_byte);
+        if (done == range->size || head == 0)
+        {
+            continue;
+        }
+        memcpy(split, range->src + offset, head);
+        memcpy(split + head, range->src + offset + head + padding, per_byte - head);
+        if (embed != NULL)
+        {
+            embed(split, split, range->data + done, 1);
+            memcpy(range->dest + offset, split, head);
+            if (range->dest != range->src)
+            {
+                memcpy(range->dest + offset + head, range->src + offset + head, padding);
+            }
+            memcpy(range->dest + offset + head + padding, split + head, per_byte - head);
+        }
+        else
+        {
+            extract(range->out + done, split, 1);
+        }
+        offset += per_byte + padding;
+        pos += per_byte;
+        done++;
+    }
+}
+
+/* Walk rows through the cipher
+ * Input: Range to embed into or extract from, with a cipher
+ * Output: Range processed, the data XORed with the keystream
+ * Description: Goes BMP_CIPHER_TILE data bytes at a time, the first tile ends
+ * on a keystream block boundary so every later one starts on one. Embedding
+ * XORs a tile into a stack buffer and walks its rows from there, extraction
+ * walks the rows into the output and XORs the tile in place. Either way the
+ * tile is still in L1 when the second pass reaches it, the data isn't read
+ * from memory twice
+ * Return value: None
+ */
+static void bmp_walk_cipher(const BmpRange *range)
+{
+    unsigned char tile[BMP_CIPHER_TILE];
+    size_t per_byte = 8 / range->bits;
+    size_t base = bmp_file_end(range->bmp, range->pos);
+    size_t piece, offset;
+    BmpRange part = *range;
+
+    for (size_t done = 0; done < range->size; done += piece)
+    {
+        piece = BMP_CIPHER_TILE - (range->stream + done) % CHACHA_BLOCK_SIZE;
+        piece = piece < range->size - done ? piece : range->size - done;
+        part.pos = range->pos + done * per_byte;
+        part.size = piece;
+        offset = bmp_file_end(range->bmp, part.pos) - base;
+        part.src = range->src + offset;
+        if (range->out == NULL)
+        {
+            chacha_xor(range->cipher, range->stream + done, tile, range->data + done, piece);
+            part.dest = range->dest + offset;
+            part.data = tile;
+            bmp_walk_rows(&part);
+        }
+        else
+        {
+            part.out = range->out + done;
+            bmp_walk_rows(&part);
+            chacha_xor(range->cipher, range->stream + done, part.out, part.out, piece);
+        }
+    }
+}
+
+/* Walk range
+ * Input: Range to embed into or extract from
+ * Output: Range processed, through the cipher when it has one
+ * Return value: None
+ */
+static void bmp_walk_range(const BmpRange *range)
+{
+    if (range->cipher != NULL)
+    {
+        bmp_walk_cipher(range);
+        return;
+    }
+    bmp_walk_rows(range);
+}
+
+/* Thread entry for one range */
+static void *bmp_range_worker(void *arg)
+{
+    bmp_walk_range(arg);
+    return NULL;
+}
+
+/* Walk rows, multi-threaded
+ * Input: Range covering the whole job and thread count
+ * Output: Range processed
+ * Description: The data is cut in equal parts like lsb_embed_mt does. A part
+ * starting at pixel byte p starts at file offset bmp_file_end(p), so every part
+ * knows its place without the ones in front of it
+ * Return value: None
+ */
+static void bmp_walk_rows_mt(const BmpRange *job, int threads)
+{
+    BmpRange ranges[LSB_MAX_THREADS];
+    pthread_t tids[LSB_MAX_THREADS];
+    int started[LSB_MAX_THREADS];
+    size_t per_byte = 8 / job->bits;
+    size_t base = bmp_file_end(job->bmp, job->pos);
+    size_t max_ranges = job->size / LSB_MT_MIN_CHUNK;
+    size_t per_range, start, offset;
+    int count = lsb_resolve_threads(threads);
+
+    if (max_ranges < (size_t) count)
+    {
+        count = max_ranges > 0 ? max_ranges : 1;
+    }
+    per_range = job->size / count;
+    for (int t = 0; t < count; t++)
+    {
+        start = per_range * t;
+        offset = bmp_file_end(job->bmp, job->pos + start * per_byte) - base;
+        ranges[t] = *job;
+        ranges[t].dest = job->dest != NULL ? job->dest + offset : NULL;
+        ranges[t].src = job->src + offset;
+        ranges[t].out = job->out != NULL ? job->out + start : NULL;
+        ranges[t].data = job->data != NULL ? job->data + start : NULL;
+        ranges[t].pos = job->pos + start * per_byte;
+        ranges[t].size = t == count - 1 ? job->size - start : per_range;
+        ranges[t].stream = job->stream + start;
+    }
+
+    // The calling thread takes the last part, a part without a thread runs inline
+    for (int t = 0; t < count - 1; t++)
+    {
+        started[t] = pthread_create(&tids[t], NULL, bmp_range_worker, &ranges[t]) == 0;
+        if (!started[t])
+        {
+            bmp_walk_range(&ranges[t]);
+        }
+    }
+    bmp_walk_range(&ranges[count - 1]);
+    for (int t = 0; t < count - 1; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(tids[t], NULL);
+        }
+    }
+}
+
+/* Embed into rows
+ * Input: Destination and source at file offset bmp_file_end(bmp, pos), parsed
+ * image, first pixel byte, data and its size, bits per pixel byte and thread count
+ * Output: dest with the data in the pixel bytes, padding copied over
+ * Return value: None
+ */
+void bmp_embed(unsigned char *dest, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+               const unsigned char *data, size_t size, uint bits, int threads)
+{
+    bmp_embed_cipher(dest, src, bmp, pos, data, size, bits, NULL, 0, threads);
+}
+
+/* Extract from rows
+ * Input: Array for the data, source at file offset bmp_file_end(bmp, pos),
+ * parsed image, first pixel byte, data size, bits per pixel byte and thread count
+ * Output: Data gathered from the pixel bytes
+ * Return value: None
+ */
+void bmp_extract(unsigned char *data, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                 size_t size, uint bits, int threads)
+{
+    bmp_extract_cipher(data, src, bmp, pos, size, bits, NULL, 0, threads);
+}
+
+/* Embed into rows through a cipher
+ * Input: Like bmp_embed, plus the cipher (NULL for none) and the stream offset
+ * of the first data byte
+ * Output: dest with the encrypted data in the pixel bytes, padding copied over
+ * Description: Plain rows without padding are one run of pixel bytes and go to
+ * the kernels in one piece. With a cipher every thread XORs the keystream of
+ * its own part, tile by tile
+ * Return value: None
+ */
+void bmp_embed_cipher(unsigned char *dest, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                      const unsigned char *data, size_t size, uint bits, const ChaCha *cipher, unsigned long long stream,
+                      int threads)
+{
+    BmpRange job = { dest, src, NULL, data, bmp, pos, size, bits, cipher, stream };
+
+    if (cipher == NULL && bmp->row_size == bmp->row_stride)
+    {
+        lsb_embed_mt(dest, src, data, size, bits, threads);
+        return;
+    }
+    bmp_walk_rows_mt(&job, threads);
+}
+
+/* Extract from rows through a cipher
+ * Input: Like bmp_extract, plus the cipher (NULL for none) and the stream
+ * offset of the first data byte
+ * Output: Data gathered from the pixel bytes and decrypted
+ * Return value: None
+ */
+void bmp_extract_cipher(unsigned char *data, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                        size_t size, uint bits, const ChaCha *cipher, unsigned long long stream, int threads)
+{
+    BmpRange job = { NULL, src, data, NULL, bmp, pos, size, bits, cipher, stream };
+
+    if (cipher == NULL && bmp->row_size == bmp->row_stride)
+    {
+        lsb_extract_mt(data, src, size, bits, threads);
+        return;
+    }
+    bmp_walk_rows_mt(&job, threads);
+}
@@ -0,0 +1,96 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>
+#include "chacha.h"
+#include "types.h"
+
+/*
+ * Row aware view of a bmp image
+ * The pixel rows start at bfOffBits and every row is padded to a multiple of
+ * 4 bytes. Data only goes to the pixel bytes, a logical position counts those
+ * bytes row after row in file order, padding and anything in front of the
+ * first row are skipped and stay as they are.
+ */
+
+/* File header and BITMAPINFOHEADER, all that is needed to parse a supported image */
+#define BMP_HEADER_SIZE 54
+
+/* DIB header sizes: BITMAPINFOHEADER, V4 and V5 are between these */
+#define BMP_MIN_DIB_SIZE 40
+#define BMP_MAX_DIB_SIZE 124
+
+/* compression field */
+#define BMP_BI_RGB 0
+#define BMP_BI_BITFIELDS 3
+
+/*
+ * Most file bytes n pixel bytes can span. A 24 bit row has up to 3 bytes of
+ * padding for at least 3 pixel bytes, and a span may start in front of a row
+ */
+#define BMP_MAX_SPAN(n) ((n) + (n) / 3 + 3)
+
+typedef struct _BmpInfo
+{
+    size_t pixel_offset;    /* bfOffBits, file offset of the first row */
+    uint dib_size;
+    uint width;
+    uint height;
+    int top_down;           /* negative height in the header, first row is the top one */
+    uint bit_count;         /* 24 or 32 */
+    size_t row_size;        /* pixel bytes of a row */
+    size_t row_stride;      /* row_size padded to 4 bytes */
+    size_t capacity;        /* pixel bytes of all rows present */
+} BmpInfo;
+
+/* Parse the first len bytes of an image, at least BMP_HEADER_SIZE */
+Status bmp_parse_header(const unsigned char *header, size_t len, BmpInfo *bmp);
+
+/* Bound the capacity by the rows present in a file of file_size bytes */
+void bmp_clip_capacity(BmpInfo *bmp, size_t file_size);
+
+/* Whether the pixel bytes run from byte 54 to the end without any gap */
+int bmp_is_linear(const BmpInfo *bmp);
+
+/* Layout of images made before rows were honoured: every byte from 54 on, width * height * 3 of them */
+void bmp_linear_layout(const BmpInfo *bmp, BmpInfo *linear);
+
+/* File offset just behind pixel byte pos - 1, bfOffBits for pos 0 */
+size_t bmp_file_end(const BmpInfo *bmp, size_t pos);
+
+/* Copy count pixel bytes from pos on out of the file bytes at src, which points to file offset bmp_file_end(bmp, pos) */
+void bmp_get_pixels(unsigned char *pixels, const unsigned char *src, const BmpInfo *bmp, size_t pos, size_t count);
+
+/* Put count pixel bytes from pos on back into the file bytes at dest, the padding in between stays as it is */
+void bmp_put_pixels(unsigned char *dest, const unsigned char *pixels, const BmpInfo *bmp, size_t pos, size_t count);
+
+/*
+ * Embed size data bytes, bits bits per pixel byte, from pixel byte pos on.
+ * dest and src point to file offset bmp_file_end(bmp, pos) and cover the file
+ * bytes up to bmp_file_end(bmp, pos + size * 8 / bits). Padding in between is
+ * copied when dest != src
+ */
+void bmp_embed(unsigned char *dest, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+               const unsigned char *data, size_t size, uint bits, int threads);
+
+/* Extract size data bytes from pixel byte pos on, src points like for bmp_embed */
+void bmp_extract(unsigned char *data, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                 size_t size, uint bits, int threads);
+
+/* Data tile the cipher walk XORs at a time, small enough to stay in L1 between keystream and rows */
+#define BMP_CIPHER_TILE 4096
+
+/*
+ * Like bmp_embed, the data is XORed with the keystream of cipher from stream
+ * offset stream on while it is embedded. data is left as it is, cipher NULL
+ * embeds it plain
+ */
+void bmp_embed_cipher(unsigned char *dest, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                      const unsigned char *data, size_t size, uint bits, const ChaCha *cipher, unsigned long long stream,
+                      int threads);
+
+/* Like bmp_extract, the data is XORed with the keystream of cipher from stream offset stream on as it is gathered */
+void bmp_extract_cipher(unsigned char *data, const unsigned char *src, const BmpInfo *bmp, size_t pos,
+                        size_t size, uint bits, const ChaCha *cipher, unsigned long long stream, int threads);
+
+#endif
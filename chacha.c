@@ -0,0 +1,374 @@
+#include <stdint.h>
+#include <string.h>
+#include "chacha.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define CHACHA_ROTL(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+/* One quarter round on four words of the state */
+#define CHACHA_QR(a, b, c, d)                                                                              \
+    do                                                                                                     \
+    {                                                                                                      \
+        a += b; d ^= a; d = CHACHA_ROTL(d, 16);                                                            \
+        c += d; b ^= c; b = CHACHA_ROTL(b, 12);                                                            \
+        a += b; d ^= a; d = CHACHA_ROTL(d, 8);                                                             \
+        c += d; b ^= c; b = CHACHA_ROTL(b, 7);                                                             \
+    } while (0)
+
+/* Little endian word of a key or nonce */
+static uint32_t chacha_get_le(const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* Set up
+ * Input: State to fill, key of CHACHA_KEY_SIZE bytes and nonce of CHACHA_NONCE_SIZE bytes
+ * Output: "expand 32-byte k", the key and the nonce as little endian words
+ * Description: The counter words stay 0, every kernel puts its block number in
+ * Return value: None
+ */
+void chacha_init(ChaCha *cipher, const unsigned char *key, const unsigned char *nonce)
+{
+    cipher->state[0] = 0x61707865;
+    cipher->state[1] = 0x3320646e;
+    cipher->state[2] = 0x79622d32;
+    cipher->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+    {
+        cipher->state[4 + i] = chacha_get_le(key + 4 * i);
+    }
+    cipher->state[12] = 0;
+    cipher->state[13] = 0;
+    cipher->state[14] = chacha_get_le(nonce);
+    cipher->state[15] = chacha_get_le(nonce + 4);
+}
+
+/* Keystream block
+ * Input: State, block number and a buffer of CHACHA_BLOCK_SIZE bytes
+ * Output: 64 keystream bytes of the block
+ * Description: 20 rounds, column and diagonal rounds taking turns, then the
+ * input is added. Words are stored little endian byte by byte so the byte
+ * order of the CPU doesn't matter
+ * Return value: None
+ */
+static void chacha_block(const ChaCha *cipher, uint64_t block, unsigned char *stream)
+{
+    uint32_t input[16], x[16];
+
+    memcpy(input, cipher->state, sizeof(input));
+    input[12] = (uint32_t) block;
+    input[13] = (uint32_t) (block >> 32);
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; round++)
+    {
+        CHACHA_QR(x[0], x[4], x[8], x[12]);
+        CHACHA_QR(x[1], x[5], x[9], x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8], x[13]);
+        CHACHA_QR(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        x[i] += input[i];
+        stream[4 * i] = x[i];
+        stream[4 * i + 1] = x[i] >> 8;
+        stream[4 * i + 2] = x[i] >> 16;
+        stream[4 * i + 3] = x[i] >> 24;
+    }
+}
+
+/* XOR, scalar version
+ * Input: State, first block number, output, input and number of whole blocks
+ * Output: in XORed with the keystream
+ * Description: Reference kernel, also used for the blocks the vector kernels
+ * leave behind
+ * Return value: None
+ */
+void chacha_xor_scalar(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    unsigned char stream[CHACHA_BLOCK_SIZE];
+
+    for (size_t b = 0; b < blocks; b++)
+    {
+        chacha_block(cipher, block + b, stream);
+        for (int i = 0; i < CHACHA_BLOCK_SIZE; i++)
+        {
+            out[i] = in[i] ^ stream[i];
+        }
+        in += CHACHA_BLOCK_SIZE;
+        out += CHACHA_BLOCK_SIZE;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Vector rotations by 12 and 7 take two shifts, by 16 a swap of the halves of every word */
+#define CHACHA_ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA_ROTL16_SSE2(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1)
+
+#define CHACHA_QR_SSE2(a, b, c, d)                                                                         \
+    do                                                                                                     \
+    {                                                                                                      \
+        a = _mm_add_epi32(a, b); d = CHACHA_ROTL16_SSE2(_mm_xor_si128(d, a));                              \
+        c = _mm_add_epi32(c, d); b = CHACHA_ROTL_SSE2(_mm_xor_si128(b, c), 12);                            \
+        a = _mm_add_epi32(a, b); d = CHACHA_ROTL_SSE2(_mm_xor_si128(d, a), 8);                             \
+        c = _mm_add_epi32(c, d); b = CHACHA_ROTL_SSE2(_mm_xor_si128(b, c), 7);                             \
+    } while (0)
+
+/* XOR, SSE2 version
+ * Input: State, first block number, output, input and number of whole blocks
+ * Output: in XORed with the keystream
+ * Description: Lane j of vector i holds word i of block + j, so the rounds
+ * run on 4 blocks at once without any shuffling. At the end every group of
+ * 4 words is transposed back into 16 consecutive bytes of each block
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void chacha_xor_sse2(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    __m128i input[16], x[16];
+    size_t b = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        input[i] = _mm_set1_epi32((int) cipher->state[i]);
+    }
+    for (; b + 4 <= blocks; b += 4, block += 4)
+    {
+        input[12] = _mm_setr_epi32((int) block, (int) (block + 1), (int) (block + 2), (int) (block + 3));
+        input[13] = _mm_setr_epi32((int) (block >> 32), (int) ((block + 1) >> 32), (int) ((block + 2) >> 32), (int) ((block + 3) >> 32));
+        memcpy(x, input, sizeof(x));
+        for (int round = 0; round < 10; round++)
+        {
+            CHACHA_QR_SSE2(x[0], x[4], x[8], x[12]);
+            CHACHA_QR_SSE2(x[1], x[5], x[9], x[13]);
+            CHACHA_QR_SSE2(x[2], x[6], x[10], x[14]);
+            CHACHA_QR_SSE2(x[3], x[7], x[11], x[15]);
+            CHACHA_QR_SSE2(x[0], x[5], x[10], x[15]);
+            CHACHA_QR_SSE2(x[1], x[6], x[11], x[12]);
+            CHACHA_QR_SSE2(x[2], x[7], x[8], x[13]);
+            CHACHA_QR_SSE2(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            x[i] = _mm_add_epi32(x[i], input[i]);
+        }
+
+        for (int a = 0; a < 16; a += 4)
+        {
+            __m128i t0 = _mm_unpacklo_epi32(x[a], x[a + 1]);
+            __m128i t1 = _mm_unpacklo_epi32(x[a + 2], x[a + 3]);
+            __m128i t2 = _mm_unpackhi_epi32(x[a], x[a + 1]);
+            __m128i t3 = _mm_unpackhi_epi32(x[a + 2], x[a + 3]);
+            __m128i words[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1), _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+
+            for (int j = 0; j < 4; j++)
+            {
+                const unsigned char *src = in + j * CHACHA_BLOCK_SIZE + a * 4;
+
+                _mm_storeu_si128((__m128i *) (out + j * CHACHA_BLOCK_SIZE + a * 4),
+                                 _mm_xor_si128(_mm_loadu_si128((const __m128i *) src), words[j]));
+            }
+        }
+        in += 4 * CHACHA_BLOCK_SIZE;
+        out += 4 * CHACHA_BLOCK_SIZE;
+    }
+
+    chacha_xor_scalar(cipher, block, out, in, blocks - b);
+}
+
+#define CHACHA_ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define CHACHA_QR_AVX2(a, b, c, d)                                                                         \
+    do                                                                                                     \
+    {                                                                                                      \
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16);                \
+        c = _mm256_add_epi32(c, d); b = CHACHA_ROTL_AVX2(_mm256_xor_si256(b, c), 12);                      \
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);                 \
+        c = _mm256_add_epi32(c, d); b = CHACHA_ROTL_AVX2(_mm256_xor_si256(b, c), 7);                       \
+    } while (0)
+
+/* XOR, AVX2 version
+ * Input: State, first block number, output, input and number of whole blocks
+ * Output: in XORed with the keystream
+ * Description: Like the SSE2 kernel with 8 lanes, the rotations by 16 and 8
+ * are byte shuffles. The transposition works within the 128 bit halves, the
+ * low one ends up with blocks 0 to 3 and the high one with blocks 4 to 7, a
+ * cross lane permute then joins 32 consecutive bytes of a block
+ * Return value: None
+ */
+__attribute__((target("avx2")))
+void chacha_xor_avx2(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    __m256i input[16], x[16], words[4][4];
+    uint32_t low[8], high[8];
+    size_t b = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        input[i] = _mm256_set1_epi32((int) cipher->state[i]);
+    }
+    for (; b + 8 <= blocks; b += 8, block += 8)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            low[j] = (uint32_t) (block + j);
+            high[j] = (uint32_t) ((block + j) >> 32);
+        }
+        input[12] = _mm256_loadu_si256((const __m256i *) low);
+        input[13] = _mm256_loadu_si256((const __m256i *) high);
+        memcpy(x, input, sizeof(x));
+        for (int round = 0; round < 10; round++)
+        {
+            CHACHA_QR_AVX2(x[0], x[4], x[8], x[12]);
+            CHACHA_QR_AVX2(x[1], x[5], x[9], x[13]);
+            CHACHA_QR_AVX2(x[2], x[6], x[10], x[14]);
+            CHACHA_QR_AVX2(x[3], x[7], x[11], x[15]);
+            CHACHA_QR_AVX2(x[0], x[5], x[10], x[15]);
+            CHACHA_QR_AVX2(x[1], x[6], x[11], x[12]);
+            CHACHA_QR_AVX2(x[2], x[7], x[8], x[13]);
+            CHACHA_QR_AVX2(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            x[i] = _mm256_add_epi32(x[i], input[i]);
+        }
+
+        // words[g][j]: words 4g to 4g + 3 of block j in the low half, of block j + 4 in the high half
+        for (int g = 0; g < 4; g++)
+        {
+            __m256i t0 = _mm256_unpacklo_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i t1 = _mm256_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m256i t2 = _mm256_unpackhi_epi32(x[4 * g], x[4 * g + 1]);
+            __m256i t3 = _mm256_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+
+            words[g][0] = _mm256_unpacklo_epi64(t0, t1);
+            words[g][1] = _mm256_unpackhi_epi64(t0, t1);
+            words[g][2] = _mm256_unpacklo_epi64(t2, t3);
+            words[g][3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            for (int g = 0; g < 4; g += 2)
+            {
+                const unsigned char *low_src = in + j * CHACHA_BLOCK_SIZE + g * 16;
+                const unsigned char *high_src = in + (j + 4) * CHACHA_BLOCK_SIZE + g * 16;
+                __m256i low_words = _mm256_permute2x128_si256(words[g][j], words[g + 1][j], 0x20);
+                __m256i high_words = _mm256_permute2x128_si256(words[g][j], words[g + 1][j], 0x31);
+
+                _mm256_storeu_si256((__m256i *) (out + j * CHACHA_BLOCK_SIZE + g * 16),
+                                    _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) low_src), low_words));
+                _mm256_storeu_si256((__m256i *) (out + (j + 4) * CHACHA_BLOCK_SIZE + g * 16),
+                                    _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) high_src), high_words));
+            }
+        }
+        in += 8 * CHACHA_BLOCK_SIZE;
+        out += 8 * CHACHA_BLOCK_SIZE;
+    }
+
+    chacha_xor_sse2(cipher, block, out, in, blocks - b);
+}
+
+#endif
+
+/* Select kernel
+ * Input: None
+ * Output: Kernel function
+ * Description: Checks the running CPU and returns the widest kernel it supports
+ * Return value: Kernel function
+ */
+ChaChaFn chacha_select(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return chacha_xor_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return chacha_xor_sse2;
+    }
+#endif
+    return chacha_xor_scalar;
+}
+
+/* Kernel name
+ * Input: Kernel function
+ * Output: Printable name of the kernel
+ * Return value: Name, "unknown" for foreign functions
+ */
+const char *chacha_name(ChaChaFn fn)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (fn == chacha_xor_avx2)
+    {
+        return "avx2";
+    }
+    if (fn == chacha_xor_sse2)
+    {
+        return "sse2";
+    }
+#endif
+    if (fn == chacha_xor_scalar)
+    {
+        return "scalar";
+    }
+    return "unknown";
+}
+
+/* XOR
+ * Input: State, stream offset of the first byte, output, input and size
+ * Output: in XORed with the keystream from offset on
+ * Description: Whole blocks go to the selected kernel, a block cut by the
+ * start or the end of the range is made on its own
+ * Return value: None
+ */
+void chacha_xor(const ChaCha *cipher, uint64_t offset, unsigned char *out, const unsigned char *in, size_t size)
+{
+    unsigned char stream[CHACHA_BLOCK_SIZE];
+    uint64_t block = offset / CHACHA_BLOCK_SIZE;
+    size_t skip = offset % CHACHA_BLOCK_SIZE;
+    size_t piece, blocks;
+
+    if (skip > 0 && size > 0)
+    {
+        chacha_block(cipher, block++, stream);
+        piece = CHACHA_BLOCK_SIZE - skip < size ? CHACHA_BLOCK_SIZE - skip : size;
+        for (size_t i = 0; i < piece; i++)
+        {
+            out[i] = in[i] ^ stream[skip + i];
+        }
+        in += piece;
+        out += piece;
+        size -= piece;
+    }
+
+    blocks = size / CHACHA_BLOCK_SIZE;
+    if (blocks > 0)
+    {
+        chacha_select()(cipher, block, out, in, blocks);
+        block += blocks;
+        in += blocks * CHACHA_BLOCK_SIZE;
+        out += blocks * CHACHA_BLOCK_SIZE;
+        size -= blocks * CHACHA_BLOCK_SIZE;
+    }
+
+    if (size > 0)
+    {
+        chacha_block(cipher, block, stream);
+        for (size_t i = 0; i < size; i++)
+        {
+            out[i] = in[i] ^ stream[i];
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ChaCha20 stream cipher, the original variant with a 64 bit block counter
+ * and a 64 bit nonce, so a stream runs for 2^70 bytes. The keystream byte at
+ * offset n comes from block n / 64, any part of a stream can be produced on
+ * its own. Encrypting and decrypting are the same XOR.
+ */
+typedef struct _ChaCha
+{
+    uint32_t state[16];     /* constants, key, counter (unused, 0) and nonce */
+} ChaCha;
+
+/* Block size of the keystream */
+#define CHACHA_BLOCK_SIZE 64
+
+/* Key and nonce sizes in bytes */
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_NONCE_SIZE 8
+
+/* XOR blocks whole 64 byte blocks of in with the keystream from block on into out, in may be out */
+typedef void (*ChaChaFn)(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks);
+
+/* Set up the state for a key and a nonce */
+void chacha_init(ChaCha *cipher, const unsigned char *key, const unsigned char *nonce);
+
+/* Portable kernel, one block at a time */
+void chacha_xor_scalar(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks);
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 4 blocks per iteration, one per 32 bit lane */
+void chacha_xor_sse2(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks);
+
+/* 8 blocks per iteration, one per 32 bit lane */
+void chacha_xor_avx2(const ChaCha *cipher, uint64_t block, unsigned char *out, const unsigned char *in, size_t blocks);
+#endif
+
+/* Pick the fastest kernel the running CPU supports */
+ChaChaFn chacha_select(void);
+
+/* Name of a kernel returned by chacha_select */
+const char *chacha_name(ChaChaFn fn);
+
+/* XOR size bytes of in with the keystream from stream offset offset on into out with the selected kernel, in may be out */
+void chacha_xor(const ChaCha *cipher, uint64_t offset, unsigned char *out, const unsigned char *in, size_t size);
+
+#endif
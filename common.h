@@ -4,4 +4,91 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/* Image bytes holding the longest size field (64 bits), one bit per byte */
+#define SIZE_FIELD_BUF_SIZE 64
+
+/* Image bytes moved per stdio call for the short header fields */
+#define MAX_FIELD_BUF_SIZE 64
+
+/*
+ * The 32 bit extension size field carries format flags above the size itself.
+ * Images encoded without options have all flags clear, exactly like the images
+ * made before the flags existed.
+ */
+#define EXTN_SIZE_MASK 0xFFu
+#define FLAG_LSB_BITS_SHIFT 8
+#define FLAG_LSB_BITS_MASK (3u << FLAG_LSB_BITS_SHIFT)     /* log2 of the data bits per image byte */
+#define FLAG_ROW_LAYOUT (1u << 10)                          /* rows start at bfOffBits, padding skipped */
+#define FLAG_SIZE64 (1u << 11)                              /* data size field has 64 bits instead of 32 */
+#define FLAG_COMPRESSED (1u << 12)                          /* data is an lz block stream, a 64 bit raw size field follows the size */
+#define FLAG_CHECKSUM (1u << 13)                            /* data framed in chunks with a CRC32C each, header CRC32C behind the sizes */
+#define FLAG_ENCRYPTED (1u << 14)                           /* data XORed with a ChaCha20 keystream, salt and key check behind the sizes */
+#define FLAG_SHARDED (1u << 15)                             /* data is one slice of a secret spread over several images, shard fields behind the key */
+#define FLAG_SCATTERED (1u << 16)                           /* data pixel bytes shuffled by the key of encrypted data, see scatter.h */
+#define KNOWN_FLAGS (FLAG_LSB_BITS_MASK | FLAG_ROW_LAYOUT | FLAG_SIZE64 | FLAG_COMPRESSED | FLAG_CHECKSUM | FLAG_ENCRYPTED | FLAG_SHARDED | FLAG_SCATTERED)
+
+/* Data bits per image byte (1, 2 or 4) to flags and back */
+#define LSB_BITS_TO_FLAGS(bits) ((uint) ((bits) == 4 ? 2 : (bits) == 2 ? 1 : 0) << FLAG_LSB_BITS_SHIFT)
+#define FLAGS_TO_LSB_BITS(flags) (1u << (((flags) & FLAG_LSB_BITS_MASK) >> FLAG_LSB_BITS_SHIFT))
+
+/* Data sizes above 32 bits get the 64 bit size field, bytes of the field for the given flags */
+#define SIZE_TO_FLAGS(size) ((unsigned long long) (size) > 0xFFFFFFFFull ? FLAG_SIZE64 : 0u)
+#define SIZE_FIELD_BYTES(flags) ((flags) & FLAG_SIZE64 ? 8u : 4u)
+
+/* Bytes of the raw size field of compressed data */
+#define RAW_SIZE_FIELD_BYTES 8u
+
+/*
+ * Checksummed data: every CHUNK_SIZE bytes of data, and the shorter last
+ * ones, are followed by a trailer ending in a CRC32C, 32 bits MSB first.
+ * For compressed data the trailer starts with the offset in the chunk of the
+ * first lz block starting in it (NO_BLOCK for none) and the index of that
+ * block, 32 and 64 bits, so decoding picks up again behind a corrupt chunk.
+ * The CRC32C covers the chunk and the rest of its trailer. The data size field
+ * counts the data only, FRAMED_SIZE is what the image holds
+ */
+#define CHUNK_SIZE (64 * 1024)
+#define CRC_FIELD_BYTES 4u
+#define BLOCK_OFFSET_FIELD_BYTES 4u
+#define BLOCK_INDEX_FIELD_BYTES 8u
+#define NO_BLOCK 0xFFFFFFFFu
+#define TRAILER_BYTES(flags) ((flags) & FLAG_COMPRESSED ? BLOCK_OFFSET_FIELD_BYTES + BLOCK_INDEX_FIELD_BYTES + CRC_FIELD_BYTES : CRC_FIELD_BYTES)
+#define CHUNK_COUNT(size) (((size) + CHUNK_SIZE - 1) / CHUNK_SIZE)
+#define FRAMED_SIZE(size, flags) ((flags) & FLAG_CHECKSUM ? (size) + CHUNK_COUNT(size) * TRAILER_BYTES(flags) : (size))
+
+/*
+ * Encrypted data: the key is derived from a passphrase and a random salt with
+ * PBKDF2-HMAC-SHA256, the salt and a check value of the key follow the sizes.
+ * A wrong passphrase fails the check instead of decoding garbage. The data is
+ * XORed with the keystream from offset 0 on, trailers of checksummed data stay
+ * plain and their CRC32C covers the encrypted chunk
+ */
+#define SALT_FIELD_BYTES 16u
+#define KEY_CHECK_FIELD_BYTES 8u
+#define KEY_FIELD_BYTES (SALT_FIELD_BYTES + KEY_CHECK_FIELD_BYTES)
+#define KDF_ROUNDS 100000
+
+/*
+ * Sharded data: a secret too big for one image is cut into slices, one per
+ * image. The shard fields follow the key fields: 64 bit payload id shared by
+ * the shards of one secret, 32 bit shard index and count, 64 bit offset of the
+ * slice in the secret and 64 bit size of the whole secret. The data size counts
+ * the slice only. The fields are plain, so shards of encrypted data are found
+ * and put in order without the key
+ */
+#define SHARD_FIELD_BYTES (8u + 4u + 4u + 8u + 8u)
+
+/* Longest key file, its content is the passphrase */
+#define MAX_KEY_FILE_SIZE (64 * 1024)
+
+/* Longest output file name, extension included */
+#define MAX_FNAME_SIZE 4096
+
+/* File name standing for stdin or stdout */
+#define STREAM_FNAME "-"
+#define IS_STREAM_FNAME(fname) (!strcmp((fname), STREAM_FNAME))
+
+/* Progress messages, muted for quiet runs such as batch jobs */
+#define PRINT_INFO(quiet, ...) do { if (!(quiet)) printf(__VA_ARGS__); } while (0)
+
 #endif
@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Reflected CRC32C polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+/* Bytes per stream of the interleaved hardware kernel, long rounds first */
+#define CRC32C_LONG 4096
+#define CRC32C_SHORT 256
+
+/* Slicing tables, table[k][n] is the checksum of byte n followed by k zero bytes */
+static uint32_t crc32c_table[8][256];
+
+/* Multipliers moving a checksum over n zero bytes, see crc32c_shift */
+static uint32_t crc32c_long_shift[2];
+static uint32_t crc32c_short_shift[2];
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* x^n mod P
+ * Input: Power n
+ * Description: Reflected, bit 31 of the result holds x^0. Every step is one
+ * multiplication by x, reduced by P when x^32 comes up
+ * Return value: x^n mod P
+ */
+static uint32_t crc32c_power(size_t n)
+{
+    uint32_t value = 0x80000000u;
+
+    while (n-- > 0)
+    {
+        value = value & 1 ? value >> 1 ^ CRC32C_POLY : value >> 1;
+    }
+    return value;
+}
+
+/* Build tables
+ * Input: None
+ * Output: Slicing tables and the multipliers of the hardware kernel
+ * Description: Runs once, whichever kernel is called first
+ * Return value: None
+ */
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 1 ? crc >> 1 ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (int k = 1; k < 8; k++)
+        {
+            crc32c_table[k][n] = crc32c_table[k - 1][n] >> 8 ^ crc32c_table[0][crc32c_table[k - 1][n] & 0xFF];
+        }
+    }
+
+    // A checksum moves over n bytes when multiplied by x^(8n - 33), see crc32c_shift
+    crc32c_long_shift[0] = crc32c_power(8 * CRC32C_LONG - 33);
+    crc32c_long_shift[1] = crc32c_power(16 * CRC32C_LONG - 33);
+    crc32c_short_shift[0] = crc32c_power(8 * CRC32C_SHORT - 33);
+    crc32c_short_shift[1] = crc32c_power(16 * CRC32C_SHORT - 33);
+}
+
+/* Checksum, scalar version
+ * Input: Checksum of the bytes in front (0 to start), data and its size
+ * Output: Checksum of everything up to the end of data
+ * Description: Slicing by 8, every step folds 8 bytes with 8 table lookups.
+ * Bytes are read one by one so the byte order of the CPU doesn't matter
+ * Return value: Checksum
+ */
+uint32_t crc32c_scalar(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint32_t low, high;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        low = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+        high = (uint32_t) p[4] | (uint32_t) p[5] << 8 | (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+        crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][low >> 8 & 0xFF] ^ crc32c_table[5][low >> 16 & 0xFF] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xFF] ^ crc32c_table[2][high >> 8 & 0xFF] ^ crc32c_table[1][high >> 16 & 0xFF] ^ crc32c_table[0][high >> 24];
+    }
+    while (size-- > 0)
+    {
+        crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+
+/* Shift checksum
+ * Input: Checksum register and the multiplier x^(8n - 33) mod P
+ * Description: The carry-less product of two reflected 32 bit values is the
+ * product times x as a 64 bit reflected value, and crc32 of 64 bits with a zero
+ * register multiplies by x^32 and reduces. Together that is crc * x^(8n) mod P,
+ * the register after n more zero bytes
+ * Return value: Shifted register
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_shift(uint32_t crc, uint32_t multiplier)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int) crc), _mm_cvtsi32_si128((int) multiplier), 0);
+
+    return _mm_crc32_u64(0, (uint64_t) _mm_cvtsi128_si64(product));
+}
+
+/* Three streams
+ * Input: Checksum register, data of at least 3 * length bytes, stream length
+ * and its multipliers
+ * Description: The crc32 instruction has a latency of 3 cycles and a
+ * throughput of 1, so three independent streams keep it busy. The first two
+ * registers are then shifted over the streams behind them and merged
+ * Return value: Register after 3 * length bytes
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_streams(uint32_t crc, const unsigned char *p, size_t length, const uint32_t *shift)
+{
+    uint64_t a = crc, b = 0, c = 0;
+    uint64_t words[3];
+
+    for (size_t i = 0; i < length; i += 8)
+    {
+        memcpy(&words[0], p + i, 8);
+        memcpy(&words[1], p + length + i, 8);
+        memcpy(&words[2], p + 2 * length + i, 8);
+        a = _mm_crc32_u64(a, words[0]);
+        b = _mm_crc32_u64(b, words[1]);
+        c = _mm_crc32_u64(c, words[2]);
+    }
+    return crc32c_shift(a, shift[1]) ^ crc32c_shift(b, shift[0]) ^ (uint32_t) c;
+}
+
+/* Checksum, SSE4.2 version
+ * Input: Checksum of the bytes in front (0 to start), data and its size
+ * Output: Checksum of everything up to the end of data
+ * Description: Long rounds of 3 * 4 KiB, then short ones of 3 * 256 bytes,
+ * then single streams of 8 and 1 bytes for the tail
+ * Return value: Checksum
+ */
+__attribute__((target("sse4.2,pclmul")))
+uint32_t crc32c_sse42(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t word;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+    for (; size >= 3 * CRC32C_LONG; size -= 3 * CRC32C_LONG, p += 3 * CRC32C_LONG)
+    {
+        crc = crc32c_streams(crc, p, CRC32C_LONG, crc32c_long_shift);
+    }
+    for (; size >= 3 * CRC32C_SHORT; size -= 3 * CRC32C_SHORT, p += 3 * CRC32C_SHORT)
+    {
+        crc = crc32c_streams(crc, p, CRC32C_SHORT, crc32c_short_shift);
+    }
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    while (size-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return ~crc;
+}
+
+#endif
+
+/* Select kernel
+ * Input: None
+ * Output: Kernel function
+ * Description: The hardware kernel needs both the crc32 instruction and
+ * carry-less multiplication
+ * Return value: Kernel function
+ */
+Crc32cFn crc32c_select(void)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+    {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_scalar;
+}
+
+/* Kernel name
+ * Input: Kernel function
+ * Output: Printable name of the kernel
+ * Return value: Name, "unknown" for foreign functions
+ */
+const char *crc32c_name(Crc32cFn fn)
+{
+#if defined(__x86_64__)
+    if (fn == crc32c_sse42)
+    {
+        return "sse42";
+    }
+#endif
+    if (fn == crc32c_scalar)
+    {
+        return "scalar";
+    }
+    return "unknown";
+}
+
+/* Checksum
+ * Input: Checksum of the bytes in front (0 to start), data and its size
+ * Output: Checksum of everything up to the end of data
+ * Description: Runs the kernel selected for this CPU
+ * Return value: Checksum
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size)
+{
+    return crc32c_select()(crc, data, size);
+}
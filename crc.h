@@ -0,0 +1,31 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli), reflected polynomial 0x82F63B78, the checksum of
+ * iSCSI and ext4. crc is the value returned for the bytes in front, 0 to
+ * start, so crc32c(crc32c(0, a), b) is the checksum of a followed by b.
+ */
+typedef uint32_t (*Crc32cFn)(uint32_t crc, const void *data, size_t size);
+
+/* Portable kernel, 8 bytes per step with 8 lookup tables */
+uint32_t crc32c_scalar(uint32_t crc, const void *data, size_t size);
+
+#if defined(__x86_64__)
+/* crc32 instruction on 3 interleaved streams, merged with carry-less multiplies */
+uint32_t crc32c_sse42(uint32_t crc, const void *data, size_t size);
+#endif
+
+/* Pick the fastest kernel the running CPU supports */
+Crc32cFn crc32c_select(void);
+
+/* Name of a kernel returned by crc32c_select */
+const char *crc32c_name(Crc32cFn fn);
+
+/* Checksum with the selected kernel */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+#endif
@@ -1,6 +1,21 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "decode.h"
+#include "bmp.h"
+#include "chacha.h"
+#include "crc.h"
+#include "lsb.h"
+#include "map.h"
+#include "stego.h"
+#include "scatter.h"
+#include "uring.h"
 #include "types.h"
 #include "common.h"
 
@@ -17,35 +32,41 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     // Check if the source image  is provided
     if (argv[2] == NULL)
     {
-        printf("ERROR: Source image is not provided\n");
+        fprintf(stderr, "ERROR: Source image is not provided\n");
         return d_failure;
     }
 
     
     char *str;
     
-    // Do error handling for source image
-    if ((str = strstr(argv[2], ".bmp")) == NULL)
+    // Do error handling for source image, - reads it from stdin
+    if (!IS_STREAM_FNAME(argv[2]) && (str = strstr(argv[2], ".bmp")) == NULL)
     {
-        printf("ERROR: Unsupported format of Source image\n");
-        printf("Usage: ./a.out -d <.bmp file> [output file]\n");
+        fprintf(stderr, "ERROR: Unsupported format of Source image\n");
+        fprintf(stderr, "Usage: ./a.out -d <.bmp file> [output file]\n");
         return d_failure;
     }
 
     // Source image name
     decInfo->src_image_fname = argv[2];
+
+    // The output goes to stdout, keep the INFO messages out of it
+    if (argv[3] != NULL && IS_STREAM_FNAME(argv[3]))
+    {
+        decInfo->quiet = 1;
+    }
     
-    printf("INFO: ## Decoding Procedure Started ##\n");
+    PRINT_INFO(decInfo->quiet, "INFO: ## Decoding Procedure Started ##\n");
 
     // do error handling for file openings
     if (Open_files_for_decoding(decInfo, argv) == e_failure)
     {
-        printf("ERROR: Open_files_for_decoding function is failed\n");
+        fprintf(stderr, "ERROR: Open_files_for_decoding function is failed\n");
         return 1;
     }
     else
     {
-        printf("INFO: Done. Opened all required files\n");
+        PRINT_INFO(decInfo->quiet, "INFO: Done. Opened all required files\n");
     }
     
     return d_success;
@@ -59,44 +80,192 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
  */
 Status Open_files_for_decoding(DecodeInfo *decInfo, char *argv[])
 {
-    printf("INFO: Opening required files\n");
+    PRINT_INFO(decInfo->quiet, "INFO: Opening required files\n");
+    stats_start(&decInfo->stats);
+    stats_begin(&decInfo->stats, e_phase_setup);
     /* Open source image */
-    decInfo->fptr_src_image = fopen(decInfo->src_image_fname, "r");
+    decInfo->fptr_src_image = IS_STREAM_FNAME(decInfo->src_image_fname) ? stdin : fopen(decInfo->src_image_fname, "r");
 
     // Do error handling 
     if (decInfo->fptr_src_image == NULL)
     {
         perror("fopen");
-    	printf("ERROR: Unable to open file %s\n", decInfo->src_image_fname);
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->src_image_fname);
         return d_failure;
     }
     else
     {
-        printf("INFO: Opened %s\n", decInfo->src_image_fname);
+        PRINT_INFO(decInfo->quiet, "INFO: Opened %s\n", decInfo->src_image_fname);
+    }
+
+    // Use the zero-copy engine whenever the source image can be mapped, unless the io_uring engine is asked for
+    if (decInfo->uring == NULL && map_src_image_for_decoding(decInfo) == d_failure)
+    {
+        PRINT_INFO(decInfo->quiet, "INFO: %s can't be mapped, using stdio\n", decInfo->src_image_fname);
     }
 
-    // Decoding magic string
-    fseek(decInfo->fptr_src_image, 54, SEEK_SET);
+    // Decoding magic string, from the first row on
+    stats_begin(&decInfo->stats, e_phase_header);
+    if (read_bmp_header_for_decoding(decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    if (decInfo->uring != NULL && start_uring_for_decoding(decInfo) == d_failure)
+    {
+        PRINT_INFO(decInfo->quiet, "INFO: %s can't go through io_uring, using stdio\n", decInfo->src_image_fname);
+    }
     // Do error handling for magic string
+    stats_begin(&decInfo->stats, e_phase_magic);
     if (decode_magic_string(strlen(MAGIC_STRING), decInfo) == d_failure || strcmp(decInfo->decoded_magic_string, MAGIC_STRING))
     {
-        printf("ERROR: This is not an encrypted file\n");
+        fprintf(stderr, "ERROR: This is not an encrypted file\n");
         return d_failure;
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(decInfo->quiet, "INFO: Done\n");
     }
 
     /* Decode output file extension */
     /* Do error hanlding for Output File Extension */
+    stats_begin(&decInfo->stats, e_phase_extn);
     if(decode_output_fextn(decInfo) == d_failure)
     {
         return d_failure;
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(decInfo->quiet, "INFO: Done\n");
+    }
+
+    // Get the size of data, a corrupt header is rejected before the output file exists
+    PRINT_INFO(decInfo->quiet, "INFO: Decoding File Size\n");
+    stats_begin(&decInfo->stats, e_phase_size);
+    if (decInfo->src_image_map != NULL)
+    {
+        decInfo->size_secret_data = get_size_from_map(SIZE_FIELD_BYTES(decInfo->format_flags), decInfo);
+    }
+    else
+    {
+        decInfo->size_secret_data = get_size_from_image(SIZE_FIELD_BYTES(decInfo->format_flags), decInfo);
+    }
+    if(decInfo->size_secret_data == 0)
+    {
+        PRINT_INFO(decInfo->quiet, "INFO: No Encoded data found\n");
+        return d_failure;
+    }
+
+    // Compressed data is followed by its size before compression
+    decInfo->size_raw_data = decInfo->size_secret_data;
+    if (decInfo->format_flags & FLAG_COMPRESSED)
+    {
+        decInfo->size_raw_data = decInfo->src_image_map != NULL ? get_size_from_map(RAW_SIZE_FIELD_BYTES, decInfo)
+                                                                : get_size_from_image(RAW_SIZE_FIELD_BYTES, decInfo);
+    }
+    // Encrypted data is followed by the salt and check of its key
+    if (decInfo->format_flags & FLAG_ENCRYPTED)
+    {
+        char key_fields[KEY_FIELD_BYTES + 1];
+
+        if ((decInfo->src_image_map != NULL ? decode_data_from_map(KEY_FIELD_BYTES, key_fields, decInfo)
+                                            : decode_data_from_image(KEY_FIELD_BYTES, key_fields, decInfo)) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        memcpy(decInfo->key_fields, key_fields, KEY_FIELD_BYTES);
+    }
+    // A shard is followed by its shard fields, the slice has to lie inside the secret
+    memset(&decInfo->shard, 0, sizeof(decInfo->shard));
+    if (decInfo->format_flags & FLAG_SHARDED)
+    {
+        char shard_fields[SHARD_FIELD_BYTES + 1];
+
+        if ((decInfo->src_image_map != NULL ? decode_data_from_map(SHARD_FIELD_BYTES, shard_fields, decInfo)
+                                            : decode_data_from_image(SHARD_FIELD_BYTES, shard_fields, decInfo)) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        stego_get_shard((const unsigned char *) shard_fields, &decInfo->shard);
+        if (decInfo->shard.count == 0 || decInfo->shard.index >= decInfo->shard.count || decInfo->shard.offset > decInfo->shard.total ||
+            decInfo->size_secret_data > decInfo->shard.total - decInfo->shard.offset)
+        {
+            fprintf(stderr, "ERROR: Header of %s is corrupt\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+    }
+    if ((decInfo->format_flags & FLAG_CHECKSUM) && check_header_crc(decInfo) == d_failure)
+    {
+        fprintf(stderr, "ERROR: Header of %s is corrupt\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    if (check_data_size(decInfo) == d_failure)
+    {
+        fprintf(stderr, "ERROR: %s can't hold %zu bytes of data, it is corrupt\n", decInfo->src_image_fname, decInfo->size_secret_data);
+        return d_failure;
+    }
+    else
+    {
+        PRINT_INFO(decInfo->quiet, "INFO: Done\n");
+    }
+    if (unlock_data_key(decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    decInfo->data_pos = decInfo->pixel_pos;
+    if ((decInfo->format_flags & FLAG_SCATTERED) && start_scatter_for_decoding(decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    decInfo->cipher_offset = 0;
+    decInfo->chunk_first = 0;
+    decInfo->chunk_count = 0;
+    decInfo->data_offset = 0;
+    decInfo->corrupt_chunks = 0;
+
+    // A shard is written into the reassembled secret, which the caller opened
+    if (decInfo->format_flags & FLAG_SHARDED)
+    {
+        if (!decInfo->reassemble)
+        {
+            fprintf(stderr, "ERROR: %s holds shard %u of %u, put the shards together with -R\n", decInfo->src_image_fname,
+                    decInfo->shard.index + 1, decInfo->shard.count);
+            return d_failure;
+        }
+        if (decInfo->format_flags & FLAG_COMPRESSED)
+        {
+            fprintf(stderr, "ERROR: Shard in %s is compressed, its slice can't be placed\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        return d_success;
+    }
+    if (decInfo->reassemble)
+    {
+        fprintf(stderr, "ERROR: %s holds no shard\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+
+    // The entries of an archive are opened one by one, into the output directory
+    if (decInfo->archive)
+    {
+        if (decInfo->format_flags & FLAG_COMPRESSED)
+        {
+            fprintf(stderr, "ERROR: Archive in %s is compressed, its entries can't be found\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        decInfo->output_fname = argv[3] != NULL ? argv[3] : ".";
+        if (IS_STREAM_FNAME(decInfo->output_fname) && decInfo->archive_entry == NULL && !decInfo->list_archive)
+        {
+            fprintf(stderr, "ERROR: An archive is extracted into a directory, or give the entry to write with -x\n");
+            return d_failure;
+        }
+        return d_success;
+    }
+    if (decInfo->list_archive || decInfo->archive_entry != NULL)
+    {
+        fprintf(stderr, "ERROR: %s holds no archive\n", decInfo->src_image_fname);
+        return d_failure;
     }
 
     // Open Output file
@@ -116,86 +285,327 @@ Status Open_files_for_decoding(DecodeInfo *decInfo, char *argv[])
         }
         else
         {
-            puts("ERROR: Invalid format for decoded file\n");
+            fprintf(stderr, "ERROR: Invalid format for decoded file\n");
             return d_failure;
         }
-        printf("INFO: Output file not mentioned. Creating %s as default\n", decInfo->output_fname);
+        PRINT_INFO(decInfo->quiet, "INFO: Output file not mentioned. Creating %s as default\n", decInfo->output_fname);
+    }
+    else if (IS_STREAM_FNAME(argv[3]))
+    {
+        decInfo->output_fname = argv[3];
     }
     else
     {
-        char *str;
-        if((str = strchr(argv[3], '.')) == NULL)
-        {
-            strcat(argv[3], decInfo->output_fextn);
-            decInfo->output_fname = argv[3];
-        }
-        else
+        // The name gets the decoded extension in place of its own, argv is left as it is
+        char *str = strchr(strrchr(argv[3], '/') != NULL ? strrchr(argv[3], '/') : argv[3], '.');
+        if (snprintf(decInfo->output_fname_buf, MAX_FNAME_SIZE, "%.*s%s", str == NULL ? (int) strlen(argv[3]) : (int) (str - argv[3]),
+                     argv[3], decInfo->output_fextn) >= MAX_FNAME_SIZE)
         {
-            strcpy(str, decInfo->output_fextn);
-            decInfo->output_fname = argv[3];
+            fprintf(stderr, "ERROR: Output file name is too long\n");
+            return d_failure;
         }
+        decInfo->output_fname = decInfo->output_fname_buf;
     }
 
-    // Open output file
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");
+    // Open output file (read/write so that it can be memory mapped)
+    stats_begin(&decInfo->stats, e_phase_setup);
+    decInfo->fptr_output = IS_STREAM_FNAME(decInfo->output_fname) ? stdout : fopen(decInfo->output_fname, "w+");
 
     // Do error handling for output file
     if (decInfo->fptr_output == NULL)
     {
         perror("fopen");
-    	printf("ERROR: Unable to open file %s\n", decInfo->output_fname);
+    	fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->output_fname);
         return d_failure;
     }
     else
     {
-        printf("INFO: Opened %s\n", decInfo->output_fname);
+        PRINT_INFO(decInfo->quiet, "INFO: Opened %s\n", decInfo->output_fname);
     }
 
     // All files opened successfully
     return d_success;
 }
 
-/* Perform Decoding
+/* Read bmp header for decoding
  * Input: Decoding data
- * Output: Decoded Output file
- * Description: Decode the data from source image and stores in output file
- * Return value: d_failure, d_success
+ * Output: Row layout of the source image
+ * Description: The stdio path reads over the header and whatever lies in front
+ * of the first row instead of seeking, so the source image may be a pipe
+ * Return value: d_success, d_failure for a truncated or unsupported image
  */
-Status do_decoding(DecodeInfo *decInfo)
+Status read_bmp_header_for_decoding(DecodeInfo *decInfo)
+{
+    const unsigned char *header = (const unsigned char *) decInfo->src_image_map;
+    struct stat st;
+    size_t remaining, chunk;
+
+    decInfo->image_size = decInfo->src_image_map != NULL ? decInfo->image_map_size : 0;
+    if (header == NULL)
+    {
+        if (fread(decInfo->image_data, sizeof(char), BMP_HEADER_SIZE, decInfo->fptr_src_image) != BMP_HEADER_SIZE)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        header = (const unsigned char *) decInfo->image_data;
+        if (fstat(fileno(decInfo->fptr_src_image), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            decInfo->image_size = st.st_size;
+        }
+    }
+    if (bmp_parse_header(header, BMP_HEADER_SIZE, &decInfo->bmp) == d_failure)
+    {
+        fprintf(stderr, "ERROR: %s is not an uncompressed 24 or 32 bit bmp image\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    if (decInfo->image_size > 0)
+    {
+        bmp_clip_capacity(&decInfo->bmp, decInfo->image_size);
+    }
+    decInfo->pixel_pos = 0;
+
+    for (remaining = decInfo->src_image_map == NULL ? decInfo->bmp.pixel_offset - BMP_HEADER_SIZE : 0; remaining > 0; remaining -= chunk)
+    {
+        chunk = remaining < MAX_ENC_IMAGE_BUF_SIZE ? remaining : MAX_ENC_IMAGE_BUF_SIZE;
+        if (fread(decInfo->image_data, sizeof(char), chunk, decInfo->fptr_src_image) != chunk)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+    }
+
+    return d_success;
+}
+
+/* Map source image for decoding
+ * Input: Decoding data
+ * Output: Read only view of the source image
+ * Description: Maps the source image so that the LSBs are extracted straight from
+ * the mapped pages. Non regular files keep using the stdio path.
+ * Return value: d_success, d_failure if the image can't be mapped
+ */
+Status map_src_image_for_decoding(DecodeInfo *decInfo)
 {
-    // Get the size of data
-    printf("INFO: Decoding %s File Size\n", decInfo->output_fname);
-    if((decInfo->size_secret_data = get_size_from_image(decInfo->fptr_src_image)) == 0)
+    struct stat st;
+    int fd = fileno(decInfo->fptr_src_image);
+
+    decInfo->src_image_map = NULL;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < 54)
     {
-        printf("INFO: No Encoded data found\n");
         return d_failure;
     }
-    else
+
+    decInfo->image_map_size = st.st_size;
+    decInfo->src_image_map = mmap(NULL, decInfo->image_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (decInfo->src_image_map == MAP_FAILED)
+    {
+        decInfo->src_image_map = NULL;
+        return d_failure;
+    }
+    // Walked front to back exactly once, window by window (see map.h)
+    madvise(decInfo->src_image_map, decInfo->image_map_size, MADV_SEQUENTIAL);
+
+    return d_success;
+}
+
+/* Start uring for decoding
+ * Input: Decoding data, the bmp header read
+ * Output: Source image stream on the ring, reading ahead from the first row
+ * to the end of the file on all slots
+ * Description: A pipe stays on stdio
+ * Return value: d_success, d_failure when the image can't go through the ring
+ */
+Status start_uring_for_decoding(DecodeInfo *decInfo)
+{
+    struct stat st;
+    off_t offset;
+
+    if (fstat(fileno(decInfo->fptr_src_image), &st) == -1 || !S_ISREG(st.st_mode) || (offset = ftello(decInfo->fptr_src_image)) == -1)
+    {
+        return d_failure;
+    }
+    uring_reset(decInfo->uring);
+    stats_watch_ring(&decInfo->stats, &decInfo->uring->bytes_read, &decInfo->uring->bytes_written);
+    if (uring_open_stream(&decInfo->src_stream, decInfo->uring, fileno(decInfo->fptr_src_image), 0, offset, st.st_size, URING_SLOTS) == d_failure)
+    {
+        return d_failure;
+    }
+    decInfo->uring_active = 1;
+
+    return d_success;
+}
+
+/* Start scatter for decoding
+ * Input: Decoding data, the header read and the key unlocked
+ * Output: Data behind the header read through the tiles of the key
+ * Description: The tiles are read with pread in data order, which is no
+ * longer the file order, so the map and the io_uring stream are dropped and
+ * the stdio paths hand every block to the tiles. A pipe can't go back to a
+ * tile and is turned down
+ * Return value: d_success, d_failure for a source image that isn't a regular file
+ */
+Status start_scatter_for_decoding(DecodeInfo *decInfo)
+{
+    struct stat st;
+
+    if (fstat(fileno(decInfo->fptr_src_image), &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: Data of %s is scattered, it can only be read from a regular file\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    if (decInfo->uring_active)
+    {
+        uring_reset(decInfo->uring);
+        decInfo->uring_active = 0;
+    }
+    if (decInfo->src_image_map != NULL)
+    {
+        munmap(decInfo->src_image_map, decInfo->image_map_size);
+        decInfo->src_image_map = NULL;
+    }
+    scatter_init(&decInfo->scatter_state, decInfo->cipher, &decInfo->bmp, decInfo->data_pos, fileno(decInfo->fptr_src_image));
+    decInfo->scatter_active = 1;
+
+    return d_success;
+}
+
+/* Close files for decoding
+ * Input: Decoding data
+ * Output: No mapped views or open files left
+ * Description: Safe to call after a failure at any stage, as long as the file
+ * pointers started out NULL
+ * Return value: None
+ */
+void close_files_for_decoding(DecodeInfo *decInfo)
+{
+    // Requests still in flight use the descriptor
+    if (decInfo->uring_active)
+    {
+        uring_reset(decInfo->uring);
+        decInfo->uring_active = 0;
+    }
+    decInfo->scatter_active = 0;
+    if (decInfo->src_image_map != NULL)
+    {
+        munmap(decInfo->src_image_map, decInfo->image_map_size);
+        decInfo->src_image_map = NULL;
+    }
+    if (decInfo->fptr_src_image != NULL)
     {
-        printf("INFO: Done\n");
+        fclose(decInfo->fptr_src_image);
+        decInfo->fptr_src_image = NULL;
     }
+    if (decInfo->fptr_output != NULL)
+    {
+        fclose(decInfo->fptr_output);
+        decInfo->fptr_output = NULL;
+    }
+    free(decInfo->chunk_data);
+    free(decInfo->chunk_info);
+    free(decInfo->archive_index);
+    decInfo->chunk_data = NULL;
+    decInfo->chunk_info = NULL;
+    decInfo->archive_index = NULL;
+}
+
+/* Perform Decoding
+ * Input: Decoding data
+ * Output: Decoded Output file
+ * Description: Decode the data from source image and stores in output file
+ * Return value: d_failure, d_success
+ */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    // The size of data was decoded and checked along with the header
     // printf("Size of secret data: %u\n", decInfo->size_secret_data);
 
     // Decode and Store the secret data in output file
-    if(decode_data_to_output_file(decInfo) != d_success)
+    stats_begin(&decInfo->stats, e_phase_payload);
+    if ((decInfo->reassemble ? decode_shard_data(decInfo) : decInfo->archive ? decode_archive(decInfo) : decode_data_to_output_file(decInfo)) !=
+        d_success)
     {
-        printf("ERROR: do_decoding function failed\n");
+        fprintf(stderr, "ERROR: do_decoding function failed\n");
         return d_failure;
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(decInfo->quiet, "INFO: Done\n");
     }
 
     // Close all opened files
-    fclose(decInfo->fptr_src_image);
-    fclose(decInfo->fptr_output);
+    close_files_for_decoding(decInfo);
+    stats_report(&decInfo->stats, "decode", stderr);
     
     // Decoding done
     return d_success;
 
 }
 
+/* Check data size
+ * Input: Decoding data
+ * Output: None
+ * Description: Bounds the decoded data size by the pixel bytes left behind the
+ * header, so that a corrupt size is rejected before anything is written. A source
+ * image without a size (a pipe) is checked against the rows its header declares.
+ * The size itself is not multiplied, a corrupt 64 bit size would wrap around.
+ * Checksummed data needs room for its CRC32C fields as well
+ * Return value: d_success, d_failure if the image is too short for the data
+ */
+Status check_data_size(DecodeInfo *decInfo)
+{
+    size_t room = (decInfo->bmp.capacity - decInfo->pixel_pos) * decInfo->lsb_bits / 8;
+
+    return decInfo->size_secret_data <= room && FRAMED_SIZE(decInfo->size_secret_data, decInfo->format_flags) <= room ? d_success : d_failure;
+}
+
+/* Unlock data key
+ * Input: Decoding data
+ * Output: cipher pointing to the key of encrypted data, NULL for plain data
+ * Description: The key is derived from the passphrase and the salt read with
+ * the header, a wrong passphrase fails the key check before anything is written
+ * Return value: d_success, d_failure for a missing or wrong passphrase
+ */
+Status unlock_data_key(DecodeInfo *decInfo)
+{
+    decInfo->cipher = NULL;
+    if (!(decInfo->format_flags & FLAG_ENCRYPTED))
+    {
+        return d_success;
+    }
+    if (decInfo->passphrase == NULL)
+    {
+        fprintf(stderr, "ERROR: %s is encrypted, give the passphrase with -P or the key file with -K\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    PRINT_INFO(decInfo->quiet, "INFO: Deriving the key\n");
+    stego_make_key(&decInfo->key, decInfo->passphrase, decInfo->passphrase_size, decInfo->key_fields);
+    if (memcmp(decInfo->key.fields, decInfo->key_fields, KEY_FIELD_BYTES))
+    {
+        fprintf(stderr, "ERROR: Wrong passphrase or key file for %s\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    decInfo->cipher = &decInfo->key.cipher;
+    return d_success;
+}
+
+/* Check header CRC
+ * Input: Decoding data
+ * Output: None
+ * Description: The CRC32C covers the header fields as they were encoded, they
+ * are put back together from what was decoded
+ * Return value: d_success, d_failure if a field is corrupt or the image is too short
+ */
+Status check_header_crc(DecodeInfo *decInfo)
+{
+    unsigned char fields[STEGO_MAX_HEADER_SIZE];
+    size_t size_fields = stego_put_fields(fields, decInfo->output_fextn, decInfo->format_flags, decInfo->size_secret_data, decInfo->size_raw_data,
+                                         decInfo->key_fields, &decInfo->shard);
+    size_t crc = decInfo->src_image_map != NULL ? get_size_from_map(CRC_FIELD_BYTES, decInfo) : get_size_from_image(CRC_FIELD_BYTES, decInfo);
+
+    return crc == crc32c(0, fields, size_fields) ? d_success : d_failure;
+}
+
 /* Decode Maigc String
  * Input: Magic string length and decoding data
  * Output: Decoded magic string from source image
@@ -204,8 +614,12 @@ Status do_decoding(DecodeInfo *decInfo)
  */
 Status decode_magic_string(uint size, DecodeInfo *decInfo)
 {
-    printf("INFO: Decodeing Magic String Siganture\n");
-    if(decode_data_from_image(size, decInfo->decoded_magic_string, decInfo->fptr_src_image) == d_success)
+    PRINT_INFO(decInfo->quiet, "INFO: Decodeing Magic String Siganture\n");
+    if (decInfo->src_image_map != NULL)
+    {
+        return decode_data_from_map(size, decInfo->decoded_magic_string, decInfo);
+    }
+    if(decode_data_from_image(size, decInfo->decoded_magic_string, decInfo) == d_success)
     {
         return d_success;
     }
@@ -223,38 +637,138 @@ Status decode_magic_string(uint size, DecodeInfo *decInfo)
  */
 Status decode_output_fextn(DecodeInfo *decInfo)
 {
-    printf("INFO: Decoding output file extension\n");
-    // Get the size of extension
-    if((decInfo->size_output_fextn = get_size_from_image(decInfo->fptr_src_image)) == 0)
+    PRINT_INFO(decInfo->quiet, "INFO: Decoding output file extension\n");
+    // Get the size of extension, the format flags share the field
+    if (decInfo->src_image_map != NULL)
+    {
+        decInfo->size_output_fextn = get_size_from_map(4, decInfo);
+    }
+    else
+    {
+        decInfo->size_output_fextn = get_size_from_image(4, decInfo);
+    }
+    decInfo->format_flags = decInfo->size_output_fextn & ~EXTN_SIZE_MASK;
+    decInfo->size_output_fextn &= EXTN_SIZE_MASK;
+    if(decInfo->size_output_fextn == 0 || decInfo->size_output_fextn >= MAX_OUTPUT_FILE_EXT)
+    {
+        fprintf(stderr, "ERROR: failed to get the size of extension\n");
+        return d_failure;
+    }
+    if ((decInfo->format_flags & ~KNOWN_FLAGS) || (decInfo->format_flags & FLAG_LSB_BITS_MASK) == FLAG_LSB_BITS_MASK ||
+        (decInfo->format_flags & (FLAG_SCATTERED | FLAG_ENCRYPTED)) == FLAG_SCATTERED)
     {
-        printf("ERROR: failed to get the size of extension\n");
+        fprintf(stderr, "ERROR: Unsupported stego format flags 0x%x\n", decInfo->format_flags);
         return d_failure;
     }
+    decInfo->lsb_bits = FLAGS_TO_LSB_BITS(decInfo->format_flags);
     // printf("size of ouput extension: %d\n", decInfo->size_output_fextn);
 
+    // Images of older versions use every byte from 54 on, padding included. The fields
+    // read so far have to sit at the same place in that layout
+    if (!(decInfo->format_flags & FLAG_ROW_LAYOUT) && !bmp_is_linear(&decInfo->bmp))
+    {
+        BmpInfo linear;
+
+        bmp_linear_layout(&decInfo->bmp, &linear);
+        if (decInfo->image_size > 0)
+        {
+            bmp_clip_capacity(&linear, decInfo->image_size);
+        }
+        if (bmp_file_end(&linear, decInfo->pixel_pos) != bmp_file_end(&decInfo->bmp, decInfo->pixel_pos))
+        {
+            fprintf(stderr, "ERROR: Rows of %s are too short for the layout it was encoded in\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        decInfo->bmp = linear;
+    }
+
     // Decode extension
-    if(decode_data_from_image(decInfo->size_output_fextn, decInfo->output_fextn, decInfo->fptr_src_image) == d_success)
+    Status status;
+    if (decInfo->src_image_map != NULL)
+    {
+        status = decode_data_from_map(decInfo->size_output_fextn, decInfo->output_fextn, decInfo);
+    }
+    else
+    {
+        status = decode_data_from_image(decInfo->size_output_fextn, decInfo->output_fextn, decInfo);
+    }
+    if(status == d_success)
     {
-        if(!(strcmp(decInfo->output_fextn, ".txt") && strcmp(decInfo->output_fextn, ".c") && strcmp(decInfo->output_fextn, ".sh")))
+        decInfo->archive = !strcmp(decInfo->output_fextn, ARCHIVE_EXTN);
+    if(!(strcmp(decInfo->output_fextn, ".txt") && strcmp(decInfo->output_fextn, ".c") && strcmp(decInfo->output_fextn, ".sh")) || decInfo->archive)
         {
             // printf("Encoded Extension is: %s\n", decInfo->output_fextn);
             return d_success;
         }
         else
         {
-            printf("%s\n", decInfo->output_fextn);
-            printf("ERROR: Unsupported format of secret file\n");
+            fprintf(stderr, "%s\n", decInfo->output_fextn);
+            fprintf(stderr, "ERROR: Unsupported format of secret file\n");
             return d_failure;
         }
     }
     else
     {
-        printf("INFO: decode_data_from_image function failed\n");
+        PRINT_INFO(decInfo->quiet, "INFO: decode_data_from_image function failed\n");
         return d_failure;
     }
     
 }
 
+/* Decrypt data bytes
+ * Input: Data bytes as embedded, their number, data offset of the first and decoding data
+ * Output: Plain data bytes, left as they are when there is no key
+ * Return value: None
+ */
+static void decrypt_data_bytes(char *data, size_t size, size_t offset, DecodeInfo *decInfo)
+{
+    if (decInfo->cipher != NULL)
+    {
+        chacha_xor(decInfo->cipher, offset, (unsigned char *) data, (const unsigned char *) data, size);
+    }
+}
+
+/* Decode image block
+ * Input: Array to store the decoded block and its size, bits per pixel byte,
+ * image buffer able to hold BMP_MAX_SPAN(size * 8 / bits) bytes and decoding data
+ * Output: Decoded block, pixel_pos advanced
+ * Description: decode_block_from_image on the io_uring stream when it runs,
+ * the encoded bytes come from the slots read ahead. Scattered data comes from
+ * its tiles
+ * Return value: d_success, d_failure on short read
+ */
+static Status decode_image_block(char *data, size_t size, uint bits, char *image_buffer, DecodeInfo *decInfo)
+{
+    size_t pixels = size * 8 / bits;
+    size_t image_size;
+
+    if (decInfo->scatter_active)
+    {
+        if (scatter_read(&decInfo->scatter_state, decInfo->pixel_pos - decInfo->data_pos, (unsigned char *) data, size, bits) == d_failure)
+        {
+            return d_failure;
+        }
+        decInfo->pixel_pos += pixels;
+        return d_success;
+    }
+    if (!decInfo->uring_active)
+    {
+        return decode_block_from_image(data, size, bits, image_buffer, &decInfo->bmp, &decInfo->pixel_pos, decInfo->fptr_src_image);
+    }
+    if (decInfo->pixel_pos + pixels > decInfo->bmp.capacity)
+    {
+        return d_failure;
+    }
+    image_size = bmp_file_end(&decInfo->bmp, decInfo->pixel_pos + pixels) - bmp_file_end(&decInfo->bmp, decInfo->pixel_pos);
+    if (uring_read(&decInfo->src_stream, image_buffer, image_size) == d_failure)
+    {
+        return d_failure;
+    }
+    bmp_extract((unsigned char *) data, (const unsigned char *) image_buffer, &decInfo->bmp, decInfo->pixel_pos, size, bits, 1);
+    decInfo->pixel_pos += pixels;
+    return d_success;
+}
+
 /* Decode data to ouptut fiel
  * Input: Decoding data
  * Output: Decoded output file
@@ -263,24 +777,819 @@ Status decode_output_fextn(DecodeInfo *decInfo)
  */
 Status decode_data_to_output_file(DecodeInfo *decInfo)
 {    
-    printf("INFO: Decoding %s File Data\n", decInfo->output_fname);
-    // variable to store the decoded byte
-    char decoded_data = 0;
+    PRINT_INFO(decInfo->quiet, "INFO: Decoding %s File Data\n", decInfo->output_fname);
+    size_t remaining = decInfo->size_secret_data;
+    size_t chunk;
 
-    // Array to get encoded data from source image
-    char encoded_data[MAX_ENC_IMAGE_BUF_SIZE] = {0};
+    // Compressed data goes through the block buffers, checksummed data through the chunk buffers
+    if (decInfo->format_flags & FLAG_COMPRESSED)
+    {
+        return decode_compressed_data(decInfo);
+    }
+    if (decInfo->format_flags & FLAG_CHECKSUM)
+    {
+        return decode_checked_data(decInfo);
+    }
 
-    // Decode one byte from 8 bytes of encoded data
-    for (int i = 0; i < decInfo->size_secret_data; i++)
+    // Extract straight from the mapped source image
+    if (decInfo->src_image_map != NULL)
     {
-        decoded_data = 0;
-        fread(encoded_data, sizeof(char), MAX_ENC_IMAGE_BUF_SIZE, decInfo->fptr_src_image);
-        decode_byte_from_lsb(&decoded_data, encoded_data);
-        fwrite(&decoded_data, sizeof(char), MAX_OUTPUT_BUF_SIZE, decInfo->fptr_output);
+        return decode_map_to_output_file(decInfo);
     }
-    
-    return d_success;
-}
+
+    // Decode a block of output bytes from 8 times as many bytes of encoded data
+    while (remaining > 0)
+    {
+        chunk = remaining < MAX_OUTPUT_BUF_SIZE ? remaining : MAX_OUTPUT_BUF_SIZE;
+        if (decode_image_block(decInfo->output_data, chunk, decInfo->lsb_bits, decInfo->image_data, decInfo) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        decrypt_data_bytes(decInfo->output_data, chunk, decInfo->size_secret_data - remaining, decInfo);
+        if (fwrite(decInfo->output_data, sizeof(char), chunk, decInfo->fptr_output) != chunk)
+        {
+            return d_failure;
+        }
+        remaining -= chunk;
+    }
+    
+    return d_success;
+}
+
+/* Decode image bytes
+ * Input: Array to store the decoded bytes, number of bytes and decoding data
+ * Output: Next bytes as embedded, from the map or through stdio
+ * Return value: d_success, d_failure if the image is too short
+ */
+static Status decode_image_bytes(char *data, size_t size, DecodeInfo *decInfo)
+{
+    size_t chunk;
+
+    if (decInfo->src_image_map != NULL)
+    {
+        return extract_bits_from_map(data, size, decInfo->lsb_bits, decInfo);
+    }
+    for (size_t done = 0; done < size; done += chunk)
+    {
+        chunk = size - done < MAX_OUTPUT_BUF_SIZE ? size - done : MAX_OUTPUT_BUF_SIZE;
+        if (decode_image_block(data + done, chunk, decInfo->lsb_bits, decInfo->image_data, decInfo) == d_failure)
+        {
+            return d_failure;
+        }
+    }
+    return d_success;
+}
+
+/* Get stego header
+ * Input: Header to fill and decoding data
+ * Output: The fields the chunk calls of the library need
+ * Return value: None
+ */
+static void get_stego_header(StegoHeader *header, DecodeInfo *decInfo)
+{
+    header->size = decInfo->size_secret_data;
+    header->format_flags = decInfo->format_flags;
+    header->lsb_bits = decInfo->lsb_bits;
+    header->data_offset = decInfo->data_pos;
+    header->bmp = decInfo->bmp;
+    header->cipher = decInfo->cipher;
+}
+
+/* Decode chunk batch
+ * Input: Decoding data
+ * Output: Next chunks of checksummed data in chunk_data, their states in chunk_info
+ * Description: The zero-copy engine takes a window of chunks at a time and has
+ * stego_extract_chunks check and decrypt them on all threads, then releases the
+ * pages. The stdio engine reads one chunk and its trailer. Every corrupt chunk is
+ * reported with the data bytes it holds, decoding goes on behind it
+ * Return value: d_success, d_failure if the image is too short or out of memory
+ */
+Status decode_chunk_batch(DecodeInfo *decInfo)
+{
+    unsigned char trailer[TRAILER_BYTES(FLAG_COMPRESSED)];
+    size_t total = CHUNK_COUNT(decInfo->size_secret_data);
+    size_t first = decInfo->chunk_first + decInfo->chunk_count;
+    size_t batch = decInfo->src_image_map != NULL ? MAP_WINDOW_DATA_SIZE(decInfo->lsb_bits) / CHUNK_SIZE : 1;
+    size_t length, start;
+
+    batch = batch > 0 ? batch : 1;
+    if (decInfo->chunk_data == NULL)
+    {
+        decInfo->chunk_data = malloc(batch * CHUNK_SIZE);
+        decInfo->chunk_info = malloc(batch * sizeof(StegoChunk));
+        if (decInfo->chunk_data == NULL || decInfo->chunk_info == NULL)
+        {
+            return d_failure;
+        }
+    }
+    if (first >= total)
+    {
+        return d_failure;
+    }
+    decInfo->chunk_first = first;
+    decInfo->chunk_count = total - first < batch ? total - first : batch;
+
+    if (decInfo->src_image_map != NULL)
+    {
+        StegoHeader header;
+
+        get_stego_header(&header, decInfo);
+        start = bmp_file_end(&decInfo->bmp, decInfo->pixel_pos);
+        stego_extract_chunks((unsigned char *) decInfo->chunk_data, decInfo->chunk_info, (const unsigned char *) decInfo->src_image_map,
+                             &header, first, decInfo->chunk_count, decInfo->num_threads > 1 ? decInfo->num_threads : 1);
+        decInfo->pixel_pos = stego_chunks_end(&header, first + decInfo->chunk_count);
+        map_release(decInfo->src_image_map, start, bmp_file_end(&decInfo->bmp, decInfo->pixel_pos));
+    }
+    else
+    {
+        length = decInfo->size_secret_data - first * CHUNK_SIZE < CHUNK_SIZE ? decInfo->size_secret_data - first * CHUNK_SIZE : CHUNK_SIZE;
+        if (decode_image_bytes(decInfo->chunk_data, length, decInfo) == d_failure ||
+            decode_image_bytes((char *) trailer, TRAILER_BYTES(decInfo->format_flags), decInfo) == d_failure)
+        {
+            return d_failure;
+        }
+        stego_check_chunk(&decInfo->chunk_info[0], (const unsigned char *) decInfo->chunk_data, length, trailer, decInfo->format_flags, first);
+        decrypt_data_bytes(decInfo->chunk_data, length, first * CHUNK_SIZE, decInfo);
+    }
+
+    for (size_t i = 0; i < decInfo->chunk_count; i++)
+    {
+        if (decInfo->chunk_info[i].corrupt)
+        {
+            start = (first + i) * CHUNK_SIZE;
+            length = decInfo->size_secret_data - start < CHUNK_SIZE ? decInfo->size_secret_data - start : CHUNK_SIZE;
+            fprintf(stderr, "ERROR: Chunk %zu of %s is corrupt, data bytes %zu to %zu\n", first + i, decInfo->src_image_fname, start, start + length - 1);
+            decInfo->corrupt_chunks++;
+        }
+    }
+    return d_success;
+}
+
+/* Decode payload bytes
+ * Input: Array to store the decoded bytes, number of bytes and decoding data
+ * Output: Next bytes of the embedded data
+ * Description: Checksummed data is handed out from the checked chunks, the next
+ * batch is read when the bytes run past the current one. data_corrupt is set
+ * when a byte comes from a corrupt chunk, callers clear it
+ * Return value: d_success, d_failure if the image is too short
+ */
+Status decode_payload_bytes(char *data, size_t size, DecodeInfo *decInfo)
+{
+    size_t end, piece, base;
+
+    if (!(decInfo->format_flags & FLAG_CHECKSUM))
+    {
+        if (decInfo->src_image_map != NULL)
+        {
+            return extract_payload_from_map(data, size, decInfo);
+        }
+        if (decode_image_bytes(data, size, decInfo) == d_failure)
+        {
+            return d_failure;
+        }
+        decrypt_data_bytes(data, size, decInfo->cipher_offset, decInfo);
+        decInfo->cipher_offset += size;
+        return d_success;
+    }
+    while (size > 0)
+    {
+        base = decInfo->chunk_first * CHUNK_SIZE;
+        end = (decInfo->chunk_first + decInfo->chunk_count) * CHUNK_SIZE;
+        end = end < decInfo->size_secret_data ? end : decInfo->size_secret_data;
+        if (decInfo->data_offset >= end)
+        {
+            if (decode_chunk_batch(decInfo) == d_failure)
+            {
+                return d_failure;
+            }
+            continue;
+        }
+
+        piece = end - decInfo->data_offset < size ? end - decInfo->data_offset : size;
+        for (size_t chunk = decInfo->data_offset / CHUNK_SIZE; chunk <= (decInfo->data_offset + piece - 1) / CHUNK_SIZE; chunk++)
+        {
+            decInfo->data_corrupt |= decInfo->chunk_info[chunk - decInfo->chunk_first].corrupt;
+        }
+        memcpy(data, decInfo->chunk_data + (decInfo->data_offset - base), piece);
+        decInfo->data_offset += piece;
+        data += piece;
+        size -= piece;
+    }
+    return d_success;
+}
+
+/* Skip image
+ * Input: Pixel byte to go to and decoding data
+ * Output: pixel_pos, and the file position of the stdio engine, on pixel byte pos
+ * Description: The mapped engine and scattered data just move on. The stdio
+ * engine seeks, a pipe can't seek so it reads the bytes in between and can only go forward
+ * Return value: d_success, d_failure if the image is too short
+ */
+static Status skip_image_bytes(size_t pos, DecodeInfo *decInfo)
+{
+    off_t move;
+    size_t chunk;
+
+    if (pos > decInfo->bmp.capacity)
+    {
+        return d_failure;
+    }
+    if (decInfo->scatter_active)
+    {
+        decInfo->pixel_pos = pos;
+        return d_success;
+    }
+    move = (off_t) bmp_file_end(&decInfo->bmp, pos) - (off_t) bmp_file_end(&decInfo->bmp, decInfo->pixel_pos);
+    if (decInfo->uring_active)
+    {
+        if (uring_seek(&decInfo->src_stream, decInfo->src_stream.offset + move) == d_failure)
+        {
+            return d_failure;
+        }
+    }
+    else if (decInfo->src_image_map == NULL)
+    {
+        if (fseeko(decInfo->fptr_src_image, move, SEEK_CUR) == -1)
+        {
+            if (errno != ESPIPE || move < 0)
+            {
+                return d_failure;
+            }
+            for (; move > 0; move -= chunk)
+            {
+                chunk = (size_t) move < MAX_ENC_IMAGE_BUF_SIZE ? (size_t) move : MAX_ENC_IMAGE_BUF_SIZE;
+                if (fread(decInfo->image_data, sizeof(char), chunk, decInfo->fptr_src_image) != chunk)
+                {
+                    return d_failure;
+                }
+            }
+        }
+    }
+    decInfo->pixel_pos = pos;
+    return d_success;
+}
+
+/* Decode seek data
+ * Input: Data byte offset and decoding data
+ * Output: The next bytes decode_payload_bytes hands out start at offset
+ * Description: The pixel byte of any data byte follows from the header: data
+ * that isn't checksummed has 8 / lsb_bits pixel bytes per byte, checksummed
+ * data goes to the start of the chunk holding the offset, which is read and
+ * checked on its own. A chunk already read is not read again. The keystream of
+ * encrypted data is positioned along, so nothing in front of offset is decoded
+ * Return value: d_success, d_failure if the image is too short or can't go back
+ */
+Status decode_seek_data(size_t offset, DecodeInfo *decInfo)
+{
+    size_t first = offset / CHUNK_SIZE;
+    StegoHeader header;
+
+    if (offset > decInfo->size_secret_data)
+    {
+        return d_failure;
+    }
+    if (!(decInfo->format_flags & FLAG_CHECKSUM))
+    {
+        decInfo->cipher_offset = offset;
+        return skip_image_bytes(decInfo->data_pos + offset * 8 / decInfo->lsb_bits, decInfo);
+    }
+
+    decInfo->data_offset = offset;
+    if (first >= decInfo->chunk_first && first < decInfo->chunk_first + decInfo->chunk_count)
+    {
+        return d_success;
+    }
+    get_stego_header(&header, decInfo);
+    decInfo->chunk_first = first;
+    decInfo->chunk_count = 0;
+    return skip_image_bytes(stego_chunks_end(&header, first), decInfo);
+}
+
+/* Decode archive index
+ * Input: Decoding data, the data being an archive
+ * Output: archive_index with archive_count entries, archive_data the bytes of the index
+ * Description: The index is read through decode_payload_bytes like any data.
+ * Data too short for the count is turned down, the count is bounded by the
+ * data size before anything is allocated, every
+ * entry has to follow the one in front of it and the entries have to end with
+ * the data, names have to be plain file names
+ * Return value: d_success, d_failure for a truncated, corrupt or damaged index
+ */
+Status decode_archive_index(DecodeInfo *decInfo)
+{
+    unsigned char field[ARCHIVE_ENTRY_FIELD_BYTES];
+    size_t count, size_name, offset = 0;
+    ArchiveEntry *entry;
+
+    decInfo->data_corrupt = 0;
+    if (decInfo->size_secret_data < ARCHIVE_COUNT_FIELD_BYTES ||
+        decode_payload_bytes((char *) field, ARCHIVE_COUNT_FIELD_BYTES, decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    count = stego_get_size(field, ARCHIVE_COUNT_FIELD_BYTES);
+    decInfo->archive_data = ARCHIVE_COUNT_FIELD_BYTES;
+    if (count == 0 || count > (decInfo->size_secret_data - ARCHIVE_COUNT_FIELD_BYTES) / (ARCHIVE_ENTRY_FIELD_BYTES + 1) ||
+        (decInfo->archive_index = malloc(count * sizeof(ArchiveEntry))) == NULL)
+    {
+        return d_failure;
+    }
+
+    for (decInfo->archive_count = 0; decInfo->archive_count < count; decInfo->archive_count++)
+    {
+        entry = &decInfo->archive_index[decInfo->archive_count];
+        if (decode_payload_bytes((char *) field, ARCHIVE_ENTRY_FIELD_BYTES, decInfo) == d_failure ||
+            (size_name = archive_get_entry(field, entry)) == 0 || decode_payload_bytes(entry->name, size_name, decInfo) == d_failure)
+        {
+            return d_failure;
+        }
+        entry->name[size_name] = '\0';
+        decInfo->archive_data += ARCHIVE_ENTRY_FIELD_BYTES + size_name;
+        if (!archive_valid_name(entry->name) || entry->offset != offset || entry->size > decInfo->size_secret_data - offset)
+        {
+            return d_failure;
+        }
+        offset += entry->size;
+    }
+
+    return !decInfo->data_corrupt && decInfo->archive_data <= decInfo->size_secret_data &&
+           offset == decInfo->size_secret_data - decInfo->archive_data ? d_success : d_failure;
+}
+
+/* Decode archive entry
+ * Input: Entry to extract and decoding data
+ * Output: The entry in the output directory, or on stdout for -
+ * Description: Goes straight to the first data byte of the entry. An entry
+ * with corrupt chunks is still written in full, data_corrupt tells it apart
+ * Return value: d_success, d_failure for a truncated image, a failed write or corrupt chunks in the entry
+ */
+static Status decode_archive_entry(const ArchiveEntry *entry, DecodeInfo *decInfo)
+{
+    char path[MAX_FNAME_SIZE];
+    FILE *fptr;
+    Status status = d_success;
+    size_t chunk;
+
+    if (IS_STREAM_FNAME(decInfo->output_fname))
+    {
+        fptr = stdout;
+    }
+    else if (snprintf(path, MAX_FNAME_SIZE, "%s/%s", decInfo->output_fname, entry->name) >= MAX_FNAME_SIZE)
+    {
+        fprintf(stderr, "ERROR: Output file name is too long\n");
+        return d_failure;
+    }
+    else if ((fptr = fopen(path, "w")) == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", path);
+        return d_failure;
+    }
+
+    decInfo->data_corrupt = 0;
+    if (decode_seek_data(decInfo->archive_data + entry->offset, decInfo) == d_failure)
+    {
+        status = d_failure;
+    }
+    for (size_t done = 0; done < entry->size && status == d_success; done += chunk)
+    {
+        chunk = entry->size - done < MAX_OUTPUT_BUF_SIZE ? entry->size - done : MAX_OUTPUT_BUF_SIZE;
+        if (decode_payload_bytes(decInfo->output_data, chunk, decInfo) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            status = d_failure;
+        }
+        else if (fwrite(decInfo->output_data, sizeof(char), chunk, fptr) != chunk)
+        {
+            status = d_failure;
+        }
+    }
+    if (fptr != stdout && fclose(fptr) != 0)
+    {
+        status = d_failure;
+    }
+
+    if (status == d_success && decInfo->data_corrupt)
+    {
+        fprintf(stderr, "ERROR: Entry %s of %s is corrupt\n", entry->name, decInfo->src_image_fname);
+        status = d_failure;
+    }
+    else if (status == d_success)
+    {
+        PRINT_INFO(decInfo->quiet, "INFO: Extracted %s, %zu bytes\n", entry->name, entry->size);
+    }
+    return status;
+}
+
+/* Decode archive
+ * Input: Decoding data, the data being an archive
+ * Output: Index listed on stdout, or the entries in the output directory
+ * Description: Only the index and the entries asked for are decoded, -x goes
+ * straight to the bits of its entry. Extracting everything walks the entries
+ * in order, so a pipe works as well
+ * Return value: d_success, d_failure for a corrupt index, an unknown entry or a failed entry
+ */
+Status decode_archive(DecodeInfo *decInfo)
+{
+    ArchiveEntry *entry = NULL;
+    Status status = d_success;
+
+    if (decode_archive_index(decInfo) == d_failure)
+    {
+        fprintf(stderr, "ERROR: Index of the archive in %s is corrupt\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+
+    if (decInfo->list_archive)
+    {
+        for (size_t i = 0; i < decInfo->archive_count; i++)
+        {
+            printf("%s\t%zu\n", decInfo->archive_index[i].name, decInfo->archive_index[i].size);
+        }
+        PRINT_INFO(decInfo->quiet, "INFO: %zu entries, %zu bytes\n", decInfo->archive_count, decInfo->size_secret_data - decInfo->archive_data);
+        return d_success;
+    }
+
+    if (decInfo->archive_entry != NULL)
+    {
+        for (size_t i = 0; i < decInfo->archive_count && entry == NULL; i++)
+        {
+            entry = !strcmp(decInfo->archive_index[i].name, decInfo->archive_entry) ? &decInfo->archive_index[i] : NULL;
+        }
+        if (entry == NULL)
+        {
+            fprintf(stderr, "ERROR: The archive in %s has no entry %s\n", decInfo->src_image_fname, decInfo->archive_entry);
+            return d_failure;
+        }
+        status = decode_archive_entry(entry, decInfo);
+        return check_corrupt_chunks(decInfo) == d_success ? status : d_failure;
+    }
+
+    if (mkdir(decInfo->output_fname, 0777) == -1 && errno != EEXIST)
+    {
+        perror("mkdir");
+        fprintf(stderr, "ERROR: Unable to create directory %s\n", decInfo->output_fname);
+        return d_failure;
+    }
+    for (size_t i = 0; i < decInfo->archive_count; i++)
+    {
+        // Like the chunks of plain data, the entries behind a corrupt one are still extracted
+        if (decode_archive_entry(&decInfo->archive_index[i], decInfo) == d_failure)
+        {
+            if (!decInfo->data_corrupt)
+            {
+                return d_failure;
+            }
+            status = d_failure;
+        }
+    }
+    PRINT_INFO(decInfo->quiet, "INFO: %zu entries extracted into %s\n", decInfo->archive_count, decInfo->output_fname);
+    return check_corrupt_chunks(decInfo) == d_success ? status : d_failure;
+}
+
+/* Decode shard data
+ * Input: Decoding data, the data being one shard
+ * Output: The slice written into the reassembled secret at its offset
+ * Description: The shards of one secret write disjoint ranges of the same
+ * file, so they run side by side with pwrite and need no lock. Checksummed
+ * data reports its corrupt chunks and still writes the others
+ * Return value: d_success, d_failure for a truncated image, a failed write or corrupt chunks
+ */
+Status decode_shard_data(DecodeInfo *decInfo)
+{
+    size_t chunk;
+
+    PRINT_INFO(decInfo->quiet, "INFO: Decoding shard %u of %u into %s\n", decInfo->shard.index + 1, decInfo->shard.count, decInfo->output_fname);
+    for (size_t done = 0; done < decInfo->size_secret_data; done += chunk)
+    {
+        chunk = decInfo->size_secret_data - done < MAX_OUTPUT_BUF_SIZE ? decInfo->size_secret_data - done : MAX_OUTPUT_BUF_SIZE;
+        if (decode_payload_bytes(decInfo->output_data, chunk, decInfo) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        if (pwrite(decInfo->shard_fd, decInfo->output_data, chunk, decInfo->shard.offset + done) != (ssize_t) chunk)
+        {
+            perror("pwrite");
+            return d_failure;
+        }
+    }
+    return check_corrupt_chunks(decInfo);
+}
+
+/* Decode checked data
+ * Input: Decoding data
+ * Output: Decoded output file
+ * Description: Writes every batch of chunks as it was read. Corrupt chunks are
+ * written as well, they are reported and the data in all others is intact
+ * Return value: d_success, d_failure for a truncated image, a failed write or corrupt chunks
+ */
+Status decode_checked_data(DecodeInfo *decInfo)
+{
+    size_t length;
+
+    for (size_t done = 0; done < decInfo->size_secret_data; done += length)
+    {
+        if (decode_chunk_batch(decInfo) == d_failure)
+        {
+            fprintf(stderr, "ERROR: %s is truncated\n", decInfo->src_image_fname);
+            return d_failure;
+        }
+        length = decInfo->chunk_count * CHUNK_SIZE < decInfo->size_secret_data - done ? decInfo->chunk_count * CHUNK_SIZE
+                                                                                       : decInfo->size_secret_data - done;
+        if (fwrite(decInfo->chunk_data, sizeof(char), length, decInfo->fptr_output) != length)
+        {
+            return d_failure;
+        }
+    }
+    return check_corrupt_chunks(decInfo);
+}
+
+/* Check corrupt chunks
+ * Input: Decoding data
+ * Output: Summary of the corrupt chunks, if any
+ * Return value: d_success, d_failure when a chunk was corrupt
+ */
+Status check_corrupt_chunks(DecodeInfo *decInfo)
+{
+    if (decInfo->corrupt_chunks == 0)
+    {
+        return d_success;
+    }
+    fprintf(stderr, "ERROR: %zu of %zu chunks of %s are corrupt, the data of the others is intact in %s\n", decInfo->corrupt_chunks,
+            CHUNK_COUNT(decInfo->size_secret_data), decInfo->src_image_fname,
+            IS_STREAM_FNAME(decInfo->output_fname) ? "stdout" : decInfo->output_fname);
+    return d_failure;
+}
+
+/* Decode resync
+ * Input: Raw bytes written so far and decoding data, the block header read
+ * last lies in a corrupt chunk
+ * Output: Data offset on the block the next intact chunk points to, the raw
+ * bytes in front of that block written as zeros
+ * Description: The chunk the block header starts in may hold more blocks, but
+ * only the first one is known, so the search starts with the chunk behind it
+ * and loads batches as it goes. Without such a chunk the rest of the output is
+ * written as zeros
+ * Return value: d_success, d_failure when no chunk helps or a write fails
+ */
+Status decode_resync(size_t *done, DecodeInfo *decInfo)
+{
+    size_t total = CHUNK_COUNT(decInfo->size_secret_data);
+    size_t chunk = (decInfo->data_offset - LZ_BLOCK_HEADER_SIZE) / CHUNK_SIZE + 1;
+    size_t target = decInfo->size_raw_data;
+    Status status = d_failure;
+    StegoChunk *state;
+    size_t piece;
+
+    for (; chunk < total; chunk++)
+    {
+        if (chunk == decInfo->chunk_first + decInfo->chunk_count && decode_chunk_batch(decInfo) == d_failure)
+        {
+            break;
+        }
+        state = &decInfo->chunk_info[chunk - decInfo->chunk_first];
+        if (!state->corrupt && state->block_offset != SIZE_MAX)
+        {
+            if (state->block_index <= decInfo->size_raw_data / LZ_BLOCK_SIZE && state->block_index * LZ_BLOCK_SIZE >= *done)
+            {
+                target = state->block_index * LZ_BLOCK_SIZE;
+                decInfo->data_offset = state->block_offset;
+                status = d_success;
+            }
+            break;
+        }
+    }
+
+    if (target > *done)
+    {
+        fprintf(stderr, "ERROR: Output bytes %zu to %zu are lost, written as zeros\n", *done, target - 1);
+    }
+    memset(decInfo->lz_raw, 0, LZ_BLOCK_SIZE);
+    for (; *done < target; *done += piece)
+    {
+        piece = target - *done < LZ_BLOCK_SIZE ? target - *done : LZ_BLOCK_SIZE;
+        if (fwrite(decInfo->lz_raw, sizeof(char), piece, decInfo->fptr_output) != piece)
+        {
+            return d_failure;
+        }
+    }
+    return status;
+}
+
+/* Decode compressed data
+ * Input: Decoding data
+ * Output: Decompressed output file
+ * Description: Reads the embedded lz block stream one block at a time, header
+ * then body, decompresses the body unless it was stored as it is and writes
+ * the result. Lengths are checked against the block size, the data left and
+ * the raw size before they are used. For checksummed data a block in a corrupt
+ * chunk is written as zeros, every block but the last holds LZ_BLOCK_SIZE raw
+ * bytes so the blocks behind it stay in place. Behind a block header in a
+ * corrupt chunk decode_resync finds the next block to go on with
+ * Return value: d_success, d_failure for a truncated image or corrupt stream
+ */
+Status decode_compressed_data(DecodeInfo *decInfo)
+{
+    unsigned char field[LZ_BLOCK_HEADER_SIZE];
+    size_t stored = decInfo->size_secret_data, done = 0;
+    size_t length, out;
+    const char *raw;
+    uint block;
+
+    while (stored > 0)
+    {
+        decInfo->data_corrupt = 0;
+        if (stored < LZ_BLOCK_HEADER_SIZE || decode_payload_bytes((char *) field, LZ_BLOCK_HEADER_SIZE, decInfo) == d_failure)
+        {
+            break;
+        }
+        if (decInfo->data_corrupt)
+        {
+            if (decode_resync(&done, decInfo) == d_failure)
+            {
+                break;
+            }
+            stored = decInfo->size_secret_data - decInfo->data_offset;
+            continue;
+        }
+        stored -= LZ_BLOCK_HEADER_SIZE;
+        block = stego_get_size(field, LZ_BLOCK_HEADER_SIZE);
+        length = block & ~LZ_BLOCK_STORED;
+        if (length > LZ_BLOCK_SIZE || length > stored || decode_payload_bytes(decInfo->lz_body, length, decInfo) == d_failure)
+        {
+            break;
+        }
+        stored -= length;
+
+        raw = decInfo->lz_body;
+        out = length;
+        if (decInfo->data_corrupt)
+        {
+            raw = decInfo->lz_raw;
+            out = block & LZ_BLOCK_STORED ? length : decInfo->size_raw_data - done < LZ_BLOCK_SIZE ? decInfo->size_raw_data - done : LZ_BLOCK_SIZE;
+            memset(decInfo->lz_raw, 0, out);
+            fprintf(stderr, "ERROR: Output bytes %zu to %zu are lost, written as zeros\n", done, done + out - 1);
+        }
+        else if (!(block & LZ_BLOCK_STORED))
+        {
+            raw = decInfo->lz_raw;
+            if (lz_decompress((unsigned char *) decInfo->lz_raw, LZ_BLOCK_SIZE, &out, (const unsigned char *) decInfo->lz_body, length) == d_failure)
+            {
+                break;
+            }
+        }
+        if (out > decInfo->size_raw_data - done)
+        {
+            break;
+        }
+        if (fwrite(raw, sizeof(char), out, decInfo->fptr_output) != out)
+        {
+            return d_failure;
+        }
+        done += out;
+    }
+
+    if (stored > 0 || done != decInfo->size_raw_data)
+    {
+        check_corrupt_chunks(decInfo);
+        fprintf(stderr, "ERROR: Compressed data in %s is corrupt\n", decInfo->src_image_fname);
+        return d_failure;
+    }
+    return check_corrupt_chunks(decInfo);
+}
+
+/* Extract bytes from map
+ * Input: Array to store the decoded bytes, number of bytes and decoding data
+ * Output: Decoded bytes
+ * Description: Gathers the LSBs of the mapped source image into bytes, 8 image
+ * bytes per decoded byte, and advances the map offset
+ * Return value: d_success, d_failure if the image is too short
+ */
+Status extract_bytes_from_map(char *data, size_t size, DecodeInfo *decInfo)
+{
+    return extract_bits_from_map(data, size, 1, decInfo);
+}
+
+/* Extract cipher from map
+ * Input: Array to store the decoded bytes, number of bytes, bits per image
+ * byte, cipher or NULL and decoding data
+ * Output: Decoded bytes
+ * Description: See extract_bits_from_map, the bytes are decrypted with the
+ * keystream from cipher_offset on when a cipher is given
+ * Return value: d_success, d_failure if the image is too short
+ */
+static Status extract_cipher_from_map(char *data, size_t size, uint bits, const ChaCha *cipher, DecodeInfo *decInfo)
+{
+    size_t offset = bmp_file_end(&decInfo->bmp, decInfo->pixel_pos);
+    size_t pixels = size * 8 / bits;
+
+    if (pixels > decInfo->bmp.capacity - decInfo->pixel_pos)
+    {
+        return d_failure;
+    }
+
+    bmp_extract_cipher((unsigned char *) data, (const unsigned char *) decInfo->src_image_map + offset, &decInfo->bmp, decInfo->pixel_pos, size,
+                       bits, cipher, decInfo->cipher_offset, decInfo->num_threads > 1 ? decInfo->num_threads : 1);
+    decInfo->pixel_pos += pixels;
+    map_release(decInfo->src_image_map, offset, bmp_file_end(&decInfo->bmp, decInfo->pixel_pos));
+
+    return d_success;
+}
+
+/* Extract bits from map
+ * Input: Array to store the decoded bytes, number of bytes, bits per image byte and decoding data
+ * Output: Decoded bytes
+ * Description: Gathers the low bits bits of 8 / bits mapped pixel bytes per
+ * decoded byte, skipping the row padding, and advances the pixel position. The
+ * pages behind the data are released, callers keep size within a window
+ * Return value: d_success, d_failure if the image is too short
+ */
+Status extract_bits_from_map(char *data, size_t size, uint bits, DecodeInfo *decInfo)
+{
+    return extract_cipher_from_map(data, size, bits, NULL, decInfo);
+}
+
+/* Extract payload from map
+ * Input: Array to store the decoded bytes, number of bytes and decoding data
+ * Output: Next data bytes, lsb_bits bits per pixel byte
+ * Description: With a key the bytes are XORed with the keystream from
+ * cipher_offset on inside the row walk (bmp_extract_cipher), so they are
+ * written once, already plain
+ * Return value: d_success, d_failure if the image is too short
+ */
+Status extract_payload_from_map(char *data, size_t size, DecodeInfo *decInfo)
+{
+    if (extract_cipher_from_map(data, size, decInfo->lsb_bits, decInfo->cipher, decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    decInfo->cipher_offset += size;
+    return d_success;
+}
+
+/* Decode map to output file
+ * Input: Decoding data
+ * Output: Decoded output file
+ * Description: Extracts the secret data from the mapped source image. A regular
+ * output file opened for reading and writing is sized and mapped as well so the
+ * decoded bytes land straight in its pages, one window at a time, any other
+ * output (pipes, stdout redirected by the shell, which is write only) gets the
+ * data in blocks through fwrite.
+ * Return value: d_success, d_failure
+ */
+Status decode_map_to_output_file(DecodeInfo *decInfo)
+{
+    struct stat st;
+    int fd = fileno(decInfo->fptr_output);
+    char *output_map;
+    size_t done, chunk;
+    Status status = d_success;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR)
+    {
+        if (ftruncate(fd, decInfo->size_secret_data) == -1)
+        {
+            perror("ftruncate");
+            return d_failure;
+        }
+        output_map = mmap(NULL, decInfo->size_secret_data, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (output_map == MAP_FAILED)
+        {
+            perror("mmap");
+            return d_failure;
+        }
+        for (done = 0; done < decInfo->size_secret_data && status == d_success; done += chunk)
+        {
+            chunk = decInfo->size_secret_data - done;
+            if (chunk > MAP_WINDOW_DATA_SIZE(decInfo->lsb_bits))
+            {
+                chunk = MAP_WINDOW_DATA_SIZE(decInfo->lsb_bits);
+            }
+            status = extract_payload_from_map(output_map + done, chunk, decInfo);
+            map_release(output_map, done, done + chunk);
+        }
+        munmap(output_map, decInfo->size_secret_data);
+        return status;
+    }
+
+    // Output can't be mapped, hand the data over in blocks
+    for (done = 0; done < decInfo->size_secret_data; done += chunk)
+    {
+        chunk = decInfo->size_secret_data - done;
+        if (chunk > MAX_OUTPUT_BUF_SIZE)
+        {
+            chunk = MAX_OUTPUT_BUF_SIZE;
+        }
+        if (extract_payload_from_map(decInfo->output_data, chunk, decInfo) == d_failure ||
+            fwrite(decInfo->output_data, sizeof(char), chunk, decInfo->fptr_output) != chunk)
+        {
+            return d_failure;
+        }
+    }
+    return d_success;
+}
 
 /* Decode byte from lsb of encoded source image
  * Input: one byte to store the decoded data and encoded_data 
@@ -290,54 +1599,119 @@ Status decode_data_to_output_file(DecodeInfo *decInfo)
  */
 Status decode_byte_from_lsb(char *byte, char *encoded_data)
 {
-   for (int i = 7, index = 0; index < 8; i--, index++)
-   {
-        *byte = *byte | (encoded_data[index] & 1) << i;
-   }
+    unsigned char decoded;
+
+    lsb_extract(&decoded, (const unsigned char *) encoded_data, 1);
+    *byte = *byte | decoded;
 
-   return d_success;
+    return d_success;
 }
 
 /* Get the size from image
- * Input: Source image pointer
+ * Input: Bytes of the size field (4 or 8) and decoding data
  * Output: Decoded size
  * Description: Decodes the size from source image
- * return value: decoded size
+ * return value: decoded size, 0 if the image is too short
  */
-uint get_size_from_image(FILE *fptr_src_image)
+size_t get_size_from_image(uint field_size, DecodeInfo *decInfo)
 {
-    // get the encoded data from source image
-    char encoded_size[MAX_ENC_IMAGE_BUF_SIZE * 4];
+    // get the encoded data from source image, row padding included
+    char encoded_size[BMP_MAX_SPAN(SIZE_FIELD_BUF_SIZE)];
 
     // Variable to store decode size value
-    uint decoded_size = 0;
+    unsigned char size_bytes[8];
 
-    // Read 32 bytes from encoded image to decode 4 bytes of data (i.e. size)
-    fread(encoded_size, sizeof(char), MAX_ENC_IMAGE_BUF_SIZE * 4, fptr_src_image);
-    for (int i = 31, index = 0; index < MAX_ENC_IMAGE_BUF_SIZE * 4; i--, index++)
+    // Read 32 or 64 pixel bytes from encoded image to decode 4 or 8 bytes of data (i.e. size)
+    if (decode_image_block((char *) size_bytes, field_size, 1, encoded_size, decInfo) == d_failure)
+    {
+        return 0;
+    }
+    // Size is stored MSB first, i.e. as big endian bytes
+    return stego_get_size(size_bytes, field_size);
+}
+
+/* Get the size from mapped image
+ * Input: Bytes of the size field (4 or 8) and decoding data
+ * Output: Decoded size
+ * Description: Decodes the size straight from the mapped source image
+ * return value: decoded size, 0 if the image is too short
+ */
+size_t get_size_from_map(uint field_size, DecodeInfo *decInfo)
+{
+    unsigned char size_bytes[8];
+
+    // The size is stored MSB first, i.e. as big endian bytes
+    if (extract_bytes_from_map((char *) size_bytes, field_size, decInfo) == d_failure)
+    {
+        return 0;
+    }
+    return stego_get_size(size_bytes, field_size);
+}
+
+/* Decodes String from mapped source image
+ * Input: Size of string, array to store the decoded string and decoding data
+ * Output: Decoded string
+ * Description: Decodes a string straight from the mapped source image
+ * Return value: d_success, d_failure
+ */
+Status decode_data_from_map(uint size, char *data, DecodeInfo *decInfo)
+{
+    if (extract_bytes_from_map(data, size, decInfo) == d_failure)
     {
-        decoded_size = decoded_size | (encoded_size[index] & 1) << i;
+        return d_failure;
     }
-    return decoded_size;
+    data[size] = '\0';
+    return d_success;
 }
 
 /* Decodes String from source image
- * Input: Size of string, array to store the decoded string and source file pointer
+ * Input: Size of string, array to store the decoded string and decoding data
  * Output: Decoded string
  * Description: Decodes a string from source image
  * Return value: d_success
  */
-Status decode_data_from_image(uint size, char *data, FILE *fptr_src_image)
+Status decode_data_from_image(uint size, char *data, DecodeInfo *decInfo)
 {
-    char decoded_byte = 0;
-    char encoded_data[MAX_ENC_IMAGE_BUF_SIZE];
-    for (int i = 0; i < size; i++)
+    char encoded_data[BMP_MAX_SPAN(MAX_FIELD_BUF_SIZE)];
+    uint chunk;
+
+    // The header strings are short, decode them a few bytes per fread
+    for (uint i = 0; i < size; i += chunk)
     {
-        decoded_byte = 0;
-        fread(encoded_data, sizeof(char), MAX_ENC_IMAGE_BUF_SIZE, fptr_src_image);
-        decode_byte_from_lsb(&decoded_byte, encoded_data);
-        data[i] = decoded_byte;
+        chunk = size - i < MAX_FIELD_BUF_SIZE / 8 ? size - i : MAX_FIELD_BUF_SIZE / 8;
+        if (decode_image_block(data + i, chunk, 1, encoded_data, decInfo) == d_failure)
+        {
+            return d_failure;
+        }
     }
     data[size] = '\0';
     return d_success;
-}
\ No newline at end of file
+}
+
+/* Decodes a block from source image
+ * Input: Array to store the decoded block and its size, bits per pixel byte, image
+ * buffer able to hold BMP_MAX_SPAN(size * 8 / bits) bytes, image layout, next
+ * pixel byte and source file pointer
+ * Output: Decoded block, *pos advanced
+ * Description: Reads the encoded data for the whole block, row padding
+ * included, with a single fread and decodes every byte of it
+ * Return value: d_success, d_failure on short read
+ */
+Status decode_block_from_image(char *data, size_t size, uint bits, char *image_buffer, const BmpInfo *bmp, size_t *pos, FILE *fptr_src_image)
+{
+    size_t pixels = size * 8 / bits;
+    size_t image_size;
+
+    if (*pos + pixels > bmp->capacity)
+    {
+        return d_failure;
+    }
+    image_size = bmp_file_end(bmp, *pos + pixels) - bmp_file_end(bmp, *pos);
+    if (fread(image_buffer, sizeof(char), image_size, fptr_src_image) != image_size)
+    {
+        return d_failure;
+    }
+    bmp_extract((unsigned char *) data, (const unsigned char *) image_buffer, bmp, *pos, size, bits, 1);
+    *pos += pixels;
+    return d_success;
+}
@@ -2,9 +2,20 @@
 #define DECODE_H
 #define MAGIC_STRING_LENGTH 2
 #include "types.h"
-
-#define MAX_OUTPUT_BUF_SIZE 1
-#define MAX_ENC_IMAGE_BUF_SIZE (MAX_OUTPUT_BUF_SIZE * 8)
+#include "common.h"
+#include "archive.h"
+#include "bmp.h"
+#include "lz.h"
+#include "stego.h"
+#include "scatter.h"
+#include "uring.h"
+#include "stats.h"
+
+/* Output bytes per block of the stdio pipeline, override with -DMAX_OUTPUT_BUF_SIZE=n */
+#ifndef MAX_OUTPUT_BUF_SIZE
+#define MAX_OUTPUT_BUF_SIZE (64 * 1024)
+#endif
+#define MAX_ENC_IMAGE_BUF_SIZE BMP_MAX_SPAN(MAX_OUTPUT_BUF_SIZE * 8)
 #define MAX_OUTPUT_FILE_EXT 5
 
 // Strucutre definition to store decoding data
@@ -13,6 +24,9 @@ typedef struct _DecodeInfo
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
+    size_t image_size;          /* 0 for a pipe */
+    BmpInfo bmp;
+    size_t pixel_pos;           /* next pixel byte to extract from */
     
     /* Decoded Magic string */
     char decoded_magic_string[MAGIC_STRING_LENGTH + 1];
@@ -21,14 +35,107 @@ typedef struct _DecodeInfo
     uint size_output_fextn;
     char output_fextn[MAX_OUTPUT_FILE_EXT];
 
+    /* Format flags stored along with the extension size */
+    uint format_flags;
+
+    /* Secret data bits per image byte: 1, 2 or 4 */
+    uint lsb_bits;
+
     /* Output file info */
     char *output_fname;
+    char output_fname_buf[MAX_FNAME_SIZE];
     FILE *fptr_output;
-    uint size_secret_data;
+    size_t size_secret_data;    /* bytes embedded */
+    size_t size_raw_data;       /* bytes after decompression, size_secret_data when not compressed */
+    char output_data[MAX_OUTPUT_BUF_SIZE];
+
+    /*
+     * Encrypted data: the key is derived from the passphrase (-P or -K) and
+     * the salt read with the header, cipher points to it once its check
+     * matched. cipher_offset is the keystream offset of the next data byte
+     */
+    const char *passphrase;
+    size_t passphrase_size;
+    unsigned char key_fields[KEY_FIELD_BYTES];
+    StegoKey key;
+    const ChaCha *cipher;
+    size_t cipher_offset;
+
+    /* One block of compressed data as embedded and decompressed */
+    char lz_body[LZ_BLOCK_SIZE];
+    char lz_raw[LZ_BLOCK_SIZE];
+
+    /*
+     * Checksummed data is read a batch of checked chunks at a time, a window
+     * of them for the zero-copy engine, one for stdio. The buffers are allocated
+     * on first use
+     */
+    size_t data_pos;            /* pixel byte of the first data byte */
+    char *chunk_data;
+    StegoChunk *chunk_info;
+    size_t chunk_first;         /* first chunk of the batch */
+    size_t chunk_count;
+    size_t data_offset;         /* data byte handed out next */
+    size_t corrupt_chunks;      /* corrupt chunks found so far */
+    int data_corrupt;           /* set once a byte of a corrupt chunk was handed out */
+
+    /*
+     * Archives go to the output directory entry by entry, -l lists the index
+     * instead and -x extracts only the named entry. The index is read first,
+     * archive_data is its size, the data offset the entries count from
+     */
+    int archive;
+    int list_archive;
+    const char *archive_entry;
+    ArchiveEntry *archive_index;
+    size_t archive_count;
+    size_t archive_data;
+
+    /*
+     * Sharded data is one slice of a bigger secret, see common.h. Reassembling
+     * (-R) writes the slice into shard_fd at its offset, the shards of one
+     * secret land in disjoint ranges of the same file
+     */
+    StegoShard shard;
+    int reassemble;
+    int shard_fd;
+
+    /* Encoded image data for one output block */
+    char image_data[MAX_ENC_IMAGE_BUF_SIZE];
+
+    /* Memory mapped views used by the zero-copy engine */
+    char *src_image_map;
+    size_t image_map_size;
+
+    /* io_uring engine (-U), NULL when off. Behind the bmp header the source image is read through
+       a stream on the ring, the output still goes through stdio */
+    Uring *uring;
+    int uring_active;
+    UringStream src_stream;
+
+    /* Scattered data (FLAG_SCATTERED) is read a tile at a time with pread, the map and the io_uring
+       stream are dropped once the header is read */
+    int scatter_active;
+    Scatter scatter_state;
+
+    /* Threads used by the zero-copy engine, 0 or 1 runs serially */
+    int num_threads;
+
+    /* Suppress the INFO messages */
+    int quiet;
+
+    /* Per phase counters, reported on stderr when a format is set (-t) */
+    StatsInfo stats;
 } DecodeInfo;
 
 /* Decoding function prototypes */
 
+/* Move the reads of the rows onto an io_uring stream */
+Status start_uring_for_decoding(DecodeInfo *decInfo);
+
+/* Read the data behind the header through the tiles it is scattered over */
+Status start_scatter_for_decoding(DecodeInfo *decInfo);
+
 /* Read and validate Deccode args from argv */
 Status read_and_validate_decode_args(char *argc[], DecodeInfo *decInfo);
 
@@ -45,16 +152,85 @@ Status decode_output_fextn(DecodeInfo *decInfo);
 Status do_decoding(DecodeInfo *decInfo);
 
 /* Decodes string from the image */
-Status decode_data_from_image(uint size, char *data, FILE *fptr_src_image);
+Status decode_data_from_image(uint size, char *data, DecodeInfo *decInfo);
+
+/* Decode one block of data, bits bits per pixel byte from pixel byte *pos on, using the caller's image buffer */
+Status decode_block_from_image(char *data, size_t size, uint bits, char *image_buffer, const BmpInfo *bmp, size_t *pos, FILE *fptr_src_image);
+
+/* Read the bmp header of the source image and go to its first row */
+Status read_bmp_header_for_decoding(DecodeInfo *decInfo);
 
 /* Store the decoded data in output file */
 Status decode_data_to_output_file(DecodeInfo *decInfo);
 
+/* Decompress the embedded lz block stream into output file, block by block */
+Status decode_compressed_data(DecodeInfo *decInfo);
+
+/* Write the slice of a shard into the reassembled secret at its offset */
+Status decode_shard_data(DecodeInfo *decInfo);
+
 /* Decode bytes from lsb of source image */
 Status decode_byte_from_lsb(char *data, char *encoded_data);
 
-/* Decode the size from source image */
-uint get_size_from_image(FILE *fptr_src_image);
+/* Decode a 4 or 8 byte size field from source image */
+size_t get_size_from_image(uint field_size, DecodeInfo *decInfo);
+
+/* Release mapped views and close whatever files are still open */
+void close_files_for_decoding(DecodeInfo *decInfo);
+
+/* Map the source image into memory */
+Status map_src_image_for_decoding(DecodeInfo *decInfo);
+
+/* Decodes string straight from the mapped source image */
+Status decode_data_from_map(uint size, char *data, DecodeInfo *decInfo);
+
+/* Check the decoded data size against the image bytes left */
+Status check_data_size(DecodeInfo *decInfo);
+
+/* Derive the key of encrypted data from the passphrase and check it against the header */
+Status unlock_data_key(DecodeInfo *decInfo);
+
+/* Read the header CRC32C of checksummed data and check the fields read before it */
+Status check_header_crc(DecodeInfo *decInfo);
+
+/* Read the next batch of chunks of checksummed data and check every chunk */
+Status decode_chunk_batch(DecodeInfo *decInfo);
+
+/* Next bytes of the embedded data, checksummed data through the checked chunks */
+Status decode_payload_bytes(char *data, size_t size, DecodeInfo *decInfo);
+
+/* Go to data byte offset, the next bytes decode_payload_bytes hands out start there */
+Status decode_seek_data(size_t offset, DecodeInfo *decInfo);
+
+/* Read the index of an archive */
+Status decode_archive_index(DecodeInfo *decInfo);
+
+/* List the archive index, extract the entry asked for or all of them into the output directory */
+Status decode_archive(DecodeInfo *decInfo);
+
+/* Go on behind a block header in a corrupt chunk with the block the next intact chunk points to, zeros in between */
+Status decode_resync(size_t *done, DecodeInfo *decInfo);
+
+/* Store checksummed data in output file, corrupt chunks included and reported */
+Status decode_checked_data(DecodeInfo *decInfo);
+
+/* Report the corrupt chunks found, d_failure when there are any */
+Status check_corrupt_chunks(DecodeInfo *decInfo);
+
+/* Gather LSBs of the mapped source image into bytes */
+Status extract_bytes_from_map(char *data, size_t size, DecodeInfo *decInfo);
+
+/* Gather the low bits bits of the mapped source image into bytes */
+Status extract_bits_from_map(char *data, size_t size, uint bits, DecodeInfo *decInfo);
+
+/* Gather the next data bytes of the mapped source image, decrypted on the way when there is a key */
+Status extract_payload_from_map(char *data, size_t size, DecodeInfo *decInfo);
+
+/* Store the data decoded from the mapped source image in output file */
+Status decode_map_to_output_file(DecodeInfo *decInfo);
+
+/* Decode a 4 or 8 byte size field straight from the mapped source image */
+size_t get_size_from_map(uint field_size, DecodeInfo *decInfo);
 
 
 #endif
\ No newline at end of file
@@ -1,7 +1,26 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 #include "encode.h"
+#include "archive.h"
+#include "bmp.h"
+#include "chacha.h"
+#include "crc.h"
+#include "lsb.h"
+#include "map.h"
+#include "stego.h"
+#include "scatter.h"
+#include "stats.h"
 #include "types.h"
+#include "uring.h"
 #include "common.h"
 
 /* Function Definitions */
@@ -10,7 +29,7 @@
  *  Input: command line arguments
  *  Output: Operation type
  *  Description: Checks the 2nd argument is a valid option or not
- *  Return value: e_encode, e_decode, e_unsupported
+ *  Return value: e_encode, e_decode, e_batch, e_probe, e_index, e_plan, e_shard, e_reassemble, e_unsupported
  */
 OperationType check_operation_type(char *argv[])
 {
@@ -23,6 +42,30 @@ OperationType check_operation_type(char *argv[])
     {
         return e_decode;
     }
+    else if (!(strcmp(argv[1], "-b")))
+    {
+        return e_batch;
+    }
+    else if (!(strcmp(argv[1], "-p")))
+    {
+        return e_probe;
+    }
+    else if (!(strcmp(argv[1], "-n")))
+    {
+        return e_index;
+    }
+    else if (!(strcmp(argv[1], "-f")))
+    {
+        return e_plan;
+    }
+    else if (!(strcmp(argv[1], "-S")))
+    {
+        return e_shard;
+    }
+    else if (!(strcmp(argv[1], "-R")))
+    {
+        return e_reassemble;
+    }
     else
     {
         return e_unsupported;
@@ -47,8 +90,12 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     }
 
     char *str;  /*temporary vaiable to check the extension */
-    /* Do error handling for source image file */
-    if((str = strstr(argv[2], ".bmp")) == NULL)
+    /* Do error handling for source image file, - reads it from stdin */
+    if (IS_STREAM_FNAME(argv[2]))
+    {
+        encInfo->src_image_fname = argv[2];
+    }
+    else if((str = strstr(argv[2], ".bmp")) == NULL)
     {
         puts("ERROR: Unsupported format of image file");
         puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file]");
@@ -59,8 +106,31 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
         encInfo->src_image_fname = argv[2];
     }
 
-    /* Do error handling for secret data file */
-    if ((str = strchr(argv[3], '.')) == NULL || (strcmp(str, ".txt")) && (strcmp(str, ".c")) && (strcmp(str, ".sh")))
+    /* Do error handling for secret data file, - reads it from stdin as text. An archive takes any list of files */
+    if (encInfo->archive)
+    {
+        if (encInfo->compress)
+        {
+            puts("ERROR: Archives can't be compressed, their entries are found by offset");
+            return e_failure;
+        }
+        if (IS_STREAM_FNAME(argv[3]) && IS_STREAM_FNAME(argv[2]))
+        {
+            puts("ERROR: Source image and file list can't both be read from stdin");
+            return e_failure;
+        }
+        encInfo->secret_fname = argv[3];
+    }
+    else if (IS_STREAM_FNAME(argv[3]))
+    {
+        if (IS_STREAM_FNAME(argv[2]))
+        {
+            puts("ERROR: Source image and secret file can't both be read from stdin");
+            return e_failure;
+        }
+        encInfo->secret_fname = argv[3];
+    }
+    else if ((str = strchr(argv[3], '.')) == NULL || (strcmp(str, ".txt")) && (strcmp(str, ".c")) && (strcmp(str, ".sh")))
     {
         puts("ERROR: Unsupported format of secret file.");
         puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file]");
@@ -71,49 +141,128 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
         encInfo->secret_fname = argv[3];
     }
 
+    /* Secret data bits per image byte, 1 unless asked otherwise */
+    if (encInfo->lsb_bits == 0)
+    {
+        encInfo->lsb_bits = 1;
+    }
+    if (LSB_BITS_TO_FLAGS(encInfo->lsb_bits) == 0 && encInfo->lsb_bits != 1)
+    {
+        puts("ERROR: Bits per image byte must be 1, 2 or 4");
+        return e_failure;
+    }
+
+    /* Scattered data is patched into a clone of the source image, read back from the secret file at will */
+    if (encInfo->scatter)
+    {
+        if (encInfo->passphrase == NULL)
+        {
+            puts("ERROR: Scattering needs a key, give -P or -K");
+            return e_failure;
+        }
+        if (IS_STREAM_FNAME(encInfo->src_image_fname) || (!encInfo->archive && IS_STREAM_FNAME(encInfo->secret_fname)) ||
+            (encInfo->inplace_mode == e_inplace_off && argv[4] != NULL && IS_STREAM_FNAME(argv[4])))
+        {
+            puts("ERROR: Scattering needs the source image, the secret file and the stego image to be named files");
+            return e_failure;
+        }
+    }
+
+    /* In place modes write to the source image */
+    if (encInfo->inplace_mode != e_inplace_off)
+    {
+        if (IS_STREAM_FNAME(encInfo->src_image_fname))
+        {
+            puts("ERROR: In place encoding needs a named source image");
+            return e_failure;
+        }
+        encInfo->stego_image_fname = encInfo->src_image_fname;
+        return e_success;
+    }
+
     /* Create Output file*/
     if(argv[4] == NULL)
     {
-        printf("INFO: Output file not mentioned. Creating steged_img.bmp as default\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Output file not mentioned. Creating steged_img.bmp as default\n");
         encInfo->stego_image_fname = "steged_img.bmp";
         return e_success;
     }
-    else if((str = strchr(argv[4], '.')) == NULL)
+    else if (IS_STREAM_FNAME(argv[4]))
     {
-        strcat(argv[4], ".bmp");
+        // The stego image goes to stdout, keep the INFO messages out of it
+        encInfo->quiet = 1;
+        encInfo->stego_image_fname = argv[4];
+        return e_success;
     }
-    else
+
+    // The name gets a .bmp extension in place of its own, argv is left as it is
+    str = strchr(strrchr(argv[4], '/') != NULL ? strrchr(argv[4], '/') : argv[4], '.');
+    if (snprintf(encInfo->stego_fname_buf, MAX_FNAME_SIZE, "%.*s.bmp", str == NULL ? (int) strlen(argv[4]) : (int) (str - argv[4]), argv[4]) >= MAX_FNAME_SIZE)
     {
-        strcpy(str, ".bmp");
+        puts("ERROR: Output file name is too long");
+        return e_failure;
     }
-
-    encInfo->stego_image_fname = argv[4];
+    encInfo->stego_image_fname = encInfo->stego_fname_buf;
 
     return e_success;
 }
 
 /* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
+ * Input: The 54 byte bmp header
+ * Output: Pixel bytes of all rows, row padding left out
  * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * and height after that. size is 4 bytes. See bmp_parse_header
+ * Return value: Pixel bytes, 0 for an unsupported image
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+size_t get_image_size_for_bmp(const char *bmp_header)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
+    BmpInfo bmp;
+
+    if (bmp_parse_header((const unsigned char *) bmp_header, BMP_HEADER_SIZE, &bmp) == e_failure)
+    {
+        return 0;
+    }
+    return bmp.capacity;
+}
 
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    // printf("width = %u\n", width);
+/* Read bmp header
+ * Input: Address of structure variable which holds the encoding data
+ * Output: The 54 byte bmp header of the source image and its row layout
+ * Description: The header is read once, from the start of the source image, and
+ * kept for the capacity check and the stego image. Nothing seeks back to it, so
+ * the source image may be a pipe. A regular file bounds the capacity by the rows it holds
+ * Return value: e_success, e_failure on short read or an unsupported image
+ */
+Status read_bmp_header(EncodeInfo *encInfo)
+{
+    size_t file_size;
 
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    // printf("height = %u\n", height);
+    if (fread(encInfo->bmp_header, sizeof(char), BMP_HEADER_SIZE, encInfo->fptr_src_image) != BMP_HEADER_SIZE)
+    {
+        return e_failure;
+    }
+    if (bmp_parse_header((const unsigned char *) encInfo->bmp_header, BMP_HEADER_SIZE, &encInfo->bmp) == e_failure)
+    {
+        printf("ERROR: %s is not an uncompressed 24 or 32 bit bmp image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    if ((file_size = get_file_size(encInfo->fptr_src_image)) > 0)
+    {
+        bmp_clip_capacity(&encInfo->bmp, file_size);
+    }
+    encInfo->pixel_pos = 0;
+    return e_success;
+}
 
-    // Return image capacity
-    return width * height * 3;
+/* Open stream
+ * Input: File name and fopen mode, stream standing for -
+ * Output: File pointer
+ * Description: - stands for stdin or stdout, anything else is opened with fopen
+ * Return value: File pointer, NULL on error
+ */
+FILE *open_stream(const char *fname, const char *mode, FILE *std_stream)
+{
+    return IS_STREAM_FNAME(fname) ? std_stream : fopen(fname, mode);
 }
 
 /* 
@@ -125,10 +274,10 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  */
 Status open_files(EncodeInfo *encInfo)
 {
-    printf("INFO: Opening required files\n");
+    PRINT_INFO(encInfo->quiet, "INFO: Opening required files\n");
 
-    // Open Src Image file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    // Open Src Image file, writable when it gets patched directly
+    encInfo->fptr_src_image = open_stream(encInfo->src_image_fname, encInfo->inplace_mode == e_inplace_direct ? "r+" : "r", stdin);
 
     // Do Error handling
     if (encInfo->fptr_src_image == NULL)
@@ -138,10 +287,10 @@ Status open_files(EncodeInfo *encInfo)
 
     	return e_failure;
     }
-    printf("INFO: Opened %s\n", encInfo->src_image_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Opened %s\n", encInfo->src_image_fname);
 
     // Open Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    encInfo->fptr_secret = open_stream(encInfo->secret_fname, "r", stdin);
 
     // Do Error handling
     if (encInfo->fptr_secret == NULL)
@@ -151,10 +300,34 @@ Status open_files(EncodeInfo *encInfo)
 
     	return e_failure;
     }
-    printf("INFO: Opened %s\n", encInfo->secret_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Opened %s\n", encInfo->secret_fname);
+
+    // A shard reads its slice only
+    if (encInfo->secret_offset > 0 && fseeko(encInfo->fptr_secret, encInfo->secret_offset, SEEK_SET) == -1)
+    {
+        fprintf(stderr, "ERROR: Unable to seek in %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+
+    // The listed files are bundled, the archive stands in for the secret file from here on
+    if (encInfo->archive && open_archive(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // No mapping yet, the engine decides in do_encoding
+    encInfo->src_image_map = NULL;
+    encInfo->stego_image_map = NULL;
+    encInfo->secret_map = NULL;
+
+    // In place modes have no separate stego image to create
+    if (encInfo->inplace_mode != e_inplace_off)
+    {
+        return e_success;
+    }
 
-    // Open Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    // Open Stego Image file (read/write so that it can be memory mapped)
+    encInfo->fptr_stego_image = open_stream(encInfo->stego_image_fname, "w+", stdout);
 
     // Do Error handling
     if (encInfo->fptr_stego_image == NULL)
@@ -164,12 +337,239 @@ Status open_files(EncodeInfo *encInfo)
 
     	return e_failure;
     }
-    printf("INFO: Opened %s\n", encInfo->stego_image_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Opened %s\n", encInfo->stego_image_fname);
 
     // No failure return e_success
     return e_success;
 }
 
+/* Open archive
+ * Input: Address of structure variable which holds the encoding data, the
+ * secret file being the list of files to bundle
+ * Output: fptr_secret on the archive of the listed files
+ * Description: The archive goes to an unnamed temporary file, a regular file,
+ * so every engine reads it like any secret file and it is gone once closed
+ * Return value: e_success, e_failure
+ */
+Status open_archive(EncodeInfo *encInfo)
+{
+    FILE *fptr_archive = tmpfile();
+
+    PRINT_INFO(encInfo->quiet, "INFO: Bundling the files listed in %s\n", encInfo->secret_fname);
+    if (fptr_archive == NULL)
+    {
+        perror("tmpfile");
+        return e_failure;
+    }
+    if (archive_build(encInfo->fptr_secret, fptr_archive, &encInfo->archive_entries) == e_failure)
+    {
+        fclose(fptr_archive);
+        return e_failure;
+    }
+    fclose(encInfo->fptr_secret);
+    encInfo->fptr_secret = fptr_archive;
+    rewind(encInfo->fptr_secret);
+    encInfo->size_secret_file = 0;
+    PRINT_INFO(encInfo->quiet, "INFO: Done. %zu files\n", encInfo->archive_entries);
+
+    return e_success;
+}
+
+/* Map files for encoding
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Read only views of src image and secret file, writable view of stego image
+ * Description: Maps all files into memory so that the LSB embedding runs straight
+ * in the mapped pages. Only regular files can be mapped, and the stego image only
+ * when it is open for reading and writing, anything else (pipes, character
+ * devices, stdout redirected by the shell) keeps using the stdio path.
+ * Return value: e_success, e_failure if the files can't be mapped
+ */
+Status map_files_for_encoding(EncodeInfo *encInfo)
+{
+    struct stat src_st, secret_st, stego_st;
+    size_t secret_base = encInfo->secret_offset & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int secret_fd = fileno(encInfo->fptr_secret);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+
+    // Only seekable regular files can be mapped
+    if (fstat(src_fd, &src_st) == -1 || fstat(secret_fd, &secret_st) == -1 || fstat(stego_fd, &stego_st) == -1)
+    {
+        return e_failure;
+    }
+    if (!S_ISREG(src_st.st_mode) || !S_ISREG(secret_st.st_mode) || !S_ISREG(stego_st.st_mode) || src_st.st_size < 54 ||
+        (size_t) secret_st.st_size < encInfo->secret_offset + encInfo->size_secret_file || (fcntl(stego_fd, F_GETFL) & O_ACCMODE) != O_RDWR)
+    {
+        return e_failure;
+    }
+
+    encInfo->image_map_size = src_st.st_size;
+
+    // Map source image read only
+    encInfo->src_image_map = mmap(NULL, encInfo->image_map_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+    if (encInfo->src_image_map == MAP_FAILED)
+    {
+        encInfo->src_image_map = NULL;
+        return e_failure;
+    }
+
+    // Map secret file read only, from the page holding the first byte of a shard's slice
+    encInfo->secret_map = mmap(NULL, encInfo->secret_offset - secret_base + encInfo->size_secret_file, PROT_READ, MAP_PRIVATE, secret_fd,
+                               secret_base);
+    if (encInfo->secret_map == MAP_FAILED)
+    {
+        encInfo->secret_map = NULL;
+        unmap_files_for_encoding(encInfo);
+        return e_failure;
+    }
+    encInfo->secret_map += encInfo->secret_offset - secret_base;
+
+    // Size the stego image like the source and map it writable
+    if (ftruncate(stego_fd, encInfo->image_map_size) == -1)
+    {
+        unmap_files_for_encoding(encInfo);
+        return e_failure;
+    }
+    encInfo->stego_image_map = mmap(NULL, encInfo->image_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, stego_fd, 0);
+    if (encInfo->stego_image_map == MAP_FAILED)
+    {
+        encInfo->stego_image_map = NULL;
+        unmap_files_for_encoding(encInfo);
+        return e_failure;
+    }
+
+    // All views are walked front to back exactly once, window by window (see map.h)
+    madvise(encInfo->src_image_map, encInfo->image_map_size, MADV_SEQUENTIAL);
+    madvise(encInfo->secret_map - (encInfo->secret_offset - secret_base), encInfo->secret_offset - secret_base + encInfo->size_secret_file,
+            MADV_SEQUENTIAL);
+    madvise(encInfo->stego_image_map, encInfo->image_map_size, MADV_SEQUENTIAL);
+
+    return e_success;
+}
+
+/* Unmap files for encoding
+ * Input: Address of structure variable which holds the encoding data
+ * Output: All mapped views released
+ * Description: Releases whatever map_files_for_encoding managed to map
+ * Return value: None
+ */
+void unmap_files_for_encoding(EncodeInfo *encInfo)
+{
+    if (encInfo->src_image_map != NULL)
+    {
+        munmap(encInfo->src_image_map, encInfo->image_map_size);
+        encInfo->src_image_map = NULL;
+    }
+    if (encInfo->secret_map != NULL)
+    {
+        size_t secret_lead = encInfo->secret_offset & ((size_t) sysconf(_SC_PAGESIZE) - 1);
+
+        munmap(encInfo->secret_map - secret_lead, secret_lead + encInfo->size_secret_file);
+        encInfo->secret_map = NULL;
+    }
+    if (encInfo->stego_image_map != NULL)
+    {
+        munmap(encInfo->stego_image_map, encInfo->image_map_size);
+        encInfo->stego_image_map = NULL;
+    }
+}
+
+/* Close files for encoding
+ * Input: Address of structure variable which holds the encoding data
+ * Output: No mapped views or open files left
+ * Description: Safe to call after a failure at any stage, as long as the file
+ * pointers started out NULL
+ * Return value: None
+ */
+void close_files_for_encoding(EncodeInfo *encInfo)
+{
+    // Requests still in flight use the descriptors
+    if (encInfo->uring_active)
+    {
+        uring_reset(encInfo->uring);
+        encInfo->uring_active = 0;
+    }
+    unmap_files_for_encoding(encInfo);
+    if (encInfo->fptr_src_image != NULL)
+    {
+        fclose(encInfo->fptr_src_image);
+        encInfo->fptr_src_image = NULL;
+    }
+    if (encInfo->fptr_secret != NULL)
+    {
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
+    }
+    if (encInfo->fptr_stego_image != NULL)
+    {
+        fclose(encInfo->fptr_stego_image);
+        encInfo->fptr_stego_image = NULL;
+    }
+}
+
+/* Start uring for encoding
+ * Input: Address of structure variable which holds the encoding data, the bmp
+ * header copied
+ * Output: Source and stego image streams on the ring from the current file
+ * positions on, a secret file stream when the secret data is read as it is
+ * Description: The source stream reads ahead up to the last pixel byte the
+ * data takes, the ring slots are split 3:3:2 between the source, the stego
+ * image and the secret file. Pipes stay on stdio
+ * Return value: e_success, e_failure when the files can't go through the ring
+ */
+Status start_uring_for_encoding(EncodeInfo *encInfo)
+{
+    Uring *ring = encInfo->uring;
+    struct stat src_st, stego_st, secret_st;
+    off_t src_offset, stego_offset, secret_offset;
+    size_t pixels = stego_required_capacity(encInfo->extn_secret_file, encInfo->format_flags, encInfo->size_payload);
+
+    if (ring == NULL || fflush(encInfo->fptr_stego_image) != 0 || fstat(fileno(encInfo->fptr_src_image), &src_st) == -1 ||
+        fstat(fileno(encInfo->fptr_stego_image), &stego_st) == -1 || !S_ISREG(src_st.st_mode) || !S_ISREG(stego_st.st_mode) ||
+        (src_offset = ftello(encInfo->fptr_src_image)) == -1 || (stego_offset = ftello(encInfo->fptr_stego_image)) == -1)
+    {
+        return e_failure;
+    }
+
+    uring_reset(ring);
+    stats_watch_ring(&encInfo->stats, &ring->bytes_read, &ring->bytes_written);
+    if (uring_open_stream(&encInfo->src_stream, ring, fileno(encInfo->fptr_src_image), 0, src_offset, bmp_file_end(&encInfo->bmp, pixels),
+                          URING_SLOTS * 3 / 8) == e_failure ||
+        uring_open_stream(&encInfo->stego_stream, ring, fileno(encInfo->fptr_stego_image), 1, stego_offset, 0, URING_SLOTS * 3 / 8) == e_failure)
+    {
+        uring_reset(ring);
+        return e_failure;
+    }
+    encInfo->uring_secret = !encInfo->compress && fstat(fileno(encInfo->fptr_secret), &secret_st) == 0 && S_ISREG(secret_st.st_mode) &&
+                            (secret_offset = ftello(encInfo->fptr_secret)) != -1 &&
+                            uring_open_stream(&encInfo->secret_stream, ring, fileno(encInfo->fptr_secret), 0, secret_offset,
+                                              secret_offset + encInfo->size_secret_file, URING_SLOTS / 4) == e_success;
+    encInfo->uring_active = 1;
+
+    return e_success;
+}
+
+/* Finish uring for encoding
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Everything embedded is in the stego image, the stdio positions of
+ * both images moved behind it for the tail copy
+ * Return value: e_success, e_failure on a failed write
+ */
+Status finish_uring_for_encoding(EncodeInfo *encInfo)
+{
+    Status status = uring_flush(&encInfo->stego_stream);
+
+    if (fseeko(encInfo->fptr_src_image, encInfo->src_stream.offset, SEEK_SET) == -1 ||
+        fseeko(encInfo->fptr_stego_image, encInfo->stego_stream.offset, SEEK_SET) == -1)
+    {
+        status = e_failure;
+    }
+    uring_reset(encInfo->uring);
+    encInfo->uring_active = 0;
+
+    return status;
+}
+
 /* Do Encoding
  * Input: address of structure varible which holds encoding data 
  * Output: Encoded image 
@@ -178,22 +578,62 @@ Status open_files(EncodeInfo *encInfo)
  */
 Status do_encoding(EncodeInfo *encInfo)
 {
-    printf("INFO: ## Encoding Procedure Started ##\n");
+    Status status;
+    size_t file_size;
 
-    // get the size of secret file
-    printf("INFO: Checking for %s size\n", encInfo->secret_fname);
-    if ((encInfo->size_secret_file = get_file_size(encInfo->fptr_secret)) == 0)
+    PRINT_INFO(encInfo->quiet, "INFO: ## Encoding Procedure Started ##\n");
+    stats_start(&encInfo->stats);
+    stats_begin(&encInfo->stats, e_phase_setup);
+
+    // get the size of secret file, -s only stands in for it when the secret has no size of its own. A shard
+    // sizes its slice of the file
+    PRINT_INFO(encInfo->quiet, "INFO: Checking for %s size\n", encInfo->secret_fname);
+    file_size = get_file_size(encInfo->fptr_secret);
+    if (encInfo->shard == NULL && encInfo->size_secret_file != 0 && file_size != 0 && encInfo->size_secret_file != file_size)
+    {
+        printf("ERROR: -s %zu disagrees with the size of %s, %zu bytes\n", encInfo->size_secret_file, encInfo->secret_fname, file_size);
+        return e_failure;
+    }
+    if (encInfo->size_secret_file == 0 && (encInfo->size_secret_file = file_size) == 0)
     {
-        printf("%s file is empty\n", encInfo->secret_fname);
+        if (IS_STREAM_FNAME(encInfo->secret_fname))
+        {
+            printf("ERROR: Size of the secret data on stdin is unknown, pass it with -s\n");
+        }
+        else
+        {
+            printf("%s file is empty\n", encInfo->secret_fname);
+        }
         return e_failure;
     }
     else
     {
-        printf("INFO: Done. Not Empty\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done. Not Empty\n");
+    }
+
+    // Compressed data is sized before anything is written, the header comes first
+    if (get_payload_size(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // The key goes into the header as well, a fresh salt makes it unique to this image
+    if (encInfo->passphrase != NULL)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Deriving the key\n");
+        if (stego_make_key(&encInfo->key, encInfo->passphrase, encInfo->passphrase_size, NULL) == e_failure)
+        {
+            printf("ERROR: No random salt for the key\n");
+            return e_failure;
+        }
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
 
+    // The extension goes into the header, its size counts against the capacity
+    set_secret_file_extn(encInfo);
+
     // Check capacity of source image to handle the secret data
-    printf("INFO: Checking for %s capacity to handle %s\n", encInfo->src_image_fname, encInfo->secret_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Checking for %s capacity to handle %s\n", encInfo->src_image_fname, encInfo->secret_fname);
     if(check_capacity(encInfo) == e_failure)
     {
         printf("ERROR: %s file doesn't have sufficient capacity to encode the secret data\n", encInfo->src_image_fname);
@@ -201,23 +641,60 @@ Status do_encoding(EncodeInfo *encInfo)
     }
     else
     {
-        printf("INFO: Done. Found OK\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done. Found OK\n");
+    }
+
+    // Only the modified region gets written in place
+    if (encInfo->inplace_mode != e_inplace_off)
+    {
+        if ((status = encode_in_place(encInfo)) == e_success)
+        {
+            stats_report(&encInfo->stats, "encode", stderr);
+        }
+        return status;
+    }
+
+    // Scattered data goes tile by tile into a clone of the source image
+    if (encInfo->scatter)
+    {
+        if ((status = encode_scattered(encInfo)) == e_success)
+        {
+            stats_report(&encInfo->stats, "encode", stderr);
+        }
+        return status;
+    }
+
+    // Use the zero-copy engine whenever all files can be mapped, unless the io_uring engine is asked for
+    if (encInfo->uring == NULL && map_files_for_encoding(encInfo) == e_failure)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Files can't be mapped, using stdio\n");
     }
 
     // Copy header of bmp file
-    printf("INFO: Copying Image header\n");
-    if(copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    PRINT_INFO(encInfo->quiet, "INFO: Copying Image header\n");
+    stats_begin(&encInfo->stats, e_phase_header);
+    if (encInfo->src_image_map != NULL)
+    {
+        memcpy(encInfo->stego_image_map, encInfo->src_image_map, encInfo->bmp.pixel_offset);
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
+    }
+    else if(copy_bmp_header(encInfo->bmp_header, &encInfo->bmp, encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
     {
         printf("ERROR: copy_bmp_header function failed\n");
         return e_failure;
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
+    }
+    if (encInfo->uring != NULL && start_uring_for_encoding(encInfo) == e_failure)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Files can't go through io_uring, using stdio\n");
     }
     
     // Encode Magic String
-    printf("INFO: Encoding Magic String Signature\n");
+    PRINT_INFO(encInfo->quiet, "INFO: Encoding Magic String Signature\n");
+    stats_begin(&encInfo->stats, e_phase_magic);
     if(encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
     {
         printf("ERROR: encode_magic_string function is failed\n");
@@ -225,15 +702,12 @@ Status do_encoding(EncodeInfo *encInfo)
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
     
     // Encoding secret file extension
-
-    // Copy secret file extension
-    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, "."));
-
-    printf("INFO: Encoding %s File Extension\n", encInfo->secret_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Encoding %s File Extension\n", encInfo->secret_fname);
+    stats_begin(&encInfo->stats, e_phase_extn);
     if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
     {
         printf("ERROR: encode_secret_file_extn function failed\n");
@@ -241,14 +715,15 @@ Status do_encoding(EncodeInfo *encInfo)
     }
     else
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
 
     // Error handling for Encode secret file size
-    printf("INFO: Encoding %s File Size\n", encInfo->secret_fname);
-    if(encode_secret_file_size(encInfo->size_secret_file,encInfo) == e_success)
+    PRINT_INFO(encInfo->quiet, "INFO: Encoding %s File Size\n", encInfo->secret_fname);
+    stats_begin(&encInfo->stats, e_phase_size);
+    if(encode_secret_file_size(encInfo->size_payload,encInfo) == e_success)
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
     else
     {
@@ -257,23 +732,41 @@ Status do_encoding(EncodeInfo *encInfo)
     }
 
     // Error handling for Encode secret file data
-    printf("INFO: Encoding %s File Data\n", encInfo->secret_fname);
+    PRINT_INFO(encInfo->quiet, "INFO: Encoding %s File Data\n", encInfo->secret_fname);
+    stats_begin(&encInfo->stats, e_phase_payload);
     if(encode_secret_file_data(encInfo) == e_success)
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
     else
     {
         printf("ERROR: encode_secret_file_data function is failed\n");
         return e_failure;
     }
+    if (encInfo->uring_active && finish_uring_for_encoding(encInfo) == e_failure)
+    {
+        printf("ERROR: Writing the stego image through io_uring failed\n");
+        return e_failure;
+    }
 
 
     // Error handling for Encode remaining data
-    printf("INFO: Copying Left Over Data\n");
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+    PRINT_INFO(encInfo->quiet, "INFO: Copying Left Over Data\n");
+    stats_begin(&encInfo->stats, e_phase_tail);
+    if (encInfo->src_image_map != NULL)
+    {
+        // The tail is never touched through the maps, the kernel copies it file to file
+        size_t tail = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+        status = copy_image_region(fileno(encInfo->fptr_src_image), tail, fileno(encInfo->fptr_stego_image),
+                                   tail, encInfo->image_map_size - tail);
+    }
+    else
+    {
+        status = copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+    }
+    if (status == e_success)
     {
-        printf("INFO: Done\n");
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
     }
     else
     {
@@ -281,10 +774,9 @@ Status do_encoding(EncodeInfo *encInfo)
         return e_failure;
     }
 
-    // Close all opened files
-    fclose(encInfo->fptr_src_image);
-    fclose(encInfo->fptr_secret);
-    fclose(encInfo->fptr_stego_image);
+    // Close all opened files, the last buffered writes belong to the tail
+    close_files_for_encoding(encInfo);
+    stats_report(&encInfo->stats, "encode", stderr);
     
     // Encoding done
     return e_success;
@@ -293,16 +785,31 @@ Status do_encoding(EncodeInfo *encInfo)
 /* Check Capacity 
  * Input: Address of structure variable which holds the encoding data
  * Output: Image size
- * Description: Checks the image capacity to handle secret data
+ * Description: Checks the image capacity to handle secret data. Only pixel
+ * bytes count, the row padding can't carry anything
  * return value: e_success, e_failure
  */
 Status check_capacity(EncodeInfo *encInfo)
 {
     // Get the size of source image
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
+    if (read_bmp_header(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    encInfo->image_capacity = encInfo->bmp.capacity;
     
-    // Check capacity
-    if (encInfo->image_capacity > 54 + ( strlen(MAGIC_STRING) + 4 + strlen(".txt") + 4 + encInfo->size_secret_file) * 8)
+    // The format flags share the field with the extension size, images with row padding or
+    // anything in front of the rows are marked, the others keep the layout of older versions.
+    // Data above 4 GiB is marked for its longer size field, compressed data for its raw size field,
+    // encrypted data for its key fields, a shard for its shard fields and checksummed data for its CRC32C
+    // fields and chunk trailers. Scattered data takes the same pixel bytes, only in another order
+    encInfo->format_flags = LSB_BITS_TO_FLAGS(encInfo->lsb_bits) | (bmp_is_linear(&encInfo->bmp) ? 0 : FLAG_ROW_LAYOUT) |
+                            SIZE_TO_FLAGS(encInfo->size_payload) | (encInfo->compress ? FLAG_COMPRESSED : 0) |
+                            (encInfo->checksum ? FLAG_CHECKSUM : 0) | (encInfo->passphrase != NULL ? FLAG_ENCRYPTED : 0) |
+                            (encInfo->scatter ? FLAG_SCATTERED : 0) | (encInfo->shard != NULL ? FLAG_SHARDED : 0);
+
+    // Check capacity, the header holds the real extension
+    if (encInfo->image_capacity >= stego_required_capacity(encInfo->extn_secret_file, encInfo->format_flags, encInfo->size_payload))
     {
         return e_success;
     }
@@ -316,13 +823,34 @@ Status check_capacity(EncodeInfo *encInfo)
 /* get file size 
  * Input: File pointer
  * Output: Size of file
- * Description: Finds the size of the file
- * Return value: Size of file
+ * Description: Finds the size of the file without moving the file position
+ * Return value: Size of file, 0 for pipes and other files without a size
+ */
+size_t get_file_size(FILE *fptr)
+{
+    struct stat st;
+
+    if (fstat(fileno(fptr), &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        return 0;
+    }
+    return st.st_size;
+}
+
+/* Set secret file extension
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Extension stored along with the secret data
+ * Description: Secret data read from stdin is stored as .txt, an archive as ARCHIVE_EXTN
+ * Return value: None
  */
-uint get_file_size(FILE *fptr)
+void set_secret_file_extn(EncodeInfo *encInfo)
 {
-    fseek(fptr, 0, SEEK_END);
-    return ftell(fptr);
+    if (encInfo->archive)
+    {
+        strcpy(encInfo->extn_secret_file, ARCHIVE_EXTN);
+        return;
+    }
+    strcpy(encInfo->extn_secret_file, IS_STREAM_FNAME(encInfo->secret_fname) ? ".txt" : strstr(encInfo->secret_fname, "."));
 }
 
 
@@ -334,8 +862,14 @@ uint get_file_size(FILE *fptr)
  */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
+    // Encode straight into the mapped stego image
+    if (encInfo->src_image_map != NULL)
+    {
+        return encode_data_to_map(magic_string, strlen(magic_string), encInfo);
+    }
+
     // Error handling for encoding magic string into stego image
-    if(encode_data_to_image((char *) magic_string, strlen(magic_string), encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    if(encode_data_to_image(magic_string, strlen(magic_string), encInfo) == e_failure)
     {
         printf("ERROR: encode_data_to_image function is failed\n");
         return e_failure;
@@ -345,80 +879,331 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
     
 }
 
-/* Encode data to image
- * Input: Data to be encoded and its size. source image and stego image file pointers
- * Output: Output image which encoded data
- * Description: Encodeds the provided data to image
- * Return value: e_success
+/* Encode block to uring
+ * Input: Data to be encoded and its size, bits per pixel byte, image buffer able
+ * to hold BMP_MAX_SPAN(size * 8 / bits) bytes and address of structure variable
+ * which holds the encoding data
+ * Output: Block encoded, pixel_pos advanced
+ * Description: encode_block_to_image on the io_uring streams, the source bytes
+ * come from the slots read ahead and the stego bytes go to a slot written out
+ * once full
+ * Return value: e_success, e_failure
  */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image)
+static Status encode_block_to_uring(const char *data, size_t size, uint bits, char *image_buffer, EncodeInfo *encInfo)
 {
-    // Temporary array get the RGB data of source image
-    char image_buffer[MAX_IMAGE_BUF_SIZE];
+    size_t pixels = size * 8 / bits;
+    size_t image_size;
 
-    // Read 8 bytes from source image each time to encode 1 byte of data and store the encoded data to stego image
-    for (int i = 0; i < size; i++)
+    if (encInfo->pixel_pos + pixels > encInfo->bmp.capacity)
+    {
+        return e_failure;
+    }
+    image_size = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos + pixels) - bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+    if (uring_read(&encInfo->src_stream, image_buffer, image_size) == e_failure)
+    {
+        return e_failure;
+    }
+    bmp_embed((unsigned char *) image_buffer, (unsigned char *) image_buffer, &encInfo->bmp, encInfo->pixel_pos, (const unsigned char *) data,
+              size, bits, 1);
+    if (uring_write(&encInfo->stego_stream, image_buffer, image_size) == e_failure)
     {
-        fread(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE, fptr_src_image);
-        encode_byte_to_lsb(data[i], image_buffer);
-        fwrite(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE, fptr_stego_image);
+        return e_failure;
     }
+    encInfo->pixel_pos += pixels;
 
     return e_success;
-
 }
 
-/* Encode Secret file data 
- * Input: Address of structure variable which holds encoding data 
- * Output: Image with Secret data encoded in it
- * Description: Encodes the content of secret file into stego image
- * Return value: e_success
+/* Encode data to image
+ * Input: Data to be encoded and its size, address of structure variable which holds the encoding data
+ * Output: Output image which encoded data
+ * Description: Encodeds the provided data to image, one bit per pixel byte. Meant for the short header
+ * fields, the data goes through a small local buffer a few bytes at a time
+ * Return value: e_success, e_failure
  */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo)
 {
-    // Get the secret file pointer to starting position
-    rewind(encInfo->fptr_secret);
+    // Temporary array get the RGB data of source image, row padding included
+    char image_buffer[BMP_MAX_SPAN(MAX_FIELD_BUF_SIZE)];
+    int chunk;
 
-    // Get data byte by byte from secret file and encode in stego image
-    while (!feof(encInfo->fptr_secret))
+    // Read 8 bytes from source image for every byte of data, as many as the buffer holds at a time
+    for (int i = 0; i < size; i += chunk)
     {
-        fread(encInfo->secret_data, sizeof(char), MAX_SECRET_BUF_SIZE, encInfo->fptr_secret);
-        encode_data_to_image(encInfo->secret_data, MAX_SECRET_BUF_SIZE, encInfo->fptr_src_image, encInfo->fptr_stego_image);
+        chunk = size - i < MAX_FIELD_BUF_SIZE / 8 ? size - i : MAX_FIELD_BUF_SIZE / 8;
+        if (encInfo->uring_active ? encode_block_to_uring(data + i, chunk, 1, image_buffer, encInfo) == e_failure
+                                  : encode_block_to_image(data + i, chunk, 1, image_buffer, &encInfo->bmp, &encInfo->pixel_pos,
+                                                          encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+        {
+            return e_failure;
+        }
     }
 
     return e_success;
+
 }
 
-/* Encode secret file size
- * Input: file size, Structre variable which holds the encoding data 
- * Output: Stego image with size encoded in it
- * Description: Encode the given file size to stego image
- * Return value: e_success
+/* Encode block to image
+ * Input: Data to be encoded and its size, bits per pixel byte, image buffer able
+ * to hold BMP_MAX_SPAN(size * 8 / bits) bytes, image layout, next pixel byte,
+ * source image and stego image file pointers
+ * Output: Output image with the encoded block, *pos advanced
+ * Description: Reads the RGB data for the whole block with a single fread, encodes
+ * every byte and writes the block back with a single fwrite. The block runs from
+ * the end of the previous one to its last pixel byte, so the row padding in
+ * between passes through unchanged
+ * Return value: e_success, e_failure on short read/write
  */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+Status encode_block_to_image(const char *data, size_t size, uint bits, char *image_buffer, const BmpInfo *bmp, size_t *pos,
+                             FILE *fptr_src_image, FILE *fptr_stego_image)
 {
-    char image_buffer[MAX_IMAGE_BUF_SIZE * 4];  // To encode 32 bits(4 bytes) we need 32 bytes
+    size_t pixels = size * 8 / bits;
+    size_t image_size;
 
-    // Read 32 bytes of RGB data from source image and encode it with secret data and store in stego image
-    fread(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE * 4, encInfo->fptr_src_image);
-    encode_size_to_lsb(encInfo->size_secret_file, image_buffer);
-    fwrite(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE * 4, encInfo->fptr_stego_image);
+    if (*pos + pixels > bmp->capacity)
+    {
+        return e_failure;
+    }
+    image_size = bmp_file_end(bmp, *pos + pixels) - bmp_file_end(bmp, *pos);
+    if (fread(image_buffer, sizeof(char), image_size, fptr_src_image) != image_size)
+    {
+        return e_failure;
+    }
+    bmp_embed((unsigned char *) image_buffer, (unsigned char *) image_buffer, bmp, *pos, (const unsigned char *) data, size, bits, 1);
+    if (fwrite(image_buffer, sizeof(char), image_size, fptr_stego_image) != image_size)
+    {
+        return e_failure;
+    }
+    *pos += pixels;
 
     return e_success;
 }
 
-/* Copy bmp header
- * Input: Source image and stego image file pointers
+/* Encode cipher to map
+ * Input: Data to be encoded, its size, bits per pixel byte, cipher or NULL and
+ * address of structure variable which holds the encoding data
+ * Output: Mapped stego image with encoded data
+ * Description: See encode_bits_to_map, the data is encrypted with the keystream
+ * from cipher_offset on when a cipher is given
+ * Return value: e_success, e_failure if the image is too short
+ */
+static Status encode_cipher_to_map(const char *data, size_t size, uint bits, const ChaCha *cipher, EncodeInfo *encInfo)
+{
+    size_t offset = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+    size_t pixels = size * 8 / bits;
+    size_t end;
+
+    // Every byte of data takes 8 / bits bytes of RGB data
+    if (pixels > encInfo->bmp.capacity - encInfo->pixel_pos)
+    {
+        return e_failure;
+    }
+
+    bmp_embed_cipher((unsigned char *) encInfo->stego_image_map + offset, (const unsigned char *) encInfo->src_image_map + offset, &encInfo->bmp,
+                     encInfo->pixel_pos, (const unsigned char *) data, size, bits, cipher, encInfo->cipher_offset,
+                     encInfo->num_threads > 1 ? encInfo->num_threads : 1);
+    encInfo->pixel_pos += pixels;
+
+    end = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+    map_release(encInfo->src_image_map, offset, end);
+    map_release(encInfo->stego_image_map, offset, end);
+
+    return e_success;
+}
+
+/* Encode data to map
+ * Input: Data to be encoded, its size and address of structure variable which holds the encoding data
+ * Output: Mapped stego image with encoded data
+ * Description: Encodes one bit per image byte, used for the header fields
+ * Return value: e_success, e_failure if the image is too short
+ */
+Status encode_data_to_map(const char *data, size_t size, EncodeInfo *encInfo)
+{
+    return encode_bits_to_map(data, size, 1, encInfo);
+}
+
+/* Encode bits to map
+ * Input: Data to be encoded, its size, bits per pixel byte and address of
+ * structure variable which holds the encoding data
+ * Output: Mapped stego image with encoded data
+ * Description: Reads the RGB data from the mapped source image and writes the encoded
+ * bytes straight to the mapped stego image, no intermediate buffer involved.
+ * The row padding in between is copied along. The pages of both images are
+ * released behind the data, callers keep size within a window
+ * Return value: e_success, e_failure if the image is too short
+ */
+Status encode_bits_to_map(const char *data, size_t size, uint bits, EncodeInfo *encInfo)
+{
+    return encode_cipher_to_map(data, size, bits, NULL, encInfo);
+}
+
+/* Encode payload to map
+ * Input: Secret data, its size and address of structure variable which holds
+ * the encoding data
+ * Output: Mapped stego image with the data encoded at lsb_bits bits per image byte
+ * Description: With a key the data is XORed with the keystream from
+ * cipher_offset on inside the row walk (bmp_embed_cipher), tile by tile on
+ * every thread, so it is read once and never copied
+ * Return value: e_success, e_failure if the image is too short
+ */
+Status encode_payload_to_map(const char *data, size_t size, EncodeInfo *encInfo)
+{
+    const ChaCha *cipher = encInfo->passphrase != NULL ? &encInfo->key.cipher : NULL;
+
+    if (encode_cipher_to_map(data, size, encInfo->lsb_bits, cipher, encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    encInfo->cipher_offset += size;
+    return e_success;
+}
+
+/* Encode size to map
+ * Input: Size to be encoded, bytes of its field (4 or 8) and address of structure
+ * variable which holds the encoding data
+ * Output: Mapped stego image with encoded size
+ * Description: The size is stored MSB first, which is the same as encoding
+ * its bytes in big endian order
+ * Return value: e_success, e_failure
+ */
+Status encode_size_to_map(size_t size, uint field_size, EncodeInfo *encInfo)
+{
+    unsigned char size_bytes[8];
+
+    return encode_data_to_map((char *) size_bytes, stego_put_size(size_bytes, size, field_size), encInfo);
+}
+
+/* Encode Secret file data 
+ * Input: Address of structure variable which holds encoding data 
+ * Output: Image with Secret data encoded in it
+ * Description: Encodes the content of secret file into stego image. Either
+ * way only a window or a block of the files is in memory at a time
+ * Return value: e_success
+ */
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    size_t remaining = encInfo->size_secret_file;
+    size_t chunk;
+
+    encInfo->chunk_fill = 0;
+    encInfo->chunk_crc = 0;
+    encInfo->chunk_block = NO_BLOCK;
+    encInfo->cipher_offset = 0;
+    if (encInfo->compress)
+    {
+        return encode_compressed_data(-1, encInfo);
+    }
+    if (encInfo->checksum && encInfo->src_image_map != NULL)
+    {
+        return encode_checked_map(encInfo);
+    }
+
+    // Whole secret file is mapped, encode it window by window and drop the pages behind
+    if (encInfo->src_image_map != NULL)
+    {
+        for (size_t done = 0; done < encInfo->size_secret_file; done += chunk)
+        {
+            chunk = encInfo->size_secret_file - done < MAP_WINDOW_DATA_SIZE(encInfo->lsb_bits) ? encInfo->size_secret_file - done
+                                                                                              : MAP_WINDOW_DATA_SIZE(encInfo->lsb_bits);
+            if (encode_payload_to_map(encInfo->secret_map + done, chunk, encInfo) == e_failure)
+            {
+                return e_failure;
+            }
+            map_release(encInfo->secret_map, done, done + chunk);
+        }
+        return e_success;
+    }
+
+    // Get data block by block from secret file and encode in stego image, exactly the encoded size.
+    // Nothing has been read from the secret file yet, so it may be a pipe
+    while (remaining > 0)
+    {
+        chunk = remaining < MAX_SECRET_BUF_SIZE ? remaining : MAX_SECRET_BUF_SIZE;
+        if (encInfo->uring_secret ? uring_read(&encInfo->secret_stream, encInfo->secret_data, chunk) == e_failure
+                                  : fread(encInfo->secret_data, sizeof(char), chunk, encInfo->fptr_secret) != chunk)
+        {
+            return e_failure;
+        }
+        if (embed_payload_bytes(-1, encInfo->secret_data, chunk, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        remaining -= chunk;
+    }
+
+    return embed_payload_end(-1, encInfo);
+}
+
+/* Encode secret file size
+ * Input: file size, Structre variable which holds the encoding data 
+ * Output: Stego image with size encoded in it
+ * Description: Encode the given file size to stego image, in 32 bits or, above
+ * 4 GiB, in the 64 bits FLAG_SIZE64 announced in the extension size field.
+ * Compressed data is followed by its size before compression, in 64 bits,
+ * encrypted data by the salt and check of its key, a shard by its shard fields.
+ * Checksummed data gets the CRC32C of the header fields behind that
+ * Return value: e_success
+ */
+Status encode_secret_file_size(size_t file_size, EncodeInfo *encInfo)
+{
+    // The size is stored MSB first, i.e. as big endian bytes
+    unsigned char size_bytes[8 + RAW_SIZE_FIELD_BYTES + KEY_FIELD_BYTES + SHARD_FIELD_BYTES + CRC_FIELD_BYTES];
+    unsigned char fields[STEGO_MAX_HEADER_SIZE];
+    size_t field_size = stego_put_size(size_bytes, file_size, SIZE_FIELD_BYTES(SIZE_TO_FLAGS(file_size)));
+
+    if (encInfo->compress)
+    {
+        field_size += stego_put_size(size_bytes + field_size, encInfo->size_secret_file, RAW_SIZE_FIELD_BYTES);
+    }
+    if (encInfo->passphrase != NULL)
+    {
+        memcpy(size_bytes + field_size, encInfo->key.fields, KEY_FIELD_BYTES);
+        field_size += KEY_FIELD_BYTES;
+    }
+    if (encInfo->shard != NULL)
+    {
+        field_size += stego_put_shard(size_bytes + field_size, encInfo->shard);
+    }
+    if (encInfo->checksum)
+    {
+        uint crc = crc32c(0, fields, stego_put_fields(fields, encInfo->extn_secret_file, encInfo->format_flags, file_size, encInfo->size_secret_file,
+                                                      encInfo->key.fields, encInfo->shard));
+
+        field_size += stego_put_size(size_bytes + field_size, crc, CRC_FIELD_BYTES);
+    }
+    if (encInfo->src_image_map != NULL)
+    {
+        return encode_data_to_map((char *) size_bytes, field_size, encInfo);
+    }
+
+    // Read the RGB data of 32 pixel bytes per size byte from source image and encode it with secret data and store in stego image
+    return encode_data_to_image((char *) size_bytes, field_size, encInfo);
+}
+
+/* Copy bmp header
+ * Input: Source image bmp header and its layout, source and stego image file pointers
  * Output: Stego image with same bmp header as source image header
- * Description: Copies the source image bmp header to stego image
- * return value: e_success
+ * Description: Writes the header read by read_bmp_header to stego image, then
+ * copies whatever lies between it and the first row (the rest of a larger DIB
+ * header, bit masks, a gap) as it is
+ * return value: e_success, e_failure
  */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+Status copy_bmp_header(const char *bmp_header, const BmpInfo *bmp, FILE *fptr_src_image, FILE *fptr_dest_image)
 {
-    char header[54] = {0};
-    rewind(fptr_src_image);
-    if(fread(header, sizeof(char), 54, fptr_src_image) != 54) return e_failure;
-    if(fwrite(header, sizeof(char), 54, fptr_dest_image) != 54) return e_failure;
+    char buffer[MAX_FIELD_BUF_SIZE];
+    size_t remaining = bmp->pixel_offset - BMP_HEADER_SIZE;
+    size_t chunk;
+
+    if(fwrite(bmp_header, sizeof(char), BMP_HEADER_SIZE, fptr_dest_image) != BMP_HEADER_SIZE) return e_failure;
+
+    for (; remaining > 0; remaining -= chunk)
+    {
+        chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        if (fread(buffer, sizeof(char), chunk, fptr_src_image) != chunk || fwrite(buffer, sizeof(char), chunk, fptr_dest_image) != chunk)
+        {
+            return e_failure;
+        }
+    }
 
     return e_success;
 }
@@ -431,25 +1216,23 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
  */
 Status encode_byte_to_lsb(char data, char *image_buffer)
 {
-    for (int i = 7, index = 0; i >= 0; index++, i--)
-    {
-        image_buffer[index] = (image_buffer[index] & ~1) | ((unsigned) data >> i & 1);
-    }
+    lsb_embed((unsigned char *) image_buffer, (unsigned char *) image_buffer, (unsigned char *) &data, 1);
     return e_success;
 }
 
 /* Encodes the size to lsb of RGB data
- * Input: size to be encoded and image buffer where data is to be encoded
+ * Input: size to be encoded, bytes of its field (4 or 8) and image buffer of
+ * field_size * 8 bytes where data is to be encoded
  * Output: Encoded image buffer with given size
  * Description: Encodes the given size to the lsb's of RGB data
  * Return value: e_success
  */
-Status encode_size_to_lsb(int size, char *image_buffer)
+Status encode_size_to_lsb(size_t size, uint field_size, char *image_buffer)
 {
-    for (int i = 31, index = 0; i >= 0; index++, i--)
-    {
-        image_buffer[index] = (image_buffer[index] & ~1) |  ((unsigned) size >> i & 1);
-    }
+    // MSB first is the same as the bytes in big endian order
+    unsigned char size_bytes[8];
+
+    lsb_embed((unsigned char *) image_buffer, (unsigned char *) image_buffer, size_bytes, stego_put_size(size_bytes, size, field_size));
     return e_success;
 }
 
@@ -462,15 +1245,29 @@ Status encode_size_to_lsb(int size, char *image_buffer)
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
    int size_secret_extn = strlen(file_extn);
-   char image_buffer[MAX_IMAGE_BUF_SIZE * 4];
+
+    // The format flags set by check_capacity share the field with the extension size
+    uint extn_field = size_secret_extn | encInfo->format_flags;
+    unsigned char size_bytes[4];
+
+    // Encode extension size and extension straight into the mapped stego image
+    if (encInfo->src_image_map != NULL)
+    {
+        if (encode_size_to_map(extn_field, 4, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        return encode_data_to_map(encInfo->extn_secret_file, size_secret_extn, encInfo);
+    }
 
     // Encode secret file extension size
-    fread(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE * 4, encInfo->fptr_src_image);
-    encode_size_to_lsb(size_secret_extn, image_buffer);
-    fwrite(image_buffer, sizeof(char), MAX_IMAGE_BUF_SIZE * 4, encInfo->fptr_stego_image);
+    if (encode_data_to_image((char *) size_bytes, stego_put_size(size_bytes, extn_field, 4), encInfo) == e_failure)
+    {
+        return e_failure;
+    }
 
     // Encode secret file extension
-    if (encode_data_to_image(encInfo->extn_secret_file, size_secret_extn, encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+    if (encode_data_to_image(encInfo->extn_secret_file, size_secret_extn, encInfo) == e_success)
     {
         return e_success;
     }
@@ -483,16 +1280,670 @@ Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 /* Copy left over data
  * Input: Source image and stego image file pointers
  * Output: Completely encoded stego image
- * Description: Encode the left over data from source image to stego image
- * Return value: e_success
+ * Description: Copies the left over data from source image to stego image. When
+ * the source is a regular file the kernel moves the data between the files
+ * (copy_image_region), otherwise it goes through stdio in large blocks
+ * Return value: e_success, e_failure
  */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    char temp;
-    while (fread(&temp, sizeof(char), 1, fptr_src) == 1)
+    struct stat st;
+    off_t in_offset, out_offset;
+    char *buffer;
+    size_t count;
+
+    // Seekable source: flush what stdio holds and copy by file offsets
+    if (fflush(fptr_dest) == 0 && fstat(fileno(fptr_src), &st) == 0 && S_ISREG(st.st_mode) &&
+        (in_offset = ftello(fptr_src)) != -1 && in_offset <= st.st_size)
+    {
+        // A pipe as destination has no offset, the data is appended to it
+        out_offset = ftello(fptr_dest);
+        if (copy_image_region(fileno(fptr_src), in_offset, fileno(fptr_dest), out_offset, st.st_size - in_offset) == e_failure)
+        {
+            return e_failure;
+        }
+
+        // Keep the stdio positions in step with what the kernel did
+        fseeko(fptr_src, 0, SEEK_END);
+        if (out_offset != -1)
+        {
+            fseeko(fptr_dest, out_offset + st.st_size - in_offset, SEEK_SET);
+        }
+        return e_success;
+    }
+
+    // Non seekable source, large blocks through stdio
+    if ((buffer = malloc(MAX_COPY_BUF_SIZE)) == NULL)
     {
-        if(fwrite(&temp, sizeof(char), 1, fptr_dest) != 1) return e_failure;
+        return e_failure;
     }
-    
+    while ((count = fread(buffer, sizeof(char), MAX_COPY_BUF_SIZE, fptr_src)) > 0)
+    {
+        if (fwrite(buffer, sizeof(char), count, fptr_dest) != count)
+        {
+            free(buffer);
+            return e_failure;
+        }
+    }
+    free(buffer);
+
+    return ferror(fptr_src) ? e_failure : e_success;
+}
+
+/* Sync parent directory
+ * Input: File name
+ * Output: The directory holding the file synced, so a rename into it is durable
+ * Return value: e_success, e_failure
+ */
+static Status sync_parent_dir(const char *fname)
+{
+    char dir_name[4096];
+    const char *slash = strrchr(fname, '/');
+    size_t size = slash == NULL ? 0 : slash == fname ? 1 : (size_t) (slash - fname);
+    int dir_fd;
+    Status status;
+
+    if (size >= sizeof(dir_name))
+    {
+        return e_failure;
+    }
+    if (size == 0)
+    {
+        strcpy(dir_name, ".");
+    }
+    else
+    {
+        memcpy(dir_name, fname, size);
+        dir_name[size] = '\0';
+    }
+    if ((dir_fd = open(dir_name, O_RDONLY | O_DIRECTORY)) == -1)
+    {
+        return e_failure;
+    }
+    status = fsync(dir_fd) == 0 ? e_success : e_failure;
+    close(dir_fd);
+
+    return status;
+}
+
+/* Encode in place
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Source image carrying the secret data
+ * Description: Direct mode patches the source image through its own descriptor.
+ * Atomic mode clones the source image to a temporary file next to it, patches the
+ * clone and renames it over the source, so readers see either the old or the new
+ * image, then syncs the directory so the rename survives a crash. Either way only
+ * the bytes holding the header and data are rewritten
+ * Return value: e_success, e_failure
+ */
+Status encode_in_place(EncodeInfo *encInfo)
+{
+    struct stat st;
+    char temp_fname[4096];
+    int fd = fileno(encInfo->fptr_src_image);
+    Status status;
+
+    if (encInfo->inplace_mode == e_inplace_direct)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Patching %s in place\n", encInfo->src_image_fname);
+        stats_begin(&encInfo->stats, e_phase_payload);
+        if ((status = patch_stego_image(fd, encInfo)) == e_success)
+        {
+            PRINT_INFO(encInfo->quiet, "INFO: Done\n");
+        }
+        close_files_for_encoding(encInfo);
+        return status;
+    }
+
+    // Clone the source next to itself so that rename stays on one filesystem
+    if (fstat(fd, &st) == -1 || snprintf(temp_fname, sizeof(temp_fname), "%s.XXXXXX", encInfo->src_image_fname) >= (int) sizeof(temp_fname))
+    {
+        close_files_for_encoding(encInfo);
+        return e_failure;
+    }
+    int temp_fd = mkstemp(temp_fname);
+    if (temp_fd == -1)
+    {
+        perror("mkstemp");
+        close_files_for_encoding(encInfo);
+        return e_failure;
+    }
+
+    PRINT_INFO(encInfo->quiet, "INFO: Cloning %s\n", encInfo->src_image_fname);
+    stats_begin(&encInfo->stats, e_phase_tail);
+    status = fchmod(temp_fd, st.st_mode & 07777) == 0 ? clone_image(fd, temp_fd, st.st_size) : e_failure;
+    if (status == e_success)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Patching the clone of %s\n", encInfo->src_image_fname);
+        stats_begin(&encInfo->stats, e_phase_payload);
+        status = patch_stego_image(temp_fd, encInfo);
+    }
+    if (status == e_success && fsync(temp_fd) == -1)
+    {
+        perror("fsync");
+        status = e_failure;
+    }
+    if (status == e_success && rename(temp_fname, encInfo->src_image_fname) == -1)
+    {
+        perror("rename");
+        status = e_failure;
+    }
+    else if (status == e_success && sync_parent_dir(encInfo->src_image_fname) == e_failure)
+    {
+        // The new image is in place already, only its name may not survive a crash
+        perror("fsync");
+        printf("ERROR: The directory of %s could not be synced\n", encInfo->src_image_fname);
+        close(temp_fd);
+        close_files_for_encoding(encInfo);
+        return e_failure;
+    }
+    if (status == e_success)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
+    }
+    else
+    {
+        unlink(temp_fname);
+    }
+    close(temp_fd);
+    close_files_for_encoding(encInfo);
+
+    return status;
+}
+
+/* Encode scattered
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Stego image carrying the secret data scattered over its tiles
+ * Description: The source image is cloned into the stego image, which then
+ * gets patched like in place encoding does. Tiles are read and written back
+ * one at a time, each once, in the order the data fills them
+ * Return value: e_success, e_failure
+ */
+Status encode_scattered(EncodeInfo *encInfo)
+{
+    struct stat st, st_stego;
+    int fd = fileno(encInfo->fptr_stego_image);
+    Status status;
+
+    if (fstat(fileno(encInfo->fptr_src_image), &st) == -1 || !S_ISREG(st.st_mode) || fstat(fd, &st_stego) == -1 || !S_ISREG(st_stego.st_mode))
+    {
+        printf("ERROR: Scattering needs %s and %s to be regular files\n", encInfo->src_image_fname, encInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    PRINT_INFO(encInfo->quiet, "INFO: Cloning %s\n", encInfo->src_image_fname);
+    stats_begin(&encInfo->stats, e_phase_tail);
+    status = clone_image(fileno(encInfo->fptr_src_image), fd, st.st_size);
+    if (status == e_success)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Scattering %s over %s\n", encInfo->secret_fname, encInfo->stego_image_fname);
+        stats_begin(&encInfo->stats, e_phase_payload);
+        status = patch_stego_image(fd, encInfo);
+    }
+    if (status == e_success)
+    {
+        PRINT_INFO(encInfo->quiet, "INFO: Done\n");
+    }
+    close_files_for_encoding(encInfo);
+
+    return status;
+}
+
+/* Clone image
+ * Input: Source and destination fds and the size of the source
+ * Output: Destination with the same content as the source
+ * Description: FICLONE shares all extents, which costs no data I/O on reflink
+ * capable filesystems. Elsewhere the copy falls back to copy_image_region
+ * Return value: e_success, e_failure
+ */
+Status clone_image(int fd_src, int fd_dest, off_t size)
+{
+    if (ioctl(fd_dest, FICLONE, fd_src) == 0)
+    {
+        return e_success;
+    }
+    return copy_image_region(fd_src, 0, fd_dest, 0, size);
+}
+
+/* Patch region
+ * Input: fd of the image, data and its size, bits per pixel byte and address of
+ * structure variable which holds the encoding data
+ * Output: Image region behind pixel byte pixel_pos carrying the data
+ * Description: Reads the region with pread, embeds in place and writes it back
+ * with pwrite. Row padding inside the region is written back as it was read
+ * Return value: e_success, e_failure
+ */
+static Status patch_region(int fd, const unsigned char *data, size_t size, uint bits, EncodeInfo *encInfo)
+{
+    size_t pixels = size * 8 / bits;
+    off_t offset = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+    ssize_t image_size = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos + pixels) - offset;
+
+    // Behind the header of scattered data the pixel bytes are the ones of the data tiles
+    if (encInfo->scatter_active)
+    {
+        if (scatter_write(&encInfo->scatter_state, encInfo->pixel_pos - encInfo->scatter_state.base, data, size, bits) == e_failure)
+        {
+            return e_failure;
+        }
+        encInfo->pixel_pos += pixels;
+        return e_success;
+    }
+    if (encInfo->pixel_pos + pixels > encInfo->bmp.capacity || pread(fd, encInfo->image_data, image_size, offset) != image_size)
+    {
+        return e_failure;
+    }
+    bmp_embed((unsigned char *) encInfo->image_data, (unsigned char *) encInfo->image_data, &encInfo->bmp, encInfo->pixel_pos, data, size, bits, 1);
+    if (pwrite(fd, encInfo->image_data, image_size, offset) != image_size)
+    {
+        return e_failure;
+    }
+    encInfo->pixel_pos += pixels;
+
+    return e_success;
+}
+
+/* Patch secret data
+ * Input: fd of the image to patch, the header in, and address of structure
+ * variable which holds the encoding data
+ * Output: Image region behind the header carrying the secret data
+ * Description: The secret file is read block by block with pread, compressed
+ * data goes through encode_compressed_data
+ * Return value: e_success, e_failure
+ */
+static Status patch_secret_data(int fd, EncodeInfo *encInfo)
+{
+    size_t secret_offset = 0;
+    size_t chunk;
+
+    if (encInfo->compress)
+    {
+        return encode_compressed_data(fd, encInfo);
+    }
+
+    while (secret_offset < encInfo->size_secret_file)
+    {
+        chunk = encInfo->size_secret_file - secret_offset < MAX_SECRET_BUF_SIZE ? encInfo->size_secret_file - secret_offset : MAX_SECRET_BUF_SIZE;
+        if (pread(fileno(encInfo->fptr_secret), encInfo->secret_data, chunk, encInfo->secret_offset + secret_offset) != (ssize_t) chunk ||
+            embed_payload_bytes(fd, encInfo->secret_data, chunk, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        secret_offset += chunk;
+    }
+
+    return embed_payload_end(fd, encInfo);
+}
+
+/* Patch stego image
+ * Input: fd of the image to patch and address of structure variable which holds the encoding data
+ * Output: Image carrying the header and secret data
+ * Description: Builds the header (magic string, extension size, extension, data
+ * size) as plain bytes with stego_build_header, then patches the image region behind it and behind every
+ * secret block with patch_region. Scattered data goes to the tiles behind the
+ * header, the last one is written back at the end.
+ * Nothing outside the modified region, or the tiles of scattered data, is read or written
+ * Return value: e_success, e_failure
+ */
+Status patch_stego_image(int fd, EncodeInfo *encInfo)
+{
+    unsigned char header[STEGO_MAX_HEADER_SIZE];
+    uint size_header = stego_build_header(header, encInfo->extn_secret_file, encInfo->size_payload, encInfo->compress ? encInfo->size_secret_file : 0,
+                                          encInfo->checksum, encInfo->passphrase != NULL ? &encInfo->key : NULL, encInfo->scatter, encInfo->shard,
+                                          encInfo->lsb_bits, &encInfo->bmp);
+    Status status;
+
+    if (size_header == 0)
+    {
+        return e_failure;
+    }
+
+    // Header first, then the secret data block by block
+    encInfo->pixel_pos = 0;
+    encInfo->chunk_fill = 0;
+    encInfo->chunk_crc = 0;
+    encInfo->chunk_block = NO_BLOCK;
+    encInfo->cipher_offset = 0;
+    if (patch_region(fd, header, size_header, 1, encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    if (encInfo->scatter)
+    {
+        scatter_init(&encInfo->scatter_state, &encInfo->key.cipher, &encInfo->bmp, encInfo->pixel_pos, fd);
+        encInfo->scatter_active = 1;
+    }
+
+    status = patch_secret_data(fd, encInfo);
+    if (encInfo->scatter_active)
+    {
+        encInfo->scatter_active = 0;
+        status = status == e_success ? scatter_flush(&encInfo->scatter_state) : e_failure;
+    }
+
+    return status;
+}
+
+/* Get payload size
+ * Input: Address of structure variable which holds the encoding data
+ * Output: size_payload, the bytes the data takes in the image
+ * Description: Without compression that is the secret data itself. With it the
+ * secret file is compressed once here only to count the bytes of the block
+ * stream, which the size field and the capacity check need before the first
+ * block gets embedded. The blocks are compressed again while embedding, the
+ * same way, so no more than one block is ever held. That needs a secret the
+ * file can be read twice from, not a pipe
+ * Return value: e_success, e_failure
+ */
+Status get_payload_size(EncodeInfo *encInfo)
+{
+    int fd = fileno(encInfo->fptr_secret);
+    size_t offset, chunk;
+
+    encInfo->size_payload = encInfo->size_secret_file;
+    if (!encInfo->compress)
+    {
+        return e_success;
+    }
+    if (get_file_size(encInfo->fptr_secret) < encInfo->size_secret_file)
+    {
+        printf("ERROR: Compression needs the secret data in a regular file\n");
+        return e_failure;
+    }
+
+    PRINT_INFO(encInfo->quiet, "INFO: Compressing %s\n", encInfo->secret_fname);
+    encInfo->size_payload = 0;
+    for (offset = 0; offset < encInfo->size_secret_file; offset += chunk)
+    {
+        chunk = encInfo->size_secret_file - offset < LZ_BLOCK_SIZE ? encInfo->size_secret_file - offset : LZ_BLOCK_SIZE;
+        if (pread(fd, encInfo->lz_raw, chunk, offset) != (ssize_t) chunk)
+        {
+            return e_failure;
+        }
+        encInfo->size_payload += lz_encode_block((unsigned char *) encInfo->lz_block, (unsigned char *) encInfo->lz_raw, chunk);
+    }
+    PRINT_INFO(encInfo->quiet, "INFO: Done. %zu bytes compressed to %zu\n", encInfo->size_secret_file, encInfo->size_payload);
+
+    return e_success;
+}
+
+/* Embed image bytes
+ * Input: fd of the image to patch or -1, data and its size and address of
+ * structure variable which holds the encoding data
+ * Output: Data embedded behind pixel byte pixel_pos by whichever engine runs
+ * Description: Cut into pieces the buffers of the stdio and in place engines hold
+ * Return value: e_success, e_failure
+ */
+static Status embed_image_bytes(int fd, const char *data, size_t size, EncodeInfo *encInfo)
+{
+    size_t chunk;
+    Status status;
+
+    if (fd == -1 && encInfo->src_image_map != NULL)
+    {
+        return encode_bits_to_map(data, size, encInfo->lsb_bits, encInfo);
+    }
+    for (size_t done = 0; done < size; done += chunk)
+    {
+        chunk = size - done < MAX_SECRET_BUF_SIZE ? size - done : MAX_SECRET_BUF_SIZE;
+        if (fd != -1)
+        {
+            status = patch_region(fd, (const unsigned char *) data + done, chunk, encInfo->lsb_bits, encInfo);
+        }
+        else if (encInfo->uring_active)
+        {
+            status = encode_block_to_uring(data + done, chunk, encInfo->lsb_bits, encInfo->image_data, encInfo);
+        }
+        else
+        {
+            status = encode_block_to_image(data + done, chunk, encInfo->lsb_bits, encInfo->image_data, &encInfo->bmp, &encInfo->pixel_pos,
+                                           encInfo->fptr_src_image, encInfo->fptr_stego_image);
+        }
+        if (status == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    return e_success;
+}
+
+/* Embed chunk trailer
+ * Input: fd of the image to patch or -1 and address of structure variable
+ * which holds the encoding data
+ * Output: Trailer of the chunk embedded so far, next chunk started
+ * Return value: e_success, e_failure
+ */
+static Status embed_chunk_trailer(int fd, EncodeInfo *encInfo)
+{
+    unsigned char trailer[TRAILER_BYTES(FLAG_COMPRESSED)];
+    size_t bytes = stego_put_trailer(trailer, encInfo->chunk_crc, encInfo->format_flags, encInfo->chunk_block, encInfo->chunk_block_index);
+
+    encInfo->chunk_fill = 0;
+    encInfo->chunk_crc = 0;
+    encInfo->chunk_block = NO_BLOCK;
+    return embed_image_bytes(fd, (const char *) trailer, bytes, encInfo);
+}
+
+/* Embed framed bytes
+ * Input: fd of the image to patch or -1, data and its size and address of
+ * structure variable which holds the encoding data
+ * Output: Data embedded behind pixel byte pixel_pos
+ * Description: Checksummed data is cut at the chunk ends, the CRC32C of a chunk
+ * grows with every piece and the trailer goes in as soon as the chunk is full
+ * Return value: e_success, e_failure
+ */
+static Status embed_framed_bytes(int fd, const char *data, size_t size, EncodeInfo *encInfo)
+{
+    size_t piece;
+
+    if (!encInfo->checksum)
+    {
+        return embed_image_bytes(fd, data, size, encInfo);
+    }
+    for (size_t done = 0; done < size; done += piece)
+    {
+        piece = CHUNK_SIZE - encInfo->chunk_fill < size - done ? CHUNK_SIZE - encInfo->chunk_fill : size - done;
+        encInfo->chunk_crc = crc32c(encInfo->chunk_crc, data + done, piece);
+        if (embed_image_bytes(fd, data + done, piece, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        if ((encInfo->chunk_fill += piece) == CHUNK_SIZE && embed_chunk_trailer(fd, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    return e_success;
+}
+
+/* Embed payload bytes
+ * Input: fd of the image to patch or -1, data and its size and address of
+ * structure variable which holds the encoding data
+ * Output: Data embedded behind pixel byte pixel_pos
+ * Description: With a key the data is encrypted into cipher_data a block at a
+ * time before it is framed, so the chunk CRC32C covers it as embedded.
+ * Callers end the data with embed_payload_end
+ * Return value: e_success, e_failure
+ */
+Status embed_payload_bytes(int fd, const char *data, size_t size, EncodeInfo *encInfo)
+{
+    size_t piece;
+
+    if (encInfo->passphrase == NULL)
+    {
+        return embed_framed_bytes(fd, data, size, encInfo);
+    }
+    for (size_t done = 0; done < size; done += piece)
+    {
+        piece = size - done < MAX_SECRET_BUF_SIZE ? size - done : MAX_SECRET_BUF_SIZE;
+        chacha_xor(&encInfo->key.cipher, encInfo->cipher_offset, (unsigned char *) encInfo->cipher_data, (const unsigned char *) data + done, piece);
+        encInfo->cipher_offset += piece;
+        if (embed_framed_bytes(fd, encInfo->cipher_data, piece, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    return e_success;
+}
+
+/* Embed payload end
+ * Input: fd of the image to patch or -1 and address of structure variable
+ * which holds the encoding data
+ * Output: Trailer of a short last chunk of checksummed data
+ * Return value: e_success, e_failure
+ */
+Status embed_payload_end(int fd, EncodeInfo *encInfo)
+{
+    return encInfo->checksum && encInfo->chunk_fill > 0 ? embed_chunk_trailer(fd, encInfo) : e_success;
+}
+
+/* Encode checked map
+ * Input: Address of structure variable which holds the encoding data
+ * Output: Mapped stego image carrying the secret data in checksummed chunks
+ * Description: Goes a window of whole chunks at a time. stego_embed_chunks
+ * spreads the chunks of a window over the threads, each encrypting its chunks
+ * when there is a key and computing their CRC32C, then the pages of all three
+ * maps are released
+ * Return value: e_success
+ */
+Status encode_checked_map(EncodeInfo *encInfo)
+{
+    StegoHeader header;
+    size_t total = CHUNK_COUNT(encInfo->size_secret_file);
+    size_t per_window = MAP_WINDOW_DATA_SIZE(encInfo->lsb_bits) / CHUNK_SIZE;
+    size_t count, start, end;
+
+    header.size = encInfo->size_secret_file;
+    header.format_flags = encInfo->format_flags;
+    header.lsb_bits = encInfo->lsb_bits;
+    header.data_offset = encInfo->pixel_pos;
+    header.bmp = encInfo->bmp;
+    header.cipher = encInfo->passphrase != NULL ? &encInfo->key.cipher : NULL;
+    per_window = per_window > 0 ? per_window : 1;
+
+    for (size_t first = 0; first < total; first += count)
+    {
+        count = total - first < per_window ? total - first : per_window;
+        start = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+        stego_embed_chunks((unsigned char *) encInfo->stego_image_map, (const unsigned char *) encInfo->src_image_map,
+                           encInfo->secret_map + first * CHUNK_SIZE, &header, first, count, encInfo->num_threads > 1 ? encInfo->num_threads : 1);
+        encInfo->pixel_pos = stego_chunks_end(&header, first + count);
+
+        end = bmp_file_end(&encInfo->bmp, encInfo->pixel_pos);
+        map_release(encInfo->src_image_map, start, end);
+        map_release(encInfo->stego_image_map, start, end);
+        map_release(encInfo->secret_map, first * CHUNK_SIZE, (first + count) * CHUNK_SIZE < header.size ? (first + count) * CHUNK_SIZE : header.size);
+    }
+
     return e_success;
 }
+
+/* Encode compressed data
+ * Input: fd of the image to patch in place, -1 for the mapped and stdio
+ * engines, and address of structure variable which holds the encoding data
+ * Output: Image carrying the lz block stream of the secret data
+ * Description: Takes one LZ_BLOCK_SIZE block of the secret file at a time,
+ * from the map or with pread, encodes it and embeds the encoded block. The
+ * trailer of a chunk of checksummed data points to the first block starting in it
+ * Return value: e_success, e_failure, also when the stream came out different
+ * from the one get_payload_size counted
+ */
+Status encode_compressed_data(int fd, EncodeInfo *encInfo)
+{
+    const char *raw;
+    size_t offset, chunk, size, embedded = 0;
+
+    for (offset = 0; offset < encInfo->size_secret_file; offset += chunk)
+    {
+        chunk = encInfo->size_secret_file - offset < LZ_BLOCK_SIZE ? encInfo->size_secret_file - offset : LZ_BLOCK_SIZE;
+        raw = encInfo->secret_map != NULL ? encInfo->secret_map + offset : encInfo->lz_raw;
+        if (encInfo->secret_map == NULL && pread(fileno(encInfo->fptr_secret), encInfo->lz_raw, chunk, offset) != (ssize_t) chunk)
+        {
+            return e_failure;
+        }
+        size = lz_encode_block((unsigned char *) encInfo->lz_block, (const unsigned char *) raw, chunk);
+        if (encInfo->checksum && encInfo->chunk_block == NO_BLOCK)
+        {
+            encInfo->chunk_block = encInfo->chunk_fill;
+            encInfo->chunk_block_index = offset / LZ_BLOCK_SIZE;
+        }
+        if ((embedded += size) > encInfo->size_payload || embed_payload_bytes(fd, encInfo->lz_block, size, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        if (encInfo->secret_map != NULL)
+        {
+            map_release(encInfo->secret_map, offset, offset + chunk);
+        }
+    }
+
+    return embedded == encInfo->size_payload ? embed_payload_end(fd, encInfo) : e_failure;
+}
+
+/* Copy image region
+ * Input: Source fd and offset, destination fd and offset (-1 to append at the
+ * current position, e.g. for pipes) and number of bytes
+ * Output: Region copied from source to destination
+ * Description: copy_file_range first, which stays in the kernel and can share
+ * extents on reflink capable filesystems, then sendfile, then pread/write with
+ * a MAX_COPY_BUF_SIZE buffer. Each step picks up where the previous one stopped
+ * Return value: e_success, e_failure
+ */
+Status copy_image_region(int fd_in, off_t offset_in, int fd_out, off_t offset_out, off_t size)
+{
+    loff_t in = offset_in, out = offset_out;
+    ssize_t count, written;
+    char *buffer;
+
+    // Kernel side copy between the files
+    while (size > 0 && (count = copy_file_range(fd_in, &in, fd_out, offset_out == -1 ? NULL : &out, size, 0)) > 0)
+    {
+        size -= count;
+    }
+
+    // sendfile writes at the current position of fd_out
+    if (size > 0 && (offset_out == -1 || lseek(fd_out, out, SEEK_SET) != -1))
+    {
+        while (size > 0 && (count = sendfile(fd_out, fd_in, &in, size)) > 0)
+        {
+            size -= count;
+            out += count;
+        }
+    }
+    if (size == 0)
+    {
+        return e_success;
+    }
+
+    // Neither is supported for this pair of files, copy through a large buffer
+    if ((buffer = malloc(MAX_COPY_BUF_SIZE)) == NULL)
+    {
+        return e_failure;
+    }
+    while (size > 0)
+    {
+        count = pread(fd_in, buffer, size < MAX_COPY_BUF_SIZE ? size : MAX_COPY_BUF_SIZE, in);
+        if (count <= 0)
+        {
+            break;
+        }
+        for (ssize_t done = 0; done < count; done += written)
+        {
+            written = offset_out == -1 ? write(fd_out, buffer + done, count - done) : pwrite(fd_out, buffer + done, count - done, out + done);
+            if (written <= 0)
+            {
+                free(buffer);
+                return e_failure;
+            }
+        }
+        in += count;
+        out += count;
+        size -= count;
+    }
+    free(buffer);
+
+    return size == 0 ? e_success : e_failure;
+}
@@ -2,6 +2,13 @@
 #define ENCODE_H
 
 #include "types.h" // Contains user defined types
+#include "common.h"
+#include "bmp.h"
+#include "lz.h"
+#include "stats.h"
+#include "stego.h"
+#include "scatter.h"
+#include "uring.h"
 
 /* 
  * Structure to store information required for
@@ -10,30 +17,120 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+/* Secret bytes per block of the stdio pipeline, override with -DMAX_SECRET_BUF_SIZE=n */
+#ifndef MAX_SECRET_BUF_SIZE
+#define MAX_SECRET_BUF_SIZE (64 * 1024)
+#endif
+#define MAX_IMAGE_BUF_SIZE BMP_MAX_SPAN(MAX_SECRET_BUF_SIZE * 8)
+
+/* Buffer for copying the untouched image data when the kernel can't do it */
+#define MAX_COPY_BUF_SIZE (1024 * 1024)
 #define MAX_FILE_SUFFIX 4
 
+/* Where the stego image goes */
+typedef enum
+{
+    e_inplace_off,      /* new stego image file */
+    e_inplace_direct,   /* patch the source image itself */
+    e_inplace_atomic    /* patch a clone of the source image, then rename it over the source */
+} InplaceMode;
+
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
-    uint image_capacity;
+    size_t image_capacity;
     uint bits_per_pixel;
+    char bmp_header[BMP_HEADER_SIZE];
+    BmpInfo bmp;
+    size_t pixel_pos;           /* next pixel byte to embed into */
     char image_data[MAX_IMAGE_BUF_SIZE];
 
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
-    char extn_secret_file[MAX_FILE_SUFFIX];
+    char extn_secret_file[MAX_FILE_SUFFIX + 1];
     char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file;
+    size_t size_secret_file;    /* preset for secret data on stdin (-s) */
+    size_t size_payload;        /* bytes embedded: the secret data or its lz block stream */
+
+    /* Sharding: the slice of the secret file this image carries, from secret_offset on for
+       size_secret_file bytes, NULL for the whole file */
+    const StegoShard *shard;
+    size_t secret_offset;
+
+    /* The secret file lists the files to bundle (-a), the archive is built in a temporary file */
+    int archive;
+    size_t archive_entries;
 
     /* Stego Image Info */
     char *stego_image_fname;
+    char stego_fname_buf[MAX_FNAME_SIZE];
     FILE *fptr_stego_image;
 
+    /* Memory mapped views used by the zero-copy engine */
+    char *src_image_map;
+    char *stego_image_map;
+    char *secret_map;
+    size_t image_map_size;
+
+    /* io_uring engine (-U), NULL when off. Once the bmp header is copied the stdio pipeline reads
+       the source image and writes the stego image through streams on the ring, the secret file too
+       unless it is a pipe or gets compressed */
+    Uring *uring;
+    int uring_active;
+    int uring_secret;
+    UringStream src_stream;
+    UringStream stego_stream;
+    UringStream secret_stream;
+
+    /* Threads used by the zero-copy engine, 0 or 1 runs serially */
+    int num_threads;
+
+    /* Suppress the INFO messages */
+    int quiet;
+
+    /* In place encoding, only the modified region of the image is written */
+    InplaceMode inplace_mode;
+
+    /* Secret data bits per image byte: 1, 2 or 4 */
+    uint lsb_bits;
+
+    /* Compress the secret data before embedding (-z), one raw and one encoded block at a time */
+    int compress;
+    char lz_raw[LZ_BLOCK_SIZE];
+    char lz_block[LZ_MAX_BLOCK_SIZE];
+
+    /* Frame the embedded data in chunks with a CRC32C each (-c), the chunk being embedded and,
+       for compressed data, the offset in it and index of the first block starting in it */
+    int checksum;
+    size_t chunk_fill;
+    uint chunk_crc;
+    uint chunk_block;
+    size_t chunk_block_index;
+
+    /* Encrypt the data after compression (-P or -K): the passphrase or key file content, NULL for
+       none, the key derived from it, the stream offset of the next data byte and a buffer the
+       stdio and in place engines encrypt into */
+    const char *passphrase;
+    size_t passphrase_size;
+    StegoKey key;
+    size_t cipher_offset;
+    char cipher_data[MAX_SECRET_BUF_SIZE];
+
+    /* Scatter the data pixel bytes by the key (-r): the clone of the source image is patched a tile
+       at a time, scatter_active once the header is in */
+    int scatter;
+    int scatter_active;
+    Scatter scatter_state;
+
+    /* Format flags stored along with the extension size */
+    uint format_flags;
+
+    /* Per phase counters, reported on stderr when a format is set (-t) */
+    StatsInfo stats;
+
 } EncodeInfo;
 
 
@@ -55,13 +152,25 @@ Status open_files(EncodeInfo *encInfo);
 Status check_capacity(EncodeInfo *encInfo);
 
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+size_t get_image_size_for_bmp(const char *bmp_header);
+
+/* Read the bmp header of the source image */
+Status read_bmp_header(EncodeInfo *encInfo);
+
+/* Bundle the files listed in the secret file into a temporary archive that replaces it */
+Status open_archive(EncodeInfo *encInfo);
+
+/* Open a file, - stands for std_stream */
+FILE *open_stream(const char *fname, const char *mode, FILE *std_stream);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+size_t get_file_size(FILE *fptr);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Set the extension stored along with the secret data */
+void set_secret_file_extn(EncodeInfo *encInfo);
+
+/* Copy bmp image header and everything up to the first row */
+Status copy_bmp_header(const char *bmp_header, const BmpInfo *bmp, FILE *fptr_src_image, FILE *fptr_dest_image);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
@@ -70,21 +179,82 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(size_t file_size, EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Bytes to embed for the secret data, compressed or not */
+Status get_payload_size(EncodeInfo *encInfo);
+
+/* Compress the secret data block by block and embed it, into the image behind fd when it isn't -1 */
+Status encode_compressed_data(int fd, EncodeInfo *encInfo);
+
+/* Embed payload bytes, cut in chunks with a trailer each for checksummed data, into the image behind fd when it isn't -1 */
+Status embed_payload_bytes(int fd, const char *data, size_t size, EncodeInfo *encInfo);
+
+/* End the embedded payload, a short last chunk gets its trailer */
+Status embed_payload_end(int fd, EncodeInfo *encInfo);
+
+/* Encode the secret data in checksummed chunks straight into the mapped stego image, chunks spread over the threads */
+Status encode_checked_map(EncodeInfo *encInfo);
+
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image);
+Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo);
+
+/* Encode one block of data, bits bits per pixel byte from pixel byte *pos on, using the caller's image buffer */
+Status encode_block_to_image(const char *data, size_t size, uint bits, char *image_buffer, const BmpInfo *bmp, size_t *pos,
+                             FILE *fptr_src_image, FILE *fptr_stego_image);
 
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer);
 
-/* Encode a size into LSB of image data array */
-Status encode_size_to_lsb(int size, char *image_buffer);
+/* Encode a 4 or 8 byte size field into LSB of image data array */
+Status encode_size_to_lsb(size_t size, uint field_size, char *image_buffer);
 
 /* Copy remaining image bytes from src to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
 
+/* Encode into the source image itself, writing only the modified region */
+Status encode_in_place(EncodeInfo *encInfo);
+
+/* Encode scattered data into a clone of the source image */
+Status encode_scattered(EncodeInfo *encInfo);
+
+/* Clone a whole image file, sharing extents when the filesystem allows it */
+Status clone_image(int fd_src, int fd_dest, off_t size);
+
+/* Encode header and secret data into the image behind fd with pread/pwrite */
+Status patch_stego_image(int fd, EncodeInfo *encInfo);
+
+/* Copy a region between two files without passing it through user space when possible */
+Status copy_image_region(int fd_in, off_t offset_in, int fd_out, off_t offset_out, off_t size);
+
+/* Move the stdio pipeline of the rows onto the io_uring streams */
+Status start_uring_for_encoding(EncodeInfo *encInfo);
+
+/* Wait for the io_uring streams and hand the files back to stdio */
+Status finish_uring_for_encoding(EncodeInfo *encInfo);
+
+/* Map src image, secret file and stego image into memory */
+Status map_files_for_encoding(EncodeInfo *encInfo);
+
+/* Release the memory mapped views */
+void unmap_files_for_encoding(EncodeInfo *encInfo);
+
+/* Release mapped views and close whatever files are still open */
+void close_files_for_encoding(EncodeInfo *encInfo);
+
+/* Encode data straight into the mapped stego image */
+Status encode_data_to_map(const char *data, size_t size, EncodeInfo *encInfo);
+
+/* Encode data straight into the mapped stego image, bits bits per image byte */
+Status encode_bits_to_map(const char *data, size_t size, uint bits, EncodeInfo *encInfo);
+
+/* Encode secret data straight into the mapped stego image, encrypted on the way when there is a key */
+Status encode_payload_to_map(const char *data, size_t size, EncodeInfo *encInfo);
+
+/* Encode a 4 or 8 byte size field straight into the mapped stego image */
+Status encode_size_to_map(size_t size, uint field_size, EncodeInfo *encInfo);
+
 #endif
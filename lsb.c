@@ -0,0 +1,816 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lsb.h"
+
+/* One contiguous range of work for a thread */
+typedef struct
+{
+    unsigned char *dest;
+    const unsigned char *src;
+    const unsigned char *data;
+    unsigned char *out;
+    size_t size;
+    LsbEmbedFn embed;
+    LsbExtractFn extract;
+} LsbRange;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Bit reversal of every byte value, movemask collects the LSBs in reverse order */
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const unsigned char reverse_bits[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/* Embed bytes, scalar version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in its LSBs
+ * Description: Reference kernel, every iteration writes one image byte.
+ * Also used for the tails the vector kernels leave behind
+ * Return value: None
+ */
+void lsb_embed_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            *dest++ = (*src++ & ~1) | (data[i] >> bit & 1);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Embed bytes, SSE2 version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in its LSBs
+ * Description: Every payload byte is replicated 8 times by unpacking it with
+ * itself, the bit meant for each lane is isolated with a per lane mask and turned
+ * into 0/1 by a compare. 16 payload bytes fill 8 vectors of image bytes
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_embed_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    const __m128i select = _mm_setr_epi8((char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                         (char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i keep = _mm_set1_epi8((char) 0xFE);
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i payload = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i pairs[2], quads[4];
+
+        // Byte n of the payload ends up in lanes 8n..8n+7
+        pairs[0] = _mm_unpacklo_epi8(payload, payload);
+        pairs[1] = _mm_unpackhi_epi8(payload, payload);
+        quads[0] = _mm_unpacklo_epi16(pairs[0], pairs[0]);
+        quads[1] = _mm_unpackhi_epi16(pairs[0], pairs[0]);
+        quads[2] = _mm_unpacklo_epi16(pairs[1], pairs[1]);
+        quads[3] = _mm_unpackhi_epi16(pairs[1], pairs[1]);
+
+        for (int q = 0; q < 4; q++)
+        {
+            __m128i octs[2] = { _mm_unpacklo_epi32(quads[q], quads[q]), _mm_unpackhi_epi32(quads[q], quads[q]) };
+
+            for (int o = 0; o < 2; o++)
+            {
+                __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(octs[o], select), select), one);
+                __m128i image = _mm_loadu_si128((const __m128i *) src);
+
+                _mm_storeu_si128((__m128i *) dest, _mm_or_si128(_mm_and_si128(image, keep), bits));
+                src += 16;
+                dest += 16;
+            }
+        }
+    }
+
+    lsb_embed_scalar(dest, src, data + i, size - i);
+}
+
+/* Embed bytes, AVX2 version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in its LSBs
+ * Description: 4 payload bytes are broadcast and shuffled so that every one of them
+ * covers 8 lanes, then masked and compared like the SSE2 kernel. 32 payload bytes
+ * fill 8 vectors of image bytes
+ * Return value: None
+ */
+__attribute__((target("avx2")))
+void lsb_embed_avx2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i select = _mm256_setr_epi8((char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                            (char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                            (char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                            (char) 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i keep = _mm256_set1_epi8((char) 0xFE);
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int w = 0; w < 8; w++)
+        {
+            int32_t word;
+            memcpy(&word, data + i + w * 4, 4);
+
+            __m256i octs = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+            __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(octs, select), select), one);
+            __m256i image = _mm256_loadu_si256((const __m256i *) src);
+
+            _mm256_storeu_si256((__m256i *) dest, _mm256_or_si256(_mm256_and_si256(image, keep), bits));
+            src += 32;
+            dest += 32;
+        }
+    }
+
+    lsb_embed_scalar(dest, src, data + i, size - i);
+}
+
+/* Embed bytes, BMI2 version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in its LSBs
+ * Description: pdep deposits the 8 bits of a payload byte into bit 0 of the 8 bytes
+ * of a 64 bit word, LSB first, the byte swap turns that into MSB first. One
+ * word covers the 8 image bytes of a payload byte, 64 payload bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("bmi2")))
+void lsb_embed_bmi2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    const uint64_t lsbs = 0x0101010101010101ULL;
+    size_t i = 0;
+
+    for (; i + 64 <= size; i += 64)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            uint64_t image;
+            memcpy(&image, src, 8);
+            image = (image & ~lsbs) | __builtin_bswap64(_pdep_u64(data[i + b], lsbs));
+            memcpy(dest, &image, 8);
+            src += 8;
+            dest += 8;
+        }
+    }
+
+    lsb_embed_scalar(dest, src, data + i, size - i);
+}
+
+#endif
+
+/* Select embedding kernel
+ * Input: None
+ * Output: Kernel function
+ * Description: Checks the running CPU and returns the widest kernel it supports.
+ * AVX2 beats pdep, which is microcoded and slow on older AMD parts
+ * Return value: Kernel function
+ */
+LsbEmbedFn lsb_select_embed(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return lsb_embed_avx2;
+    }
+    if (__builtin_cpu_supports("bmi2"))
+    {
+        return lsb_embed_bmi2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return lsb_embed_sse2;
+    }
+#endif
+    return lsb_embed_scalar;
+}
+
+/* Kernel name
+ * Input: Kernel function
+ * Output: Printable name of the kernel
+ * Return value: Name, "unknown" for foreign functions
+ */
+const char *lsb_embed_name(LsbEmbedFn fn)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (fn == lsb_embed_avx2)
+    {
+        return "avx2";
+    }
+    if (fn == lsb_embed_bmi2)
+    {
+        return "bmi2";
+    }
+    if (fn == lsb_embed_sse2)
+    {
+        return "sse2";
+    }
+#endif
+    if (fn == lsb_embed_scalar)
+    {
+        return "scalar";
+    }
+    return "unknown";
+}
+
+/* Embed bytes
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in its LSBs
+ * Description: Runs the kernel selected for this CPU
+ * Return value: None
+ */
+void lsb_embed(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    lsb_select_embed()(dest, src, data, size);
+}
+
+/* Extract bytes, scalar version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the LSBs
+ * Description: Reference kernel, every iteration reads one image byte.
+ * Also used for the tails the vector kernels leave behind
+ * Return value: None
+ */
+void lsb_extract_scalar(unsigned char *data, const unsigned char *src, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char byte = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            byte = byte << 1 | (*src++ & 1);
+        }
+        data[i] = byte;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Extract bytes, SSE2 version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the LSBs
+ * Description: Shifting every 16 bit lane left by 7 moves bit 0 of each byte to
+ * its sign bit, movemask then packs 16 LSBs at once. movemask puts the first
+ * image byte in the lowest bit, so the bytes are bit reversed through a table
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_extract_sse2(unsigned char *data, const unsigned char *src, size_t size)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        for (int v = 0; v < 8; v++)
+        {
+            __m128i image = _mm_loadu_si128((const __m128i *) src);
+            int mask = _mm_movemask_epi8(_mm_slli_epi16(image, 7));
+
+            data[i + v * 2] = reverse_bits[mask & 0xFF];
+            data[i + v * 2 + 1] = reverse_bits[mask >> 8];
+            src += 16;
+        }
+    }
+
+    lsb_extract_scalar(data + i, src, size - i);
+}
+
+/* Extract bytes, AVX2 version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the LSBs
+ * Description: Reverses every group of 8 image bytes with a shuffle so that the
+ * movemask lands MSB first, 32 image bytes give 4 payload bytes per movemask
+ * Return value: None
+ */
+__attribute__((target("avx2")))
+void lsb_extract_avx2(unsigned char *data, const unsigned char *src, size_t size)
+{
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int v = 0; v < 8; v++)
+        {
+            __m256i image = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) src), reverse);
+            int32_t mask = _mm256_movemask_epi8(_mm256_slli_epi16(image, 7));
+
+            memcpy(data + i + v * 4, &mask, 4);
+            src += 32;
+        }
+    }
+
+    lsb_extract_scalar(data + i, src, size - i);
+}
+
+/* Extract bytes, BMI2 version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the LSBs
+ * Description: After a byte swap the first image byte sits in the top byte of the
+ * word, pext then packs the 8 LSBs MSB first. 64 payload bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("bmi2")))
+void lsb_extract_bmi2(unsigned char *data, const unsigned char *src, size_t size)
+{
+    const uint64_t lsbs = 0x0101010101010101ULL;
+    size_t i = 0;
+
+    for (; i + 64 <= size; i += 64)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            uint64_t image;
+            memcpy(&image, src, 8);
+            data[i + b] = _pext_u64(__builtin_bswap64(image), lsbs);
+            src += 8;
+        }
+    }
+
+    lsb_extract_scalar(data + i, src, size - i);
+}
+
+#endif
+
+/* Select extraction kernel
+ * Input: None
+ * Output: Kernel function
+ * Description: Same preference order as lsb_select_embed
+ * Return value: Kernel function
+ */
+LsbExtractFn lsb_select_extract(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return lsb_extract_avx2;
+    }
+    if (__builtin_cpu_supports("bmi2"))
+    {
+        return lsb_extract_bmi2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return lsb_extract_sse2;
+    }
+#endif
+    return lsb_extract_scalar;
+}
+
+/* Kernel name
+ * Input: Kernel function
+ * Output: Printable name of the kernel
+ * Return value: Name, "unknown" for foreign functions
+ */
+const char *lsb_extract_name(LsbExtractFn fn)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (fn == lsb_extract_avx2)
+    {
+        return "avx2";
+    }
+    if (fn == lsb_extract_bmi2)
+    {
+        return "bmi2";
+    }
+    if (fn == lsb_extract_sse2)
+    {
+        return "sse2";
+    }
+#endif
+    if (fn == lsb_extract_scalar)
+    {
+        return "scalar";
+    }
+    return "unknown";
+}
+
+/* Extract bytes
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the LSBs
+ * Description: Runs the kernel selected for this CPU
+ * Return value: None
+ */
+void lsb_extract(unsigned char *data, const unsigned char *src, size_t size)
+{
+    lsb_select_extract()(data, src, size);
+}
+
+/* Embed bytes, k bits version
+ * Input: Destination and source image bytes, payload, payload size and bits per image byte
+ * Output: dest with the payload in the low bits bits
+ * Description: Generic loop behind the 2 and 4 bit scalar kernels
+ * Return value: None
+ */
+static void lsb_embed_bits_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size, unsigned bits)
+{
+    const unsigned char mask = (1 << bits) - 1;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        for (int shift = 8 - bits; shift >= 0; shift -= bits)
+        {
+            *dest++ = (*src++ & ~mask) | (data[i] >> shift & mask);
+        }
+    }
+}
+
+/* Extract bytes, k bits version
+ * Input: Array for the payload, source image bytes, payload size and bits per image byte
+ * Output: Payload gathered from the low bits bits
+ * Description: Generic loop behind the 2 and 4 bit scalar kernels
+ * Return value: None
+ */
+static void lsb_extract_bits_scalar(unsigned char *data, const unsigned char *src, size_t size, unsigned bits)
+{
+    const unsigned char mask = (1 << bits) - 1;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char byte = 0;
+        for (unsigned done = 0; done < 8; done += bits)
+        {
+            byte = byte << bits | (*src++ & mask);
+        }
+        data[i] = byte;
+    }
+}
+
+void lsb_embed2_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    lsb_embed_bits_scalar(dest, src, data, size, 2);
+}
+
+void lsb_embed4_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    lsb_embed_bits_scalar(dest, src, data, size, 4);
+}
+
+void lsb_extract2_scalar(unsigned char *data, const unsigned char *src, size_t size)
+{
+    lsb_extract_bits_scalar(data, src, size, 2);
+}
+
+void lsb_extract4_scalar(unsigned char *data, const unsigned char *src, size_t size)
+{
+    lsb_extract_bits_scalar(data, src, size, 4);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Embed bytes, 2 bits SSE2 version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in the low 2 bits
+ * Description: The 4 bit pairs of every payload byte are split into 4 vectors and
+ * interleaved back with byte and word unpacks, 16 payload bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_embed2_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    const __m128i low2 = _mm_set1_epi8(0x03);
+    const __m128i keep = _mm_set1_epi8((char) 0xFC);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i payload = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i c3 = _mm_and_si128(_mm_srli_epi16(payload, 6), low2);
+        __m128i c2 = _mm_and_si128(_mm_srli_epi16(payload, 4), low2);
+        __m128i c1 = _mm_and_si128(_mm_srli_epi16(payload, 2), low2);
+        __m128i c0 = _mm_and_si128(payload, low2);
+        __m128i high[2] = { _mm_unpacklo_epi8(c3, c2), _mm_unpackhi_epi8(c3, c2) };
+        __m128i low[2] = { _mm_unpacklo_epi8(c1, c0), _mm_unpackhi_epi8(c1, c0) };
+        __m128i bits[4] = { _mm_unpacklo_epi16(high[0], low[0]), _mm_unpackhi_epi16(high[0], low[0]),
+                            _mm_unpacklo_epi16(high[1], low[1]), _mm_unpackhi_epi16(high[1], low[1]) };
+
+        for (int v = 0; v < 4; v++)
+        {
+            __m128i image = _mm_loadu_si128((const __m128i *) src);
+
+            _mm_storeu_si128((__m128i *) dest, _mm_or_si128(_mm_and_si128(image, keep), bits[v]));
+            src += 16;
+            dest += 16;
+        }
+    }
+
+    lsb_embed2_scalar(dest, src, data + i, size - i);
+}
+
+/* Embed bytes, 4 bits SSE2 version
+ * Input: Destination and source image bytes, payload and payload size
+ * Output: dest with the payload in the low 4 bits
+ * Description: High and low nibbles are interleaved with byte unpacks, 16 payload
+ * bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_embed4_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size)
+{
+    const __m128i low4 = _mm_set1_epi8(0x0F);
+    const __m128i keep = _mm_set1_epi8((char) 0xF0);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i payload = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(payload, 4), low4);
+        __m128i low = _mm_and_si128(payload, low4);
+        __m128i bits[2] = { _mm_unpacklo_epi8(high, low), _mm_unpackhi_epi8(high, low) };
+
+        for (int v = 0; v < 2; v++)
+        {
+            __m128i image = _mm_loadu_si128((const __m128i *) src);
+
+            _mm_storeu_si128((__m128i *) dest, _mm_or_si128(_mm_and_si128(image, keep), bits[v]));
+            src += 16;
+            dest += 16;
+        }
+    }
+
+    lsb_embed4_scalar(dest, src, data + i, size - i);
+}
+
+/* Pair up fields
+ * Input: Vector of fields of width bits in the low bits of every byte
+ * Output: Every 16 bit lane holds first << bits | second in its low byte
+ * Description: Building block of the 2 and 4 bit extraction, pack the result with packus
+ */
+__attribute__((target("sse2")))
+static inline __m128i lsb_pair_fields(__m128i fields, int bits)
+{
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+
+    return _mm_and_si128(_mm_or_si128(_mm_slli_epi16(fields, bits), _mm_srli_epi16(fields, 8)), low_byte);
+}
+
+/* Extract bytes, 2 bits SSE2 version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the low 2 bits
+ * Description: Pairs of 2 bit fields are merged into nibbles, pairs of nibbles into
+ * bytes, 64 image bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_extract2_sse2(unsigned char *data, const unsigned char *src, size_t size)
+{
+    const __m128i low2 = _mm_set1_epi8(0x03);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i nibbles[2];
+
+        for (int n = 0; n < 2; n++)
+        {
+            __m128i first = _mm_and_si128(_mm_loadu_si128((const __m128i *) src), low2);
+            __m128i second = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + 16)), low2);
+
+            nibbles[n] = _mm_packus_epi16(lsb_pair_fields(first, 2), lsb_pair_fields(second, 2));
+            src += 32;
+        }
+        _mm_storeu_si128((__m128i *) (data + i), _mm_packus_epi16(lsb_pair_fields(nibbles[0], 4), lsb_pair_fields(nibbles[1], 4)));
+    }
+
+    lsb_extract2_scalar(data + i, src, size - i);
+}
+
+/* Extract bytes, 4 bits SSE2 version
+ * Input: Array for the payload, source image bytes and payload size
+ * Output: Payload gathered from the low 4 bits
+ * Description: Pairs of nibbles are merged into bytes, 32 image bytes per iteration
+ * Return value: None
+ */
+__attribute__((target("sse2")))
+void lsb_extract4_sse2(unsigned char *data, const unsigned char *src, size_t size)
+{
+    const __m128i low4 = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i first = _mm_and_si128(_mm_loadu_si128((const __m128i *) src), low4);
+        __m128i second = _mm_and_si128(_mm_loadu_si128((const __m128i *) (src + 16)), low4);
+
+        _mm_storeu_si128((__m128i *) (data + i), _mm_packus_epi16(lsb_pair_fields(first, 4), lsb_pair_fields(second, 4)));
+        src += 32;
+    }
+
+    lsb_extract4_scalar(data + i, src, size - i);
+}
+
+#endif
+
+/* Select k bits embedding kernel
+ * Input: Bits per image byte, 1, 2 or 4
+ * Output: Kernel function
+ * Return value: Kernel function, NULL for an unsupported bit count
+ */
+LsbEmbedFn lsb_select_embed_bits(unsigned bits)
+{
+    switch (bits)
+    {
+        case 1:
+            return lsb_select_embed();
+#if defined(__x86_64__) || defined(__i386__)
+        case 2:
+            return __builtin_cpu_supports("sse2") ? lsb_embed2_sse2 : lsb_embed2_scalar;
+        case 4:
+            return __builtin_cpu_supports("sse2") ? lsb_embed4_sse2 : lsb_embed4_scalar;
+#else
+        case 2:
+            return lsb_embed2_scalar;
+        case 4:
+            return lsb_embed4_scalar;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/* Select k bits extraction kernel
+ * Input: Bits per image byte, 1, 2 or 4
+ * Output: Kernel function
+ * Return value: Kernel function, NULL for an unsupported bit count
+ */
+LsbExtractFn lsb_select_extract_bits(unsigned bits)
+{
+    switch (bits)
+    {
+        case 1:
+            return lsb_select_extract();
+#if defined(__x86_64__) || defined(__i386__)
+        case 2:
+            return __builtin_cpu_supports("sse2") ? lsb_extract2_sse2 : lsb_extract2_scalar;
+        case 4:
+            return __builtin_cpu_supports("sse2") ? lsb_extract4_sse2 : lsb_extract4_scalar;
+#else
+        case 2:
+            return lsb_extract2_scalar;
+        case 4:
+            return lsb_extract4_scalar;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/* Resolve thread count
+ * Input: Requested number of threads
+ * Output: Usable number of threads
+ * Description: 0 or less asks for one thread per online CPU, anything above
+ * LSB_MAX_THREADS is clamped
+ * Return value: Number of threads, at least 1
+ */
+int lsb_resolve_threads(int threads)
+{
+    if (threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    return threads > LSB_MAX_THREADS ? LSB_MAX_THREADS : threads;
+}
+
+/* Thread entry for one range, embeds or extracts depending on the kernel set */
+static void *lsb_range_worker(void *arg)
+{
+    LsbRange *range = arg;
+
+    if (range->embed != NULL)
+    {
+        range->embed(range->dest, range->src, range->data, range->size);
+    }
+    else
+    {
+        range->extract(range->out, range->src, range->size);
+    }
+    return NULL;
+}
+
+/* Run ranges
+ * Input: Filled in ranges and their count
+ * Output: All ranges processed
+ * Description: Every range but the last gets its own thread, the calling thread
+ * takes the last one. A range whose thread can't be created runs inline
+ * Return value: None
+ */
+static void lsb_run_ranges(LsbRange *ranges, int count)
+{
+    pthread_t tids[LSB_MAX_THREADS];
+    int started[LSB_MAX_THREADS];
+
+    for (int t = 0; t < count - 1; t++)
+    {
+        started[t] = pthread_create(&tids[t], NULL, lsb_range_worker, &ranges[t]) == 0;
+        if (!started[t])
+        {
+            lsb_range_worker(&ranges[t]);
+        }
+    }
+    lsb_range_worker(&ranges[count - 1]);
+    for (int t = 0; t < count - 1; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(tids[t], NULL);
+        }
+    }
+}
+
+/* Split work
+ * Input: Payload size and requested threads
+ * Output: Number of ranges worth a thread
+ * Return value: 1 when the job is too small to split
+ */
+static int lsb_split_count(size_t size, int threads)
+{
+    size_t max_ranges = size / LSB_MT_MIN_CHUNK;
+
+    threads = lsb_resolve_threads(threads);
+    if (max_ranges < (size_t) threads)
+    {
+        threads = max_ranges > 0 ? max_ranges : 1;
+    }
+    return threads;
+}
+
+/* Embed bytes, multi-threaded
+ * Input: Destination and source image bytes, payload, payload size, bits per
+ * image byte (1, 2 or 4) and thread count
+ * Output: dest with the payload in its LSBs
+ * Description: Cuts the payload in equal contiguous ranges and embeds every range
+ * into its own image range on a separate thread
+ * Return value: None
+ */
+void lsb_embed_mt(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size, unsigned bits, int threads)
+{
+    LsbRange ranges[LSB_MAX_THREADS];
+    LsbEmbedFn embed = lsb_select_embed_bits(bits);
+    int count = lsb_split_count(size, threads);
+    size_t per_range = size / count;
+    size_t stride = 8 / bits;
+
+    if (count == 1)
+    {
+        embed(dest, src, data, size);
+        return;
+    }
+
+    for (int t = 0; t < count; t++)
+    {
+        size_t start = per_range * t;
+
+        ranges[t].dest = dest + start * stride;
+        ranges[t].src = src + start * stride;
+        ranges[t].data = data + start;
+        ranges[t].size = t == count - 1 ? size - start : per_range;
+        ranges[t].embed = embed;
+        ranges[t].extract = NULL;
+    }
+    lsb_run_ranges(ranges, count);
+}
+
+/* Extract bytes, multi-threaded
+ * Input: Array for the payload, source image bytes, payload size, bits per
+ * image byte (1, 2 or 4) and thread count
+ * Output: Payload gathered from the LSBs
+ * Description: Same split as lsb_embed_mt
+ * Return value: None
+ */
+void lsb_extract_mt(unsigned char *data, const unsigned char *src, size_t size, unsigned bits, int threads)
+{
+    LsbRange ranges[LSB_MAX_THREADS];
+    LsbExtractFn extract = lsb_select_extract_bits(bits);
+    int count = lsb_split_count(size, threads);
+    size_t per_range = size / count;
+    size_t stride = 8 / bits;
+
+    if (count == 1)
+    {
+        extract(data, src, size);
+        return;
+    }
+
+    for (int t = 0; t < count; t++)
+    {
+        size_t start = per_range * t;
+
+        ranges[t].src = src + start * stride;
+        ranges[t].out = data + start;
+        ranges[t].size = t == count - 1 ? size - start : per_range;
+        ranges[t].embed = NULL;
+        ranges[t].extract = extract;
+    }
+    lsb_run_ranges(ranges, count);
+}
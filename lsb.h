@@ -0,0 +1,108 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+
+/*
+ * LSB embedding kernels
+ * Every payload byte is spread MSB first over the LSBs of 8 consecutive
+ * image bytes. dest and src may point to the same buffer.
+ */
+typedef void (*LsbEmbedFn)(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+
+/* Portable reference kernel, one bit per iteration */
+void lsb_embed_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 16 payload bytes into 128 image bytes per iteration */
+void lsb_embed_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+
+/* 32 payload bytes into 256 image bytes per iteration */
+void lsb_embed_avx2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+
+/* 64 payload bytes into 512 image bytes per iteration using pdep */
+void lsb_embed_bmi2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+#endif
+
+/* Pick the fastest embedding kernel the running CPU supports */
+LsbEmbedFn lsb_select_embed(void);
+
+/* Name of a kernel returned by lsb_select_embed */
+const char *lsb_embed_name(LsbEmbedFn fn);
+
+/* Embed size payload bytes into size * 8 image bytes with the selected kernel */
+void lsb_embed(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+
+/*
+ * LSB extraction kernels
+ * Gather bit 0 of size * 8 image bytes into size payload bytes, MSB first
+ */
+typedef void (*LsbExtractFn)(unsigned char *data, const unsigned char *src, size_t size);
+
+/* Portable reference kernel, one bit per iteration */
+void lsb_extract_scalar(unsigned char *data, const unsigned char *src, size_t size);
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 128 image bytes into 16 payload bytes per iteration */
+void lsb_extract_sse2(unsigned char *data, const unsigned char *src, size_t size);
+
+/* 256 image bytes into 32 payload bytes per iteration */
+void lsb_extract_avx2(unsigned char *data, const unsigned char *src, size_t size);
+
+/* 512 image bytes into 64 payload bytes per iteration using pext */
+void lsb_extract_bmi2(unsigned char *data, const unsigned char *src, size_t size);
+#endif
+
+/* Pick the fastest extraction kernel the running CPU supports */
+LsbExtractFn lsb_select_extract(void);
+
+/* Name of a kernel returned by lsb_select_extract */
+const char *lsb_extract_name(LsbExtractFn fn);
+
+/* Extract size payload bytes from size * 8 image bytes with the selected kernel */
+void lsb_extract(unsigned char *data, const unsigned char *src, size_t size);
+
+/*
+ * k-LSB kernels, 2 or 4 payload bits per image byte, still MSB first.
+ * A payload byte takes 8 / bits image bytes.
+ */
+void lsb_embed2_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+void lsb_embed4_scalar(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+void lsb_extract2_scalar(unsigned char *data, const unsigned char *src, size_t size);
+void lsb_extract4_scalar(unsigned char *data, const unsigned char *src, size_t size);
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 16 payload bytes into 64 (2 bits) or 32 (4 bits) image bytes per iteration */
+void lsb_embed2_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+void lsb_embed4_sse2(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size);
+void lsb_extract2_sse2(unsigned char *data, const unsigned char *src, size_t size);
+void lsb_extract4_sse2(unsigned char *data, const unsigned char *src, size_t size);
+#endif
+
+/* Pick the embedding kernel for 1, 2 or 4 bits per image byte */
+LsbEmbedFn lsb_select_embed_bits(unsigned bits);
+
+/* Pick the extraction kernel for 1, 2 or 4 bits per image byte */
+LsbExtractFn lsb_select_extract_bits(unsigned bits);
+
+/*
+ * Multi-threaded variants
+ * Payload byte i only touches the 8 / bits image bytes starting at 8i / bits,
+ * so the payload is cut into contiguous ranges, one per thread. The result is byte identical to the
+ * single threaded kernels.
+ */
+#define LSB_MAX_THREADS 64
+
+/* Payload bytes a thread has to get at least, smaller jobs don't pay for the thread */
+#define LSB_MT_MIN_CHUNK (256 * 1024)
+
+/* Resolve a -j argument, 0 means one thread per online CPU */
+int lsb_resolve_threads(int threads);
+
+/* Embed bits bits per image byte using up to threads threads */
+void lsb_embed_mt(unsigned char *dest, const unsigned char *src, const unsigned char *data, size_t size, unsigned bits, int threads);
+
+/* Extract bits bits per image byte using up to threads threads */
+void lsb_extract_mt(unsigned char *data, const unsigned char *src, size_t size, unsigned bits, int threads);
+
+#endif
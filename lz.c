@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+#include "types.h"
+
+/* Positions of the last 4 byte strings seen, by hash */
+#define LZ_HASH_BITS 14
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+/* Misses in a row before the search starts skipping, grows the step by one every 2^n */
+#define LZ_SKIP_SHIFT 6
+
+/* 4 bytes at p, in whatever byte order */
+static uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, 4);
+    return value;
+}
+
+/* Hash of the 4 bytes at p */
+static uint32_t lz_hash(const unsigned char *p)
+{
+    return (lz_read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Put a length nibble overflow, 255 per byte and the rest */
+static unsigned char *lz_put_length(unsigned char *op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        *op++ = 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* Emit sequence
+ * Input: Output position and end, literals and their count, match offset and
+ * length, match length 0 for the last sequence
+ * Output: Sequence written
+ * Return value: Next output position, NULL when it doesn't fit
+ */
+static unsigned char *lz_emit(unsigned char *op, const unsigned char *op_end, const unsigned char *literals, size_t literal_length,
+                              size_t offset, size_t match_length)
+{
+    size_t worst = 1 + literal_length / 255 + 1 + literal_length + (match_length > 0 ? 2 + match_length / 255 + 1 : 0);
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    unsigned char *token = op;
+
+    if (worst > (size_t) (op_end - op))
+    {
+        return NULL;
+    }
+    *op++ = (literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15);
+    if (literal_length >= 15)
+    {
+        op = lz_put_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (match_length == 0)
+    {
+        *token &= 0xF0;
+        return op;
+    }
+    *op++ = offset;
+    *op++ = offset >> 8;
+    if (match_code >= 15)
+    {
+        op = lz_put_length(op, match_code - 15);
+    }
+    return op;
+}
+
+/* Compress
+ * Input: Buffer of capacity bytes, data and its size
+ * Output: Compressed body
+ * Description: Greedy single pass: the 4 bytes at every position are looked
+ * up in a hash table of earlier positions, a hit is extended as far as it
+ * goes. Long runs of misses make the search skip ahead, so data that doesn't
+ * compress costs little
+ * Return value: Compressed bytes, 0 when they would need more than capacity
+ */
+size_t lz_compress(unsigned char *dest, size_t capacity, const unsigned char *src, size_t size)
+{
+    uint32_t table[LZ_HASH_SIZE];
+    const unsigned char *ip = src, *anchor = src, *end = src + size, *ref;
+    unsigned char *op = dest, *op_end = dest + capacity;
+    size_t length, misses = 0;
+    uint32_t hash;
+
+    memset(table, 0, sizeof(table));
+    while (size >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+        hash = lz_hash(ip);
+        ref = src + table[hash];
+        table[hash] = ip - src;
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != lz_read32(ip))
+        {
+            ip += 1 + (misses++ >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        for (length = LZ_MIN_MATCH; ip + length < end && ref[length] == ip[length]; length++)
+        {
+        }
+        if ((op = lz_emit(op, op_end, anchor, ip - anchor, ip - ref, length)) == NULL)
+        {
+            return 0;
+        }
+        ip += length;
+        anchor = ip;
+        misses = 0;
+    }
+    if ((op = lz_emit(op, op_end, anchor, end - anchor, 0, 0)) == NULL)
+    {
+        return 0;
+    }
+
+    return op - dest;
+}
+
+/* Get a length nibble overflow
+ * Input: Input position and end, length so far
+ * Return value: Next input position, NULL when the input ends first
+ */
+static const unsigned char *lz_get_length(const unsigned char *ip, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+
+    do
+    {
+        if (ip == end)
+        {
+            return NULL;
+        }
+        byte = *ip++;
+        *length += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+/* Decompress
+ * Input: Buffer of capacity bytes, compressed body and its size
+ * Output: Data, *out_size set to its bytes
+ * Description: Every length and offset is checked against both buffers, a
+ * corrupt body fails instead of reading or writing outside them
+ * Return value: e_success, e_failure for a corrupt body
+ */
+Status lz_decompress(unsigned char *dest, size_t capacity, size_t *out_size, const unsigned char *src, size_t size)
+{
+    const unsigned char *ip = src, *end = src + size;
+    unsigned char *op = dest;
+    size_t literal_length, match_length, offset;
+    unsigned char token;
+
+    while (ip < end)
+    {
+        token = *ip++;
+        literal_length = token >> 4;
+        if (literal_length == 15 && (ip = lz_get_length(ip, end, &literal_length)) == NULL)
+        {
+            return e_failure;
+        }
+        if (literal_length > (size_t) (end - ip) || literal_length > capacity - (op - dest))
+        {
+            return e_failure;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        // The last sequence has no match
+        if (ip == end)
+        {
+            break;
+        }
+        if (end - ip < 2)
+        {
+            return e_failure;
+        }
+        offset = ip[0] | (size_t) ip[1] << 8;
+        ip += 2;
+        match_length = token & 15;
+        if (match_length == 15 && (ip = lz_get_length(ip, end, &match_length)) == NULL)
+        {
+            return e_failure;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dest) || match_length > capacity - (op - dest))
+        {
+            return e_failure;
+        }
+
+        // A match may overlap its own output, then it repeats the last offset bytes
+        if (offset >= match_length)
+        {
+            memcpy(op, op - offset, match_length);
+            op += match_length;
+        }
+        else
+        {
+            for (size_t i = 0; i < match_length; i++, op++)
+            {
+                *op = *(op - offset);
+            }
+        }
+    }
+    *out_size = op - dest;
+
+    return e_success;
+}
+
+/* Encode block
+ * Input: Buffer of LZ_MAX_BLOCK_SIZE bytes, raw data of at most LZ_BLOCK_SIZE bytes
+ * Output: Block header and body, compressed unless that doesn't shrink it
+ * Return value: Bytes of the encoded block
+ */
+size_t lz_encode_block(unsigned char *dest, const unsigned char *src, size_t size)
+{
+    size_t body = size > 0 ? lz_compress(dest + LZ_BLOCK_HEADER_SIZE, size - 1, src, size) : 0;
+    uint32_t header = body;
+
+    if (body == 0)
+    {
+        memcpy(dest + LZ_BLOCK_HEADER_SIZE, src, size);
+        body = size;
+        header = size | LZ_BLOCK_STORED;
+    }
+    dest[0] = header >> 24;
+    dest[1] = header >> 16;
+    dest[2] = header >> 8;
+    dest[3] = header;
+
+    return LZ_BLOCK_HEADER_SIZE + body;
+}
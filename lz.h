@@ -0,0 +1,44 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Block LZ codec for payloads
+ * The data is cut in LZ_BLOCK_SIZE blocks, each compressed on its own, so
+ * both sides only ever hold one block. Every block is
+ *     32 bit body length | LZ_BLOCK_STORED, MSB first, then the body
+ * and a body that would not shrink is stored as it is.
+ *
+ * A compressed body is a run of sequences, LZ4 style:
+ *     token (literal length << 4 | match length - LZ_MIN_MATCH), more literal
+ *     length bytes when that nibble is 15, the literals, 16 bit little endian
+ *     offset back into the output, more match length bytes when that nibble is 15
+ * Length bytes add up until one below 255. The last sequence ends after its literals.
+ */
+
+/* Raw bytes per block */
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+/* Block header, the body length and the flag below */
+#define LZ_BLOCK_HEADER_SIZE 4
+#define LZ_BLOCK_STORED 0x80000000u
+
+/* Longest encoded block */
+#define LZ_MAX_BLOCK_SIZE (LZ_BLOCK_HEADER_SIZE + LZ_BLOCK_SIZE)
+
+/* Shortest match worth a sequence, and the farthest one */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/* Compress size bytes into at most capacity bytes, returns the compressed size, 0 when it doesn't fit */
+size_t lz_compress(unsigned char *dest, size_t capacity, const unsigned char *src, size_t size);
+
+/* Decompress a body of size bytes into at most capacity bytes, *out_size gets the bytes written */
+Status lz_decompress(unsigned char *dest, size_t capacity, size_t *out_size, const unsigned char *src, size_t size);
+
+/* Encode one block of at most LZ_BLOCK_SIZE raw bytes, header included, returns its bytes */
+size_t lz_encode_block(unsigned char *dest, const unsigned char *src, size_t size);
+
+#endif
@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "map.h"
+
+/* Release mapped pages
+ * Input: Mapped view and the range of it that was walked
+ * Output: Pages of the range taken out of the resident set
+ * Description: Only for read only views and shared writable views. Their pages
+ * stay in the page cache, dirty ones are written back as usual, and touching
+ * them again just faults them back in. The page holding end is kept, the next
+ * window still needs it and releases it along with its own
+ * Return value: None
+ */
+void map_release(const char *map, size_t start, size_t end)
+{
+    static size_t page_size;
+    uintptr_t first, last;
+
+    if (page_size == 0)
+    {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+    first = (uintptr_t) (map + start) & ~(uintptr_t) (page_size - 1);
+    last = (uintptr_t) (map + end) & ~(uintptr_t) (page_size - 1);
+    if (last > first)
+    {
+        madvise((void *) first, last - first, MADV_DONTNEED);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stddef.h>
+
+/*
+ * Helpers of the memory mapped engines
+ * The engines walk their maps front to back in windows and hand every window
+ * back to the kernel once it is done, so the resident set stays the same
+ * whatever the size of the files.
+ */
+
+/* Image bytes walked per window, override with -DMAP_WINDOW_SIZE=n */
+#ifndef MAP_WINDOW_SIZE
+#define MAP_WINDOW_SIZE (16 * 1024 * 1024)
+#endif
+
+/* Data bytes of one window at bits bits per image byte */
+#define MAP_WINDOW_DATA_SIZE(bits) ((size_t) MAP_WINDOW_SIZE / 8 * (bits))
+
+/* Drop the pages of map that lie completely in front of offset end and from start on */
+void map_release(const char *map, size_t start, size_t end);
+
+#endif
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pool.h"
+#include "bmp.h"
+#include "lsb.h"
+#include "stego.h"
+#include "types.h"
+#include "common.h"
+
+/* Modification time of a file in ns */
+static long long pool_mtime_ns(const struct stat *st)
+{
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* Order carriers by path */
+static int pool_compare_path(const void *a, const void *b)
+{
+    return strcmp(((const PoolCarrier *) a)->path, ((const PoolCarrier *) b)->path);
+}
+
+/* Order carriers by capacity, then by path so the index is the same for the same images */
+static int pool_compare_capacity(const void *a, const void *b)
+{
+    const PoolCarrier *x = a, *y = b;
+
+    return x->capacity < y->capacity ? -1 : x->capacity > y->capacity ? 1 : strcmp(x->path, y->path);
+}
+
+/* Order requests by the pixel bytes they take, biggest first */
+static int pool_compare_needed(const void *a, const void *b)
+{
+    const PoolRequest *x = *(const PoolRequest *const *) a, *y = *(const PoolRequest *const *) b;
+
+    return x->needed > y->needed ? -1 : x->needed < y->needed;
+}
+
+/* Free carriers
+ * Input: Carriers and their count
+ * Output: Paths and the array released
+ * Return value: None
+ */
+static void pool_free_carriers(PoolCarrier *carriers, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        free(carriers[i].path);
+    }
+    free(carriers);
+}
+
+/* Load index
+ * Input: Index file name, addresses to store the carriers and their count, whether a missing file is an empty index
+ * Output: Carriers in index order
+ * Description: The index must start with POOL_INDEX_MAGIC and be sorted by
+ * capacity, anything else is taken for a damaged or foreign file
+ * Return value: e_success, e_failure
+ */
+static Status pool_load_index(const char *fname, PoolCarrier **carriers, size_t *count, int missing_ok)
+{
+    FILE *fptr = fopen(fname, "r");
+    char line[MAX_POOL_LINE];
+    size_t max_carriers = 0, length;
+    uint line_no = 1;
+    PoolCarrier carrier;
+    void *grown;
+    int path;
+
+    *carriers = NULL;
+    *count = 0;
+    if (fptr == NULL)
+    {
+        if (missing_ok && errno == ENOENT)
+        {
+            return e_success;
+        }
+        perror("fopen");
+        printf("ERROR: Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    if (fgets(line, MAX_POOL_LINE, fptr) == NULL || strncmp(line, POOL_INDEX_MAGIC, strlen(POOL_INDEX_MAGIC)))
+    {
+        printf("ERROR: %s is not a carrier index\n", fname);
+        fclose(fptr);
+        return e_failure;
+    }
+
+    while (fgets(line, MAX_POOL_LINE, fptr) != NULL)
+    {
+        line_no++;
+        length = strcspn(line, "\n");
+        line[length] = '\0';
+        path = 0;
+        if (sscanf(line, "%zu\t%zu\t%lld%n", &carrier.capacity, &carrier.file_size, &carrier.mtime_ns, &path) != 3 ||
+            line[path] != '\t' || line[++path] == '\0' || (*count > 0 && carrier.capacity < (*carriers)[*count - 1].capacity))
+        {
+            printf("ERROR: Line %u of %s is damaged, rebuild the index\n", line_no, fname);
+            fclose(fptr);
+            pool_free_carriers(*carriers, *count);
+            *carriers = NULL;
+            *count = 0;
+            return e_failure;
+        }
+        if (*count == max_carriers)
+        {
+            max_carriers = max_carriers > 0 ? max_carriers * 2 : 1024;
+            if ((grown = realloc(*carriers, max_carriers * sizeof(PoolCarrier))) == NULL)
+            {
+                fclose(fptr);
+                return e_failure;
+            }
+            *carriers = grown;
+        }
+        if ((carrier.path = strdup(line + path)) == NULL)
+        {
+            fclose(fptr);
+            return e_failure;
+        }
+        (*carriers)[(*count)++] = carrier;
+    }
+    fclose(fptr);
+
+    return e_success;
+}
+
+/* Read carrier
+ * Input: Image path, its stat and the carrier to fill
+ * Output: Capacity of the image
+ * Description: A single pread of the bmp header, the capacity counts the pixel
+ * bytes of the rows the header declares and the file holds, like check_capacity
+ * Return value: e_success, e_failure for an unreadable or unsupported image
+ */
+Status pool_read_carrier(const char *path, const struct stat *st, PoolCarrier *carrier)
+{
+    unsigned char header[BMP_HEADER_SIZE];
+    BmpInfo bmp;
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        return e_failure;
+    }
+    len = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if (len < 0 || bmp_parse_header(header, len, &bmp) == e_failure)
+    {
+        return e_failure;
+    }
+    bmp_clip_capacity(&bmp, st->st_size);
+    carrier->capacity = bmp.capacity;
+
+    return e_success;
+}
+
+/* Add carrier
+ * Input: Pool data and the carrier, its path owned by the pool from now on
+ * Output: Carrier appended, the pool lock must be held
+ * Return value: e_success, e_failure when out of memory
+ */
+static Status pool_add_carrier(PoolInfo *poolInfo, const PoolCarrier *carrier)
+{
+    void *grown;
+
+    if (poolInfo->num_carriers == poolInfo->max_carriers)
+    {
+        poolInfo->max_carriers = poolInfo->max_carriers > 0 ? poolInfo->max_carriers * 2 : 1024;
+        if ((grown = realloc(poolInfo->carriers, poolInfo->max_carriers * sizeof(PoolCarrier))) == NULL)
+        {
+            return e_failure;
+        }
+        poolInfo->carriers = grown;
+    }
+    poolInfo->carriers[poolInfo->num_carriers++] = *carrier;
+
+    return e_success;
+}
+
+/* Index worker
+ * Input: Pool data
+ * Output: A carrier for every image of the walk that is a supported bmp
+ * Description: An image whose size and modification time match the old index
+ * keeps its capacity without being opened, the others get their header read
+ */
+static void *index_worker(void *arg)
+{
+    PoolInfo *poolInfo = arg;
+    char path[MAX_SCAN_PATH];
+    PoolCarrier carrier, *old;
+    struct stat st;
+    int reused, ok;
+
+    while (next_scan_image(&poolInfo->scan, path))
+    {
+        reused = 0;
+        ok = 0;
+        carrier.path = path;
+        if (strchr(path, '\n') == NULL && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            carrier.file_size = st.st_size;
+            carrier.mtime_ns = pool_mtime_ns(&st);
+            old = bsearch(&carrier, poolInfo->old_carriers, poolInfo->num_old_carriers, sizeof(PoolCarrier), pool_compare_path);
+            if (old != NULL && old->file_size == carrier.file_size && old->mtime_ns == carrier.mtime_ns)
+            {
+                carrier.capacity = old->capacity;
+                reused = ok = 1;
+            }
+            else
+            {
+                ok = pool_read_carrier(path, &st, &carrier) == e_success;
+            }
+        }
+
+        pthread_mutex_lock(&poolInfo->scan.lock);
+        poolInfo->scan.images_scanned++;
+        if (ok && (carrier.path = strdup(path)) != NULL && pool_add_carrier(poolInfo, &carrier) == e_success)
+        {
+            reused ? poolInfo->images_reused++ : poolInfo->images_read++;
+        }
+        else
+        {
+            poolInfo->images_skipped++;
+        }
+        pthread_mutex_unlock(&poolInfo->scan.lock);
+    }
+
+    return NULL;
+}
+
+/* Write index
+ * Input: Pool data with the carriers sorted by capacity
+ * Output: Index file
+ * Description: The index is written to a temporary file next to it and renamed
+ * over the old one, so a planner never reads half an index
+ * Return value: e_success, e_failure
+ */
+static Status pool_write_index(PoolInfo *poolInfo)
+{
+    char temp_fname[MAX_SCAN_PATH + 8];
+    FILE *fptr;
+    int ok;
+
+    if (snprintf(temp_fname, sizeof(temp_fname), "%s.tmp", poolInfo->index_fname) >= (int) sizeof(temp_fname) ||
+        (fptr = fopen(temp_fname, "w")) == NULL)
+    {
+        perror("fopen");
+        printf("ERROR: Unable to write the index %s\n", poolInfo->index_fname);
+        return e_failure;
+    }
+    ok = fprintf(fptr, "%s: pixel bytes, file size, mtime ns, path\n", POOL_INDEX_MAGIC) > 0;
+    for (size_t i = 0; i < poolInfo->num_carriers && ok; i++)
+    {
+        ok = fprintf(fptr, "%zu\t%zu\t%lld\t%s\n", poolInfo->carriers[i].capacity, poolInfo->carriers[i].file_size,
+                     poolInfo->carriers[i].mtime_ns, poolInfo->carriers[i].path) > 0;
+    }
+    ok = fclose(fptr) == 0 && ok;
+    if (!ok || rename(temp_fname, poolInfo->index_fname) == -1)
+    {
+        perror("rename");
+        printf("ERROR: Unable to write the index %s\n", poolInfo->index_fname);
+        unlink(temp_fname);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Read and validate index arguments
+ * Input: command line arguments and address of structure variable which holds pool data
+ * Output: Index file name and the paths to index
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_index_args(char *argv[], PoolInfo *poolInfo)
+{
+    if (argv[2] == NULL || argv[3] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for indexing.");
+        puts("Usage: ./a.out -n <index file> <.bmp file | directory>... [-j workers]");
+        return e_failure;
+    }
+
+    poolInfo->index_fname = argv[2];
+    poolInfo->scan.paths = argv + 3;
+    for (poolInfo->scan.num_paths = 0; poolInfo->scan.paths[poolInfo->scan.num_paths] != NULL; poolInfo->scan.num_paths++)
+        ;
+    if (poolInfo->scan.num_workers < 1)
+    {
+        poolInfo->scan.num_workers = 1;
+    }
+
+    return e_success;
+}
+
+/* Do index
+ * Input: Address of structure variable which holds pool data
+ * Output: Index file listing every bmp file below the paths, sorted by capacity
+ * Description: The old index, when there is one, is kept by path so unchanged
+ * images are not read again. The images are walked like for probing, on
+ * num_workers workers. An image reached twice is listed once
+ * Return value: e_success, e_failure
+ */
+Status do_index(PoolInfo *poolInfo)
+{
+    pthread_t tids[LSB_MAX_THREADS];
+    Status status;
+    size_t kept = 0;
+    int started = 0;
+
+    if (pool_load_index(poolInfo->index_fname, &poolInfo->old_carriers, &poolInfo->num_old_carriers, 1) == e_failure)
+    {
+        return e_failure;
+    }
+    qsort(poolInfo->old_carriers, poolInfo->num_old_carriers, sizeof(PoolCarrier), pool_compare_path);
+
+    poolInfo->scan.next_path = 0;
+    poolInfo->scan.depth = 0;
+    poolInfo->scan.images_scanned = 0;
+    pthread_mutex_init(&poolInfo->scan.lock, NULL);
+    for (int w = 0; w < poolInfo->scan.num_workers && w < LSB_MAX_THREADS; w++)
+    {
+        if (pthread_create(&tids[started], NULL, index_worker, poolInfo) == 0)
+        {
+            started++;
+        }
+    }
+
+    // No thread could be started, index here
+    if (started == 0)
+    {
+        index_worker(poolInfo);
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+    pthread_mutex_destroy(&poolInfo->scan.lock);
+
+    // Drop images reached through more than one path argument
+    qsort(poolInfo->carriers, poolInfo->num_carriers, sizeof(PoolCarrier), pool_compare_path);
+    for (size_t i = 0; i < poolInfo->num_carriers; i++)
+    {
+        if (kept > 0 && !strcmp(poolInfo->carriers[kept - 1].path, poolInfo->carriers[i].path))
+        {
+            free(poolInfo->carriers[i].path);
+            continue;
+        }
+        poolInfo->carriers[kept++] = poolInfo->carriers[i];
+    }
+    poolInfo->num_carriers = kept;
+    qsort(poolInfo->carriers, poolInfo->num_carriers, sizeof(PoolCarrier), pool_compare_capacity);
+
+    status = pool_write_index(poolInfo);
+    printf("INFO: %zu carriers indexed, %u headers read, %u unchanged, %u skipped\n", poolInfo->num_carriers,
+           poolInfo->images_read, poolInfo->images_reused, poolInfo->images_skipped);
+
+    return status;
+}
+
+/* Read and validate plan arguments
+ * Input: command line arguments and address of structure variable which holds pool data
+ * Output: Index file name and the secret files to place
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_plan_args(char *argv[], PoolInfo *poolInfo)
+{
+    if (argv[2] == NULL || argv[3] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for planning.");
+        puts("Usage: ./a.out -f <index file> <secret file>... [-k bits] [-z] [-c] [-P | -K keyfile]");
+        return e_failure;
+    }
+
+    poolInfo->index_fname = argv[2];
+    poolInfo->secret_fnames = argv + 3;
+    for (poolInfo->num_secrets = 0; poolInfo->secret_fnames[poolInfo->num_secrets] != NULL; poolInfo->num_secrets++)
+        ;
+    if (poolInfo->lsb_bits == 0)
+    {
+        poolInfo->lsb_bits = 1;
+    }
+    if (LSB_BITS_TO_FLAGS(poolInfo->lsb_bits) == 0 && poolInfo->lsb_bits != 1)
+    {
+        puts("ERROR: Bits per image byte must be 1, 2 or 4");
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Size request
+ * Input: Pool data and the request of a secret file
+ * Output: Pixel bytes the secret file takes with its header, the same sum check_capacity makes
+ * Description: Compressed data is sized for the worst case, data that doesn't
+ * shrink, since compressing every file to plan would cost more than embedding it
+ * Return value: e_success, e_failure for a missing or empty file or an unsupported extension
+ */
+static Status pool_size_request(const PoolInfo *poolInfo, PoolRequest *request)
+{
+    const char *extn = strstr(request->fname, ".");
+    struct stat st;
+    size_t size;
+    uint flags;
+
+    if (stat(request->fname, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        printf("ERROR: %s is not a regular file with data\n", request->fname);
+        return e_failure;
+    }
+    if (extn == NULL || strlen(extn) > STEGO_MAX_EXTN)
+    {
+        printf("ERROR: Unsupported format of secret file %s\n", request->fname);
+        return e_failure;
+    }
+
+    size = poolInfo->compress ? POOL_LZ_BOUND((size_t) st.st_size) : (size_t) st.st_size;
+    flags = LSB_BITS_TO_FLAGS(poolInfo->lsb_bits) | SIZE_TO_FLAGS(size) | (poolInfo->compress ? FLAG_COMPRESSED : 0) |
+            (poolInfo->checksum ? FLAG_CHECKSUM : 0) | (poolInfo->encrypt ? FLAG_ENCRYPTED : 0);
+    request->needed = stego_required_capacity(extn, flags, size);
+
+    return e_success;
+}
+
+/* Next free carrier
+ * Input: Skip links, one per carrier and one past the end, and a carrier index
+ * Output: Links on the way pointed straight at the answer
+ * Description: Every carrier links to itself while free and to the next one
+ * once taken, so runs of taken carriers are jumped in one step
+ * Return value: Index of the first free carrier from index on, the count when none is left
+ */
+static size_t pool_next_free(size_t *next, size_t index)
+{
+    size_t root = index, link;
+
+    while (next[root] != root)
+    {
+        root = next[root];
+    }
+    while (next[index] != root)
+    {
+        link = next[index];
+        next[index] = root;
+        index = link;
+    }
+
+    return root;
+}
+
+/* Do plan
+ * Input: Address of structure variable which holds pool data
+ * Output: One line per secret file on stdout: path, carrier, pixel bytes needed, pixel bytes of the carrier
+ * Description: Best fit decreasing: the secret files go biggest first, each to
+ * the smallest carrier left that holds it, found with a binary search in the
+ * index. Every carrier takes one secret file. The carrier picked is stat'ed and
+ * passed over when it changed since it was indexed, no image is opened
+ * Return value: e_success, e_failure when a secret file got no carrier
+ */
+Status do_plan(PoolInfo *poolInfo)
+{
+    PoolRequest *requests = calloc(poolInfo->num_secrets, sizeof(PoolRequest));
+    PoolRequest **order = calloc(poolInfo->num_secrets, sizeof(PoolRequest *));
+    size_t *next = NULL;
+    size_t low, high, mid, index;
+    const PoolCarrier *carrier;
+    Status status = e_success;
+    struct stat st;
+    int placed = 0;
+
+    if (requests == NULL || order == NULL ||
+        pool_load_index(poolInfo->index_fname, &poolInfo->carriers, &poolInfo->num_carriers, 0) == e_failure ||
+        (next = malloc((poolInfo->num_carriers + 1) * sizeof(size_t))) == NULL)
+    {
+        free(requests);
+        free(order);
+        return e_failure;
+    }
+    for (size_t i = 0; i <= poolInfo->num_carriers; i++)
+    {
+        next[i] = i;
+    }
+
+    for (int i = 0; i < poolInfo->num_secrets; i++)
+    {
+        requests[i].fname = poolInfo->secret_fnames[i];
+        requests[i].carrier = SIZE_MAX;
+        order[i] = &requests[i];
+        if (pool_size_request(poolInfo, &requests[i]) == e_failure)
+        {
+            requests[i].needed = SIZE_MAX;
+            status = e_failure;
+        }
+    }
+    qsort(order, poolInfo->num_secrets, sizeof(PoolRequest *), pool_compare_needed);
+
+    for (int i = 0; i < poolInfo->num_secrets; i++)
+    {
+        if (order[i]->needed == SIZE_MAX)
+        {
+            continue;
+        }
+
+        // First carrier of the index that is big enough
+        for (low = 0, high = poolInfo->num_carriers; low < high;)
+        {
+            mid = low + (high - low) / 2;
+            poolInfo->carriers[mid].capacity < order[i]->needed ? (low = mid + 1) : (high = mid);
+        }
+
+        while ((index = pool_next_free(next, low)) < poolInfo->num_carriers)
+        {
+            carrier = &poolInfo->carriers[index];
+            next[index] = index + 1;
+            if (stat(carrier->path, &st) == 0 && (size_t) st.st_size == carrier->file_size && pool_mtime_ns(&st) == carrier->mtime_ns)
+            {
+                order[i]->carrier = index;
+                break;
+            }
+            printf("INFO: %s changed since it was indexed, passed over\n", carrier->path);
+        }
+    }
+
+    for (int i = 0; i < poolInfo->num_secrets; i++)
+    {
+        if (requests[i].carrier != SIZE_MAX)
+        {
+            carrier = &poolInfo->carriers[requests[i].carrier];
+            printf("%s\t%s\t%zu\t%zu\n", requests[i].fname, carrier->path, requests[i].needed, carrier->capacity);
+            placed++;
+        }
+        else if (requests[i].needed != SIZE_MAX)
+        {
+            printf("ERROR: No carrier left that holds %s, %zu pixel bytes\n", requests[i].fname, requests[i].needed);
+            status = e_failure;
+        }
+    }
+    printf("INFO: %d of %d secret files placed on %zu carriers\n", placed, poolInfo->num_secrets, poolInfo->num_carriers);
+
+    free(requests);
+    free(order);
+    free(next);
+
+    return status;
+}
+
+/* Close pool
+ * Input: Address of structure variable which holds pool data
+ * Output: Carriers of the index and the old index released
+ * Return value: None
+ */
+void close_pool(PoolInfo *poolInfo)
+{
+    pool_free_carriers(poolInfo->carriers, poolInfo->num_carriers);
+    pool_free_carriers(poolInfo->old_carriers, poolInfo->num_old_carriers);
+    poolInfo->carriers = NULL;
+    poolInfo->num_carriers = 0;
+    poolInfo->old_carriers = NULL;
+    poolInfo->num_old_carriers = 0;
+}
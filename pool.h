@@ -0,0 +1,92 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include "lz.h"
+#include "probe.h"
+#include "types.h"
+
+/*
+ * Carrier pool: a capacity index over many bmp images and a planner that picks
+ * carriers from it. The index is a text file, one carrier per line,
+ *     pixel bytes, file size, modification time in ns, path
+ * tab separated and sorted by pixel bytes, so the planner finds the smallest
+ * carrier that fits with a binary search. Building it reads only the bmp header
+ * of every image, and rebuilding it reads only the images whose size or
+ * modification time changed since. Planning reads the index and stats the
+ * carriers it picks, no image is opened.
+ */
+
+#define POOL_INDEX_MAGIC "# stego carrier index 1"
+
+/* Longest line of an index: three numbers, the path and the separators */
+#define MAX_POOL_LINE (MAX_SCAN_PATH + 64)
+
+/* Worst case size of compressed data, every block stored as it is behind its header */
+#define POOL_LZ_BOUND(size) ((size) + ((size) + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE * LZ_BLOCK_HEADER_SIZE)
+
+typedef struct _PoolCarrier
+{
+    char *path;
+    size_t capacity;            /* pixel bytes usable for the stego header and data */
+    size_t file_size;
+    long long mtime_ns;
+} PoolCarrier;
+
+/* A secret file to place and the carrier it got */
+typedef struct _PoolRequest
+{
+    const char *fname;
+    size_t needed;              /* pixel bytes it takes with its header */
+    size_t carrier;             /* index of the carrier, SIZE_MAX for none */
+} PoolRequest;
+
+typedef struct _PoolInfo
+{
+    /* Index file */
+    char *index_fname;
+
+    /* Indexing: images to walk on the worker pool, its lock guards the carriers and counters */
+    ScanInfo scan;
+    PoolCarrier *carriers;
+    size_t num_carriers;
+    size_t max_carriers;
+
+    /* The index before the rebuild, sorted by path */
+    PoolCarrier *old_carriers;
+    size_t num_old_carriers;
+
+    /* Counters */
+    uint images_read;
+    uint images_reused;
+    uint images_skipped;
+
+    /* Planning: secret files and how they get embedded */
+    char **secret_fnames;
+    int num_secrets;
+    uint lsb_bits;
+    int compress;
+    int checksum;
+    int encrypt;
+} PoolInfo;
+
+/* Read and validate index args from argv */
+Status read_and_validate_index_args(char *argv[], PoolInfo *poolInfo);
+
+/* Build or refresh the capacity index of the bmp files below the given paths */
+Status do_index(PoolInfo *poolInfo);
+
+/* Read and validate plan args from argv */
+Status read_and_validate_plan_args(char *argv[], PoolInfo *poolInfo);
+
+/* Pick the smallest fitting carrier of the index for every secret file */
+Status do_plan(PoolInfo *poolInfo);
+
+/* Read the capacity of the image at path into carrier from its bmp header */
+Status pool_read_carrier(const char *path, const struct stat *st, PoolCarrier *carrier);
+
+/* Release the carriers of the index */
+void close_pool(PoolInfo *poolInfo);
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "probe.h"
+#include "lsb.h"
+#include "types.h"
+
+/* Probe stego image
+ * Input: Image file name and the header to fill
+ * Output: Extension, payload size and format of the embedded file
+ * Description: Reads the first PROBE_READ_SIZE bytes of the image with a single
+ * pread and checks them with stego_read_header, which bounds the sizes by the
+ * real capacity of the image. The image is opened read only and nothing is written
+ * Return value: e_success if the image carries a payload, e_failure otherwise
+ */
+Status probe_stego_image(const char *fname, StegoHeader *header)
+{
+    unsigned char image[PROBE_READ_SIZE];
+    struct stat st;
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) == -1)
+    {
+        return e_failure;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (len = pread(fd, image, sizeof(image), 0)) < 0)
+    {
+        close(fd);
+        return e_failure;
+    }
+    close(fd);
+
+    return stego_read_header(image, len, st.st_size, header);
+}
+
+/* Read and validate scan arguments
+ * Input: command line arguments and address of structure variable which holds scan data
+ * Output: Paths to scan
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_scan_args(char *argv[], ScanInfo *scanInfo)
+{
+    if (argv[2] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for probing.");
+        puts("Usage: ./a.out -p <.bmp file | directory>... [-j workers]");
+        return e_failure;
+    }
+
+    scanInfo->paths = argv + 2;
+    for (scanInfo->num_paths = 0; scanInfo->paths[scanInfo->num_paths] != NULL; scanInfo->num_paths++)
+        ;
+    if (scanInfo->num_workers < 1)
+    {
+        scanInfo->num_workers = 1;
+    }
+
+    return e_success;
+}
+
+/* Has bmp suffix
+ * Input: File name
+ * Return value: 1 if the name ends in .bmp, 0 otherwise
+ */
+static int has_bmp_suffix(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len >= 4 && !strcasecmp(name + len - 4, ".bmp");
+}
+
+/* Next image to scan
+ * Input: Scan data, buffer for the image path
+ * Output: Path of the next image
+ * Description: Walks the paths and the directories below them depth first, one
+ * entry at a time, so no listing is ever held in memory. Files named on the
+ * command line are always probed, files found in directories only when they end
+ * in .bmp. Symbolic links inside directories are not followed. Safe to call
+ * from several workers, the walk is guarded by the scan lock
+ * Return value: 1 when an image was found, 0 when the walk is done
+ */
+int next_scan_image(ScanInfo *scanInfo, char *path)
+{
+    struct dirent *entry;
+    struct stat st;
+    int found = 0;
+
+    pthread_mutex_lock(&scanInfo->lock);
+    while (!found)
+    {
+        if (scanInfo->depth > 0)
+        {
+            // Next entry of the innermost directory
+            if ((entry = readdir(scanInfo->dirs[scanInfo->depth - 1])) == NULL)
+            {
+                closedir(scanInfo->dirs[--scanInfo->depth]);
+                continue;
+            }
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..") ||
+                snprintf(path, MAX_SCAN_PATH, "%s/%s", scanInfo->dir_paths[scanInfo->depth - 1], entry->d_name) >= MAX_SCAN_PATH)
+            {
+                continue;
+            }
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                if (lstat(path, &st) == -1)
+                {
+                    continue;
+                }
+                entry->d_type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+            if (entry->d_type == DT_REG)
+            {
+                found = has_bmp_suffix(entry->d_name);
+                continue;
+            }
+            if (entry->d_type != DT_DIR)
+            {
+                continue;
+            }
+        }
+        else if (scanInfo->next_path < scanInfo->num_paths)
+        {
+            // Next path of the command line
+            strcpy(path, scanInfo->paths[scanInfo->next_path++]);
+            if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+            {
+                found = 1;
+                continue;
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        // Descend into the directory in path
+        if (scanInfo->depth < MAX_SCAN_DEPTH && (scanInfo->dirs[scanInfo->depth] = opendir(path)) != NULL)
+        {
+            strcpy(scanInfo->dir_paths[scanInfo->depth++], path);
+        }
+    }
+    pthread_mutex_unlock(&scanInfo->lock);
+
+    return found;
+}
+
+/* Scan worker
+ * Input: Scan data
+ * Output: One line per image carrying a payload: path, extension, decoded size, bits per image byte
+ */
+static void *scan_worker(void *arg)
+{
+    ScanInfo *scanInfo = arg;
+    char path[MAX_SCAN_PATH];
+    StegoHeader header;
+    Status status;
+
+    while (next_scan_image(scanInfo, path))
+    {
+        status = probe_stego_image(path, &header);
+
+        pthread_mutex_lock(&scanInfo->lock);
+        scanInfo->images_scanned++;
+        if (status == e_success)
+        {
+            scanInfo->images_found++;
+            printf("%s\t%s\t%zu\t%u\n", path, header.extn, header.raw_size, header.lsb_bits);
+        }
+        pthread_mutex_unlock(&scanInfo->lock);
+    }
+
+    return NULL;
+}
+
+/* Do scan
+ * Input: Address of structure variable which holds scan data
+ * Output: Images carrying a payload listed on stdout
+ * Description: Starts num_workers workers, each pulling the next image from the
+ * walk and probing it. Probing is bound by the open and the single small read,
+ * so more workers than CPUs pay off on slow storage
+ * Return value: e_success
+ */
+Status do_scan(ScanInfo *scanInfo)
+{
+    pthread_t tids[LSB_MAX_THREADS];
+    int started = 0;
+
+    scanInfo->next_path = 0;
+    scanInfo->depth = 0;
+    scanInfo->images_scanned = 0;
+    scanInfo->images_found = 0;
+    pthread_mutex_init(&scanInfo->lock, NULL);
+
+    for (int w = 0; w < scanInfo->num_workers && w < LSB_MAX_THREADS; w++)
+    {
+        if (pthread_create(&tids[started], NULL, scan_worker, scanInfo) == 0)
+        {
+            started++;
+        }
+    }
+
+    // No thread could be started, scan here
+    if (started == 0)
+    {
+        scan_worker(scanInfo);
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+    pthread_mutex_destroy(&scanInfo->lock);
+
+    printf("INFO: %u images scanned, %u carry data\n", scanInfo->images_scanned, scanInfo->images_found);
+    return e_success;
+}
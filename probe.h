@@ -0,0 +1,61 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "stego.h"
+#include "types.h"
+
+/*
+ * Probe: read only check whether an image carries a payload. Only the bmp
+ * header and the stego header behind it are read, nothing is written.
+ */
+
+/*
+ * Bytes read from the start of an image to probe it: the bmp header, whatever
+ * lies in front of the first row and the stego header spread over the rows
+ */
+#define PROBE_READ_SIZE 4096
+
+/* Directory levels the scanner descends */
+#define MAX_SCAN_DEPTH 64
+#define MAX_SCAN_PATH 4096
+
+typedef struct _ScanInfo
+{
+    /* Files and directories to scan */
+    char **paths;
+    int num_paths;
+    int next_path;
+
+    /* Directories being walked, innermost last */
+    DIR *dirs[MAX_SCAN_DEPTH];
+    char dir_paths[MAX_SCAN_DEPTH][MAX_SCAN_PATH];
+    int depth;
+
+    /* Worker pool */
+    int num_workers;
+
+    /* Counters */
+    uint images_scanned;
+    uint images_found;
+
+    /* Guards the walk, stdout and the counters */
+    pthread_mutex_t lock;
+} ScanInfo;
+
+/* Probe an image file */
+Status probe_stego_image(const char *fname, StegoHeader *header);
+
+/* Read and validate scan args from argv */
+Status read_and_validate_scan_args(char *argv[], ScanInfo *scanInfo);
+
+/* Next bmp file of the walk over the scan paths into path, 0 when the walk is done */
+int next_scan_image(ScanInfo *scanInfo, char *path);
+
+/* Probe every bmp file below the given paths on the worker pool */
+Status do_scan(ScanInfo *scanInfo);
+
+#endif
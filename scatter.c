@@ -0,0 +1,337 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "scatter.h"
+#include "bmp.h"
+#include "chacha.h"
+#include "lsb.h"
+#include "types.h"
+
+/* Keystream bytes drawn at a time */
+#define SCATTER_RANDOM_SIZE 256
+
+/* Random numbers from the keystream */
+typedef struct _ScatterRandom
+{
+    const ChaCha *cipher;
+    uint64_t offset;            /* stream offset of the next buffer */
+    unsigned char buffer[SCATTER_RANDOM_SIZE];
+    size_t pos;
+} ScatterRandom;
+
+/* Next 32 bits of the keystream, little endian */
+static uint32_t scatter_random(ScatterRandom *random)
+{
+    uint32_t value;
+
+    if (random->pos == SCATTER_RANDOM_SIZE)
+    {
+        memset(random->buffer, 0, SCATTER_RANDOM_SIZE);
+        chacha_xor(random->cipher, random->offset, random->buffer, random->buffer, SCATTER_RANDOM_SIZE);
+        random->offset += SCATTER_RANDOM_SIZE;
+        random->pos = 0;
+    }
+    value = (uint32_t) random->buffer[random->pos] | (uint32_t) random->buffer[random->pos + 1] << 8 |
+            (uint32_t) random->buffer[random->pos + 2] << 16 | (uint32_t) random->buffer[random->pos + 3] << 24;
+    random->pos += 4;
+    return value;
+}
+
+/* Shuffle
+ * Input: Array for a permutation of count entries, count and random numbers
+ * Output: Random permutation of 0 to count - 1
+ * Description: Fisher-Yates, the bound is applied with a multiply instead of a
+ * modulo. The bias that leaves is below count / 2^32
+ * Return value: None
+ */
+static void scatter_shuffle(uint16_t *perm, size_t count, ScatterRandom *random)
+{
+    uint16_t swap;
+    size_t j;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        perm[i] = i;
+    }
+    for (size_t i = count; i > 1; i--)
+    {
+        j = (uint64_t) scatter_random(random) * i >> 32;
+        swap = perm[i - 1];
+        perm[i - 1] = perm[j];
+        perm[j] = swap;
+    }
+}
+
+/* 64 bit mix of the splitmix64 generator, every input bit reaches every output bit */
+static uint64_t scatter_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ x >> 31;
+}
+
+/* Tile order
+ * Input: Scatter state and a data tile below tiles
+ * Output: Image tile the data tile goes to
+ * Description: A balanced Feistel network permutes the numbers of 2 * half_bits
+ * bits, at most 4 times as many as there are tiles. Results that are no tile
+ * go through the network again until one is, which keeps it a permutation of
+ * the tiles (cycle walking). It takes no memory whatever the tile count
+ * Return value: Image tile
+ */
+static size_t scatter_order(const Scatter *scatter, size_t tile)
+{
+    uint64_t mask = ((uint64_t) 1 << scatter->half_bits) - 1;
+    uint64_t x = tile, left, right, swap;
+
+    if (scatter->tiles <= 1)
+    {
+        return tile;
+    }
+    do
+    {
+        left = x >> scatter->half_bits;
+        right = x & mask;
+        for (int r = 0; r < SCATTER_ROUNDS; r++)
+        {
+            swap = right;
+            right = left ^ (scatter_mix(right ^ scatter->round_keys[r]) & mask);
+            left = swap;
+        }
+        x = left << scatter->half_bits | right;
+    } while (x >= scatter->tiles);
+
+    return x;
+}
+
+/* Init
+ * Input: State to fill, key of the data, layout of the image, pixel byte the
+ * data starts at and fd of the image
+ * Output: Tile shuffle and permutations drawn, no tile in memory
+ * Description: Everything is drawn from the keystream at SCATTER_STREAM in a
+ * fixed order: round keys, mask key, the permutation of whole tiles and the
+ * one of the last tile. The same key and image give the same state
+ * Return value: None
+ */
+void scatter_init(Scatter *scatter, const ChaCha *cipher, const BmpInfo *bmp, size_t base, int fd)
+{
+    ScatterRandom random = { cipher, SCATTER_STREAM, { 0 }, SCATTER_RANDOM_SIZE };
+    size_t area = bmp->capacity > base ? bmp->capacity - base : 0;
+    uint bits = 0;
+
+    scatter->cipher = cipher;
+    scatter->bmp = *bmp;
+    scatter->base = base;
+    scatter->tiles = area / SCATTER_TILE_SIZE;
+    scatter->tail = area % SCATTER_TILE_SIZE;
+    while (scatter->tiles > 1 && ((scatter->tiles - 1) >> bits) > 0)
+    {
+        bits++;
+    }
+    scatter->half_bits = (bits + 1) / 2;
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        scatter->round_keys[r] = (uint64_t) scatter_random(&random) << 32 | scatter_random(&random);
+    }
+    scatter->mask_key = (uint64_t) scatter_random(&random) << 32 | scatter_random(&random);
+    scatter_shuffle(scatter->perm, SCATTER_GROUPS, &random);
+    scatter_shuffle(scatter->tail_perm, scatter->tail / SCATTER_GROUP, &random);
+
+    scatter->fd = fd;
+    scatter->linear = bmp_is_linear(bmp);
+    scatter->tile = SIZE_MAX;
+    scatter->dirty = 0;
+}
+
+/* Move groups
+ * Input: Scatter state with a tile in memory and the direction
+ * Output: The groups of the tile from image order into data order, or back
+ * Description: A group is one 8 byte move, the bytes behind the last whole
+ * group of the last tile keep their place
+ * Return value: None
+ */
+static void scatter_move(Scatter *scatter, int back)
+{
+    size_t groups = scatter->tile_size / SCATTER_GROUP;
+    size_t rest = groups * SCATTER_GROUP;
+    unsigned char *image;
+
+    for (size_t g = 0; g < groups; g++)
+    {
+        image = scatter->image + (size_t) scatter->tile_perm[g ^ scatter->tile_mask] * SCATTER_GROUP;
+        if (back)
+        {
+            memcpy(image, scatter->pixels + g * SCATTER_GROUP, SCATTER_GROUP);
+        }
+        else
+        {
+            memcpy(scatter->pixels + g * SCATTER_GROUP, image, SCATTER_GROUP);
+        }
+    }
+    if (back)
+    {
+        memcpy(scatter->image + rest, scatter->pixels + rest, scatter->tile_size - rest);
+    }
+    else
+    {
+        memcpy(scatter->pixels + rest, scatter->image + rest, scatter->tile_size - rest);
+    }
+}
+
+/* Flush
+ * Input: Scatter state
+ * Output: The tile in memory written back to the image if it was changed
+ * Description: The pixel bytes go back to their place in the tile, and the
+ * tile into the file bytes it was read from, padding as it was. Rows without
+ * padding are written from the tile as it is
+ * Return value: e_success, e_failure on a short write
+ */
+Status scatter_flush(Scatter *scatter)
+{
+    off_t offset;
+    ssize_t span_size;
+
+    if (!scatter->dirty)
+    {
+        return e_success;
+    }
+    scatter_move(scatter, 1);
+    offset = bmp_file_end(&scatter->bmp, scatter->tile_pos);
+    span_size = bmp_file_end(&scatter->bmp, scatter->tile_pos + scatter->tile_size) - offset;
+    if (!scatter->linear)
+    {
+        bmp_put_pixels(scatter->span, scatter->image, &scatter->bmp, scatter->tile_pos, scatter->tile_size);
+    }
+    if (pwrite(scatter->fd, scatter->linear ? scatter->image : scatter->span, span_size, offset) != span_size)
+    {
+        return e_failure;
+    }
+    scatter->dirty = 0;
+
+    return e_success;
+}
+
+/* Load tile
+ * Input: Scatter state and data tile
+ * Output: Pixel bytes of the tile in memory in data order, the tile in memory
+ * before written back when it was changed
+ * Return value: e_success, e_failure for a tile past the image or on a short read
+ */
+static Status scatter_load(Scatter *scatter, size_t tile)
+{
+    off_t offset;
+    ssize_t span_size;
+
+    if (tile == scatter->tile)
+    {
+        return e_success;
+    }
+    if (scatter_flush(scatter) == e_failure)
+    {
+        return e_failure;
+    }
+    scatter->tile = SIZE_MAX;
+    if (tile < scatter->tiles)
+    {
+        scatter->tile_pos = scatter->base + scatter_order(scatter, tile) * SCATTER_TILE_SIZE;
+        scatter->tile_size = SCATTER_TILE_SIZE;
+        scatter->tile_perm = scatter->perm;
+        scatter->tile_mask = scatter_mix(tile ^ scatter->mask_key) & (SCATTER_GROUPS - 1);
+    }
+    else if (tile == scatter->tiles && scatter->tail > 0)
+    {
+        scatter->tile_pos = scatter->base + scatter->tiles * SCATTER_TILE_SIZE;
+        scatter->tile_size = scatter->tail;
+        scatter->tile_perm = scatter->tail_perm;
+        scatter->tile_mask = 0;
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    offset = bmp_file_end(&scatter->bmp, scatter->tile_pos);
+    span_size = bmp_file_end(&scatter->bmp, scatter->tile_pos + scatter->tile_size) - offset;
+    if (pread(scatter->fd, scatter->linear ? scatter->image : scatter->span, span_size, offset) != span_size)
+    {
+        return e_failure;
+    }
+    if (!scatter->linear)
+    {
+        bmp_get_pixels(scatter->image, scatter->span, &scatter->bmp, scatter->tile_pos, scatter->tile_size);
+    }
+    scatter_move(scatter, 0);
+    scatter->tile = tile;
+
+    return e_success;
+}
+
+/* Write
+ * Input: Scatter state, first data pixel byte, data and its size, bits per pixel byte
+ * Output: Data embedded in the tiles it falls in
+ * Description: The LSB kernels run on the pixel bytes in data order, a tile is
+ * a whole number of data bytes. Tiles are written back once the data moves on
+ * to the next one, or on scatter_flush
+ * Return value: e_success, e_failure when the data runs past the image or on I/O errors
+ */
+Status scatter_write(Scatter *scatter, size_t unit, const unsigned char *data, size_t size, uint bits)
+{
+    LsbEmbedFn embed = lsb_select_embed_bits(bits);
+    size_t per_byte = 8 / bits;
+    size_t offset, count;
+
+    while (size > 0)
+    {
+        if (scatter_load(scatter, unit / SCATTER_TILE_SIZE) == e_failure)
+        {
+            return e_failure;
+        }
+        offset = unit % SCATTER_TILE_SIZE;
+        if ((count = (scatter->tile_size - offset) / per_byte) == 0)
+        {
+            return e_failure;
+        }
+        count = count < size ? count : size;
+        embed(scatter->pixels + offset, scatter->pixels + offset, data, count);
+        scatter->dirty = 1;
+        unit += count * per_byte;
+        data += count;
+        size -= count;
+    }
+
+    return e_success;
+}
+
+/* Read
+ * Input: Scatter state, first data pixel byte, array for the data, its size and bits per pixel byte
+ * Output: Data extracted from the tiles it falls in
+ * Return value: e_success, e_failure when the data runs past the image or on a short read
+ */
+Status scatter_read(Scatter *scatter, size_t unit, unsigned char *data, size_t size, uint bits)
+{
+    LsbExtractFn extract = lsb_select_extract_bits(bits);
+    size_t per_byte = 8 / bits;
+    size_t offset, count;
+
+    while (size > 0)
+    {
+        if (scatter_load(scatter, unit / SCATTER_TILE_SIZE) == e_failure)
+        {
+            return e_failure;
+        }
+        offset = unit % SCATTER_TILE_SIZE;
+        if ((count = (scatter->tile_size - offset) / per_byte) == 0)
+        {
+            return e_failure;
+        }
+        count = count < size ? count : size;
+        extract(data, scatter->pixels + offset, count);
+        unit += count * per_byte;
+        data += count;
+        size -= count;
+    }
+
+    return e_success;
+}
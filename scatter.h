@@ -0,0 +1,85 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+#include "chacha.h"
+#include "types.h"
+
+/*
+ * Keyed scattering of the data over the image (-r, FLAG_SCATTERED)
+ * The header stays in the first pixel bytes, the pixel bytes behind it are
+ * cut into tiles of SCATTER_TILE_SIZE, small enough for L2, and the tiles into
+ * groups of SCATTER_GROUP pixel bytes, one data byte at 1 bit per pixel byte.
+ * The data fills tile after tile in data order, but a keyed shuffle of the
+ * tiles puts data tile t into image tile order(t), and inside a tile data
+ * group g goes to image group perm[g ^ mask(t)], so every tile is shuffled in
+ * its own way. The shorter last tile keeps its place and has a permutation of
+ * its own, pixel bytes behind its last whole group stay where they are. All
+ * of it comes from the keystream of the data key far behind any data offset
+ * (SCATTER_STREAM), so without the passphrase the data can't be told from the
+ * other pixel bytes and there is nothing else to store.
+ * Only one tile at a time is read into memory, shuffled there and written
+ * back, the file is still walked a tile of contiguous rows at a time.
+ */
+
+/* Pixel bytes per tile, override with -DSCATTER_TILE_SIZE=n (a power of 2 from 64 to 512 KiB) */
+#ifndef SCATTER_TILE_SIZE
+#define SCATTER_TILE_SIZE (64 * 1024)
+#endif
+
+/* Pixel bytes moved as one, groups per tile */
+#define SCATTER_GROUP 8
+#define SCATTER_GROUPS (SCATTER_TILE_SIZE / SCATTER_GROUP)
+
+/* Keystream offset the permutations are drawn from */
+#define SCATTER_STREAM (1ull << 63)
+
+/* Rounds of the tile shuffle */
+#define SCATTER_ROUNDS 4
+
+typedef struct _Scatter
+{
+    const ChaCha *cipher;
+    BmpInfo bmp;
+    size_t base;                /* pixel byte of data pixel byte 0 */
+    size_t tiles;               /* whole tiles behind base */
+    size_t tail;                /* pixel bytes of the short last tile */
+
+    /* Tile shuffle: a Feistel network on 2 * half_bits bits, walked until it lands below tiles */
+    uint half_bits;
+    uint64_t round_keys[SCATTER_ROUNDS];
+    uint64_t mask_key;
+
+    /* Group permutations inside the whole tiles and the last one */
+    uint16_t perm[SCATTER_GROUPS];
+    uint16_t tail_perm[SCATTER_GROUPS];
+
+    /* The tile in memory, pixels in data order. Rows without padding are read into image straight away */
+    int fd;
+    int linear;
+    size_t tile;                /* data tile, SIZE_MAX for none */
+    int dirty;
+    size_t tile_pos;            /* its first image pixel byte */
+    size_t tile_size;
+    const uint16_t *tile_perm;
+    uint tile_mask;
+    unsigned char pixels[SCATTER_TILE_SIZE];
+    unsigned char image[SCATTER_TILE_SIZE];
+    unsigned char span[BMP_MAX_SPAN(SCATTER_TILE_SIZE)];
+} Scatter;
+
+/* Draw the permutations for the data pixel bytes from base to the end of the image on fd */
+void scatter_init(Scatter *scatter, const ChaCha *cipher, const BmpInfo *bmp, size_t base, int fd);
+
+/* Embed size data bytes, bits bits per pixel byte, from data pixel byte unit on */
+Status scatter_write(Scatter *scatter, size_t unit, const unsigned char *data, size_t size, uint bits);
+
+/* Extract size data bytes from data pixel byte unit on */
+Status scatter_read(Scatter *scatter, size_t unit, unsigned char *data, size_t size, uint bits);
+
+/* Write the tile in memory back when it was changed */
+Status scatter_flush(Scatter *scatter);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <string.h>
+#include "sha256.h"
+
+#define SHA256_ROTR(v, n) ((v) >> (n) | (v) << (32 - (n)))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Compress one block
+ * Input: Hash state and 64 bytes of message
+ * Output: Updated hash state
+ * Return value: None
+ */
+static void sha256_block(uint32_t *hash, const unsigned char *block)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 | (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ w[i - 2] >> 10;
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = hash[0]; b = hash[1]; c = hash[2]; d = hash[3];
+    e = hash[4]; f = hash[5]; g = hash[6]; h = hash[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    hash[0] += a; hash[1] += b; hash[2] += c; hash[3] += d;
+    hash[4] += e; hash[5] += f; hash[6] += g; hash[7] += h;
+}
+
+/* Start a hash
+ * Input: Context
+ * Output: Initial hash values, nothing buffered
+ * Return value: None
+ */
+void sha256_init(Sha256 *ctx)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->hash, initial, sizeof(initial));
+    ctx->fill = 0;
+    ctx->length = 0;
+}
+
+/* Hash more bytes
+ * Input: Context, data and its size
+ * Output: Every completed block compressed, the rest buffered
+ * Return value: None
+ */
+void sha256_update(Sha256 *ctx, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    ctx->length += size;
+    while (size > 0)
+    {
+        size_t piece = SHA256_BLOCK_SIZE - ctx->fill < size ? SHA256_BLOCK_SIZE - ctx->fill : size;
+
+        memcpy(ctx->block + ctx->fill, p, piece);
+        ctx->fill += piece;
+        p += piece;
+        size -= piece;
+        if (ctx->fill == SHA256_BLOCK_SIZE)
+        {
+            sha256_block(ctx->hash, ctx->block);
+            ctx->fill = 0;
+        }
+    }
+}
+
+/* Finish a hash
+ * Input: Context and a buffer of SHA256_SIZE bytes
+ * Output: Digest, big endian words
+ * Description: A 1 bit, zeros up to 8 bytes before a block end, then the
+ * message length in bits
+ * Return value: None
+ */
+void sha256_final(Sha256 *ctx, unsigned char *digest)
+{
+    uint64_t bits = ctx->length * 8;
+
+    ctx->block[ctx->fill++] = 0x80;
+    if (ctx->fill > SHA256_BLOCK_SIZE - 8)
+    {
+        memset(ctx->block + ctx->fill, 0, SHA256_BLOCK_SIZE - ctx->fill);
+        sha256_block(ctx->hash, ctx->block);
+        ctx->fill = 0;
+    }
+    memset(ctx->block + ctx->fill, 0, SHA256_BLOCK_SIZE - 8 - ctx->fill);
+    for (int i = 0; i < 8; i++)
+    {
+        ctx->block[SHA256_BLOCK_SIZE - 1 - i] = bits >> 8 * i;
+    }
+    sha256_block(ctx->hash, ctx->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = ctx->hash[i] >> 24;
+        digest[4 * i + 1] = ctx->hash[i] >> 16;
+        digest[4 * i + 2] = ctx->hash[i] >> 8;
+        digest[4 * i + 3] = ctx->hash[i];
+    }
+}
+
+/* Keyed hashes
+ * Input: Key, a buffer of SHA256_SIZE bytes and the inner and outer hash contexts
+ * Output: Both contexts fed with the padded key, ready for the message
+ * Description: Keys longer than a block are hashed first
+ * Return value: None
+ */
+static void hmac_sha256_start(const void *key, size_t key_size, Sha256 *inner, Sha256 *outer)
+{
+    unsigned char pad[SHA256_BLOCK_SIZE] = { 0 };
+
+    if (key_size > SHA256_BLOCK_SIZE)
+    {
+        sha256_init(inner);
+        sha256_update(inner, key, key_size);
+        sha256_final(inner, pad);
+    }
+    else
+    {
+        memcpy(pad, key, key_size);
+    }
+
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+    {
+        pad[i] ^= 0x36;
+    }
+    sha256_init(inner);
+    sha256_update(inner, pad, SHA256_BLOCK_SIZE);
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+    {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+    sha256_init(outer);
+    sha256_update(outer, pad, SHA256_BLOCK_SIZE);
+}
+
+/* Finish a keyed hash
+ * Input: Contexts from hmac_sha256_start, the inner one fed with the message
+ * Output: Message authentication code
+ * Return value: None
+ */
+static void hmac_sha256_finish(Sha256 *inner, Sha256 *outer, unsigned char *mac)
+{
+    unsigned char digest[SHA256_SIZE];
+
+    sha256_final(inner, digest);
+    sha256_update(outer, digest, SHA256_SIZE);
+    sha256_final(outer, mac);
+}
+
+/* HMAC-SHA256
+ * Input: Key, message and a buffer of SHA256_SIZE bytes
+ * Output: Message authentication code
+ * Return value: None
+ */
+void hmac_sha256(const void *key, size_t key_size, const void *data, size_t size, unsigned char *mac)
+{
+    Sha256 inner, outer;
+
+    hmac_sha256_start(key, key_size, &inner, &outer);
+    sha256_update(&inner, data, size);
+    hmac_sha256_finish(&inner, &outer, mac);
+}
+
+/* PBKDF2-HMAC-SHA256
+ * Input: Password, salt, iteration count, key buffer and key size
+ * Output: Derived key
+ * Description: Block i of the key is U1 ^ U2 ^ ... with U1 = HMAC(salt || i)
+ * and Un = HMAC(Un-1). The padded password is hashed once into two
+ * contexts which every iteration starts from
+ * Return value: None
+ */
+void pbkdf2_sha256(const void *password, size_t password_size, const void *salt, size_t salt_size, unsigned long rounds,
+                   unsigned char *key, size_t size)
+{
+    Sha256 inner_start, outer_start, inner, outer;
+    unsigned char u[SHA256_SIZE], t[SHA256_SIZE], index[4];
+
+    hmac_sha256_start(password, password_size, &inner_start, &outer_start);
+    for (uint32_t block = 1; size > 0; block++)
+    {
+        size_t piece = size < SHA256_SIZE ? size : SHA256_SIZE;
+
+        index[0] = block >> 24;
+        index[1] = block >> 16;
+        index[2] = block >> 8;
+        index[3] = block;
+        inner = inner_start;
+        outer = outer_start;
+        sha256_update(&inner, salt, salt_size);
+        sha256_update(&inner, index, 4);
+        hmac_sha256_finish(&inner, &outer, u);
+        memcpy(t, u, SHA256_SIZE);
+
+        for (unsigned long round = 1; round < rounds; round++)
+        {
+            inner = inner_start;
+            outer = outer_start;
+            sha256_update(&inner, u, SHA256_SIZE);
+            hmac_sha256_finish(&inner, &outer, u);
+            for (int i = 0; i < SHA256_SIZE; i++)
+            {
+                t[i] ^= u[i];
+            }
+        }
+
+        memcpy(key, t, piece);
+        key += piece;
+        size -= piece;
+    }
+}
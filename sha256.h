@@ -0,0 +1,38 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SHA-256 (FIPS 180-4) with HMAC (RFC 2104) and PBKDF2 (RFC 8018) on top,
+ * enough to turn a passphrase into a cipher key.
+ */
+#define SHA256_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct _Sha256
+{
+    uint32_t hash[8];
+    unsigned char block[SHA256_BLOCK_SIZE];
+    size_t fill;                /* bytes waiting in block */
+    uint64_t length;            /* bytes hashed so far */
+} Sha256;
+
+/* Start a hash */
+void sha256_init(Sha256 *ctx);
+
+/* Hash more bytes */
+void sha256_update(Sha256 *ctx, const void *data, size_t size);
+
+/* Pad, hash the length and store the digest */
+void sha256_final(Sha256 *ctx, unsigned char *digest);
+
+/* HMAC-SHA256 of data with key */
+void hmac_sha256(const void *key, size_t key_size, const void *data, size_t size, unsigned char *mac);
+
+/* PBKDF2-HMAC-SHA256, size bytes of key derived from password and salt in rounds iterations */
+void pbkdf2_sha256(const void *password, size_t password_size, const void *salt, size_t salt_size, unsigned long rounds,
+                   unsigned char *key, size_t size);
+
+#endif
@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "shard.h"
+#include "lsb.h"
+#include "pool.h"
+#include "stego.h"
+#include "types.h"
+#include "common.h"
+
+/* Order carriers by path */
+static int shard_compare_path(const void *a, const void *b)
+{
+    return strcmp(((const ShardCarrier *) a)->path, ((const ShardCarrier *) b)->path);
+}
+
+/* Order carriers by capacity, biggest first, then by path so the same images give the same shards */
+static int shard_compare_capacity(const void *a, const void *b)
+{
+    const ShardCarrier *x = a, *y = b;
+
+    if (x->capacity != y->capacity)
+    {
+        return x->capacity < y->capacity ? 1 : -1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+/* Order shards by payload id, then by index */
+static int shard_compare_index(const void *a, const void *b)
+{
+    const StegoShard *x = &((const ShardCarrier *) a)->shard, *y = &((const ShardCarrier *) b)->shard;
+
+    if (x->id != y->id)
+    {
+        return x->id < y->id ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Add carrier
+ * Input: Shard data and the carrier, its path owned by the shard data from now on
+ * Output: Carrier appended, the scan lock must be held
+ * Return value: e_success, e_failure when out of memory
+ */
+static Status shard_add_carrier(ShardInfo *shardInfo, const ShardCarrier *carrier)
+{
+    void *grown;
+
+    if (shardInfo->num_carriers == shardInfo->max_carriers)
+    {
+        shardInfo->max_carriers = shardInfo->max_carriers > 0 ? shardInfo->max_carriers * 2 : 64;
+        if ((grown = realloc(shardInfo->carriers, shardInfo->max_carriers * sizeof(ShardCarrier))) == NULL)
+        {
+            return e_failure;
+        }
+        shardInfo->carriers = grown;
+    }
+    shardInfo->carriers[shardInfo->num_carriers++] = *carrier;
+
+    return e_success;
+}
+
+/* Carrier worker
+ * Input: Shard data
+ * Output: A carrier with its capacity for every image of the walk that is a supported bmp
+ * Description: Only the bmp header of every image is read
+ */
+static void *carrier_worker(void *arg)
+{
+    ShardInfo *shardInfo = arg;
+    char path[MAX_SCAN_PATH];
+    ShardCarrier carrier;
+    PoolCarrier pool;
+    struct stat st;
+
+    memset(&carrier, 0, sizeof(carrier));
+    while (next_scan_image(&shardInfo->scan, path))
+    {
+        if (stat(path, &st) == -1 || !S_ISREG(st.st_mode) || pool_read_carrier(path, &st, &pool) == e_failure)
+        {
+            continue;
+        }
+        carrier.capacity = pool.capacity;
+        pthread_mutex_lock(&shardInfo->scan.lock);
+        shardInfo->scan.images_scanned++;
+        if ((carrier.path = strdup(path)) != NULL && shard_add_carrier(shardInfo, &carrier) == e_failure)
+        {
+            free(carrier.path);
+        }
+        pthread_mutex_unlock(&shardInfo->scan.lock);
+    }
+
+    return NULL;
+}
+
+/* Probe worker
+ * Input: Shard data
+ * Output: A carrier with its shard for every image of the walk that holds one
+ * Description: Only the stego header of every image is read, images without a
+ * payload or with one that isn't sharded are passed over
+ */
+static void *probe_worker(void *arg)
+{
+    ShardInfo *shardInfo = arg;
+    char path[MAX_SCAN_PATH];
+    ShardCarrier carrier;
+    StegoHeader header;
+    int found;
+
+    memset(&carrier, 0, sizeof(carrier));
+    while (next_scan_image(&shardInfo->scan, path))
+    {
+        found = probe_stego_image(path, &header) == e_success && (header.format_flags & FLAG_SHARDED);
+        pthread_mutex_lock(&shardInfo->scan.lock);
+        shardInfo->scan.images_scanned++;
+        if (found)
+        {
+            carrier.shard = header.shard;
+            carrier.size = header.size;
+            if ((carrier.path = strdup(path)) != NULL && shard_add_carrier(shardInfo, &carrier) == e_failure)
+            {
+                free(carrier.path);
+            }
+        }
+        pthread_mutex_unlock(&shardInfo->scan.lock);
+    }
+
+    return NULL;
+}
+
+/* Run workers
+ * Input: Shard data, the worker and the most workers worth starting
+ * Output: The worker run on up to num_workers threads until it runs out of work
+ * Description: When no thread can be started the worker runs here
+ * Return value: None
+ */
+static void shard_run_workers(ShardInfo *shardInfo, void *(*worker)(void *), size_t max_workers)
+{
+    pthread_t tids[LSB_MAX_THREADS];
+    int started = 0;
+
+    for (int w = 0; w < shardInfo->scan.num_workers && w < LSB_MAX_THREADS && (size_t) w < max_workers; w++)
+    {
+        if (pthread_create(&tids[started], NULL, worker, shardInfo) == 0)
+        {
+            started++;
+        }
+    }
+    if (started == 0)
+    {
+        worker(shardInfo);
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(tids[w], NULL);
+    }
+}
+
+/* Walk carriers
+ * Input: Shard data with the paths to walk and the worker to run on every image
+ * Output: carriers, every image reached through more than one path listed once
+ * Return value: None
+ */
+static void shard_walk(ShardInfo *shardInfo, void *(*worker)(void *))
+{
+    size_t kept = 0;
+
+    shardInfo->scan.next_path = 0;
+    shardInfo->scan.depth = 0;
+    shardInfo->scan.images_scanned = 0;
+    pthread_mutex_init(&shardInfo->scan.lock, NULL);
+    shard_run_workers(shardInfo, worker, SIZE_MAX);
+
+    qsort(shardInfo->carriers, shardInfo->num_carriers, sizeof(ShardCarrier), shard_compare_path);
+    for (size_t i = 0; i < shardInfo->num_carriers; i++)
+    {
+        if (kept > 0 && !strcmp(shardInfo->carriers[kept - 1].path, shardInfo->carriers[i].path))
+        {
+            free(shardInfo->carriers[i].path);
+            continue;
+        }
+        shardInfo->carriers[kept++] = shardInfo->carriers[i];
+    }
+    shardInfo->num_carriers = kept;
+}
+
+/* Next shard
+ * Input: Shard data
+ * Output: The next shard nobody works on yet
+ * Return value: Its carrier, NULL when all shards are taken
+ */
+static ShardCarrier *shard_next(ShardInfo *shardInfo)
+{
+    ShardCarrier *carrier = NULL;
+
+    pthread_mutex_lock(&shardInfo->scan.lock);
+    if (shardInfo->next_shard < shardInfo->num_shards)
+    {
+        carrier = &shardInfo->carriers[shardInfo->next_shard++];
+    }
+    pthread_mutex_unlock(&shardInfo->scan.lock);
+
+    return carrier;
+}
+
+/* Shard done
+ * Input: Shard data and the carrier of a finished shard
+ * Output: Failure counted and reported
+ * Return value: None
+ */
+static void shard_done(ShardInfo *shardInfo, const ShardCarrier *carrier)
+{
+    pthread_mutex_lock(&shardInfo->scan.lock);
+    if (carrier->status == e_failure)
+    {
+        printf("ERROR: Shard %u of %u in %s failed\n", carrier->shard.index + 1, carrier->shard.count, carrier->path);
+        shardInfo->shards_failed++;
+    }
+    pthread_mutex_unlock(&shardInfo->scan.lock);
+}
+
+/* Encode worker
+ * Input: Shard data with the shards planned
+ * Output: A stego image for every shard the worker takes
+ * Description: Every shard goes through the same validation as the command
+ * line, with the INFO messages suppressed and the engine running serially. The
+ * encoder reads the slice only, from its offset on
+ */
+static void *encode_worker(void *arg)
+{
+    ShardInfo *shardInfo = arg;
+    EncodeInfo *encInfo = malloc(sizeof(EncodeInfo));
+    ShardCarrier *carrier;
+    char *argv[6];
+
+    while ((carrier = shard_next(shardInfo)) != NULL)
+    {
+        carrier->status = e_failure;
+        if (encInfo != NULL)
+        {
+            memset(encInfo, 0, sizeof(*encInfo));
+            encInfo->quiet = 1;
+            encInfo->lsb_bits = shardInfo->lsb_bits;
+            encInfo->checksum = shardInfo->checksum;
+            encInfo->passphrase = shardInfo->passphrase;
+            encInfo->passphrase_size = shardInfo->passphrase_size;
+            encInfo->scatter = shardInfo->scatter;
+            encInfo->shard = &carrier->shard;
+            encInfo->secret_offset = carrier->shard.offset;
+            encInfo->size_secret_file = carrier->size;
+            argv[0] = "shard";
+            argv[1] = "-e";
+            argv[2] = carrier->path;
+            argv[3] = shardInfo->secret_fname;
+            argv[4] = carrier->output_fname;
+            argv[5] = NULL;
+            if (read_and_validate_encode_args(argv, encInfo) == e_success && open_files(encInfo) == e_success)
+            {
+                carrier->status = do_encoding(encInfo);
+            }
+            close_files_for_encoding(encInfo);
+        }
+        shard_done(shardInfo, carrier);
+    }
+
+    free(encInfo);
+    return NULL;
+}
+
+/* Decode worker
+ * Input: Shard data with the shards checked and the output sized
+ * Output: The slice of every shard the worker takes in the output
+ * Description: The image is decoded like on the command line, a shard whose
+ * header changed since it was probed is turned down
+ */
+static void *decode_worker(void *arg)
+{
+    ShardInfo *shardInfo = arg;
+    DecodeInfo *decInfo = malloc(sizeof(DecodeInfo));
+    ShardCarrier *carrier;
+    char *argv[4];
+
+    while ((carrier = shard_next(shardInfo)) != NULL)
+    {
+        carrier->status = e_failure;
+        if (decInfo != NULL)
+        {
+            memset(decInfo, 0, sizeof(*decInfo));
+            decInfo->quiet = 1;
+            decInfo->reassemble = 1;
+            decInfo->shard_fd = shardInfo->fd_output;
+            decInfo->output_fname = shardInfo->secret_fname;
+            decInfo->passphrase = shardInfo->passphrase;
+            decInfo->passphrase_size = shardInfo->passphrase_size;
+            argv[0] = "shard";
+            argv[1] = "-d";
+            argv[2] = carrier->path;
+            argv[3] = NULL;
+            if (read_and_validate_decode_args(argv, decInfo) == d_success)
+            {
+                if (memcmp(&decInfo->shard, &carrier->shard, sizeof(StegoShard)) || decInfo->size_secret_data != carrier->size)
+                {
+                    printf("ERROR: %s changed while reassembling\n", carrier->path);
+                }
+                else
+                {
+                    carrier->status = do_decoding(decInfo);
+                }
+            }
+            close_files_for_decoding(decInfo);
+        }
+        shard_done(shardInfo, carrier);
+    }
+
+    free(decInfo);
+    return NULL;
+}
+
+/* Read and validate shard arguments
+ * Input: command line arguments and address of structure variable which holds shard data
+ * Output: Secret file, output prefix and the paths to walk
+ * Description: The secret file has to be a regular file, every shard reads its
+ * own slice of it. Compression, archives and in place modes are turned down,
+ * scattering needs a key
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_shard_args(char *argv[], ShardInfo *shardInfo)
+{
+    struct stat st;
+
+    if (argv[2] == NULL || argv[3] == NULL || argv[4] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for sharding.");
+        puts("Usage: ./a.out -S <secret file> <output prefix> <.bmp file | directory>... [-j workers] [-k bits] [-c] [-P | -K keyfile] [-r]");
+        return e_failure;
+    }
+    if (shardInfo->compress || shardInfo->archive || shardInfo->inplace_mode != e_inplace_off)
+    {
+        puts("ERROR: Shards can't be compressed, archives or encoded in place");
+        return e_failure;
+    }
+    if (shardInfo->scatter && shardInfo->passphrase == NULL)
+    {
+        puts("ERROR: Scattering needs a key, give -P or -K");
+        return e_failure;
+    }
+    if (IS_STREAM_FNAME(argv[2]) || stat(argv[2], &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        printf("ERROR: Secret file %s has to be a regular file that isn't empty\n", argv[2]);
+        return e_failure;
+    }
+    if (LSB_BITS_TO_FLAGS(shardInfo->lsb_bits) == 0 && shardInfo->lsb_bits != 1)
+    {
+        puts("ERROR: Bits per image byte must be 1, 2 or 4");
+        return e_failure;
+    }
+
+    shardInfo->secret_fname = argv[2];
+    shardInfo->output_prefix = argv[3];
+    shardInfo->scan.paths = argv + 4;
+    for (shardInfo->scan.num_paths = 0; shardInfo->scan.paths[shardInfo->scan.num_paths] != NULL; shardInfo->scan.num_paths++)
+        ;
+    if (shardInfo->scan.num_workers < 1)
+    {
+        shardInfo->scan.num_workers = 1;
+    }
+
+    return e_success;
+}
+
+/* Do shard
+ * Input: Address of structure variable which holds shard data
+ * Output: One stego image <prefix>_<index>.bmp per shard, listed with its carrier, slice offset and size
+ * Description: The carriers go biggest first, every one taking as much of the
+ * secret as it holds with a header of its own (stego_max_size), so the secret
+ * is spread over as few carriers as possible. All shards share a random payload
+ * id. Nothing is written when the carriers can't hold the secret
+ * Return value: e_success, e_failure
+ */
+Status do_shard(ShardInfo *shardInfo)
+{
+    const char *extn = strchr(shardInfo->secret_fname, '.');
+    const char *base = strrchr(shardInfo->output_prefix, '/') != NULL ? strrchr(shardInfo->output_prefix, '/') : shardInfo->output_prefix;
+    const char *dot = strchr(base, '.');
+    int prefix = dot == NULL ? (int) strlen(shardInfo->output_prefix) : (int) (dot - shardInfo->output_prefix);
+    uint flags = LSB_BITS_TO_FLAGS(shardInfo->lsb_bits) | (shardInfo->checksum ? FLAG_CHECKSUM : 0) |
+                 (shardInfo->passphrase != NULL ? FLAG_ENCRYPTED : 0) | (shardInfo->scatter ? FLAG_SCATTERED : 0) | FLAG_SHARDED;
+    unsigned long long id;
+    struct stat st;
+    size_t offset = 0, room;
+
+    if (extn == NULL || strlen(extn) > STEGO_MAX_EXTN || stat(shardInfo->secret_fname, &st) == -1)
+    {
+        printf("ERROR: Unable to read %s\n", shardInfo->secret_fname);
+        return e_failure;
+    }
+    if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+    {
+        perror("getrandom");
+        return e_failure;
+    }
+
+    shard_walk(shardInfo, carrier_worker);
+    qsort(shardInfo->carriers, shardInfo->num_carriers, sizeof(ShardCarrier), shard_compare_capacity);
+
+    // Biggest carriers first, each slice as big as its carrier holds, so the carriers
+    // too small for a header and a byte are all at the end
+    shardInfo->num_shards = 0;
+    for (size_t i = 0; i < shardInfo->num_carriers && offset < (size_t) st.st_size; i++)
+    {
+        ShardCarrier *carrier = &shardInfo->carriers[i];
+
+        if ((room = stego_max_size(carrier->capacity, extn, flags)) == 0)
+        {
+            break;
+        }
+        carrier->size = (size_t) st.st_size - offset < room ? (size_t) st.st_size - offset : room;
+        carrier->shard.offset = offset;
+        offset += carrier->size;
+        shardInfo->num_shards++;
+    }
+    if (offset < (size_t) st.st_size)
+    {
+        printf("ERROR: %zu carriers hold %zu of the %zu bytes of %s\n", shardInfo->num_carriers, offset, (size_t) st.st_size,
+               shardInfo->secret_fname);
+        pthread_mutex_destroy(&shardInfo->scan.lock);
+        return e_failure;
+    }
+
+    for (uint i = 0; i < shardInfo->num_shards; i++)
+    {
+        ShardCarrier *carrier = &shardInfo->carriers[i];
+
+        carrier->shard.id = id;
+        carrier->shard.index = i;
+        carrier->shard.count = shardInfo->num_shards;
+        carrier->shard.total = st.st_size;
+        if (snprintf(carrier->output_fname, MAX_FNAME_SIZE, "%.*s_%u.bmp", prefix, shardInfo->output_prefix, i) >= MAX_FNAME_SIZE)
+        {
+            puts("ERROR: Output file name is too long");
+            pthread_mutex_destroy(&shardInfo->scan.lock);
+            return e_failure;
+        }
+    }
+
+    // One worker per carrier, up to the worker count
+    shardInfo->next_shard = 0;
+    shardInfo->shards_failed = 0;
+    shard_run_workers(shardInfo, encode_worker, shardInfo->num_shards);
+    pthread_mutex_destroy(&shardInfo->scan.lock);
+
+    for (uint i = 0; i < shardInfo->num_shards; i++)
+    {
+        ShardCarrier *carrier = &shardInfo->carriers[i];
+
+        if (carrier->status == e_success)
+        {
+            printf("%s\t%s\t%zu\t%zu\n", carrier->output_fname, carrier->path, carrier->shard.offset, carrier->size);
+        }
+    }
+    printf("INFO: %zu bytes of %s in %u shards, %u failed\n", (size_t) st.st_size, shardInfo->secret_fname, shardInfo->num_shards,
+           shardInfo->shards_failed);
+
+    return shardInfo->shards_failed == 0 ? e_success : e_failure;
+}
+
+/* Read and validate reassemble arguments
+ * Input: command line arguments and address of structure variable which holds shard data
+ * Output: Output file name and the paths to walk
+ * Return value: e_success, e_failure
+ */
+Status read_and_validate_reassemble_args(char *argv[], ShardInfo *shardInfo)
+{
+    if (argv[2] == NULL || argv[3] == NULL)
+    {
+        puts("ERROR: Insufficient arguments for reassembling.");
+        puts("Usage: ./a.out -R <output file> <.bmp file | directory>... [-j workers] [-P | -K keyfile]");
+        return e_failure;
+    }
+    if (IS_STREAM_FNAME(argv[2]))
+    {
+        puts("ERROR: Shards are written at their offsets, the output has to be a file");
+        return e_failure;
+    }
+
+    shardInfo->secret_fname = argv[2];
+    shardInfo->scan.paths = argv + 3;
+    for (shardInfo->scan.num_paths = 0; shardInfo->scan.paths[shardInfo->scan.num_paths] != NULL; shardInfo->scan.num_paths++)
+        ;
+    if (shardInfo->scan.num_workers < 1)
+    {
+        shardInfo->scan.num_workers = 1;
+    }
+
+    return e_success;
+}
+
+/* Check shards
+ * Input: Shard data with the sharded images found, sorted by payload id and index
+ * Output: The shards of one secret, once each
+ * Description: The images may hold shards of one secret only. A shard found
+ * twice, as a copy with the same header, is kept once. The shards have to agree
+ * on count and size and follow each other without gap or overlap
+ * Return value: e_success, e_failure for shards of several secrets, missing or inconsistent shards
+ */
+static Status shard_check(ShardInfo *shardInfo)
+{
+    ShardCarrier *carriers = shardInfo->carriers;
+    size_t kept = 0, offset = 0;
+
+    if (shardInfo->num_carriers == 0)
+    {
+        puts("ERROR: No shards found");
+        return e_failure;
+    }
+    if (carriers[0].shard.id != carriers[shardInfo->num_carriers - 1].shard.id)
+    {
+        puts("ERROR: Shards of more than one secret found, give the images of one");
+        return e_failure;
+    }
+
+    for (size_t i = 0; i < shardInfo->num_carriers; i++)
+    {
+        if (kept > 0 && carriers[kept - 1].shard.index == carriers[i].shard.index)
+        {
+            if (memcmp(&carriers[kept - 1].shard, &carriers[i].shard, sizeof(StegoShard)) || carriers[kept - 1].size != carriers[i].size)
+            {
+                printf("ERROR: %s and %s both hold shard %u, and they differ\n", carriers[kept - 1].path, carriers[i].path,
+                       carriers[i].shard.index + 1);
+                return e_failure;
+            }
+            free(carriers[i].path);
+            continue;
+        }
+        carriers[kept++] = carriers[i];
+    }
+    shardInfo->num_carriers = kept;
+
+    for (uint i = 0; i < carriers[0].shard.count; i++)
+    {
+        if (i >= kept || carriers[i].shard.index != i)
+        {
+            printf("ERROR: Shard %u of %u is missing\n", i + 1, carriers[0].shard.count);
+            return e_failure;
+        }
+        if (carriers[i].shard.count != carriers[0].shard.count || carriers[i].shard.total != carriers[0].shard.total ||
+            carriers[i].shard.offset != offset)
+        {
+            printf("ERROR: Shard %u in %s doesn't fit the others\n", i + 1, carriers[i].path);
+            return e_failure;
+        }
+        offset += carriers[i].size;
+    }
+    if (kept != carriers[0].shard.count || offset != carriers[0].shard.total)
+    {
+        puts("ERROR: The shards don't cover the secret");
+        return e_failure;
+    }
+    shardInfo->num_shards = kept;
+
+    return e_success;
+}
+
+/* Do reassemble
+ * Input: Address of structure variable which holds shard data
+ * Output: The secret in the output file
+ * Description: The images are probed on the worker pool and the shards found
+ * are put in order by their index, whatever order the walk gives. The output is
+ * sized to the secret once, then every shard is decoded by its own worker into
+ * its slice. A shard with corrupt chunks is reported, the others are written
+ * Return value: e_success, e_failure
+ */
+Status do_reassemble(ShardInfo *shardInfo)
+{
+    shard_walk(shardInfo, probe_worker);
+    qsort(shardInfo->carriers, shardInfo->num_carriers, sizeof(ShardCarrier), shard_compare_index);
+    if (shard_check(shardInfo) == e_failure)
+    {
+        pthread_mutex_destroy(&shardInfo->scan.lock);
+        return e_failure;
+    }
+
+    shardInfo->fd_output = open(shardInfo->secret_fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (shardInfo->fd_output == -1 || ftruncate(shardInfo->fd_output, shardInfo->carriers[0].shard.total) == -1)
+    {
+        perror("open");
+        printf("ERROR: Unable to create %s\n", shardInfo->secret_fname);
+        pthread_mutex_destroy(&shardInfo->scan.lock);
+        return e_failure;
+    }
+
+    // One worker per shard, up to the worker count
+    shardInfo->next_shard = 0;
+    shardInfo->shards_failed = 0;
+    shard_run_workers(shardInfo, decode_worker, shardInfo->num_shards);
+    pthread_mutex_destroy(&shardInfo->scan.lock);
+    if (close(shardInfo->fd_output) == -1)
+    {
+        perror("close");
+        shardInfo->shards_failed++;
+    }
+
+    printf("INFO: %zu bytes from %u shards in %s, %u failed\n", shardInfo->carriers[0].shard.total, shardInfo->num_shards,
+           shardInfo->secret_fname, shardInfo->shards_failed);
+    return shardInfo->shards_failed == 0 ? e_success : e_failure;
+}
+
+/* Close shards
+ * Input: Address of structure variable which holds shard data
+ * Output: Carriers released
+ * Return value: None
+ */
+void close_shards(ShardInfo *shardInfo)
+{
+    for (size_t i = 0; i < shardInfo->num_carriers; i++)
+    {
+        free(shardInfo->carriers[i].path);
+    }
+    free(shardInfo->carriers);
+    shardInfo->carriers = NULL;
+    shardInfo->num_carriers = 0;
+}
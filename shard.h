@@ -0,0 +1,78 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdio.h>
+#include "encode.h"
+#include "decode.h"
+#include "probe.h"
+#include "stego.h"
+#include "types.h"
+
+/*
+ * Sharding: a secret too big for one carrier is cut into slices, one per
+ * carrier, every stego image holding one slice behind a header with the shard
+ * fields (payload id, shard index and count, slice offset, secret size, see
+ * common.h). The carriers are filled biggest first, each slice as big as its
+ * carrier holds, and every shard is encoded by its own worker. Reassembling
+ * probes the headers of the images given, in any order and mixed with other
+ * images, checks that the shards of one secret are all there and cover it
+ * without gaps, then decodes them side by side into their slices of the output.
+ */
+
+typedef struct _ShardCarrier
+{
+    char *path;
+    size_t capacity;            /* pixel bytes, encoding only */
+    StegoShard shard;           /* slice the carrier gets or holds */
+    size_t size;                /* bytes of the slice */
+    char output_fname[MAX_FNAME_SIZE];
+    Status status;
+} ShardCarrier;
+
+typedef struct _ShardInfo
+{
+    /* Secret file to split, or the output to put it together in */
+    char *secret_fname;
+    int fd_output;
+
+    /* Stego images are named <prefix>_<index>.bmp */
+    char *output_prefix;
+
+    /* Images to walk on the worker pool, its lock guards the carriers and counters */
+    ScanInfo scan;
+    ShardCarrier *carriers;
+    size_t num_carriers;
+    size_t max_carriers;
+
+    /* Shards, carriers[0] to carriers[num_shards - 1] once planned, and the next one a worker takes */
+    uint num_shards;
+    uint next_shard;
+    uint shards_failed;
+
+    /* How the shards get embedded, -z, -a and in place modes are turned down */
+    uint lsb_bits;
+    int checksum;
+    int compress;
+    int archive;
+    InplaceMode inplace_mode;
+    const char *passphrase;
+    size_t passphrase_size;
+    int scatter;
+} ShardInfo;
+
+/* Read and validate shard args from argv */
+Status read_and_validate_shard_args(char *argv[], ShardInfo *shardInfo);
+
+/* Spread the secret file over the carriers below the given paths, one worker per carrier */
+Status do_shard(ShardInfo *shardInfo);
+
+/* Read and validate reassemble args from argv */
+Status read_and_validate_reassemble_args(char *argv[], ShardInfo *shardInfo);
+
+/* Put the secret back together from its shards among the images below the given paths */
+Status do_reassemble(ShardInfo *shardInfo);
+
+/* Release the carriers */
+void close_shards(ShardInfo *shardInfo);
+
+#endif
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "types.h"
+
+static const char *phase_names[e_phase_count] =
+{
+    "setup", "header", "magic", "extn", "size", "payload", "tail"
+};
+
+/* Parse stats format
+ * Input: Argument of -t
+ * Return value: e_stats_kv, e_stats_json, e_stats_off for anything else
+ */
+StatsFormat stats_parse_format(const char *arg)
+{
+    if (!strcmp(arg, "kv"))
+    {
+        return e_stats_kv;
+    }
+    if (!strcmp(arg, "json"))
+    {
+        return e_stats_json;
+    }
+    return e_stats_off;
+}
+
+/* Take snapshot
+ * Input: Stats data and the counters to fill
+ * Output: Clock, I/O counters of the thread and the watched ring and page faults of the process
+ * Description: /proc/thread-self/io is read with a single pread on the fd kept
+ * open by stats_start. That pread shows up in the counters of the next snapshot,
+ * so its length is remembered and taken off again
+ * Return value: None
+ */
+static void stats_snapshot(StatsInfo *stats, PhaseCounters *counters)
+{
+    struct timespec ts;
+    struct rusage ru;
+    char buffer[512];
+    ssize_t len;
+    char *line;
+
+    memset(counters, 0, sizeof(*counters));
+    if (stats->io_fd != -1 && (len = pread(stats->io_fd, buffer, sizeof(buffer) - 1, 0)) > 0)
+    {
+        buffer[len] = '\0';
+        for (line = buffer; line != NULL; line = strchr(line, '\n') != NULL ? strchr(line, '\n') + 1 : NULL)
+        {
+            sscanf(line, "rchar: %llu", &counters->bytes_read);
+            sscanf(line, "wchar: %llu", &counters->bytes_written);
+            sscanf(line, "syscr: %llu", &counters->read_calls);
+            sscanf(line, "syscw: %llu", &counters->write_calls);
+        }
+        counters->bytes_read -= stats->io_read_len;
+        stats->io_read_len += len;
+    }
+    if (stats->ring_read != NULL)
+    {
+        counters->bytes_read += *stats->ring_read;
+        counters->bytes_written += *stats->ring_written;
+    }
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        counters->page_faults = ru.ru_minflt + ru.ru_majflt;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    counters->seconds = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Start stats
+ * Input: Stats data
+ * Output: Counters cleared, /proc/thread-self/io opened
+ * Return value: None
+ */
+void stats_start(StatsInfo *stats)
+{
+    if (stats->format == e_stats_off)
+    {
+        return;
+    }
+    memset(stats->phase, 0, sizeof(stats->phase));
+    stats->current = e_phase_count;
+    stats->io_read_len = 0;
+    stats->io_fd = open("/proc/thread-self/io", O_RDONLY);
+    stats->ring_read = NULL;
+    stats->ring_written = NULL;
+}
+
+/* Watch ring
+ * Input: Stats data and the byte counters of a ring
+ * Output: The counters added to every snapshot from now on
+ * Description: Requests of an io_uring are done by the kernel outside of the
+ * thread, so /proc/thread-self/io misses them. The running phase starts again
+ * from a snapshot with the counters, only what moves from here on is added. A
+ * run watches one ring, later calls are ignored
+ * Return value: None
+ */
+void stats_watch_ring(StatsInfo *stats, const unsigned long long *bytes_read, const unsigned long long *bytes_written)
+{
+    if (stats->format == e_stats_off || stats->ring_read != NULL)
+    {
+        return;
+    }
+    stats->ring_read = bytes_read;
+    stats->ring_written = bytes_written;
+    if (stats->current != e_phase_count)
+    {
+        stats->start.bytes_read += *bytes_read;
+        stats->start.bytes_written += *bytes_written;
+    }
+}
+
+/* Begin phase
+ * Input: Stats data and the phase that starts now
+ * Output: Snapshot of the counters, a phase still running is ended first
+ * Return value: None
+ */
+void stats_begin(StatsInfo *stats, Phase phase)
+{
+    if (stats->format == e_stats_off)
+    {
+        return;
+    }
+    stats_end(stats);
+    stats->current = phase;
+    stats_snapshot(stats, &stats->start);
+}
+
+/* End phase
+ * Input: Stats data
+ * Output: Counters of the running phase grown by what happened since it began.
+ * The read system call of every snapshot in between is taken off
+ * Return value: None
+ */
+void stats_end(StatsInfo *stats)
+{
+    PhaseCounters now, *phase;
+
+    if (stats->format == e_stats_off || stats->current == e_phase_count)
+    {
+        return;
+    }
+    stats_snapshot(stats, &now);
+    phase = &stats->phase[stats->current];
+    phase->seconds += now.seconds - stats->start.seconds;
+    phase->bytes_read += now.bytes_read - stats->start.bytes_read;
+    phase->bytes_written += now.bytes_written - stats->start.bytes_written;
+    phase->read_calls += now.read_calls - stats->start.read_calls - (stats->io_fd != -1);
+    phase->write_calls += now.write_calls - stats->start.write_calls;
+    phase->page_faults += now.page_faults - stats->start.page_faults;
+    stats->current = e_phase_count;
+}
+
+/* Print counters
+ * Input: Stream, format, operation and phase name, counters and whether a JSON member came before
+ * Output: One key=value line or one JSON member
+ * Return value: None
+ */
+static void stats_print_counters(FILE *fptr, StatsFormat format, const char *operation, const char *name, const PhaseCounters *counters, int comma)
+{
+    if (format == e_stats_kv)
+    {
+        fprintf(fptr, "operation=%s phase=%s seconds=%.6f bytes_read=%llu bytes_written=%llu read_calls=%llu write_calls=%llu page_faults=%llu\n",
+                operation, name, counters->seconds, counters->bytes_read, counters->bytes_written, counters->read_calls, counters->write_calls, counters->page_faults);
+    }
+    else
+    {
+        fprintf(fptr, "%s\"%s\":{\"seconds\":%.6f,\"bytes_read\":%llu,\"bytes_written\":%llu,\"read_calls\":%llu,\"write_calls\":%llu,\"page_faults\":%llu}",
+                comma ? "," : "", name, counters->seconds, counters->bytes_read, counters->bytes_written, counters->read_calls, counters->write_calls, counters->page_faults);
+    }
+}
+
+/* Report stats
+ * Input: Stats data, operation name and the stream to print to
+ * Output: key=value lines, one per phase and one for the total, or a single JSON object
+ * Description: Phases a run never went through are left out. Meant for stderr,
+ * so it never mixes with a stego image or decoded data written to stdout
+ * Return value: None
+ */
+void stats_report(StatsInfo *stats, const char *operation, FILE *fptr)
+{
+    PhaseCounters total = { 0, 0, 0, 0, 0, 0 };
+    int printed = 0;
+
+    if (stats->format == e_stats_off)
+    {
+        return;
+    }
+    stats_end(stats);
+    if (stats->io_fd != -1)
+    {
+        close(stats->io_fd);
+        stats->io_fd = -1;
+    }
+
+    if (stats->format == e_stats_json)
+    {
+        fprintf(fptr, "{\"operation\":\"%s\",\"phases\":{", operation);
+    }
+    for (int p = 0; p < e_phase_count; p++)
+    {
+        const PhaseCounters *phase = &stats->phase[p];
+
+        if (phase->seconds == 0)
+        {
+            continue;
+        }
+        stats_print_counters(fptr, stats->format, operation, phase_names[p], phase, printed++);
+        total.seconds += phase->seconds;
+        total.bytes_read += phase->bytes_read;
+        total.bytes_written += phase->bytes_written;
+        total.read_calls += phase->read_calls;
+        total.write_calls += phase->write_calls;
+        total.page_faults += phase->page_faults;
+    }
+    if (stats->format == e_stats_json)
+    {
+        fprintf(fptr, "}");
+    }
+    stats_print_counters(fptr, stats->format, operation, "total", &total, 1);
+    if (stats->format == e_stats_json)
+    {
+        fprintf(fptr, "}\n");
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * Per phase instrumentation of the encode and decode engines
+ * Wall time, bytes and read/write system calls of the calling thread (from
+ * /proc/thread-self/io) and page faults of the process, which is where the
+ * I/O of the mapped engine shows up. The bytes of io_uring requests don't show
+ * up there, the counters of a watched ring are added to them. Off by default,
+ * then every call returns straight away.
+ */
+
+typedef enum
+{
+    e_phase_setup,      /* sizes, capacity, opening and mapping */
+    e_phase_header,     /* bmp header */
+    e_phase_magic,
+    e_phase_extn,
+    e_phase_size,
+    e_phase_payload,
+    e_phase_tail,       /* image bytes behind the payload */
+    e_phase_count
+} Phase;
+
+typedef enum
+{
+    e_stats_off,
+    e_stats_kv,         /* key=value, one line per phase */
+    e_stats_json        /* one JSON object per run */
+} StatsFormat;
+
+typedef struct _PhaseCounters
+{
+    double seconds;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long read_calls;
+    unsigned long long write_calls;
+    unsigned long long page_faults;
+} PhaseCounters;
+
+typedef struct _StatsInfo
+{
+    StatsFormat format;
+    PhaseCounters phase[e_phase_count];
+
+    /* Snapshot taken when the running phase began */
+    PhaseCounters start;
+    Phase current;
+
+    /* /proc/thread-self/io, kept open while a run is measured */
+    int io_fd;
+    unsigned long long io_read_len;
+
+    /* Byte counters of the io_uring the run goes through, NULL for none */
+    const unsigned long long *ring_read;
+    const unsigned long long *ring_written;
+} StatsInfo;
+
+/* Parse a -t argument, "kv" or "json" */
+StatsFormat stats_parse_format(const char *arg);
+
+/* Clear the counters and start measuring a run */
+void stats_start(StatsInfo *stats);
+
+/* Add the bytes of a ring's requests to the counters from now on, until the run is reported */
+void stats_watch_ring(StatsInfo *stats, const unsigned long long *bytes_read, const unsigned long long *bytes_written);
+
+/* Start the given phase */
+void stats_begin(StatsInfo *stats, Phase phase);
+
+/* End the running phase and add its counters */
+void stats_end(StatsInfo *stats);
+
+/* Print the counters of a run and stop measuring */
+void stats_report(StatsInfo *stats, const char *operation, FILE *fptr);
+
+#endif
@@ -0,0 +1,1267 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include "stego.h"
+#include "bmp.h"
+#include "chacha.h"
+#include "crc.h"
+#include "lsb.h"
+#include "lz.h"
+#include "sha256.h"
+#include "types.h"
+#include "common.h"
+
+/* Chunks of checksummed data for one thread, embedded when dest is set, extracted otherwise */
+typedef struct _StegoChunks
+{
+    unsigned char *dest;
+    const unsigned char *image;
+    unsigned char *data;
+    StegoChunk *chunks;
+    const StegoHeader *header;
+    size_t first;
+    size_t count;
+    size_t failed;
+} StegoChunks;
+
+/* Parse image
+ * Input: First len bytes of an image of image_size bytes and the layout to fill
+ * Output: Row layout, capacity bounded by the rows present
+ * Return value: e_success, e_failure for an unsupported image
+ */
+static Status stego_parse_image(const unsigned char *image, size_t len, size_t image_size, BmpInfo *bmp)
+{
+    if (bmp_parse_header(image, len < image_size ? len : image_size, bmp) == e_failure)
+    {
+        return e_failure;
+    }
+    bmp_clip_capacity(bmp, image_size);
+    return e_success;
+}
+
+/* Extract header bytes
+ * Input: Array for the bytes and their count, first len bytes of the image, its
+ * layout and the pixel byte to start from
+ * Output: Bytes gathered one bit per pixel byte, pos advanced
+ * Return value: e_success, e_failure when the bytes lie beyond the image or len
+ */
+static Status stego_extract_field(unsigned char *data, size_t size, const unsigned char *image, size_t len,
+                                  const BmpInfo *bmp, size_t *pos)
+{
+    if (*pos + size * 8 > bmp->capacity || bmp_file_end(bmp, *pos + size * 8) > len)
+    {
+        return e_failure;
+    }
+    bmp_extract(data, image + bmp_file_end(bmp, *pos), bmp, *pos, size, 1, 1);
+    *pos += size * 8;
+    return e_success;
+}
+
+/* Put size
+ * Input: Field of bytes bytes (4 or 8) and the size to store
+ * Description: The size is stored MSB first, i.e. as big endian bytes
+ * Return value: bytes
+ */
+size_t stego_put_size(unsigned char *field, unsigned long long size, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+    {
+        field[i] = size >> (bytes - 1 - i) * 8;
+    }
+    return bytes;
+}
+
+/* Get size
+ * Input: Field of bytes bytes (4 or 8)
+ * Description: The size is stored MSB first, i.e. as big endian bytes
+ * Return value: decoded size
+ */
+unsigned long long stego_get_size(const unsigned char *field, size_t bytes)
+{
+    unsigned long long size = 0;
+
+    for (size_t i = 0; i < bytes; i++)
+    {
+        size = size << 8 | field[i];
+    }
+    return size;
+}
+
+/* Data offset
+ * Input: Extension stored with the data and the format flags
+ * Output: Pixel bytes taken by the stego header
+ * Return value: Pixel byte position of the first data byte
+ */
+size_t stego_data_offset(const char *extn, uint format_flags)
+{
+    size_t raw_size_field = format_flags & FLAG_COMPRESSED ? RAW_SIZE_FIELD_BYTES : 0;
+    size_t key_field = format_flags & FLAG_ENCRYPTED ? KEY_FIELD_BYTES : 0;
+    size_t shard_field = format_flags & FLAG_SHARDED ? SHARD_FIELD_BYTES : 0;
+    size_t crc_field = format_flags & FLAG_CHECKSUM ? CRC_FIELD_BYTES : 0;
+
+    return (strlen(MAGIC_STRING) + 4 + strlen(extn) + SIZE_FIELD_BYTES(format_flags) + raw_size_field + key_field + shard_field +
+            crc_field) * 8;
+}
+
+/* Required capacity
+ * Input: Extension stored with the data, the format flags and the data size
+ * Output: Pixel bytes the header and the data take
+ * Description: Checksummed data counts its chunk trailers, the data bytes are
+ * spread at the bits per image byte of the flags
+ * Return value: Pixel bytes an image needs to carry the data
+ */
+size_t stego_required_capacity(const char *extn, uint format_flags, size_t size)
+{
+    return stego_data_offset(extn, format_flags) + FRAMED_SIZE(size, format_flags) * 8 / FLAGS_TO_LSB_BITS(format_flags);
+}
+
+/* Max size
+ * Input: Pixel bytes, extension stored with the data and the format flags
+ * Output: Largest data size the pixel bytes hold with the header
+ * Description: Binary search over stego_required_capacity, so chunk trailers
+ * and the longer size field of data above 4 GiB are counted exactly as the
+ * encoder counts them
+ * Return value: Data bytes, 0 when nothing fits
+ */
+size_t stego_max_size(size_t capacity, const char *extn, uint format_flags)
+{
+    size_t low = 0;
+    size_t high = capacity / 8 * FLAGS_TO_LSB_BITS(format_flags) + 1;
+
+    format_flags &= ~FLAG_SIZE64;
+    while (high - low > 1)
+    {
+        size_t size = low + (high - low) / 2;
+
+        if (stego_required_capacity(extn, format_flags | SIZE_TO_FLAGS(size), size) <= capacity)
+        {
+            low = size;
+        }
+        else
+        {
+            high = size;
+        }
+    }
+
+    return low;
+}
+
+/* Image capacity
+ * Input: Image, at least its bmp header, and the size of the whole image
+ * Output: Pixel bytes usable for the stego header and data
+ * Description: Counts the pixel bytes of the rows the bmp header declares, as
+ * far as the image holds them. Row padding does not count
+ * Return value: Pixel bytes, 0 when image is not a supported bmp image
+ */
+size_t stego_image_capacity(const unsigned char *image, size_t image_size)
+{
+    BmpInfo bmp;
+
+    return stego_parse_image(image, image_size, image_size, &bmp) == e_success ? bmp.capacity : 0;
+}
+
+/* Capacity
+ * Input: Image and its size, extension and bits per image byte of the data
+ * Output: Largest data size the image can carry
+ * Description: Data above 4 GiB takes the longer size field, when that costs
+ * more than it gains the answer is the largest size of the shorter one
+ * Return value: Data bytes, 0 when nothing fits
+ */
+size_t stego_capacity(const unsigned char *image, size_t image_size, const char *extn, uint lsb_bits)
+{
+    size_t capacity = stego_image_capacity(image, image_size);
+    size_t offset = stego_data_offset(extn, 0);
+    size_t size;
+
+    if (LSB_BITS_TO_FLAGS(lsb_bits) == 0 && lsb_bits != 1)
+    {
+        return 0;
+    }
+    if (capacity <= offset)
+    {
+        return 0;
+    }
+    size = (capacity - offset) * lsb_bits / 8;
+    if (size > UINT32_MAX)
+    {
+        size = (capacity - stego_data_offset(extn, FLAG_SIZE64)) * lsb_bits / 8;
+        size = size > UINT32_MAX ? size : UINT32_MAX;
+    }
+
+    return size;
+}
+
+/* Put shard
+ * Input: Buffer of SHARD_FIELD_BYTES bytes and the shard
+ * Output: Payload id, shard index and count, slice offset and secret size
+ * Return value: Bytes written
+ */
+size_t stego_put_shard(unsigned char *field, const StegoShard *shard)
+{
+    size_t size_field = 0;
+
+    size_field += stego_put_size(field + size_field, shard->id, 8);
+    size_field += stego_put_size(field + size_field, shard->index, 4);
+    size_field += stego_put_size(field + size_field, shard->count, 4);
+    size_field += stego_put_size(field + size_field, shard->offset, 8);
+    size_field += stego_put_size(field + size_field, shard->total, 8);
+
+    return size_field;
+}
+
+/* Get shard
+ * Input: SHARD_FIELD_BYTES bytes of shard fields
+ * Output: The shard they describe
+ * Return value: None
+ */
+void stego_get_shard(const unsigned char *field, StegoShard *shard)
+{
+    shard->id = stego_get_size(field, 8);
+    shard->index = stego_get_size(field + 8, 4);
+    shard->count = stego_get_size(field + 12, 4);
+    shard->offset = stego_get_size(field + 16, 8);
+    shard->total = stego_get_size(field + 24, 8);
+}
+
+/* Put fields
+ * Input: Buffer of STEGO_MAX_HEADER_SIZE bytes, extension, format flags, data
+ * size, size before compression, salt and key check and shard
+ * Output: Magic string, extension size with the format flags, extension, data
+ * size, for compressed data raw size, for encrypted data the key fields and for
+ * sharded data the shard fields
+ * Description: These are the bytes the header CRC32C of checksummed data covers.
+ * The decoder gets them back from the fields it read
+ * Return value: Bytes written
+ */
+size_t stego_put_fields(unsigned char *header, const char *extn, uint format_flags, size_t size, size_t raw_size,
+                        const unsigned char *key_fields, const StegoShard *shard)
+{
+    size_t size_extn = strlen(extn);
+    size_t size_header = 0;
+
+    memcpy(header, MAGIC_STRING, strlen(MAGIC_STRING));
+    size_header += strlen(MAGIC_STRING);
+    size_header += stego_put_size(header + size_header, size_extn | format_flags, 4);
+    memcpy(header + size_header, extn, size_extn);
+    size_header += size_extn;
+    size_header += stego_put_size(header + size_header, size, SIZE_FIELD_BYTES(format_flags));
+    if (format_flags & FLAG_COMPRESSED)
+    {
+        size_header += stego_put_size(header + size_header, raw_size, RAW_SIZE_FIELD_BYTES);
+    }
+    if (format_flags & FLAG_ENCRYPTED)
+    {
+        memcpy(header + size_header, key_fields, KEY_FIELD_BYTES);
+        size_header += KEY_FIELD_BYTES;
+    }
+    if (format_flags & FLAG_SHARDED)
+    {
+        size_header += stego_put_shard(header + size_header, shard);
+    }
+
+    return size_header;
+}
+
+/* Build header
+ * Input: Buffer of STEGO_MAX_HEADER_SIZE bytes, extension, data size, size
+ * before compression (0 for data that isn't compressed), whether the data is
+ * checksummed, key of encrypted data (NULL otherwise), whether the key
+ * scatters the data, shard of sharded data (NULL otherwise), bits per pixel
+ * byte and layout of the image
+ * Output: Plain header bytes: magic string, extension size with the format flags,
+ * extension, data size, raw size of compressed data, key fields of encrypted
+ * data, shard fields of sharded data, CRC32C of all that for checksummed data
+ * Description: FLAG_ROW_LAYOUT is only set where the layout differs from the
+ * linear one, FLAG_SIZE64 only for data above 4 GiB, FLAG_COMPRESSED,
+ * FLAG_CHECKSUM, FLAG_ENCRYPTED, FLAG_SCATTERED and FLAG_SHARDED only when
+ * asked for, so everything else stays readable by older versions
+ * Return value: Header bytes, 0 for an invalid extension or bit count or scattering without a key
+ */
+size_t stego_build_header(unsigned char *header, const char *extn, size_t size, size_t raw_size, int checksum, const StegoKey *key,
+                          int scatter, const StegoShard *shard, uint lsb_bits, const BmpInfo *bmp)
+{
+    size_t size_extn = strlen(extn);
+    uint format_flags = LSB_BITS_TO_FLAGS(lsb_bits) | (bmp_is_linear(bmp) ? 0 : FLAG_ROW_LAYOUT) | SIZE_TO_FLAGS(size) |
+                        (raw_size > 0 ? FLAG_COMPRESSED : 0) | (checksum ? FLAG_CHECKSUM : 0) | (key != NULL ? FLAG_ENCRYPTED : 0) |
+                        (scatter ? FLAG_SCATTERED : 0) | (shard != NULL ? FLAG_SHARDED : 0);
+    size_t size_header;
+
+    if (size_extn == 0 || size_extn > STEGO_MAX_EXTN || (LSB_BITS_TO_FLAGS(lsb_bits) == 0 && lsb_bits != 1) || (scatter && key == NULL))
+    {
+        return 0;
+    }
+
+    size_header = stego_put_fields(header, extn, format_flags, size, raw_size, key != NULL ? key->fields : NULL, shard);
+    if (format_flags & FLAG_CHECKSUM)
+    {
+        size_header += stego_put_size(header + size_header, crc32c(0, header, size_header), CRC_FIELD_BYTES);
+    }
+
+    return size_header;
+}
+
+/* Make key
+ * Input: Key to fill, passphrase and its size, salt of SALT_FIELD_BYTES or NULL
+ * Output: Cipher state, salt and key check
+ * Description: PBKDF2-HMAC-SHA256 with KDF_ROUNDS rounds turns passphrase and
+ * salt into a master key, HMACs of two labels under it give the cipher key and
+ * the check. The check tells a wrong passphrase without giving the cipher key
+ * away. Every salt makes a new key, so the nonce stays 0
+ * Return value: e_success, e_failure when no random salt can be had
+ */
+Status stego_make_key(StegoKey *key, const void *passphrase, size_t passphrase_size, const unsigned char *salt)
+{
+    static const unsigned char nonce[CHACHA_NONCE_SIZE] = { 0 };
+    unsigned char master[SHA256_SIZE], digest[SHA256_SIZE];
+
+    if (salt != NULL)
+    {
+        memcpy(key->fields, salt, SALT_FIELD_BYTES);
+    }
+    else if (getrandom(key->fields, SALT_FIELD_BYTES, 0) != SALT_FIELD_BYTES)
+    {
+        return e_failure;
+    }
+
+    pbkdf2_sha256(passphrase, passphrase_size, key->fields, SALT_FIELD_BYTES, KDF_ROUNDS, master, sizeof(master));
+    hmac_sha256(master, sizeof(master), "stego key", strlen("stego key"), digest);
+    chacha_init(&key->cipher, digest, nonce);
+    hmac_sha256(master, sizeof(master), "stego check", strlen("stego check"), digest);
+    memcpy(key->fields + SALT_FIELD_BYTES, digest, KEY_CHECK_FIELD_BYTES);
+
+    return e_success;
+}
+
+/* Unlock key
+ * Input: Key to fill, passphrase and its size, header read from the image
+ * Output: Key of the data, header->cipher pointing to it
+ * Description: The key is derived with the salt of the header, its check has
+ * to match the one stored. Data that isn't encrypted needs no key
+ * Return value: e_success, e_failure for a wrong passphrase
+ */
+Status stego_unlock_key(StegoKey *key, const void *passphrase, size_t passphrase_size, StegoHeader *header)
+{
+    if (!(header->format_flags & FLAG_ENCRYPTED))
+    {
+        return e_success;
+    }
+    stego_make_key(key, passphrase, passphrase_size, header->key_fields);
+    if (memcmp(key->fields, header->key_fields, KEY_FIELD_BYTES))
+    {
+        return e_failure;
+    }
+    header->cipher = &key->cipher;
+
+    return e_success;
+}
+
+/* Encode
+ * Input: Destination and source image of image_size bytes each, data and its
+ * size, extension, bits per image byte and thread count
+ * Output: dest carrying the data
+ * Description: See stego_encode_encrypted
+ * Return value: e_success, e_failure for an invalid image or argument or too little capacity
+ */
+Status stego_encode(unsigned char *dest, const unsigned char *src, size_t image_size,
+                    const void *data, size_t size, const char *extn, uint lsb_bits, int threads)
+{
+    return stego_encode_encrypted(dest, src, image_size, data, size, extn, lsb_bits, NULL, threads);
+}
+
+/* Encode encrypted
+ * Input: Destination and source image of image_size bytes each, data and its
+ * size, extension, bits per image byte, key or NULL and thread count
+ * Output: dest carrying the data
+ * Description: dest may be src, then only the header and data region is
+ * rewritten. Otherwise everything in front of the first row, the row padding
+ * and the image bytes behind the data are copied from src as they are. The
+ * data is encrypted on its way into the rows, it is never copied
+ * Return value: e_success, e_failure for an invalid image or argument or too little capacity
+ */
+Status stego_encode_encrypted(unsigned char *dest, const unsigned char *src, size_t image_size,
+                              const void *data, size_t size, const char *extn, uint lsb_bits, const StegoKey *key, int threads)
+{
+    unsigned char header[STEGO_MAX_HEADER_SIZE];
+    size_t size_header, pos, end;
+    BmpInfo bmp;
+
+    if (stego_parse_image(src, image_size, image_size, &bmp) == e_failure ||
+        (size_header = stego_build_header(header, extn, size, 0, 0, key, 0, NULL, lsb_bits, &bmp)) == 0 || size == 0 ||
+        size > stego_capacity(src, image_size, extn, lsb_bits) ||
+        size_header * 8 > bmp.capacity || size > (bmp.capacity - size_header * 8) * lsb_bits / 8)
+    {
+        return e_failure;
+    }
+
+    if (dest != src)
+    {
+        memcpy(dest, src, bmp.pixel_offset);
+    }
+    pos = 0;
+    bmp_embed(dest + bmp.pixel_offset, src + bmp.pixel_offset, &bmp, pos, header, size_header, 1, 1);
+    pos += size_header * 8;
+    bmp_embed_cipher(dest + bmp_file_end(&bmp, pos), src + bmp_file_end(&bmp, pos), &bmp, pos, data, size, lsb_bits,
+                     key != NULL ? &key->cipher : NULL, 0, threads);
+    pos += size * 8 / lsb_bits;
+    if (dest != src)
+    {
+        end = bmp_file_end(&bmp, pos);
+        memcpy(dest + end, src + end, image_size - end);
+    }
+
+    return e_success;
+}
+
+/* Read header
+ * Input: First len bytes of an image of image_size bytes and the header to fill
+ * Output: Extension, data size and format of the embedded file
+ * Description: Checks the bmp header and the magic string, then bounds the
+ * extension size and the data size by the capacity of the image. Garbage in
+ * the size fields of a plain image fails one of these checks, the header CRC32C
+ * of checksummed data catches the rest. Without FLAG_ROW_LAYOUT the rest is
+ * read in the linear layout of older versions
+ * Return value: e_success if the image carries data, e_failure otherwise
+ */
+Status stego_read_header(const unsigned char *image, size_t len, size_t image_size, StegoHeader *header)
+{
+    unsigned char magic[sizeof(MAGIC_STRING)];
+    unsigned char size_bytes[8];
+    BmpInfo linear;
+    size_t pos = 0;
+    unsigned long long size;
+    uint extn_field, size_extn;
+
+    // bmp header, magic string and extension size come first
+    if (stego_parse_image(image, len, image_size, &header->bmp) == e_failure ||
+        stego_extract_field(magic, strlen(MAGIC_STRING), image, len, &header->bmp, &pos) == e_failure ||
+        memcmp(magic, MAGIC_STRING, strlen(MAGIC_STRING)))
+    {
+        return e_failure;
+    }
+
+    // Extension size and format flags
+    if (stego_extract_field(size_bytes, 4, image, len, &header->bmp, &pos) == e_failure)
+    {
+        return e_failure;
+    }
+    extn_field = stego_get_size(size_bytes, 4);
+    size_extn = extn_field & EXTN_SIZE_MASK;
+    header->format_flags = extn_field & ~EXTN_SIZE_MASK;
+    if (size_extn == 0 || size_extn > STEGO_MAX_EXTN ||
+        (header->format_flags & ~KNOWN_FLAGS) || (header->format_flags & FLAG_LSB_BITS_MASK) == FLAG_LSB_BITS_MASK ||
+        (header->format_flags & (FLAG_SCATTERED | FLAG_ENCRYPTED)) == FLAG_SCATTERED)
+    {
+        return e_failure;
+    }
+    header->lsb_bits = FLAGS_TO_LSB_BITS(header->format_flags);
+
+    // Older images, the fields read so far have to sit at the same place in both layouts
+    if (!(header->format_flags & FLAG_ROW_LAYOUT) && !bmp_is_linear(&header->bmp))
+    {
+        bmp_linear_layout(&header->bmp, &linear);
+        bmp_clip_capacity(&linear, image_size);
+        if (bmp_file_end(&linear, pos) != bmp_file_end(&header->bmp, pos))
+        {
+            return e_failure;
+        }
+        header->bmp = linear;
+    }
+
+    // Extension and data size
+    if (stego_extract_field((unsigned char *) header->extn, size_extn, image, len, &header->bmp, &pos) == e_failure)
+    {
+        return e_failure;
+    }
+    header->extn[size_extn] = '\0';
+    if (header->extn[0] != '.' || strlen(header->extn) != size_extn ||
+        stego_extract_field(size_bytes, SIZE_FIELD_BYTES(header->format_flags), image, len, &header->bmp, &pos) == e_failure)
+    {
+        return e_failure;
+    }
+    size = stego_get_size(size_bytes, SIZE_FIELD_BYTES(header->format_flags));
+    header->raw_size = size;
+    if (header->format_flags & FLAG_COMPRESSED)
+    {
+        if (stego_extract_field(size_bytes, RAW_SIZE_FIELD_BYTES, image, len, &header->bmp, &pos) == e_failure)
+        {
+            return e_failure;
+        }
+        header->raw_size = stego_get_size(size_bytes, RAW_SIZE_FIELD_BYTES);
+    }
+    if (header->format_flags & FLAG_ENCRYPTED &&
+        stego_extract_field(header->key_fields, KEY_FIELD_BYTES, image, len, &header->bmp, &pos) == e_failure)
+    {
+        return e_failure;
+    }
+    memset(&header->shard, 0, sizeof(header->shard));
+    if (header->format_flags & FLAG_SHARDED)
+    {
+        unsigned char shard_fields[SHARD_FIELD_BYTES];
+
+        if (stego_extract_field(shard_fields, SHARD_FIELD_BYTES, image, len, &header->bmp, &pos) == e_failure)
+        {
+            return e_failure;
+        }
+        stego_get_shard(shard_fields, &header->shard);
+        if (header->shard.count == 0 || header->shard.index >= header->shard.count || header->shard.offset > header->shard.total ||
+            size > header->shard.total - header->shard.offset)
+        {
+            return e_failure;
+        }
+    }
+    if (header->format_flags & FLAG_CHECKSUM)
+    {
+        unsigned char fields[STEGO_MAX_HEADER_SIZE];
+
+        if (stego_extract_field(size_bytes, CRC_FIELD_BYTES, image, len, &header->bmp, &pos) == e_failure ||
+            stego_get_size(size_bytes, CRC_FIELD_BYTES) !=
+                crc32c(0, fields, stego_put_fields(fields, header->extn, header->format_flags, size, header->raw_size, header->key_fields,
+                                                 &header->shard)))
+        {
+            return e_failure;
+        }
+    }
+
+    // The data has to fit in the image behind the header. The size is not multiplied,
+    // a garbage 64 bit size would wrap around
+    header->data_offset = pos;
+    if (size == 0 || size > (header->bmp.capacity - pos) * header->lsb_bits / 8 ||
+        FRAMED_SIZE(size, header->format_flags) > (header->bmp.capacity - pos) * header->lsb_bits / 8)
+    {
+        return e_failure;
+    }
+    header->size = size;
+    header->corrupt_chunks = 0;
+    header->cipher = NULL;
+
+    return e_success;
+}
+
+/* Extract payload
+ * Input: Array for the data, stego image, its header, offset and size of the
+ * data wanted and thread count
+ * Output: Data bytes offset to offset + size - 1
+ * Description: The chunk trailers of checksummed data are stepped over, a
+ * piece never runs across one. Encrypted data is decrypted on the way with the
+ * keystream at its offset
+ * Return value: None
+ */
+static void stego_extract_payload(unsigned char *data, const unsigned char *image, const StegoHeader *header, size_t offset, size_t size,
+                                  int threads)
+{
+    const BmpInfo *bmp = &header->bmp;
+    size_t piece, pos;
+
+    while (size > 0)
+    {
+        piece = size;
+        pos = offset;
+        if (header->format_flags & FLAG_CHECKSUM)
+        {
+            piece = CHUNK_SIZE - offset % CHUNK_SIZE < size ? CHUNK_SIZE - offset % CHUNK_SIZE : size;
+            pos += offset / CHUNK_SIZE * TRAILER_BYTES(header->format_flags);
+        }
+        pos = header->data_offset + pos * 8 / header->lsb_bits;
+        bmp_extract_cipher(data, image + bmp_file_end(bmp, pos), bmp, pos, piece, header->lsb_bits, header->cipher, offset, threads);
+        data += piece;
+        offset += piece;
+        size -= piece;
+    }
+}
+
+/* Chunks end
+ * Input: Header of checksummed data and a number of chunks
+ * Return value: Pixel byte behind the trailer of chunk count - 1, which is
+ * where chunk count starts
+ */
+size_t stego_chunks_end(const StegoHeader *header, size_t count)
+{
+    size_t offset = count * CHUNK_SIZE < header->size ? count * CHUNK_SIZE : header->size;
+
+    return header->data_offset + (offset + count * TRAILER_BYTES(header->format_flags)) * 8 / header->lsb_bits;
+}
+
+/* Put trailer
+ * Input: Buffer of TRAILER_BYTES(format_flags) bytes, CRC32C of the chunk,
+ * format flags, offset in the chunk of the first block starting in it and the
+ * index of that block
+ * Output: Block offset and index for compressed data, then the CRC32C of the
+ * chunk and those two fields
+ * Return value: Bytes written
+ */
+size_t stego_put_trailer(unsigned char *trailer, uint crc, uint format_flags, uint block, unsigned long long index)
+{
+    size_t bytes = 0;
+
+    if (format_flags & FLAG_COMPRESSED)
+    {
+        bytes += stego_put_size(trailer, block, BLOCK_OFFSET_FIELD_BYTES);
+        bytes += stego_put_size(trailer + bytes, index, BLOCK_INDEX_FIELD_BYTES);
+        crc = crc32c(crc, trailer, bytes);
+    }
+    bytes += stego_put_size(trailer + bytes, crc, CRC_FIELD_BYTES);
+
+    return bytes;
+}
+
+/* Check chunk
+ * Input: State to fill, data of the chunk and its length, its trailer, format
+ * flags and the chunk number
+ * Output: Whether the chunk is corrupt and, for compressed data, where the
+ * first block starting in it lies
+ * Description: A block offset past the chunk marks a corrupt chunk as well,
+ * only an intact chunk is trusted to point to a block
+ * Return value: None
+ */
+void stego_check_chunk(StegoChunk *state, const unsigned char *data, size_t length, const unsigned char *trailer,
+                       uint format_flags, size_t chunk)
+{
+    size_t fields = TRAILER_BYTES(format_flags) - CRC_FIELD_BYTES;
+    uint block = NO_BLOCK;
+
+    state->corrupt = stego_get_size(trailer + fields, CRC_FIELD_BYTES) != crc32c(crc32c(0, data, length), trailer, fields);
+    state->block_offset = SIZE_MAX;
+    state->block_index = 0;
+    if (format_flags & FLAG_COMPRESSED)
+    {
+        block = stego_get_size(trailer, BLOCK_OFFSET_FIELD_BYTES);
+        state->block_index = stego_get_size(trailer + BLOCK_OFFSET_FIELD_BYTES, BLOCK_INDEX_FIELD_BYTES);
+        state->corrupt |= block != NO_BLOCK && block >= length;
+    }
+    if (!state->corrupt && block != NO_BLOCK)
+    {
+        state->block_offset = chunk * CHUNK_SIZE + block;
+    }
+}
+
+/* Chunk position
+ * Input: Header of checksummed data and a chunk
+ * Output: Data offset and size of the chunk
+ * Return value: First pixel byte of the chunk
+ */
+static size_t stego_chunk_pos(const StegoHeader *header, size_t chunk, size_t *offset, size_t *length)
+{
+    *offset = chunk * CHUNK_SIZE;
+    *length = header->size - *offset < CHUNK_SIZE ? header->size - *offset : CHUNK_SIZE;
+    return stego_chunks_end(header, chunk);
+}
+
+/* Embed chunks
+ * Input: Chunk job of one thread
+ * Output: Data of the chunks and their trailers in job->dest, row padding in
+ * between copied from job->image
+ * Description: Encrypted data goes through a buffer of one chunk, the CRC32C
+ * covers the chunk as embedded
+ * Return value: NULL
+ */
+static void *stego_embed_worker(void *arg)
+{
+    StegoChunks *job = arg;
+    const StegoHeader *header = job->header;
+    const BmpInfo *bmp = &header->bmp;
+    unsigned char *buffer = header->cipher != NULL ? malloc(CHUNK_SIZE) : NULL;
+    unsigned char trailer[TRAILER_BYTES(FLAG_COMPRESSED)];
+    const unsigned char *in;
+    size_t offset, length, pos, bytes;
+
+    for (size_t i = 0; i < job->count; i++)
+    {
+        pos = stego_chunk_pos(header, job->first + i, &offset, &length);
+        in = job->data + i * CHUNK_SIZE;
+        if (header->cipher != NULL)
+        {
+            if (buffer == NULL)
+            {
+                break;
+            }
+            chacha_xor(header->cipher, offset, buffer, in, length);
+            in = buffer;
+        }
+        bytes = stego_put_trailer(trailer, crc32c(0, in, length), header->format_flags, NO_BLOCK, 0);
+        bmp_embed(job->dest + bmp_file_end(bmp, pos), job->image + bmp_file_end(bmp, pos), bmp, pos, in, length, header->lsb_bits, 1);
+        pos += length * 8 / header->lsb_bits;
+        bmp_embed(job->dest + bmp_file_end(bmp, pos), job->image + bmp_file_end(bmp, pos), bmp, pos, trailer, bytes, header->lsb_bits, 1);
+    }
+    free(buffer);
+
+    return NULL;
+}
+
+/* Check chunks
+ * Input: Chunk job of one thread
+ * Output: Chunks extracted into job->data or a buffer of one chunk, their
+ * states in job->chunks, corrupt ones counted
+ * Description: A chunk is its data and the trailer right behind it. Every
+ * chunk is checked on its own, so the corrupt ones are known exactly. The
+ * CRC32C covers encrypted data as embedded, chunks are decrypted behind the check
+ * Return value: NULL
+ */
+static void *stego_extract_worker(void *arg)
+{
+    StegoChunks *job = arg;
+    const StegoHeader *header = job->header;
+    const BmpInfo *bmp = &header->bmp;
+    unsigned char *buffer = job->data == NULL ? malloc(CHUNK_SIZE) : NULL;
+    unsigned char trailer[TRAILER_BYTES(FLAG_COMPRESSED)];
+    unsigned char *out;
+    size_t offset, length, pos;
+    StegoChunk state = { 1, SIZE_MAX, 0 };
+
+    for (size_t i = 0; i < job->count; i++)
+    {
+        pos = stego_chunk_pos(header, job->first + i, &offset, &length);
+        out = job->data != NULL ? job->data + i * CHUNK_SIZE : buffer;
+        if (out != NULL)
+        {
+            bmp_extract(out, job->image + bmp_file_end(bmp, pos), bmp, pos, length, header->lsb_bits, 1);
+            pos += length * 8 / header->lsb_bits;
+            bmp_extract(trailer, job->image + bmp_file_end(bmp, pos), bmp, pos, TRAILER_BYTES(header->format_flags),
+                        header->lsb_bits, 1);
+            stego_check_chunk(&state, out, length, trailer, header->format_flags, job->first + i);
+            if (header->cipher != NULL && job->data != NULL)
+            {
+                chacha_xor(header->cipher, offset, out, out, length);
+            }
+        }
+        if (job->chunks != NULL)
+        {
+            job->chunks[i] = state;
+        }
+        job->failed += state.corrupt;
+    }
+    free(buffer);
+
+    return NULL;
+}
+
+/* Run chunks
+ * Input: Job covering all chunks, the worker to run and thread count
+ * Output: Every chunk processed
+ * Description: The chunks are cut in equal runs, one per thread, like
+ * lsb_embed_mt does with the data. A run gets at least LSB_MT_MIN_CHUNK bytes.
+ * Chunks past the end of the data are left out
+ * Return value: Number of corrupt chunks the runs found
+ */
+static size_t stego_run_chunks(const StegoChunks *job, void *(*worker)(void *), int threads)
+{
+    StegoChunks jobs[LSB_MAX_THREADS];
+    pthread_t tids[LSB_MAX_THREADS];
+    int started[LSB_MAX_THREADS];
+    size_t total = CHUNK_COUNT(job->header->size);
+    size_t count, max_jobs, per_job, failed = 0;
+    int jobs_count = lsb_resolve_threads(threads);
+
+    if (job->first >= total)
+    {
+        return 0;
+    }
+    count = job->count < total - job->first ? job->count : total - job->first;
+    max_jobs = count * CHUNK_SIZE / LSB_MT_MIN_CHUNK;
+    if (max_jobs < (size_t) jobs_count)
+    {
+        jobs_count = max_jobs > 0 ? max_jobs : 1;
+    }
+    per_job = count / jobs_count;
+    for (int t = 0; t < jobs_count; t++)
+    {
+        jobs[t] = *job;
+        jobs[t].data = job->data != NULL ? job->data + per_job * t * CHUNK_SIZE : NULL;
+        jobs[t].chunks = job->chunks != NULL ? job->chunks + per_job * t : NULL;
+        jobs[t].first = job->first + per_job * t;
+        jobs[t].count = t == jobs_count - 1 ? count - per_job * t : per_job;
+        jobs[t].failed = 0;
+    }
+
+    // The calling thread takes the last run, a run without a thread runs inline
+    for (int t = 0; t < jobs_count - 1; t++)
+    {
+        started[t] = pthread_create(&tids[t], NULL, worker, &jobs[t]) == 0;
+        if (!started[t])
+        {
+            worker(&jobs[t]);
+        }
+    }
+    worker(&jobs[jobs_count - 1]);
+    for (int t = 0; t < jobs_count; t++)
+    {
+        if (t < jobs_count - 1 && started[t])
+        {
+            pthread_join(tids[t], NULL);
+        }
+        failed += jobs[t].failed;
+    }
+
+    return failed;
+}
+
+/* Embed chunks
+ * Input: Destination and source image, data of chunk first on, header of the
+ * checksummed data, first chunk, number of chunks and thread count
+ * Output: dest carrying the chunks and their trailers
+ * Description: dest and src point to the start of the images. The CRC32C of
+ * every chunk is computed by the thread that embeds it. Compressed data needs
+ * the block offsets in the trailers, the caller frames it itself
+ * Return value: None
+ */
+void stego_embed_chunks(unsigned char *dest, const unsigned char *src, const void *data, const StegoHeader *header,
+                        size_t first, size_t count, int threads)
+{
+    StegoChunks job = { dest, src, (unsigned char *) data, NULL, header, first, count, 0 };
+
+    stego_run_chunks(&job, stego_embed_worker, threads);
+}
+
+/* Extract chunks
+ * Input: Array for the data or NULL, array for the chunk states or NULL, stego
+ * image, its header, first chunk, number of chunks and thread count
+ * Output: Data and state of the chunks
+ * Return value: Number of corrupt chunks
+ */
+size_t stego_extract_chunks(unsigned char *data, StegoChunk *chunks, const unsigned char *image, const StegoHeader *header,
+                            size_t first, size_t count, int threads)
+{
+    StegoChunks job = { NULL, image, data, chunks, header, first, count, 0 };
+
+    return stego_run_chunks(&job, stego_extract_worker, threads);
+}
+
+/* Chunks corrupt
+ * Input: States of all chunks or NULL, offset and size of a data range
+ * Return value: 1 when a chunk the range touches is corrupt
+ */
+static int stego_range_corrupt(const StegoChunk *chunks, size_t offset, size_t size)
+{
+    for (size_t chunk = offset / CHUNK_SIZE; chunks != NULL && size > 0 && chunk <= (offset + size - 1) / CHUNK_SIZE; chunk++)
+    {
+        if (chunks[chunk].corrupt)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Resync
+ * Input: States of all chunks, header of the compressed data and the data
+ * offset of a block header in a corrupt chunk
+ * Output: Offset and index of the block the next intact chunk points to
+ * Description: The chunk offset lies in may hold more blocks, but only the
+ * first one is known, so the search starts with the chunk behind it
+ * Return value: e_success, e_failure when no chunk behind offset helps
+ */
+static Status stego_resync(const StegoChunk *chunks, const StegoHeader *header, size_t *offset, size_t *index)
+{
+    for (size_t chunk = *offset / CHUNK_SIZE + 1; chunk < CHUNK_COUNT(header->size); chunk++)
+    {
+        if (!chunks[chunk].corrupt && chunks[chunk].block_offset != SIZE_MAX)
+        {
+            *offset = chunks[chunk].block_offset;
+            *index = chunks[chunk].block_index;
+            return e_success;
+        }
+    }
+    return e_failure;
+}
+
+/* Decompress
+ * Input: Buffer of header->raw_size bytes, stego image, its header, states of
+ * the chunks of checksummed data (NULL otherwise) and thread count
+ * Output: Data of the lz block stream behind the header
+ * Description: Block by block, a stored block is extracted straight into data,
+ * a compressed one through a buffer of one block. Every block but the last
+ * holds LZ_BLOCK_SIZE raw bytes, so a block in a corrupt chunk is zeroed in
+ * place. Behind a block header in a corrupt chunk the stream goes on with the
+ * block the next intact chunk points to, the blocks in between are zeroed
+ * Return value: e_success, e_failure for a corrupt stream
+ */
+static Status stego_decompress(unsigned char *data, const unsigned char *image, const StegoHeader *header, const StegoChunk *chunks,
+                               int threads)
+{
+    unsigned char field[LZ_BLOCK_HEADER_SIZE];
+    unsigned char *body = malloc(LZ_BLOCK_SIZE);
+    size_t offset = 0, stored = header->size, done = 0;
+    size_t length, out, index;
+    uint block;
+
+    while (body != NULL && stored >= LZ_BLOCK_HEADER_SIZE)
+    {
+        if (stego_range_corrupt(chunks, offset, LZ_BLOCK_HEADER_SIZE))
+        {
+            if (stego_resync(chunks, header, &offset, &index) == e_failure || index > header->raw_size / LZ_BLOCK_SIZE ||
+                index * LZ_BLOCK_SIZE < done)
+            {
+                memset(data + done, 0, header->raw_size - done);
+                break;
+            }
+            memset(data + done, 0, index * LZ_BLOCK_SIZE - done);
+            done = index * LZ_BLOCK_SIZE;
+            stored = header->size - offset;
+            continue;
+        }
+        stego_extract_payload(field, image, header, offset, LZ_BLOCK_HEADER_SIZE, 1);
+        offset += LZ_BLOCK_HEADER_SIZE;
+        stored -= LZ_BLOCK_HEADER_SIZE;
+        block = stego_get_size(field, LZ_BLOCK_HEADER_SIZE);
+        length = block & ~LZ_BLOCK_STORED;
+        if (length > LZ_BLOCK_SIZE || length > stored || (block & LZ_BLOCK_STORED && length > header->raw_size - done))
+        {
+            break;
+        }
+
+        if (stego_range_corrupt(chunks, offset, length))
+        {
+            out = block & LZ_BLOCK_STORED ? length : header->raw_size - done < LZ_BLOCK_SIZE ? header->raw_size - done : LZ_BLOCK_SIZE;
+            memset(data + done, 0, out);
+        }
+        else if (block & LZ_BLOCK_STORED)
+        {
+            stego_extract_payload(data + done, image, header, offset, length, threads);
+            out = length;
+        }
+        else
+        {
+            stego_extract_payload(body, image, header, offset, length, 1);
+            if (lz_decompress(data + done, header->raw_size - done, &out, body, length) == e_failure)
+            {
+                break;
+            }
+        }
+        offset += length;
+        stored -= length;
+        done += out;
+    }
+    free(body);
+
+    return stored == 0 && done == header->raw_size ? e_success : e_failure;
+}
+
+/* Index blocks
+ * Input: Handle on compressed data
+ * Output: Data offset of every lz block header in blocks
+ * Description: Only the block headers are read, the bodies are stepped over.
+ * Every block but the last holds LZ_BLOCK_SIZE raw bytes, so the block of a
+ * raw offset is known from the offset alone
+ * Return value: e_success, e_failure for a corrupt stream or out of memory
+ */
+static Status stego_index_blocks(StegoFile *file)
+{
+    const StegoHeader *header = &file->header;
+    size_t count = (header->raw_size + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+    unsigned char field[LZ_BLOCK_HEADER_SIZE];
+    size_t offset = 0, length;
+
+    if (count == 0 || (file->blocks = malloc(count * sizeof(size_t))) == NULL)
+    {
+        return e_failure;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (header->size - offset < LZ_BLOCK_HEADER_SIZE)
+        {
+            return e_failure;
+        }
+        file->blocks[i] = offset;
+        stego_extract_payload(field, file->image, header, offset, LZ_BLOCK_HEADER_SIZE, 1);
+        offset += LZ_BLOCK_HEADER_SIZE;
+        length = stego_get_size(field, LZ_BLOCK_HEADER_SIZE) & ~LZ_BLOCK_STORED;
+        if (length > LZ_BLOCK_SIZE || length > header->size - offset)
+        {
+            return e_failure;
+        }
+        offset += length;
+    }
+
+    return offset == header->size ? e_success : e_failure;
+}
+
+/* Load chunk
+ * Input: Handle on checksummed data that isn't compressed and a chunk index
+ * Output: The chunk, checked and decrypted, in the buffer
+ * Return value: None
+ */
+static void stego_load_chunk(StegoFile *file, size_t chunk)
+{
+    StegoChunk state;
+
+    stego_extract_chunks(file->buffer, &state, file->image, &file->header, chunk, 1, 1);
+    file->buffer_index = chunk;
+    file->buffer_size = file->header.size - chunk * CHUNK_SIZE < CHUNK_SIZE ? file->header.size - chunk * CHUNK_SIZE : CHUNK_SIZE;
+    file->buffer_corrupt = state.corrupt;
+}
+
+/* Load block
+ * Input: Handle on compressed data and a block index
+ * Output: The raw bytes of the block in the buffer, zeros when it is corrupt
+ * Description: The body is decompressed from the second half of the buffer.
+ * For checksummed data the chunks the block lies in are checked first. A block
+ * that doesn't give back its raw size is corrupt as well
+ * Return value: None
+ */
+static void stego_load_block(StegoFile *file, size_t index)
+{
+    const StegoHeader *header = &file->header;
+    unsigned char field[LZ_BLOCK_HEADER_SIZE];
+    unsigned char *body = file->buffer + LZ_BLOCK_SIZE;
+    size_t offset = file->blocks[index] + LZ_BLOCK_HEADER_SIZE;
+    size_t raw = header->raw_size - index * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? header->raw_size - index * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+    size_t length, out = 0;
+    uint block;
+
+    stego_extract_payload(field, file->image, header, file->blocks[index], LZ_BLOCK_HEADER_SIZE, 1);
+    block = stego_get_size(field, LZ_BLOCK_HEADER_SIZE);
+    length = block & ~LZ_BLOCK_STORED;
+    file->buffer_corrupt = header->format_flags & FLAG_CHECKSUM &&
+                           stego_extract_chunks(NULL, NULL, file->image, header, file->blocks[index] / CHUNK_SIZE,
+                                                (offset + length - 1) / CHUNK_SIZE - file->blocks[index] / CHUNK_SIZE + 1, 1) > 0;
+    if (!file->buffer_corrupt && block & LZ_BLOCK_STORED)
+    {
+        stego_extract_payload(file->buffer, file->image, header, offset, length < raw ? length : raw, file->threads);
+        out = length;
+    }
+    else if (!file->buffer_corrupt)
+    {
+        stego_extract_payload(body, file->image, header, offset, length, 1);
+        if (lz_decompress(file->buffer, LZ_BLOCK_SIZE, &out, body, length) == e_failure)
+        {
+            out = 0;
+        }
+    }
+
+    file->buffer_corrupt |= out != raw;
+    if (file->buffer_corrupt)
+    {
+        memset(file->buffer, 0, raw);
+    }
+    file->buffer_index = index;
+    file->buffer_size = raw;
+}
+
+/* Decode
+ * Input: Buffer for the data and its size, stego image and its size, header to
+ * fill and thread count
+ * Output: Data and header of the embedded file, decompressed if it was compressed
+ * Description: See stego_decode_encrypted, encrypted data fails
+ * Return value: e_success, e_failure if the image carries no, corrupt or encrypted data or the buffer is too small
+ */
+Status stego_decode(void *data, size_t data_capacity, const unsigned char *image, size_t image_size,
+                    StegoHeader *header, int threads)
+{
+    return stego_decode_encrypted(data, data_capacity, image, image_size, header, NULL, 0, threads);
+}
+
+/* Decode data
+ * Input: Buffer for the data, stego image, its header with the key of
+ * encrypted data and thread count
+ * Output: Data of the embedded file, decompressed if it was compressed
+ * Return value: e_success, e_failure for corrupt data
+ */
+static Status stego_decode_data(void *data, const unsigned char *image, StegoHeader *header, int threads)
+{
+    StegoChunk *chunks;
+    Status status;
+
+    if ((header->format_flags & (FLAG_CHECKSUM | FLAG_COMPRESSED)) == FLAG_CHECKSUM)
+    {
+        header->corrupt_chunks = stego_extract_chunks(data, NULL, image, header, 0, CHUNK_COUNT(header->size), threads);
+        return header->corrupt_chunks == 0 ? e_success : e_failure;
+    }
+    if (header->format_flags & FLAG_CHECKSUM)
+    {
+        // Checked up front, so the blocks know which chunks to skip and where to go on
+        if ((chunks = malloc(CHUNK_COUNT(header->size) * sizeof(StegoChunk))) == NULL)
+        {
+            return e_failure;
+        }
+        header->corrupt_chunks = stego_extract_chunks(NULL, chunks, image, header, 0, CHUNK_COUNT(header->size), threads);
+        status = stego_decompress(data, image, header, chunks, threads);
+        free(chunks);
+        return status == e_success && header->corrupt_chunks == 0 ? e_success : e_failure;
+    }
+    if (header->format_flags & FLAG_COMPRESSED)
+    {
+        return stego_decompress(data, image, header, NULL, threads);
+    }
+    bmp_extract_cipher(data, image + bmp_file_end(&header->bmp, header->data_offset), &header->bmp, header->data_offset,
+                       header->size, header->lsb_bits, header->cipher, 0, threads);
+
+    return e_success;
+}
+
+/* Decode encrypted
+ * Input: Buffer for the data and its size, stego image and its size, header to
+ * fill, passphrase of encrypted data and its size (NULL when there is none)
+ * and thread count
+ * Output: Data and header of the embedded file, decompressed if it was
+ * compressed and decrypted if it was encrypted
+ * Description: When the buffer is too small the header is still filled in, so
+ * the caller can size the buffer from header->raw_size and call again. The
+ * chunks of checksummed data are checked in parallel, data in intact chunks is
+ * decoded even when others are corrupt. The key only lives for the call,
+ * header->cipher is NULL again on return. Scattered data is left to the file
+ * engines, which read it tile by tile
+ * Return value: e_success, e_failure if the image carries no or corrupt data
+ * or scattered data, the passphrase is missing or wrong or the buffer is too small
+ */
+Status stego_decode_encrypted(void *data, size_t data_capacity, const unsigned char *image, size_t image_size,
+                              StegoHeader *header, const void *passphrase, size_t passphrase_size, int threads)
+{
+    StegoKey key;
+    Status status;
+
+    if (stego_read_header(image, image_size, image_size, header) == e_failure || header->raw_size > data_capacity ||
+        (header->format_flags & FLAG_SCATTERED) || (header->format_flags & FLAG_ENCRYPTED && passphrase == NULL) ||
+        stego_unlock_key(&key, passphrase, passphrase_size, header) == e_failure)
+    {
+        return e_failure;
+    }
+    status = stego_decode_data(data, image, header, threads);
+    header->cipher = NULL;
+
+    return status;
+}
+
+/* Open
+ * Input: Handle to fill, stego image and its size, passphrase of encrypted
+ * data and its size (NULL when there is none) and thread count
+ * Output: Handle on data offset 0
+ * Description: Only the header is read, and for compressed data the header of
+ * every lz block, so any raw offset maps to its block without decompressing the
+ * ones in front of it. Checksummed and compressed data get a buffer of one
+ * chunk or block
+ * Return value: e_success, e_failure if the image carries no or corrupt data
+ * or scattered data, the passphrase is missing or wrong or there is no memory
+ */
+Status stego_open(StegoFile *file, const unsigned char *image, size_t image_size, const void *passphrase, size_t passphrase_size,
+                  int threads)
+{
+    file->image = image;
+    file->offset = 0;
+    file->threads = threads;
+    file->blocks = NULL;
+    file->buffer = NULL;
+    file->buffer_index = SIZE_MAX;
+    file->buffer_size = 0;
+    file->buffer_corrupt = 0;
+    if (stego_read_header(image, image_size, image_size, &file->header) == e_failure || (file->header.format_flags & FLAG_SCATTERED) ||
+        (file->header.format_flags & FLAG_ENCRYPTED && passphrase == NULL) ||
+        stego_unlock_key(&file->key, passphrase, passphrase_size, &file->header) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if (file->header.format_flags & FLAG_COMPRESSED)
+    {
+        file->buffer = malloc(2 * LZ_BLOCK_SIZE);
+    }
+    else if (file->header.format_flags & FLAG_CHECKSUM)
+    {
+        file->buffer = malloc(CHUNK_SIZE);
+    }
+    if ((file->header.format_flags & (FLAG_COMPRESSED | FLAG_CHECKSUM) && file->buffer == NULL) ||
+        (file->header.format_flags & FLAG_COMPRESSED && stego_index_blocks(file) == e_failure))
+    {
+        stego_close(file);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Read
+ * Input: Open handle, array for the data, bytes wanted and address to store the bytes read
+ * Output: Data from the offset of the handle on, the offset moved past it
+ * Description: Only the pixel bytes of the range are touched. Plain data is
+ * extracted straight into data, on all threads. Whole chunks of checksummed
+ * data go straight into data as well, checked on all threads, the chunk a
+ * range starts or ends in goes through the buffer and is checked on its own.
+ * Compressed data is decompressed a block at a time through the buffer. The
+ * chunk or block read last is kept, so small reads in a row cost one
+ * Return value: e_success, e_failure when a byte read comes from a corrupt chunk or block
+ */
+Status stego_read(StegoFile *file, void *data, size_t size, size_t *count)
+{
+    const StegoHeader *header = &file->header;
+    size_t unit = header->format_flags & FLAG_COMPRESSED ? LZ_BLOCK_SIZE : CHUNK_SIZE;
+    unsigned char *out = data;
+    Status status = e_success;
+    size_t index, skip, piece;
+
+    size = size < header->raw_size - file->offset ? size : header->raw_size - file->offset;
+    *count = size;
+    if (!(header->format_flags & (FLAG_CHECKSUM | FLAG_COMPRESSED)))
+    {
+        stego_extract_payload(out, file->image, header, file->offset, size, file->threads);
+        file->offset += size;
+        return e_success;
+    }
+
+    while (size > 0)
+    {
+        index = file->offset / unit;
+        skip = file->offset % unit;
+        if (!(header->format_flags & FLAG_COMPRESSED) && skip == 0 && size >= CHUNK_SIZE)
+        {
+            piece = size / CHUNK_SIZE * CHUNK_SIZE;
+            if (stego_extract_chunks(out, NULL, file->image, header, index, piece / CHUNK_SIZE, file->threads) > 0)
+            {
+                status = e_failure;
+            }
+        }
+        else
+        {
+            if (index != file->buffer_index)
+            {
+                header->format_flags & FLAG_COMPRESSED ? stego_load_block(file, index) : stego_load_chunk(file, index);
+            }
+            piece = file->buffer_size - skip < size ? file->buffer_size - skip : size;
+            memcpy(out, file->buffer + skip, piece);
+            if (file->buffer_corrupt)
+            {
+                status = e_failure;
+            }
+        }
+        out += piece;
+        file->offset += piece;
+        size -= piece;
+    }
+
+    return status;
+}
+
+/* Seek
+ * Input: Open handle, offset and where it counts from
+ * Output: Offset of the handle moved, nothing is read
+ * Return value: e_success, e_failure for an offset in front of or past the end of the data
+ */
+Status stego_seek(StegoFile *file, long long offset, int whence)
+{
+    long long base = whence == SEEK_CUR ? (long long) file->offset : whence == SEEK_END ? (long long) file->header.raw_size : 0;
+
+    if ((whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) || (offset < 0 && -offset > base) ||
+        (offset > 0 && (unsigned long long) offset > file->header.raw_size - base))
+    {
+        return e_failure;
+    }
+    file->offset = base + offset;
+
+    return e_success;
+}
+
+/* Close
+ * Input: Handle, open or after a failed stego_open
+ * Output: Buffers released, key wiped
+ * Return value: None
+ */
+void stego_close(StegoFile *file)
+{
+    free(file->blocks);
+    free(file->buffer);
+    file->blocks = NULL;
+    file->buffer = NULL;
+    file->buffer_index = SIZE_MAX;
+    file->header.cipher = NULL;
+    memset(&file->key, 0, sizeof(file->key));
+}
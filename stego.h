@@ -0,0 +1,223 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include "bmp.h"
+#include "chacha.h"
+#include "common.h"
+#include "types.h"
+
+/*
+ * libstego: buffer to buffer encoding and decoding
+ * The calls work on the caller's buffers only. There are no files, no stdio
+ * and no global state, so any number of threads may use the library at once.
+ *
+ * The pixel bytes of a stego image hold, one bit per byte,
+ *     magic string, 32 bit extension size | format flags, extension, 32 bit data size
+ * followed by the data at lsb_bits bits per byte. Sizes are MSB first. Data
+ * above 4 GiB sets FLAG_SIZE64 and has a 64 bit data size field. Compressed
+ * data (FLAG_COMPRESSED) is an lz block stream (see lz.h), the data size counts
+ * its bytes and a 64 bit field with the size before compression follows.
+ * Checksummed data (FLAG_CHECKSUM) has a CRC32C of the plain header bytes
+ * behind the sizes, and every CHUNK_SIZE bytes of data are followed by a
+ * trailer with their CRC32C, so each chunk can be checked on its own (see
+ * common.h). Trailers of compressed data also point to the first block
+ * starting in the chunk, so decoding goes on behind a corrupt one. Encrypted
+ * data (FLAG_ENCRYPTED) has the salt and key check behind the sizes, in front
+ * of the header CRC32C, and is XORed with a ChaCha20 keystream after
+ * compression and before the chunks are framed. Sharded data (FLAG_SHARDED)
+ * is one slice of a bigger secret, with the shard fields behind the key fields
+ * (see common.h). Scattered data (FLAG_SCATTERED, encrypted data only) has
+ * its pixel bytes shuffled by the key (see scatter.h), only the file engines
+ * decode it. Pixel bytes are counted row
+ * by row from bfOffBits on, skipping the row padding (see bmp.h). Images
+ * without FLAG_ROW_LAYOUT use every byte from 54 on.
+ */
+
+/* Longest extension stored with the data, including the dot */
+#define STEGO_MAX_EXTN 4
+
+/* Plain bytes of the longest stego header */
+#define STEGO_MAX_HEADER_SIZE (2 + 4 + STEGO_MAX_EXTN + 8 + 8 + KEY_FIELD_BYTES + SHARD_FIELD_BYTES + 4)
+
+/* Pixel bytes to hold the longest stego header */
+#define STEGO_MAX_HEADER_IMAGE_SIZE (STEGO_MAX_HEADER_SIZE * 8)
+
+/* Slice of a secret spread over several images */
+typedef struct _StegoShard
+{
+    unsigned long long id;          /* shared by all shards of the secret */
+    uint index;
+    uint count;
+    size_t offset;                  /* of the slice in the secret */
+    size_t total;                   /* bytes of the whole secret */
+} StegoShard;
+
+typedef struct _StegoHeader
+{
+    char extn[STEGO_MAX_EXTN + 1];  /* extension of the embedded file */
+    size_t size;                    /* data bytes as embedded */
+    size_t raw_size;                /* data bytes after decompression, size when not compressed */
+    uint format_flags;
+    uint lsb_bits;                  /* data bits per pixel byte */
+    size_t data_offset;             /* first pixel byte of the data */
+    BmpInfo bmp;                    /* layout the data was found in */
+    size_t corrupt_chunks;          /* chunks of checksummed data stego_decode found corrupt */
+    unsigned char key_fields[KEY_FIELD_BYTES];  /* salt and key check of encrypted data */
+    const ChaCha *cipher;           /* key of encrypted data, NULL until stego_unlock_key sets it */
+    StegoShard shard;               /* sharded data: the slice the image holds, count 0 otherwise */
+} StegoHeader;
+
+/* Key of encrypted data */
+typedef struct _StegoKey
+{
+    ChaCha cipher;
+    unsigned char fields[KEY_FIELD_BYTES];  /* salt and key check as stored in the header */
+} StegoKey;
+
+/* One chunk of checksummed data as found in the image */
+typedef struct _StegoChunk
+{
+    int corrupt;                    /* data or trailer fails the CRC32C */
+    size_t block_offset;            /* compressed data: data offset of the first block starting in the chunk, SIZE_MAX for none */
+    size_t block_index;             /* index of that block in the stream */
+} StegoChunk;
+
+/*
+ * Embedded data opened for reads at any offset. Offsets count the data after
+ * decompression. The header holds a pointer into the handle, it must not be
+ * copied or moved while open
+ */
+typedef struct _StegoFile
+{
+    const unsigned char *image;
+    StegoHeader header;
+    StegoKey key;
+    size_t offset;                  /* data byte read next */
+    int threads;
+    size_t *blocks;                 /* compressed data: offset of the header of every lz block */
+    unsigned char *buffer;          /* checksummed or compressed data: the chunk or block read last, then room for an lz block */
+    size_t buffer_index;            /* its chunk or block index, SIZE_MAX for none */
+    size_t buffer_size;
+    int buffer_corrupt;
+} StegoFile;
+
+/* Pixel bytes the header takes for the given extension and format flags */
+size_t stego_data_offset(const char *extn, uint format_flags);
+
+/* Pixel bytes the header and size data bytes take for the given extension and format flags, chunk trailers included */
+size_t stego_required_capacity(const char *extn, uint format_flags, size_t size);
+
+/* Largest data size capacity pixel bytes hold for the given extension and format flags, FLAG_SIZE64 set as needed */
+size_t stego_max_size(size_t capacity, const char *extn, uint format_flags);
+
+/* Store the shard fields, returns SHARD_FIELD_BYTES */
+size_t stego_put_shard(unsigned char *field, const StegoShard *shard);
+
+/* Shard from its fields */
+void stego_get_shard(const unsigned char *field, StegoShard *shard);
+
+/* Store size in a bytes long field, MSB first, returns bytes */
+size_t stego_put_size(unsigned char *field, unsigned long long size, size_t bytes);
+
+/* Size stored in a bytes long field, MSB first */
+unsigned long long stego_get_size(const unsigned char *field, size_t bytes);
+
+/* Pixel bytes usable for the stego header and data: the rows the bmp header declares and the image holds */
+size_t stego_image_capacity(const unsigned char *image, size_t image_size);
+
+/* Largest data size the image can carry with the given extension and bits per image byte */
+size_t stego_capacity(const unsigned char *image, size_t image_size, const char *extn, uint lsb_bits);
+
+/*
+ * Plain header bytes up to the shard fields for the given format flags, the part the header CRC32C covers, returns their
+ * count. key_fields are the salt and key check of encrypted data, shard the slice of sharded data
+ */
+size_t stego_put_fields(unsigned char *header, const char *extn, uint format_flags, size_t size, size_t raw_size,
+                        const unsigned char *key_fields, const StegoShard *shard);
+
+/*
+ * Build the plain header bytes for an image of layout bmp, returns their count, 0 for an invalid extension.
+ * raw_size is the size before compression for compressed data, 0 otherwise. checksum asks for checksummed data,
+ * key for encrypted data, scatter for data scattered by that key, shard for sharded data
+ */
+size_t stego_build_header(unsigned char *header, const char *extn, size_t size, size_t raw_size, int checksum, const StegoKey *key,
+                          int scatter, const StegoShard *shard, uint lsb_bits, const BmpInfo *bmp);
+
+/* Derive a key from a passphrase and a salt of SALT_FIELD_BYTES, a NULL salt gets a random one */
+Status stego_make_key(StegoKey *key, const void *passphrase, size_t passphrase_size, const unsigned char *salt);
+
+/* Derive the key of encrypted data from a passphrase and check it against the header, which then points to it */
+Status stego_unlock_key(StegoKey *key, const void *passphrase, size_t passphrase_size, StegoHeader *header);
+
+/* Encode data into a copy of src (or into src itself when dest == src) */
+Status stego_encode(unsigned char *dest, const unsigned char *src, size_t image_size,
+                    const void *data, size_t size, const char *extn, uint lsb_bits, int threads);
+
+/* Like stego_encode, the data encrypted with key (NULL for none) */
+Status stego_encode_encrypted(unsigned char *dest, const unsigned char *src, size_t image_size,
+                              const void *data, size_t size, const char *extn, uint lsb_bits, const StegoKey *key, int threads);
+
+/* Read and check the stego header from the first len bytes of an image of image_size bytes */
+Status stego_read_header(const unsigned char *image, size_t len, size_t image_size, StegoHeader *header);
+
+/*
+ * Trailer of a chunk of checksummed data into trailer, returns TRAILER_BYTES(format_flags) bytes. crc is the CRC32C of
+ * the chunk, block the offset in the chunk of the first lz block starting in it (NO_BLOCK for none) and index its index
+ */
+size_t stego_put_trailer(unsigned char *trailer, uint crc, uint format_flags, uint block, unsigned long long index);
+
+/* Check chunk chunk of length bytes against its trailer and fill its state */
+void stego_check_chunk(StegoChunk *state, const unsigned char *data, size_t length, const unsigned char *trailer,
+                       uint format_flags, size_t chunk);
+
+/* Pixel byte where chunk count of checksummed data starts, or the data ends when count is the number of chunks */
+size_t stego_chunks_end(const StegoHeader *header, size_t count);
+
+/*
+ * Embed chunks first to first + count - 1 of checksummed data that isn't compressed and their trailers into a copy
+ * of src (or into src itself when dest == src), using up to threads threads. data holds the chunks one after the other,
+ * they get encrypted on the way when header->cipher is set
+ */
+void stego_embed_chunks(unsigned char *dest, const unsigned char *src, const void *data, const StegoHeader *header,
+                        size_t first, size_t count, int threads);
+
+/*
+ * Extract chunks first to first + count - 1 of checksummed data and check them, using up to threads threads.
+ * data gets the chunks one after the other, decrypted when header->cipher is set, NULL only checks them. chunks,
+ * when not NULL, gets the state of every chunk. Returns the number of corrupt chunks
+ */
+size_t stego_extract_chunks(unsigned char *data, StegoChunk *chunks, const unsigned char *image, const StegoHeader *header,
+                            size_t first, size_t count, int threads);
+
+/*
+ * Decode the data of a stego image into data, which holds data_capacity bytes, decompressed when it was compressed.
+ * Checksummed data is decoded in full even when chunks are corrupt, header->corrupt_chunks counts them
+ */
+Status stego_decode(void *data, size_t data_capacity, const unsigned char *image, size_t image_size,
+                    StegoHeader *header, int threads);
+
+/* Like stego_decode, encrypted data is decrypted with the key derived from passphrase, NULL fails on it */
+Status stego_decode_encrypted(void *data, size_t data_capacity, const unsigned char *image, size_t image_size,
+                              StegoHeader *header, const void *passphrase, size_t passphrase_size, int threads);
+
+/*
+ * Open the data of a stego image of image_size bytes for reads at any offset, encrypted data needs its passphrase
+ * (NULL for none). The image stays the caller's and has to outlive the handle
+ */
+Status stego_open(StegoFile *file, const unsigned char *image, size_t image_size, const void *passphrase, size_t passphrase_size,
+                  int threads);
+
+/*
+ * Read up to size bytes from the offset of file on, count gets the bytes read, fewer than size only at the end of the
+ * data. Fails when a byte comes from a corrupt chunk or block, the others are read all the same
+ */
+Status stego_read(StegoFile *file, void *data, size_t size, size_t *count);
+
+/* Set the offset of file, whence is SEEK_SET, SEEK_CUR or SEEK_END. Offsets past the end of the data fail */
+Status stego_seek(StegoFile *file, long long offset, int whence);
+
+/* Release the buffers of file and wipe its key */
+void stego_close(StegoFile *file);
+
+#endif
@@ -38,28 +38,383 @@ Decoding:
         INFO: Done
         INFO: Decoding output file extension
         INFO: Done
+        INFO: Decoding File Size
+        INFO: Done
         INFO: Opened output.txt
         INFO: Done. Opened all required files
-        INFO: Decoding output.txt File Size
-        INFO: Done
         INFO: Decoding output.txt File Data
         INFO: Done
         INFO: ## Decoding Done Successfully ##
+
+Probing:
+        ./a.out -p output.bmp images/ -j 8
+        output.bmp	.txt	25	1
+        INFO: 2 images scanned, 1 carry data
+
+Indexing and planning:
+        ./a.out -n carriers.idx images/ -j 8
+        INFO: 3 carriers indexed, 3 headers read, 0 unchanged, 0 skipped
+        ./a.out -f carriers.idx secret.txt
+        secret.txt	images/small.bmp	264	786432
+        INFO: 1 of 1 secret files placed on 3 carriers
+
+Sharding:
+        ./a.out -S video.txt part images/ -j 4
+        part_0.bmp	images/big.bmp	0	294880
+        part_1.bmp	images/small.bmp	294880	98272
+        INFO: 393152 bytes of video.txt in 2 shards, 0 failed
+        ./a.out -R video.txt . -j 4
+        INFO: 393152 bytes from 2 shards in video.txt, 0 failed
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include "encode.h"
 #include "decode.h"
+#include "batch.h"
+#include "probe.h"
+#include "pool.h"
+#include "shard.h"
+#include "lsb.h"
+#include "uring.h"
 #include "types.h"
+#include "common.h"
+
+/* Parse a number
+ * Input: Option argument and address to store its value
+ * Output: Value of a plain decimal number
+ * Return value: 0, -1 when the argument is not a number as a whole
+ */
+static int parse_number(const char *arg, unsigned long *value)
+{
+    char *end;
+
+    if (*arg < '0' || *arg > '9')
+    {
+        return -1;
+    }
+    errno = 0;
+    *value = strtoul(arg, &end, 10);
+    return *end != '\0' || errno == ERANGE ? -1 : 0;
+}
+
+/* Remove the options from argv so that the positional arguments keep their index
+ * Input: argc, argv and addresses to store the thread count, in place mode, bits per image byte,
+ * secret data size, compression, checksums, quiet mode, stats format, passphrase prompt, key file, archive
+ * mode, archive listing, the archive entry to extract, the io_uring engine and scattering
+ * Output: argv without options
+ * Return value: 0, -1 on a malformed option
+ */
+static int strip_options(int argc, char *argv[], int *num_threads, InplaceMode *inplace_mode, uint *lsb_bits, size_t *secret_size,
+                         int *compress, int *checksum, int *quiet, StatsFormat *stats_format, int *ask_passphrase, const char **key_fname,
+                         int *archive, int *list_archive, const char **archive_entry, int *uring, int *scatter)
+{
+    unsigned long value;
+    int out = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j"))
+        {
+            if (i + 1 >= argc || parse_number(argv[++i], &value) == -1)
+            {
+                puts("ERROR: -j needs a thread count, 0 for one per CPU");
+                return -1;
+            }
+            *num_threads = lsb_resolve_threads(value > LSB_MAX_THREADS ? LSB_MAX_THREADS : value);
+        }
+        else if (!strcmp(argv[i], "-k"))
+        {
+            if (i + 1 >= argc || parse_number(argv[++i], &value) == -1 || (value != 1 && value != 2 && value != 4))
+            {
+                puts("ERROR: -k needs the bits per image byte (1, 2 or 4)");
+                return -1;
+            }
+            *lsb_bits = value;
+        }
+        else if (!strcmp(argv[i], "-s"))
+        {
+            if (i + 1 >= argc || parse_number(argv[++i], &value) == -1 || value == 0)
+            {
+                puts("ERROR: -s needs the size of the secret data in bytes");
+                return -1;
+            }
+            *secret_size = value;
+        }
+        else if (!strcmp(argv[i], "-t"))
+        {
+            if (i + 1 >= argc || (*stats_format = stats_parse_format(argv[++i])) == e_stats_off)
+            {
+                puts("ERROR: -t needs the stats format, kv or json");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "-K"))
+        {
+            if (i + 1 >= argc)
+            {
+                puts("ERROR: -K needs the key file");
+                return -1;
+            }
+            *key_fname = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-P"))
+        {
+            *ask_passphrase = 1;
+        }
+        else if (!strcmp(argv[i], "-x"))
+        {
+            if (i + 1 >= argc)
+            {
+                puts("ERROR: -x needs the name of the archive entry");
+                return -1;
+            }
+            *archive_entry = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-a"))
+        {
+            *archive = 1;
+        }
+        else if (!strcmp(argv[i], "-l"))
+        {
+            *list_archive = 1;
+        }
+        else if (!strcmp(argv[i], "-q"))
+        {
+            *quiet = 1;
+        }
+        else if (!strcmp(argv[i], "-z"))
+        {
+            *compress = 1;
+        }
+        else if (!strcmp(argv[i], "-c"))
+        {
+            *checksum = 1;
+        }
+        else if (!strcmp(argv[i], "-U"))
+        {
+            *uring = 1;
+        }
+        else if (!strcmp(argv[i], "-r"))
+        {
+            *scatter = 1;
+        }
+        else if (!strcmp(argv[i], "-i"))
+        {
+            *inplace_mode = e_inplace_direct;
+        }
+        else if (!strcmp(argv[i], "-I"))
+        {
+            *inplace_mode = e_inplace_atomic;
+        }
+        else
+        {
+            argv[out++] = argv[i];
+        }
+    }
+    argv[out] = NULL;
+    return 0;
+}
+
+/* Read the passphrase
+ * Input: Key file name or NULL, whether to ask twice, buffer of MAX_KEY_FILE_SIZE
+ * bytes and address to store the passphrase size
+ * Output: Passphrase in buffer
+ * Description: A key file holds the passphrase as it is, all of its bytes count.
+ * Otherwise $STEGO_PASSPHRASE is used when set, so scripts need no terminal,
+ * else it is asked for on the terminal, twice when encoding
+ * Return value: 0, -1 for an unreadable or empty key file or passphrase
+ */
+static int read_passphrase(const char *key_fname, int confirm, char *buffer, size_t *size)
+{
+    const char *passphrase = getenv("STEGO_PASSPHRASE");
+    FILE *fptr;
+
+    if (key_fname != NULL)
+    {
+        if ((fptr = fopen(key_fname, "r")) == NULL)
+        {
+            perror("fopen");
+            printf("ERROR: Unable to open file %s\n", key_fname);
+            return -1;
+        }
+        *size = fread(buffer, sizeof(char), MAX_KEY_FILE_SIZE, fptr);
+        if (fgetc(fptr) != EOF || ferror(fptr) || *size == 0)
+        {
+            printf("ERROR: Key file %s must hold 1 to %d bytes\n", key_fname, MAX_KEY_FILE_SIZE);
+            fclose(fptr);
+            return -1;
+        }
+        fclose(fptr);
+        return 0;
+    }
+
+    if (passphrase == NULL && (passphrase = getpass("Passphrase: ")) == NULL)
+    {
+        puts("ERROR: No passphrase given");
+        return -1;
+    }
+    *size = strlen(passphrase);
+    if (*size == 0 || *size > MAX_KEY_FILE_SIZE)
+    {
+        printf("ERROR: The passphrase must hold 1 to %d bytes\n", MAX_KEY_FILE_SIZE);
+        return -1;
+    }
+    memcpy(buffer, passphrase, *size);
+    if (confirm && getenv("STEGO_PASSPHRASE") == NULL)
+    {
+        passphrase = getpass("Passphrase again: ");
+        if (passphrase == NULL || strlen(passphrase) != *size || memcmp(passphrase, buffer, *size))
+        {
+            puts("ERROR: The passphrases don't match");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Open the io_uring
+ * Input: Ring to set up and whether the INFO messages are suppressed
+ * Output: Ring for the encoding or decoding
+ * Description: Without io_uring (old kernel, disabled, no locked memory for
+ * the rings) the other engines take over
+ * Return value: The ring, NULL where io_uring is not available
+ */
+static Uring *open_uring(Uring *uring, int quiet)
+{
+    if (uring_setup(uring) == e_success)
+    {
+        return uring;
+    }
+    PRINT_INFO(quiet, "INFO: io_uring is not available, using the other engines\n");
+    return NULL;
+}
 
 int main(int argc, char *argv[])
 {
     /* Declare a structure variable to store encoding data */
-    EncodeInfo encInfo;
+    static EncodeInfo encInfo;
     /* uint img_size; */
 
     /* Declare a structure variable to store decoding data */
-    DecodeInfo decInfo;
+    static DecodeInfo decInfo;
+
+    /* Declare a structure variable to store batch data */
+    static BatchInfo batchInfo;
+
+    /* Declare a structure variable to store scan data */
+    static ScanInfo scanInfo;
+
+    /* Declare a structure variable to store carrier pool data */
+    static PoolInfo poolInfo;
+
+    /* Declare a structure variable to store shard data */
+    static ShardInfo shardInfo;
+
+    /* Declare a structure variable to store the io_uring of encoding and decoding */
+    static Uring uring;
+
+    /* Threads for the zero-copy engine or batch workers, -j N */
+    int num_threads = 1;
+
+    /* Patch the source image instead of writing a new one, -i or -I */
+    InplaceMode inplace_mode = e_inplace_off;
+
+    /* Secret data bits per image byte, -k 1|2|4 */
+    uint lsb_bits = 1;
+
+    /* Size of secret data read from a pipe, -s bytes */
+    size_t secret_size = 0;
+
+    /* Compress the secret data before embedding, -z */
+    int compress = 0;
+
+    /* Frame the embedded data in chunks with a CRC32C each, -c */
+    int checksum = 0;
+
+    /* No INFO messages, -q */
+    int quiet = 0;
+
+    /* Per phase counters on stderr, -t kv|json */
+    StatsFormat stats_format = e_stats_off;
+
+    /* Encrypt the secret data with a passphrase, -P asks for it, -K reads it from a file */
+    int ask_passphrase = 0;
+    const char *key_fname = NULL;
+    static char passphrase[MAX_KEY_FILE_SIZE];
+    size_t passphrase_size = 0;
+
+    /* Bundle the files listed in the secret file, -a, list the archive, -l, or extract one entry, -x name */
+    int archive = 0;
+    int list_archive = 0;
+    const char *archive_entry = NULL;
+
+    /* Read and write the image rows through io_uring, -U */
+    int use_uring = 0;
+    /* Scatter the data over the image by the key, -r */
+    int scatter = 0;
+
+    if (strip_options(argc, argv, &num_threads, &inplace_mode, &lsb_bits, &secret_size, &compress, &checksum, &quiet, &stats_format,
+                      &ask_passphrase, &key_fname, &archive, &list_archive, &archive_entry, &use_uring, &scatter) == -1)
+    {
+        return 1;
+    }
+    // Planning only sizes the key fields, it needs no passphrase
+    if ((ask_passphrase || key_fname != NULL) && argv[1] != NULL && strcmp(argv[1], "-f") &&
+        read_passphrase(key_fname, argv[1] != NULL && (!strcmp(argv[1], "-e") || !strcmp(argv[1], "-S") || !strcmp(argv[1], "-b")), passphrase, &passphrase_size) == -1)
+    {
+        return 1;
+    }
+    if (passphrase_size > 0)
+    {
+        encInfo.passphrase = passphrase;
+        decInfo.passphrase = passphrase;
+        shardInfo.passphrase = passphrase;
+        batchInfo.passphrase = passphrase;
+    }
+    encInfo.passphrase_size = passphrase_size;
+    decInfo.passphrase_size = passphrase_size;
+    shardInfo.passphrase_size = passphrase_size;
+    batchInfo.passphrase_size = passphrase_size;
+    encInfo.quiet = quiet;
+    decInfo.quiet = quiet;
+    encInfo.stats.format = stats_format;
+    decInfo.stats.format = stats_format;
+    encInfo.inplace_mode = inplace_mode;
+    encInfo.lsb_bits = lsb_bits;
+    encInfo.size_secret_file = secret_size;
+    encInfo.compress = compress;
+    encInfo.checksum = checksum;
+    encInfo.archive = archive;
+    encInfo.scatter = scatter;
+    decInfo.list_archive = list_archive;
+    decInfo.archive_entry = archive_entry;
+    encInfo.num_threads = num_threads;
+    decInfo.num_threads = num_threads;
+    batchInfo.num_workers = num_threads;
+    scanInfo.num_workers = num_threads;
+    poolInfo.scan.num_workers = num_threads;
+    poolInfo.lsb_bits = lsb_bits;
+    poolInfo.compress = compress;
+    poolInfo.checksum = checksum;
+    poolInfo.encrypt = ask_passphrase || key_fname != NULL;
+    shardInfo.scan.num_workers = num_threads;
+    shardInfo.lsb_bits = lsb_bits;
+    shardInfo.checksum = checksum;
+    shardInfo.compress = compress;
+    shardInfo.archive = archive;
+    shardInfo.inplace_mode = inplace_mode;
+    shardInfo.scatter = scatter;
+    batchInfo.uring = use_uring;
+    batchInfo.lsb_bits = lsb_bits;
+    batchInfo.compress = compress;
+    batchInfo.checksum = checksum;
+    batchInfo.scatter = scatter;
+    batchInfo.archive = archive;
+    batchInfo.inplace_mode = inplace_mode;
     
     /*
     // Fill with sample filenames
@@ -72,8 +427,23 @@ int main(int argc, char *argv[])
     if(argv[1] == NULL)
     {
         puts("ERROR: Insufficient arguments");
-        puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file]");
-        puts("Usage: ./a.out -d <.bmp_file> [output file]");
+        puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file] [-j threads] [-k bits] [-s size] [-i | -I] [-z] [-c] [-P | -K keyfile] [-r] [-a] [-q] [-t kv|json] [-U]");
+        puts("Usage: ./a.out -d <.bmp_file> [output file | directory] [-j threads] [-P | -K keyfile] [-l | -x entry] [-q] [-t kv|json] [-U]");
+        puts("       - as a file name reads stdin or writes stdout, -s gives the size of secret data read from a pipe");
+        puts("       -z compresses the secret data before embedding, decoding needs no option for it");
+        puts("       -c adds a CRC32C to every chunk of the embedded data, decoding reports corrupt chunks and keeps the others");
+        puts("       -P (passphrase, or $STEGO_PASSPHRASE) or -K keyfile encrypts the data with ChaCha20, decoding needs the same");
+        puts("       -a bundles the files the secret file lists, one per line; decoding extracts them into the directory, -l lists them, -x only the entry");
+        puts("       -U reads and writes the image rows through io_uring, with -b every worker sets up a ring of its own");
+        puts("       -r scatters the data over the image in key shuffled tiles, needs -P or -K, decoding finds it by the key");
+        puts("Usage: ./a.out -b <manifest> <results file> [-j workers] [-k bits] [-z] [-c] [-P | -K keyfile] [-r] [-a] [-U]");
+        puts("Usage: ./a.out -p <.bmp file | directory>... [-j workers]");
+        puts("Usage: ./a.out -n <index file> <.bmp file | directory>... [-j workers]");
+        puts("Usage: ./a.out -f <index file> <secret file>... [-k bits] [-z] [-c] [-P | -K keyfile]");
+        puts("       -n indexes the capacity of the carriers, -f picks the smallest indexed carrier for every secret file");
+        puts("Usage: ./a.out -S <secret file> <output prefix> <.bmp file | directory>... [-j workers] [-k bits] [-c] [-P | -K keyfile] [-r]");
+        puts("Usage: ./a.out -R <output file> <.bmp file | directory>... [-j workers] [-P | -K keyfile]");
+        puts("       -S spreads the secret file over the carriers as <prefix>_<n>.bmp, -R puts it back together from the shards found");
         return 1;
     }
 
@@ -86,6 +456,7 @@ int main(int argc, char *argv[])
             puts("ERROR: Read and validate function failed");
             return 1;
         }
+        encInfo.uring = use_uring ? open_uring(&uring, encInfo.quiet) : NULL;
         
         /* Do error handling for file openings */
         if (open_files(&encInfo) == e_failure)
@@ -96,7 +467,7 @@ int main(int argc, char *argv[])
         else
         {
         	// printf("SUCCESS: %s function completed\n", "open_files" );
-            printf("INFO: Done\n");
+            PRINT_INFO(encInfo.quiet, "INFO: Done\n");
         }
 
         /* Do error handling for encoding */
@@ -107,39 +478,112 @@ int main(int argc, char *argv[])
         }
         else
         {
-           printf("INFO: ## Encoding Done Seccessfully ##\n");
+           PRINT_INFO(encInfo.quiet, "INFO: ## Encoding Done Seccessfully ##\n");
         }
     }
     else if (check_operation_type(argv) == e_decode)
     {
+        /* The files are opened along with the args, decoding to stdout keeps quiet */
+        decInfo.uring = use_uring ? open_uring(&uring, decInfo.quiet || (argv[2] != NULL && argv[3] != NULL && IS_STREAM_FNAME(argv[3]))) : NULL;
+
         /* Do Error handling for decode arguments */
         if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
         {
-            printf("ERROR: read_and_validate function failed\n");
+            fprintf(stderr, "ERROR: read_and_validate function failed\n");
             return 1;
         }
 
-        // do error handling for decoding
+        // do error handling for decoding, on stderr as the data may go to stdout
         if (do_decoding(&decInfo) == e_failure)
         {
-            printf("INFO: do_decoding function failed\n");
+            fprintf(stderr, "INFO: do_decoding function failed\n");
             return 1;
         }
         else
         {
-            printf("INFO: ## Decoding Done Successfully ##\n");
+            PRINT_INFO(decInfo.quiet, "INFO: ## Decoding Done Successfully ##\n");
+        }
+    }
+    else if (check_operation_type(argv) == e_batch)
+    {
+        if (read_and_validate_batch_args(argv, &batchInfo) == e_failure || open_batch_files(&batchInfo) == e_failure)
+        {
+            return 1;
+        }
+        if (do_batch(&batchInfo) == e_failure)
+        {
+            printf("ERROR: Some batch jobs failed, see %s\n", batchInfo.results_fname);
+            return 1;
+        }
+    }
+    else if (check_operation_type(argv) == e_probe)
+    {
+        if (read_and_validate_scan_args(argv, &scanInfo) == e_failure || do_scan(&scanInfo) == e_failure)
+        {
+            return 1;
+        }
+    }
+    else if (check_operation_type(argv) == e_index)
+    {
+        if (read_and_validate_index_args(argv, &poolInfo) == e_failure || do_index(&poolInfo) == e_failure)
+        {
+            close_pool(&poolInfo);
+            return 1;
+        }
+        close_pool(&poolInfo);
+    }
+    else if (check_operation_type(argv) == e_plan)
+    {
+        if (read_and_validate_plan_args(argv, &poolInfo) == e_failure || do_plan(&poolInfo) == e_failure)
+        {
+            close_pool(&poolInfo);
+            return 1;
+        }
+        close_pool(&poolInfo);
+    }
+    else if (check_operation_type(argv) == e_shard)
+    {
+        if (read_and_validate_shard_args(argv, &shardInfo) == e_failure || do_shard(&shardInfo) == e_failure)
+        {
+            close_shards(&shardInfo);
+            return 1;
+        }
+        close_shards(&shardInfo);
+    }
+    else if (check_operation_type(argv) == e_reassemble)
+    {
+        if (read_and_validate_reassemble_args(argv, &shardInfo) == e_failure || do_reassemble(&shardInfo) == e_failure)
+        {
+            close_shards(&shardInfo);
+            return 1;
         }
+        close_shards(&shardInfo);
     }
     else
     {
         puts("ERROR: Invalid Operation");
-        puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file]");
-        puts("Usage: ./a.out -d <.bmp_file> [output file]");
+        puts("Usage: ./a.out -e <.bmp_file> <.text_file> [output file] [-j threads] [-k bits] [-s size] [-i | -I] [-z] [-c] [-P | -K keyfile] [-r] [-a] [-q] [-t kv|json] [-U]");
+        puts("Usage: ./a.out -d <.bmp_file> [output file | directory] [-j threads] [-P | -K keyfile] [-l | -x entry] [-q] [-t kv|json] [-U]");
+        puts("       - as a file name reads stdin or writes stdout, -s gives the size of secret data read from a pipe");
+        puts("       -z compresses the secret data before embedding, decoding needs no option for it");
+        puts("       -c adds a CRC32C to every chunk of the embedded data, decoding reports corrupt chunks and keeps the others");
+        puts("       -P (passphrase, or $STEGO_PASSPHRASE) or -K keyfile encrypts the data with ChaCha20, decoding needs the same");
+        puts("       -a bundles the files the secret file lists, one per line; decoding extracts them into the directory, -l lists them, -x only the entry");
+        puts("       -U reads and writes the image rows through io_uring, with -b every worker sets up a ring of its own");
+        puts("       -r scatters the data over the image in key shuffled tiles, needs -P or -K, decoding finds it by the key");
+        puts("Usage: ./a.out -b <manifest> <results file> [-j workers] [-k bits] [-z] [-c] [-P | -K keyfile] [-r] [-a] [-U]");
+        puts("Usage: ./a.out -p <.bmp file | directory>... [-j workers]");
+        puts("Usage: ./a.out -n <index file> <.bmp file | directory>... [-j workers]");
+        puts("Usage: ./a.out -f <index file> <secret file>... [-k bits] [-z] [-c] [-P | -K keyfile]");
+        puts("       -n indexes the capacity of the carriers, -f picks the smallest indexed carrier for every secret file");
+        puts("Usage: ./a.out -S <secret file> <output prefix> <.bmp file | directory>... [-j workers] [-k bits] [-c] [-P | -K keyfile] [-r]");
+        puts("Usage: ./a.out -R <output file> <.bmp file | directory>... [-j workers] [-P | -K keyfile]");
+        puts("       -S spreads the secret file over the carriers as <prefix>_<n>.bmp, -R puts it back together from the shards found");
         return 1;
     }
     /*
     // Test get_image_size_for_bmp
-    img_size = get_image_size_for_bmp(encInfo.fptr_src_image);
+    img_size = get_image_size_for_bmp(encInfo.bmp_header);
     printf("INFO: Image size = %u\n", img_size);
     */
     return 0;
@@ -17,6 +17,12 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_probe,
+    e_index,
+    e_plan,
+    e_shard,
+    e_reassemble,
     e_unsupported
 } OperationType;
 
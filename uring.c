@@ -0,0 +1,453 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+/* Slot buffer */
+#define URING_BUFFER(ring, slot) ((ring)->buffers + (size_t) (slot) * URING_BLOCK_SIZE)
+
+/* Enter ring
+ * Input: Ring and whether to wait for a completion
+ * Output: Queued requests submitted
+ * Return value: 0, -1 on error
+ */
+static int uring_enter(Uring *ring, uint wait)
+{
+    int ret;
+
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1)
+    {
+        return -1;
+    }
+    ring->to_submit -= (uint) ret < ring->to_submit ? (uint) ret : ring->to_submit;
+    return 0;
+}
+
+/* Reap completions
+ * Input: Ring
+ * Output: Result of every completed request in its slot, its bytes added to
+ * the counters of the ring
+ * Return value: None
+ */
+static void uring_reap(Uring *ring)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+
+    for (; head != tail; head++)
+    {
+        cqe = (struct io_uring_cqe *) ring->cqes + (head & ring->cq_mask);
+        ring->slots[cqe->user_data].result = cqe->res;
+        ring->slots[cqe->user_data].busy = 0;
+        if (cqe->res > 0 && ring->slots[cqe->user_data].write)
+        {
+            ring->bytes_written += cqe->res;
+        }
+        else if (cqe->res > 0)
+        {
+            ring->bytes_read += cqe->res;
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Queue request
+ * Input: Ring and a slot with its request filled in
+ * Output: Request queued, the queue submitted once URING_SUBMIT_BATCH requests wait
+ * Description: Every slot has at most one request at a time and the queue has
+ * an entry per slot, so it can't overflow
+ * Return value: None
+ */
+static void uring_queue(Uring *ring, uint slot)
+{
+    UringSlot *s = &ring->slots[slot];
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *) ring->sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->registered)
+    {
+        sqe->opcode = s->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = slot;
+    }
+    else
+    {
+        sqe->opcode = s->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = s->fd;
+    sqe->off = s->offset;
+    sqe->addr = (unsigned long) URING_BUFFER(ring, slot);
+    sqe->len = s->size;
+    sqe->user_data = slot;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    s->busy = 1;
+    s->result = 0;
+    if (++ring->to_submit >= URING_SUBMIT_BATCH)
+    {
+        uring_enter(ring, 0);
+    }
+}
+
+/* Complete slot
+ * Input: Ring and slot
+ * Output: The request of the slot done
+ * Description: Waits for the completion, submitting whatever is queued on the
+ * way. A short transfer is finished with pread or pwrite
+ * Return value: e_success, e_failure for a failed request or end of file
+ */
+static Status uring_complete(Uring *ring, uint slot)
+{
+    UringSlot *s = &ring->slots[slot];
+    ssize_t done, more;
+
+    uring_reap(ring);
+    while (s->busy)
+    {
+        if (uring_enter(ring, 1) == -1)
+        {
+            return e_failure;
+        }
+        uring_reap(ring);
+    }
+    if ((done = s->result) < 0)
+    {
+        errno = -done;
+        return e_failure;
+    }
+    for (; (size_t) done < s->size; done += more)
+    {
+        more = s->write ? pwrite(s->fd, URING_BUFFER(ring, slot) + done, s->size - done, s->offset + done)
+                        : pread(s->fd, URING_BUFFER(ring, slot) + done, s->size - done, s->offset + done);
+        if (more <= 0)
+        {
+            return e_failure;
+        }
+    }
+    s->result = s->size;
+    return e_success;
+}
+
+/* Set up ring
+ * Input: Ring to fill
+ * Output: Ring of URING_SLOTS entries with its queues mapped and the slot buffers
+ * Description: The buffers are registered with the kernel when the locked
+ * memory limit allows, so the fixed read and write requests skip mapping them
+ * every time. Without that the plain requests use the same buffers. Kernels
+ * without plain read and write requests (before 5.7) are turned down
+ * Return value: e_success, e_failure where io_uring is not available
+ */
+Status uring_setup(Uring *ring)
+{
+    struct io_uring_params params;
+    struct iovec iov[URING_SLOTS];
+    void *buffers;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, URING_SLOTS, &params);
+    if (ring->fd == -1)
+    {
+        return e_failure;
+    }
+    if (!(params.features & IORING_FEAT_FAST_POLL))
+    {
+        close(ring->fd);
+        return e_failure;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED ||
+        posix_memalign(&buffers, 4096, (size_t) URING_SLOTS * URING_BLOCK_SIZE) != 0)
+    {
+        ring->sq_ring = ring->sq_ring == MAP_FAILED ? NULL : ring->sq_ring;
+        ring->cq_ring = ring->cq_ring == MAP_FAILED ? NULL : ring->cq_ring;
+        ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+        uring_close(ring);
+        return e_failure;
+    }
+    ring->buffers = buffers;
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) ((char *) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) ((char *) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (char *) ring->cq_ring + params.cq_off.cqes;
+
+    for (uint i = 0; i < URING_SLOTS; i++)
+    {
+        iov[i].iov_base = URING_BUFFER(ring, i);
+        iov[i].iov_len = URING_BLOCK_SIZE;
+    }
+    ring->registered = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, URING_SLOTS) == 0;
+
+    return e_success;
+}
+
+/* Reset ring
+ * Input: Ring
+ * Output: No request in flight, all slots free for new streams
+ * Description: Requests of failed jobs are waited for here, before their
+ * buffers are handed to the next one
+ * Return value: None
+ */
+void uring_reset(Uring *ring)
+{
+    for (uint i = 0; i < URING_SLOTS; i++)
+    {
+        uring_complete(ring, i);
+        memset(&ring->slots[i], 0, sizeof(UringSlot));
+    }
+    ring->free_slot = 0;
+}
+
+/* Close ring
+ * Input: Ring set up by uring_setup
+ * Output: Ring torn down
+ * Return value: None
+ */
+void uring_close(Uring *ring)
+{
+    if (ring->sq_ring != NULL && ring->cq_ring != NULL && ring->sqes != NULL)
+    {
+        uring_reset(ring);
+    }
+    if (ring->sq_ring != NULL)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->cq_ring != NULL)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    close(ring->fd);
+    free(ring->buffers);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/* Read ahead
+ * Input: Read stream and one of its slots, its bytes handed out
+ * Output: Slot reading the next block of the range, idle behind the end
+ * Return value: None
+ */
+static void uring_read_ahead(UringStream *stream, uint slot)
+{
+    UringSlot *s = &stream->ring->slots[slot];
+
+    s->offset = stream->next;
+    s->size = stream->next < stream->end ? (stream->end - stream->next < URING_BLOCK_SIZE ? stream->end - stream->next : URING_BLOCK_SIZE) : 0;
+    s->result = 0;
+    if (s->size > 0)
+    {
+        stream->next += s->size;
+        uring_queue(stream->ring, slot);
+    }
+}
+
+/* Open stream
+ * Input: Stream to fill, ring, file, direction, range and the slots to take
+ * Output: Stream owning count slots of the ring. A read stream has all of them
+ * reading ahead from offset on, submitted at once
+ * Return value: e_success, e_failure when the ring has no count slots left
+ */
+Status uring_open_stream(UringStream *stream, Uring *ring, int fd, int write, off_t offset, off_t end, uint count)
+{
+    if (count == 0 || ring->free_slot + count > URING_SLOTS)
+    {
+        return e_failure;
+    }
+
+    stream->ring = ring;
+    stream->fd = fd;
+    stream->write = write;
+    stream->offset = offset;
+    stream->next = offset;
+    stream->end = end;
+    stream->first = ring->free_slot;
+    stream->count = count;
+    stream->head = stream->first;
+    stream->head_pos = 0;
+    ring->free_slot += count;
+
+    for (uint i = stream->first; i < stream->first + count; i++)
+    {
+        memset(&ring->slots[i], 0, sizeof(UringSlot));
+        ring->slots[i].fd = fd;
+        ring->slots[i].write = write;
+        if (!write)
+        {
+            uring_read_ahead(stream, i);
+        }
+    }
+    if (ring->to_submit > 0 && uring_enter(ring, 0) == -1)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Read stream
+ * Input: Read stream, buffer for size bytes or NULL to skip them
+ * Output: Next size bytes of the file, the stream moved past them
+ * Description: Waits for the slot holding the bytes only. Every slot handed out
+ * completely goes on reading ahead
+ * Return value: e_success, e_failure on a failed read or past the end of the range
+ */
+Status uring_read(UringStream *stream, char *data, size_t size)
+{
+    Uring *ring = stream->ring;
+    UringSlot *s;
+    size_t piece;
+
+    while (size > 0)
+    {
+        s = &ring->slots[stream->head];
+        if (uring_complete(ring, stream->head) == e_failure || s->size == 0)
+        {
+            return e_failure;
+        }
+        piece = s->size - stream->head_pos < size ? s->size - stream->head_pos : size;
+        if (data != NULL)
+        {
+            memcpy(data, URING_BUFFER(ring, stream->head) + stream->head_pos, piece);
+            data += piece;
+        }
+        stream->head_pos += piece;
+        stream->offset += piece;
+        size -= piece;
+        if (stream->head_pos == s->size)
+        {
+            uring_read_ahead(stream, stream->head);
+            stream->head = stream->first + (stream->head - stream->first + 1) % stream->count;
+            stream->head_pos = 0;
+        }
+    }
+    return e_success;
+}
+
+/* Seek stream
+ * Input: Read stream and file offset
+ * Output: Stream handing out the bytes from offset on
+ * Description: A forward move into what is read ahead already skips over it,
+ * any other move waits for the slots and reads ahead again from offset
+ * Return value: e_success, e_failure on a failed read
+ */
+Status uring_seek(UringStream *stream, off_t offset)
+{
+    if (offset >= stream->offset && offset <= stream->next)
+    {
+        return uring_read(stream, NULL, offset - stream->offset);
+    }
+
+    for (uint i = stream->first; i < stream->first + stream->count; i++)
+    {
+        uring_complete(stream->ring, i);
+    }
+    stream->offset = offset;
+    stream->next = offset;
+    stream->head = stream->first;
+    stream->head_pos = 0;
+    for (uint i = stream->first; i < stream->first + stream->count; i++)
+    {
+        uring_read_ahead(stream, i);
+    }
+    return stream->ring->to_submit > 0 && uring_enter(stream->ring, 0) == -1 ? e_failure : e_success;
+}
+
+/* Write out
+ * Input: Write stream with bytes in its head slot
+ * Output: Head slot written at the stream's file offset, the next slot is head
+ * Return value: None
+ */
+static void uring_write_out(UringStream *stream)
+{
+    UringSlot *s = &stream->ring->slots[stream->head];
+
+    s->offset = stream->next;
+    s->size = stream->head_pos;
+    stream->next += stream->head_pos;
+    uring_queue(stream->ring, stream->head);
+    stream->head = stream->first + (stream->head - stream->first + 1) % stream->count;
+    stream->head_pos = 0;
+}
+
+/* Write stream
+ * Input: Write stream, data and its size
+ * Output: Data taken, every full slot written out
+ * Description: A slot is filled again once its previous write completed, so
+ * the other slots stay in flight meanwhile
+ * Return value: e_success, e_failure on a failed write
+ */
+Status uring_write(UringStream *stream, const char *data, size_t size)
+{
+    Uring *ring = stream->ring;
+    size_t piece;
+
+    while (size > 0)
+    {
+        if (stream->head_pos == 0 && uring_complete(ring, stream->head) == e_failure)
+        {
+            return e_failure;
+        }
+        piece = URING_BLOCK_SIZE - stream->head_pos < size ? URING_BLOCK_SIZE - stream->head_pos : size;
+        memcpy(URING_BUFFER(ring, stream->head) + stream->head_pos, data, piece);
+        stream->head_pos += piece;
+        stream->offset += piece;
+        data += piece;
+        size -= piece;
+        if (stream->head_pos == URING_BLOCK_SIZE)
+        {
+            uring_write_out(stream);
+        }
+    }
+    return e_success;
+}
+
+/* Flush stream
+ * Input: Write stream
+ * Output: All bytes taken are in the file
+ * Return value: e_success, e_failure on a failed write
+ */
+Status uring_flush(UringStream *stream)
+{
+    Status status = e_success;
+
+    if (stream->head_pos > 0)
+    {
+        uring_write_out(stream);
+    }
+    for (uint i = stream->first; i < stream->first + stream->count; i++)
+    {
+        if (uring_complete(stream->ring, i) == e_failure)
+        {
+            status = e_failure;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h"
+
+/*
+ * io_uring backend of the file engine (-U)
+ * A ring of URING_SLOTS requests, each with a buffer of URING_BLOCK_SIZE bytes
+ * registered with the kernel once, so reads and writes go straight to them.
+ * Streams walk a file front to back on some of the slots: a read stream keeps
+ * all of its slots reading ahead and hands the bytes out as they complete, a
+ * write stream fills one slot while the others are being written. Requests are
+ * queued and submitted in batches, a single io_uring_enter both submits and
+ * waits. The ring is set up with the raw system calls, no liburing, and
+ * uring_setup fails where the kernel has no io_uring (or it is disabled), so
+ * callers keep the other engines. A ring is reused job after job: the batch
+ * mode sets up one per worker.
+ */
+
+/* Requests in flight per ring and bytes per request, override with -DURING_SLOTS=n (a power of 2) and -DURING_BLOCK_SIZE=n */
+#ifndef URING_SLOTS
+#define URING_SLOTS 32
+#endif
+#ifndef URING_BLOCK_SIZE
+#define URING_BLOCK_SIZE (256 * 1024)
+#endif
+
+/* Queued requests submitted at once */
+#define URING_SUBMIT_BATCH 8
+
+typedef struct _UringSlot
+{
+    off_t offset;               /* file offset of the request */
+    size_t size;                /* bytes asked for, 0 for an idle slot */
+    int fd;
+    int write;
+    int busy;                   /* submitted or queued, not completed */
+    int result;                 /* bytes done or -errno once completed */
+} UringSlot;
+
+typedef struct _Uring
+{
+    int fd;
+
+    /* Submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    void *sqes;
+    size_t sqes_size;
+    unsigned to_submit;
+
+    /* Completion queue */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    void *cqes;
+
+    /* Slot buffers, registered unless the kernel turned that down */
+    char *buffers;
+    int registered;
+    UringSlot slots[URING_SLOTS];
+    uint free_slot;             /* first slot no stream owns */
+
+    /* Bytes of the completed requests since setup, the kernel moves them outside of the thread */
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+} Uring;
+
+typedef struct _UringStream
+{
+    Uring *ring;
+    int fd;
+    int write;
+    off_t offset;               /* file offset of the next byte handed out or taken */
+    off_t next;                 /* file offset of the next request */
+    off_t end;                  /* read streams read ahead up to here */
+    uint first;                 /* slots first to first + count - 1 */
+    uint count;
+    uint head;                  /* slot handed out or filled now */
+    size_t head_pos;            /* bytes of it handed out or filled */
+} UringStream;
+
+/* Set up a ring, e_failure where io_uring is not available */
+Status uring_setup(Uring *ring);
+
+/* Wait for all requests in flight and tear the ring down */
+void uring_close(Uring *ring);
+
+/* Wait for all requests in flight and give all slots back, streams on the ring are gone */
+void uring_reset(Uring *ring);
+
+/* Start a stream on count slots of the ring, reading fd from offset to end or writing it from offset on */
+Status uring_open_stream(UringStream *stream, Uring *ring, int fd, int write, off_t offset, off_t end, uint count);
+
+/* Next size bytes of a read stream */
+Status uring_read(UringStream *stream, char *data, size_t size);
+
+/* Move a read stream to offset, anything read ahead in front of it is dropped */
+Status uring_seek(UringStream *stream, off_t offset);
+
+/* Append size bytes to a write stream */
+Status uring_write(UringStream *stream, const char *data, size_t size);
+
+/* Write out what a write stream holds and wait for all of its requests */
+Status uring_flush(UringStream *stream);
+
+#endif